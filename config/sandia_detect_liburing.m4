@@ -0,0 +1,54 @@
+# -*- Autoconf -*-
+#
+# Copyright (c)      2011  Sandia Corporation
+#
+
+# SANDIA_DETECT_LIBURING([action-if-found], [action-if-not-found])
+# ------------------------------------------------------------------------------
+AC_DEFUN([SANDIA_DETECT_LIBURING], [
+AC_ARG_WITH([liburing],
+			[AS_HELP_STRING([--with-liburing=[path]],
+							[Use io_uring for the UDP transport, and optionally specify a path])],
+			[liburing_softfail=no],
+			[with_liburing=yes
+			 liburing_softfail=yes])
+
+  SANDIA_CHECK_PATH([$with_liburing], [], [AC_MSG_ERROR([--with-liburing option must be an absolute path])])
+
+  LIBURING_CPPFLAGS=
+  LIBURING_LDFLAGS=
+  LIBURING_LIBS=
+
+  saved_CPPFLAGS="$CPPFLAGS"
+  saved_LDFLAGS="$LDFLAGS"
+  saved_LIBS="$LIBS"
+  AS_IF([test "x$with_liburing" != xyes -a "x$with_liburing" != xno],
+    [LIBURING_CPPFLAGS="-I$with_liburing/include"
+     LIBURING_LDFLAGS="-L$with_liburing/lib"
+     CPPFLAGS="$CPPFLAGS $LIBURING_CPPFLAGS"
+     LDFLAGS="$LDFLAGS $LIBURING_LDFLAGS"])
+
+  AS_IF([test "x$with_liburing" != xno], [liburing_happy=yes], [liburing_happy=no])
+  AS_IF([test "$liburing_happy" = yes],
+    [AC_CHECK_HEADERS([liburing.h], [], [liburing_happy=no])])
+  # Buffer rings and multishot recvmsg need liburing 2.4
+  AS_IF([test "$liburing_happy" = yes],
+    [AC_CHECK_LIB([uring], [io_uring_setup_buf_ring],
+                  [LIBURING_LIBS="-luring"], [liburing_happy=no])])
+
+  CPPFLAGS="$saved_CPPFLAGS"
+  LDFLAGS="$saved_LDFLAGS"
+  LIBS="$saved_LIBS"
+
+  AC_SUBST(LIBURING_CPPFLAGS)
+  AC_SUBST(LIBURING_LDFLAGS)
+  AC_SUBST(LIBURING_LIBS)
+
+  AS_IF([test "$liburing_happy" = no],
+        [$2
+		 AS_IF([test "$liburing_softfail" = no -a "x$with_liburing" != xno],
+		       [AC_MSG_ERROR([liburing enabled, but cannot find it.])])],
+		[$1
+		 AC_DEFINE([USE_LIBURING],[1],[Define to use io_uring for UDP])])
+AM_CONDITIONAL([USE_LIBURING], [test "x$liburing_happy" = xyes])
+])
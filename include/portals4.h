@@ -62,11 +62,21 @@ typedef enum {
     PTL_SR_PERMISSION_VIOLATIONS, /*!< Specifies the status register that
                                     * counts the number of attempted permission
                                     * violations. */
-    PTL_SR_OPERATION_VIOLATIONS   /*!< Specifies the status register that counts
+    PTL_SR_OPERATION_VIOLATIONS,  /*!< Specifies the status register that counts
                                     * the number of attempted operation
                                     * violations. */
+    PTL_SR_PROGRESS_IDLE_TIME,    /*!< Implementation specific: total time
+                                    * the progress threads of the interface
+                                    * spent blocked, in milliseconds. */
+    PTL_SR_PROGRESS_WAKEUPS,      /*!< Implementation specific: number of
+                                    * times a blocked progress thread was
+                                    * woken up. */
+    PTL_SR_PROGRESS_WAKEUP_LATENCY /*!< Implementation specific: longest time
+                                    * between a shared memory message waking
+                                    * up a progress thread and the thread
+                                    * running, in microseconds. */
 } ptl_sr_index_t;
-#define PTL_SR_LAST (PTL_SR_OPERATION_VIOLATIONS + 1)
+#define PTL_SR_LAST (PTL_SR_PROGRESS_WAKEUP_LATENCY + 1)
 typedef int ptl_sr_value_t;             /*!< Signed integral type that defines
                                          * the types of values held in status
                                          * registers. */
@@ -2939,6 +2949,88 @@ int PtlEQPoll(const ptl_handle_eq_t *eq_handles,
               ptl_time_t             timeout,
               ptl_event_t           *event,
               unsigned int          *which);
+/*!
+ * @fn PtlEQGetBatch(ptl_handle_eq_t    eq_handle,
+ *                   ptl_event_t       *events,
+ *                   unsigned int       max,
+ *                   unsigned int      *count)
+ * @brief Get up to \a max events from an event queue.
+ * @details Implementation specific extension. A nonblocking function that
+ *      behaves like \a max calls to PtlEQGet(), but translates the handle
+ *      once and returns as soon as the event queue is empty. The events are
+ *      removed from the queue.
+ * @param[in] eq_handle The event queue handle.
+ * @param[out] events   On successful return, the first \a count entries of
+ *                      this array hold the next events of the event queue,
+ *                      in order.
+ * @param[in] max       Length of the \a events array.
+ * @param[out] count    On return, the number of events returned.
+ * @retval PTL_OK           Indicates success
+ * @retval PTL_NO_INIT      Indicates that the portals API has not been
+ *                          successfully initialized.
+ * @retval PTL_ARG_INVALID  Indicates that \a eq_handle is not a valid event
+ *                          queue handle or that \a max is 0.
+ * @retval PTL_EQ_EMPTY     Indicates that \a eq_handle is empty.
+ * @retval PTL_EQ_DROPPED   Indicates success (i.e., events are returned) and
+ *                          that at least one event has been dropped before
+ *                          one of the returned events, due to limited space
+ *                          in the event queue.
+ * @see PtlEQGet(), PtlEQPollBatch()
+ */
+int PtlEQGetBatch(ptl_handle_eq_t eq_handle,
+                  ptl_event_t    *events,
+                  unsigned int    max,
+                  unsigned int   *count);
+/*!
+ * @fn PtlEQPollBatch(const ptl_handle_eq_t *eq_handles,
+ *                    unsigned int           size,
+ *                    ptl_time_t             timeout,
+ *                    ptl_event_t           *events,
+ *                    unsigned int           max,
+ *                    unsigned int          *count,
+ *                    unsigned int          *which)
+ * @brief Poll for new events on multiple event queues.
+ * @details Implementation specific extension. Like PtlEQPoll(), but drains
+ *      up to \a max events from all the event queues that have some, instead
+ *      of returning a single event.
+ * @param[in] eq_handles    An array of event queue handles. All the handles
+ *                          must refer to the same interface.
+ * @param[in] size          Length of the \a eq_handles array.
+ * @param[in] timeout       Time in milliseconds to wait for an event to occur
+ *                          in one of the event queue handles. The constant \c
+ *                          PTL_TIME_FOREVER can be used to indicate an
+ *                          infinite timeout.
+ * @param[out] events       On successful return, the first \a count entries
+ *                          of this array hold the events. The events of a
+ *                          given event queue are in order.
+ * @param[in] max           Length of the \a events array.
+ * @param[out] count        On return, the number of events returned.
+ * @param[out] which        If not \c NULL, an array of \a max entries. On
+ *                          successful return, entry i holds the index into
+ *                          \a eq_handles of the event queue from which event
+ *                          i was taken.
+ * @retval PTL_OK               Indicates success
+ * @retval PTL_NO_INIT          Indicates that the portals API has not been
+ *                              successfully initialized.
+ * @retval PTL_ARG_INVALID      Indicates that an invalid argument was passed.
+ * @retval PTL_EQ_EMPTY         Indicates that the timeout has been reached and
+ *                              all of the event queues are empty.
+ * @retval PTL_EQ_DROPPED       Indicates success (i.e., events are returned)
+ *                              and that at least one event has been dropped
+ *                              before one of the returned events, due to
+ *                              limited space in its event queue.
+ * @retval PTL_INTERRUPTED      Indicates that PtlEQFree() or PtlNIFini() was
+ *                              called by another thread while this thread was
+ *                              waiting in PtlEQPollBatch().
+ * @see PtlEQPoll(), PtlEQGetBatch()
+ */
+int PtlEQPollBatch(const ptl_handle_eq_t *eq_handles,
+                   unsigned int           size,
+                   ptl_time_t             timeout,
+                   ptl_event_t           *events,
+                   unsigned int           max,
+                   unsigned int          *count,
+                   unsigned int          *which);
 /*! @} */
 
 /************************
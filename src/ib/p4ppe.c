@@ -1453,7 +1453,7 @@ static void *ppe_progress(void *arg)
         /* Infiniband. Walking the list of active NIs to find work. */
         ni_t *ni;
         list_for_each_entry(ni, &pt->ni_list, rdma.ppe_ni_list) {
-            progress_thread_rdma(ni);
+            progress_thread_rdma(ni, 0);
         }
 #endif
 
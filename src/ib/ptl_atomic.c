@@ -1720,6 +1720,37 @@ atom_op_t atom_op[PTL_OP_LAST][PTL_DATATYPE_LAST] = {
     ,
 };
 
+/**
+ * Replace the kernels of the atom_op table with vectorized ones.
+ *
+ * The level is the best one supported by the CPU, capped by the
+ * PTL_ATOMIC_SIMD parameter. Operations and types without a vectorized
+ * kernel keep their scalar one.
+ */
+void atom_op_init(void)
+{
+    enum atom_simd_level level = atom_simd_detect();
+    atom_simd_op_t kernel;
+    int op;
+    int type;
+
+    if (level > get_param(PTL_ATOMIC_SIMD))
+        level = get_param(PTL_ATOMIC_SIMD);
+
+    if (level == ATOM_SIMD_NONE)
+        return;
+
+    for (op = 0; op < PTL_OP_LAST; op++) {
+        for (type = 0; type < PTL_DATATYPE_LAST; type++) {
+            kernel = atom_simd_op(level, op, type);
+            if (kernel)
+                atom_op[op][type] = kernel;
+        }
+    }
+
+    ptl_info("using %s atomic kernels\n", atom_simd_level_name[level]);
+}
+
 #define cswap(op, s, d, type)							\
 	do {	if (op->type == d->type) d->type = s->type; } while (0)
 
@@ -48,6 +48,8 @@ extern struct atom_op_info op_info[PTL_OP_LAST];
 
 extern int atom_type_size[PTL_DATATYPE_LAST];
 
+void atom_op_init(void);
+
 int swap_data_in(ptl_op_t atom_op, ptl_datatype_t atom_type, void *dest,
                  void *source, datatype_t *operand);
 
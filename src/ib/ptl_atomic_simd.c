@@ -0,0 +1,289 @@
+/**
+ * @file ptl_atomic_simd.c
+ *
+ * Vectorized atomic ops kernels.
+ *
+ * The kernels are written with the GCC vector extensions and compiled
+ * several times, for SSE2, AVX2 and AVX-512, through the target
+ * function attribute. The whole vectors are processed first, and the
+ * tail with the same scalar operators as in ptl_atomic.c, so every
+ * level gives the same result. The level is chosen once, at
+ * initialization time (see atom_op_init()).
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "portals4.h"
+#include "ptl_atomic_simd.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && \
+    (__GNUC__ >= 5 || defined(__clang__))
+#define ATOM_SIMD_X86 1
+#else
+#define ATOM_SIMD_X86 0
+#endif
+
+const char *atom_simd_level_name[ATOM_SIMD_LAST] = {
+    [ATOM_SIMD_NONE] = "scalar",
+    [ATOM_SIMD_SSE2] = "SSE2",
+    [ATOM_SIMD_AVX2] = "AVX2",
+    [ATOM_SIMD_AVX512] = "AVX-512",
+};
+
+#define min(a, b)	(((a) < (b)) ? (a) : (b))
+#define max(a, b)	(((a) > (b)) ? (a) : (b))
+#define sum(a, b)	((a) + (b))
+#define prod(a, b)	((a) * (b))
+#define bor(a, b)	((a) | (b))
+#define band(a, b)	((a) & (b))
+#define bxor(a, b)	((a) ^ (b))
+
+/* Vector operators. Comparisons return a mask of integers of the same
+ * width, which is used to select the elements, bitwise. */
+#define vselect(m, a, b)						\
+	((vec_t)(((ivec_t)(a) & (ivec_t)(m)) | ((ivec_t)(b) & ~(ivec_t)(m))))
+#define vmin(a, b)	vselect((a) < (b), a, b)
+#define vmax(a, b)	vselect((a) > (b), a, b)
+#define vsum(a, b)	((a) + (b))
+#define vprod(a, b)	((a) * (b))
+#define vbor(a, b)	((a) | (b))
+#define vband(a, b)	((a) & (b))
+#define vbxor(a, b)	((a) ^ (b))
+
+/**
+ * Define a kernel combining two arrays of type, vbytes at a time.
+ *
+ * @param name name of the kernel
+ * @param attr function attributes, selecting the instruction set
+ * @param vbytes vector size in bytes
+ * @param type element type
+ * @param itype signed integer type of the same width as type
+ * @param vop vector operator
+ * @param sop scalar operator, for the tail
+ */
+#define ATOM_VECTOR_KERNEL(name, attr, vbytes, type, itype, vop, sop)	\
+static attr int name(void *dst, void *src, ptl_size_t length)		\
+{									\
+    typedef type vec_t __attribute__ ((vector_size(vbytes)));		\
+    typedef itype ivec_t __attribute__ ((vector_size(vbytes), unused));\
+    const ptl_size_t vlen = vbytes / sizeof(type);			\
+    ptl_size_t n = length / sizeof(type);				\
+    ptl_size_t i;							\
+    type *s = src;							\
+    type *d = dst;							\
+									\
+    for (i = 0; i + vlen <= n; i += vlen) {				\
+        vec_t a;							\
+        vec_t b;							\
+									\
+        /* The arrays may not be aligned. */				\
+        memcpy(&a, s + i, sizeof(a));					\
+        memcpy(&b, d + i, sizeof(b));					\
+        a = vop(a, b);							\
+        memcpy(d + i, &a, sizeof(a));					\
+    }									\
+									\
+    for (; i < n; i++)							\
+        d[i] = sop(s[i], d[i]);						\
+									\
+    return PTL_OK;							\
+}
+
+/* Sums and products are computed on unsigned integers, which wrap
+ * around, and give the same bits as the signed ones. Bitwise
+ * operations don't care about the sign either. */
+#define ATOM_KERNELS(KERNEL, isa, attr, vbytes)				\
+    KERNEL(min_sc_##isa, attr, vbytes, int8_t, int8_t, vmin, min)	\
+    KERNEL(min_uc_##isa, attr, vbytes, uint8_t, int8_t, vmin, min)	\
+    KERNEL(min_ss_##isa, attr, vbytes, int16_t, int16_t, vmin, min)	\
+    KERNEL(min_us_##isa, attr, vbytes, uint16_t, int16_t, vmin, min)	\
+    KERNEL(min_si_##isa, attr, vbytes, int32_t, int32_t, vmin, min)	\
+    KERNEL(min_ui_##isa, attr, vbytes, uint32_t, int32_t, vmin, min)	\
+    KERNEL(min_sl_##isa, attr, vbytes, int64_t, int64_t, vmin, min)	\
+    KERNEL(min_ul_##isa, attr, vbytes, uint64_t, int64_t, vmin, min)	\
+    KERNEL(min_f_##isa, attr, vbytes, float, int32_t, vmin, min)	\
+    KERNEL(min_d_##isa, attr, vbytes, double, int64_t, vmin, min)	\
+    KERNEL(max_sc_##isa, attr, vbytes, int8_t, int8_t, vmax, max)	\
+    KERNEL(max_uc_##isa, attr, vbytes, uint8_t, int8_t, vmax, max)	\
+    KERNEL(max_ss_##isa, attr, vbytes, int16_t, int16_t, vmax, max)	\
+    KERNEL(max_us_##isa, attr, vbytes, uint16_t, int16_t, vmax, max)	\
+    KERNEL(max_si_##isa, attr, vbytes, int32_t, int32_t, vmax, max)	\
+    KERNEL(max_ui_##isa, attr, vbytes, uint32_t, int32_t, vmax, max)	\
+    KERNEL(max_sl_##isa, attr, vbytes, int64_t, int64_t, vmax, max)	\
+    KERNEL(max_ul_##isa, attr, vbytes, uint64_t, int64_t, vmax, max)	\
+    KERNEL(max_f_##isa, attr, vbytes, float, int32_t, vmax, max)	\
+    KERNEL(max_d_##isa, attr, vbytes, double, int64_t, vmax, max)	\
+    KERNEL(sum_c_##isa, attr, vbytes, uint8_t, int8_t, vsum, sum)	\
+    KERNEL(sum_s_##isa, attr, vbytes, uint16_t, int16_t, vsum, sum)	\
+    KERNEL(sum_i_##isa, attr, vbytes, uint32_t, int32_t, vsum, sum)	\
+    KERNEL(sum_l_##isa, attr, vbytes, uint64_t, int64_t, vsum, sum)	\
+    KERNEL(sum_f_##isa, attr, vbytes, float, int32_t, vsum, sum)	\
+    KERNEL(sum_d_##isa, attr, vbytes, double, int64_t, vsum, sum)	\
+    KERNEL(prod_c_##isa, attr, vbytes, uint8_t, int8_t, vprod, prod)	\
+    KERNEL(prod_s_##isa, attr, vbytes, uint16_t, int16_t, vprod, prod)	\
+    KERNEL(prod_i_##isa, attr, vbytes, uint32_t, int32_t, vprod, prod)	\
+    KERNEL(prod_l_##isa, attr, vbytes, uint64_t, int64_t, vprod, prod)	\
+    KERNEL(prod_f_##isa, attr, vbytes, float, int32_t, vprod, prod)	\
+    KERNEL(prod_d_##isa, attr, vbytes, double, int64_t, vprod, prod)	\
+    KERNEL(bor_c_##isa, attr, vbytes, uint8_t, int8_t, vbor, bor)	\
+    KERNEL(bor_s_##isa, attr, vbytes, uint16_t, int16_t, vbor, bor)	\
+    KERNEL(bor_i_##isa, attr, vbytes, uint32_t, int32_t, vbor, bor)	\
+    KERNEL(bor_l_##isa, attr, vbytes, uint64_t, int64_t, vbor, bor)	\
+    KERNEL(band_c_##isa, attr, vbytes, uint8_t, int8_t, vband, band)	\
+    KERNEL(band_s_##isa, attr, vbytes, uint16_t, int16_t, vband, band)	\
+    KERNEL(band_i_##isa, attr, vbytes, uint32_t, int32_t, vband, band)	\
+    KERNEL(band_l_##isa, attr, vbytes, uint64_t, int64_t, vband, band)	\
+    KERNEL(bxor_c_##isa, attr, vbytes, uint8_t, int8_t, vbxor, bxor)	\
+    KERNEL(bxor_s_##isa, attr, vbytes, uint16_t, int16_t, vbxor, bxor)	\
+    KERNEL(bxor_i_##isa, attr, vbytes, uint32_t, int32_t, vbxor, bxor)	\
+    KERNEL(bxor_l_##isa, attr, vbytes, uint64_t, int64_t, vbxor, bxor)
+
+/* Same layout as the atom_op table, restricted to the vectorized
+ * operations and types. There is no table for ATOM_SIMD_NONE, whose
+ * kernels are the ones of the atom_op table. */
+#define ATOM_TABLE(isa)							\
+    {									\
+        [PTL_MIN] = {							\
+            [PTL_INT8_T] = min_sc_##isa,				\
+            [PTL_UINT8_T] = min_uc_##isa,				\
+            [PTL_INT16_T] = min_ss_##isa,				\
+            [PTL_UINT16_T] = min_us_##isa,				\
+            [PTL_INT32_T] = min_si_##isa,				\
+            [PTL_UINT32_T] = min_ui_##isa,				\
+            [PTL_INT64_T] = min_sl_##isa,				\
+            [PTL_UINT64_T] = min_ul_##isa,				\
+            [PTL_FLOAT] = min_f_##isa,					\
+            [PTL_DOUBLE] = min_d_##isa,					\
+        },								\
+        [PTL_MAX] = {							\
+            [PTL_INT8_T] = max_sc_##isa,				\
+            [PTL_UINT8_T] = max_uc_##isa,				\
+            [PTL_INT16_T] = max_ss_##isa,				\
+            [PTL_UINT16_T] = max_us_##isa,				\
+            [PTL_INT32_T] = max_si_##isa,				\
+            [PTL_UINT32_T] = max_ui_##isa,				\
+            [PTL_INT64_T] = max_sl_##isa,				\
+            [PTL_UINT64_T] = max_ul_##isa,				\
+            [PTL_FLOAT] = max_f_##isa,					\
+            [PTL_DOUBLE] = max_d_##isa,					\
+        },								\
+        [PTL_SUM] = {							\
+            [PTL_INT8_T] = sum_c_##isa,					\
+            [PTL_UINT8_T] = sum_c_##isa,				\
+            [PTL_INT16_T] = sum_s_##isa,				\
+            [PTL_UINT16_T] = sum_s_##isa,				\
+            [PTL_INT32_T] = sum_i_##isa,				\
+            [PTL_UINT32_T] = sum_i_##isa,				\
+            [PTL_INT64_T] = sum_l_##isa,				\
+            [PTL_UINT64_T] = sum_l_##isa,				\
+            [PTL_FLOAT] = sum_f_##isa,					\
+            [PTL_FLOAT_COMPLEX] = sum_f_##isa,				\
+            [PTL_DOUBLE] = sum_d_##isa,					\
+            [PTL_DOUBLE_COMPLEX] = sum_d_##isa,				\
+        },								\
+        [PTL_PROD] = {							\
+            [PTL_INT8_T] = prod_c_##isa,				\
+            [PTL_UINT8_T] = prod_c_##isa,				\
+            [PTL_INT16_T] = prod_s_##isa,				\
+            [PTL_UINT16_T] = prod_s_##isa,				\
+            [PTL_INT32_T] = prod_i_##isa,				\
+            [PTL_UINT32_T] = prod_i_##isa,				\
+            [PTL_INT64_T] = prod_l_##isa,				\
+            [PTL_UINT64_T] = prod_l_##isa,				\
+            [PTL_FLOAT] = prod_f_##isa,					\
+            [PTL_DOUBLE] = prod_d_##isa,				\
+        },								\
+        [PTL_BOR] = {							\
+            [PTL_INT8_T] = bor_c_##isa,					\
+            [PTL_UINT8_T] = bor_c_##isa,				\
+            [PTL_INT16_T] = bor_s_##isa,				\
+            [PTL_UINT16_T] = bor_s_##isa,				\
+            [PTL_INT32_T] = bor_i_##isa,				\
+            [PTL_UINT32_T] = bor_i_##isa,				\
+            [PTL_INT64_T] = bor_l_##isa,				\
+            [PTL_UINT64_T] = bor_l_##isa,				\
+        },								\
+        [PTL_BAND] = {							\
+            [PTL_INT8_T] = band_c_##isa,				\
+            [PTL_UINT8_T] = band_c_##isa,				\
+            [PTL_INT16_T] = band_s_##isa,				\
+            [PTL_UINT16_T] = band_s_##isa,				\
+            [PTL_INT32_T] = band_i_##isa,				\
+            [PTL_UINT32_T] = band_i_##isa,				\
+            [PTL_INT64_T] = band_l_##isa,				\
+            [PTL_UINT64_T] = band_l_##isa,				\
+        },								\
+        [PTL_BXOR] = {							\
+            [PTL_INT8_T] = bxor_c_##isa,				\
+            [PTL_UINT8_T] = bxor_c_##isa,				\
+            [PTL_INT16_T] = bxor_s_##isa,				\
+            [PTL_UINT16_T] = bxor_s_##isa,				\
+            [PTL_INT32_T] = bxor_i_##isa,				\
+            [PTL_UINT32_T] = bxor_i_##isa,				\
+            [PTL_INT64_T] = bxor_l_##isa,				\
+            [PTL_UINT64_T] = bxor_l_##isa,				\
+        },								\
+    }
+
+#if ATOM_SIMD_X86
+ATOM_KERNELS(ATOM_VECTOR_KERNEL, sse2, __attribute__ ((target("sse2"))), 16)
+ATOM_KERNELS(ATOM_VECTOR_KERNEL, avx2, __attribute__ ((target("avx2"))), 32)
+ATOM_KERNELS(ATOM_VECTOR_KERNEL, avx512,
+             __attribute__ ((target("avx512f,avx512bw"))), 64)
+#endif
+
+static const atom_simd_op_t
+    atom_simd_table[ATOM_SIMD_LAST][PTL_OP_LAST][PTL_DATATYPE_LAST] = {
+#if ATOM_SIMD_X86
+    [ATOM_SIMD_SSE2] = ATOM_TABLE(sse2),
+    [ATOM_SIMD_AVX2] = ATOM_TABLE(avx2),
+    [ATOM_SIMD_AVX512] = ATOM_TABLE(avx512),
+#endif
+};
+
+/**
+ * Return the best level supported by the CPU we are running on.
+ *
+ * The compiler builtins check the cpuid bits, as well as whether the
+ * OS saves the extended registers.
+ *
+ * @return the level
+ */
+enum atom_simd_level atom_simd_detect(void)
+{
+#if ATOM_SIMD_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") &&
+        __builtin_cpu_supports("avx512bw"))
+        return ATOM_SIMD_AVX512;
+
+    if (__builtin_cpu_supports("avx2"))
+        return ATOM_SIMD_AVX2;
+
+    if (__builtin_cpu_supports("sse2"))
+        return ATOM_SIMD_SSE2;
+#endif
+
+    return ATOM_SIMD_NONE;
+}
+
+/**
+ * Return the kernel implementing an operation at a given level.
+ *
+ * @param level the instruction set level
+ * @param op the atomic operation
+ * @param type the data type
+ *
+ * @return the kernel, or NULL if there is none
+ */
+atom_simd_op_t atom_simd_op(enum atom_simd_level level, ptl_op_t op,
+                            ptl_datatype_t type)
+{
+    if (level >= ATOM_SIMD_LAST || op >= PTL_OP_LAST ||
+        type >= PTL_DATATYPE_LAST)
+        return NULL;
+
+    return atom_simd_table[level][op][type];
+}
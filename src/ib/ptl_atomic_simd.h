@@ -0,0 +1,43 @@
+/**
+ * @file ptl_atomic_simd.h
+ *
+ * Vectorized versions of the atomic ops kernels.
+ *
+ * This file only depends on portals4.h, so that the atomic kernels
+ * microbenchmark can use it without the rest of the library headers.
+ */
+
+#ifndef PTL_ATOMIC_SIMD_H
+#define PTL_ATOMIC_SIMD_H
+
+/**
+ * Instruction set levels for the atomic ops kernels, in increasing
+ * order.
+ */
+enum atom_simd_level {
+    ATOM_SIMD_NONE,             /* plain C loops */
+    ATOM_SIMD_SSE2,             /* 128 bits vectors */
+    ATOM_SIMD_AVX2,             /* 256 bits vectors */
+    ATOM_SIMD_AVX512,           /* 512 bits vectors */
+    ATOM_SIMD_LAST,
+};
+
+/* Same signature as atom_op_t. */
+typedef int (*atom_simd_op_t) (void *dst, void *src, ptl_size_t length);
+
+/**
+ * Return the best level supported by the CPU we are running on.
+ */
+enum atom_simd_level atom_simd_detect(void);
+
+/**
+ * Return the kernel implementing op on type at a given level, or NULL
+ * if there is none. ATOM_SIMD_NONE has none, the plain C loops are
+ * those of the atom_op table in ptl_atomic.c.
+ */
+atom_simd_op_t atom_simd_op(enum atom_simd_level level, ptl_op_t op,
+                            ptl_datatype_t type);
+
+extern const char *atom_simd_level_name[ATOM_SIMD_LAST];
+
+#endif /* PTL_ATOMIC_SIMD_H */
@@ -35,6 +35,17 @@ int buf_setup(void *arg)
 
 #if WITH_TRANSPORT_SHMEM &&!USE_KNEM
     buf->transfer.noknem.data = NULL;
+    buf->transfer.noknem.noknem = NULL;
+#endif
+
+#if WITH_TRANSPORT_UDP
+    buf->transfer.udp.recv_data = NULL;
+#endif
+
+#if WITH_TRANSPORT_TCP
+    buf->transfer.tcp.length = 0;
+    buf->transfer.tcp.zerocopy = 0;
+    buf->transfer.tcp.bounce = NULL;
 #endif
 
     return PTL_OK;
@@ -57,6 +68,20 @@ void buf_cleanup(void *arg)
 
     buf->num_mr = 0;
 
+#if WITH_TRANSPORT_UDP
+    if (buf->transfer.udp.recv_data) {
+        free(buf->transfer.udp.recv_data);
+        buf->transfer.udp.recv_data = NULL;
+    }
+#endif
+
+#if WITH_TRANSPORT_TCP
+    if (buf->transfer.tcp.bounce) {
+        free(buf->transfer.tcp.bounce);
+        buf->transfer.tcp.bounce = NULL;
+    }
+#endif
+
 #if WITH_TRANSPORT_IB
     /* send/rdma bufs drop their references to
      * the master buf here */
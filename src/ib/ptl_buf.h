@@ -27,11 +27,6 @@ enum buf_type {
     BUF_UDP_CONN_REP,
 #endif
 
-#if WITH_RUDP
-    BUF_UDP_ACK,
-    BUF_UDP_NACK,
-#endif
-
 #if WITH_TRANSPORT_SHMEM
     BUF_SHMEM_SEND,
     BUF_SHMEM_RETURN,
@@ -99,6 +94,12 @@ struct xremote {
             struct sockaddr_in dest_addr;
         } udp;
 #endif
+
+#if WITH_TRANSPORT_TCP
+        struct {
+            struct tcp_sock *sock;
+        } tcp;
+#endif
     };
 };
 
@@ -169,6 +170,10 @@ struct buf {
         struct {
             int tgt_state;
             int in_atomic;
+            /* range of atomic locks held, wraps around if
+             * atomic_lock_last < atomic_lock_first */
+            unsigned int atomic_lock_first;
+            unsigned int atomic_lock_last;
 
             pt_t *pt;
             void *start;
@@ -241,6 +246,7 @@ struct buf {
 
     /* Target only. Must survive through buffer reuse. */
     struct list_head unexpected_list;
+    struct list_head unexpected_match_list;     /* on pt unexpected index */
     int unexpected_busy;
     pthread_cond_t cond;
 
@@ -273,9 +279,6 @@ struct buf {
             struct sockaddr_in *dest_addr;
             /* source address for recv */
             struct sockaddr_in src_addr;
-#if WITH_RUDP
-            int in_progress;
-#endif
             int i_am_prog_thread;
         } udp;
 #endif
@@ -312,6 +315,11 @@ struct buf {
             /* How many previous requests buffer (ie. from initiator)
              * will this one completes. */
             int num_req_completes;
+
+            /* Send work request, kept in the buffer so it can be
+             * chained and posted later when bundling. */
+            struct ibv_send_wr send_wr;
+            struct ibv_sge send_sge;
         } rdma;
 #endif
 
@@ -326,9 +334,11 @@ struct buf {
 
 #if (WITH_TRANSPORT_SHMEM && !USE_KNEM)
         struct {
-            /* Invariant during the transfer,
-             * 0=initiator, 2=target */
-            int transfer_state_expected;
+            /* Invariant during the transfer. Whether this side is the
+             * target, and whether it fills the bounce ring (initiator
+             * of a put, target of a get). */
+            int is_target;
+            int producer;
 
             /* Local MD/ME/LE */
             ptl_iovec_t *iovecs;
@@ -340,13 +350,16 @@ struct buf {
              * iovec array. */
             ptl_iovec_t my_iovec;
 
-            /* The associated bounce buffer. Its address, its total
-             * length, and its offset in the comm pad, relative to the
-             * NI's bounce buffers head. */
+            /* The associated bounce buffer. Its address, the length
+             * of its ring, and its offset in the comm pad, relative
+             * to the NI's bounce buffers head. */
             unsigned char *data;
             ptl_size_t data_length;
             off_t bounce_offset;
 
+            /* The free list it was taken from. */
+            struct shmem_bounce_head *bounce_head;
+
             /* noknem communication pad. For the initiator, this
              * points to the local internal_data, while for the
              * target, it is mem_buf->internal_data; both are the
@@ -356,6 +369,13 @@ struct buf {
         } noknem;
 #endif
 
+#if USE_CMA
+        struct {
+            /* Bytes already copied by process_vm_readv/writev. */
+            ptl_size_t done;
+        } cma;
+#endif
+
 #if WITH_TRANSPORT_UDP
         struct {
             /* Invariant during the transfer,
@@ -406,8 +426,41 @@ struct buf {
             unsigned int iovec_split;
             //sequence number for this buf
             unsigned int seq_num;
+
+            /* Payload of a received large message, owned by the
+             * buffer and freed with it. */
+            unsigned char *recv_data;
         } udp;
 #endif
+
+#if WITH_TRANSPORT_TCP
+        struct {
+            /* Frame header; it must live as long as the buffer since
+             * a zero copy send references it. */
+            struct tcp_hdr frame;
+
+            /* Local MD/ME/LE the payload is sent from. */
+            ptl_iovec_t *iovecs;
+            ptl_size_t num_iovecs;
+            ptl_size_t offset;
+            ptl_size_t length;
+
+            /* Fake local iovec used when the MD/LE doesn't have an
+             * iovec array. */
+            ptl_iovec_t my_iovec;
+
+            /* Whether the payload is sent without being copied, and
+             * the zero copy notification it waits for. */
+            int zerocopy;
+            uint32_t zc_id;
+            struct list_head zc_list;
+
+            /* Memory owned by the buffer and freed with it: a
+             * received message too large for internal_data, or the
+             * copy of the payload of a reply. */
+            unsigned char *bounce;
+        } tcp;
+#endif
     } transfer;
 
 #if WITH_TRANSPORT_SHMEM || IS_PPE
@@ -577,6 +630,12 @@ static inline void set_buf_dest(buf_t *buf, conn_t *connect)
             break;
 #endif
 
+#if WITH_TRANSPORT_TCP
+        case CONN_TYPE_TCP:
+            buf->dest.tcp.sock = connect->tcp.sock;
+            break;
+#endif
+
 #if WITH_TRANSPORT_UDP
         case CONN_TYPE_UDP:
             //buf->dest.udp.s = obj_to_ni(buf)->udp.s;
@@ -2,12 +2,17 @@
 #define PTL_BYTEORDER_H
 
 /* use these for network byte order */
+#ifdef __linux__
+/* Same as the kernel headers, which verbs and liburing include. */
+#include <linux/types.h>
+#else
 typedef uint16_t __be16;
 typedef uint32_t __be32;
 typedef uint64_t __be64;
 typedef uint16_t __le16;
 typedef uint32_t __le32;
 typedef uint64_t __le64;
+#endif
 
 static inline __be16 cpu_to_be16(uint16_t x)
 {
@@ -50,16 +50,11 @@ int conn_init(void *arg, void *parm)
 #if WITH_TRANSPORT_UDP
     /* Set udp as the transport. */
     conn->transport = transport_udp;
-
-#if WITH_RUDP
-    atomic_set(&conn->udp.send_seq_num, 1);
-    //recv side starts at 1, due to the
-    //need to use atomic inc on the send
-    //seq num before the message is sent
-    atomic_set(&conn->udp.recv_seq_num, 1);
-    INIT_LIST_HEAD(&conn->udp.rel_queued_bufs);
 #endif
 
+#if WITH_TRANSPORT_TCP
+    conn->transport = transport_tcp;
+    conn->tcp.sock = NULL;
 #endif
 
 #if WITH_TRANSPORT_IB || WITH_TRANSPORT_UDP
@@ -89,33 +84,136 @@ void conn_fini(void *arg)
     }
 #endif
 
-#if WITH_TRANSPORT_UDP && WITH_RUDP
-    if (conn->transport.type == CONN_TYPE_UDP) {
-        atomic_set(&conn->udp.send_seq_num, 0);
-        atomic_set(&conn->udp.recv_seq_num, 0);
-    }
-#endif
-
     pthread_mutex_destroy(&conn->mutex);
 #if WITH_TRANSPORT_IB || WITH_TRANSPORT_UDP
     pthread_cond_destroy(&conn->move_wait);
 #endif
 }
 
-static int compare_conn_id(const void *a, const void *b)
+/* Initial number of slots of the physical connection table. Must be
+ * a power of 2. */
+#define CONN_TABLE_MIN_SIZE	(64)
+
+/**
+ * Open addressing hash table of the connections of a physical NI.
+ *
+ * Connections are only removed when the NI is destroyed, so the
+ * table never has deleted entries. Readers walk it without taking
+ * any lock. Writers hold ni->physical.lock, fill a conn before
+ * publishing it in a slot, and fill a bigger table before publishing
+ * it in the NI. A table that was replaced may still be read by a
+ * concurrent lookup, so it is kept on the old list and only freed
+ * with the NI.
+ */
+struct conn_table {
+    unsigned int mask;          /* number of slots - 1 */
+    unsigned int count;         /* number of slots in use */
+    struct conn_table *old;     /* the table this one replaced */
+    conn_t *volatile slots[0];
+};
+
+static inline unsigned int conn_hash(ptl_process_t id)
+{
+    uint64_t key = ((uint64_t)id.phys.nid << 32) | id.phys.pid;
+
+    return (key * 0x9e3779b97f4a7c15ULL) >> 32;
+}
+
+/**
+ * Find a connection in a table. Lock free.
+ *
+ * @param[in] table the table, may be NULL
+ * @param[in] id the process ID to lookup
+ *
+ * @return the conn_t or NULL if not found
+ */
+static conn_t *conn_table_find(struct conn_table *table, ptl_process_t id)
+{
+    unsigned int i;
+
+    if (!table)
+        return NULL;
+
+    /* The table is never more than half full, so there is always an
+     * empty slot to stop on. */
+    for (i = conn_hash(id);; i++) {
+        conn_t *conn = table->slots[i & table->mask];
+
+        if (!conn)
+            return NULL;
+
+        if (conn->id.phys.nid == id.phys.nid &&
+            conn->id.phys.pid == id.phys.pid)
+            return conn;
+    }
+}
+
+/* Put a connection in the first free slot. */
+static void conn_table_put(struct conn_table *table, conn_t *conn)
 {
-    const conn_t *c1 = a;
-    const conn_t *c2 = b;
+    unsigned int i;
 
-    return compare_id(&c1->id, &c2->id);
+    for (i = conn_hash(conn->id);; i++) {
+        if (!table->slots[i & table->mask]) {
+            table->slots[i & table->mask] = conn;
+            table->count++;
+            return;
+        }
+    }
+}
+
+/**
+ * Insert a new connection in the table of a physical NI. Must be
+ * called with ni->physical.lock held.
+ *
+ * @param[in] ni the NI
+ * @param[in] conn the connection to insert
+ *
+ * @return status
+ */
+static int conn_table_insert(ni_t *ni, conn_t *conn)
+{
+    struct conn_table *table = ni->physical.conns;
+
+    if (!table || 2 * (table->count + 1) > table->mask + 1) {
+        struct conn_table *new_table;
+        unsigned int size = table ? 2 * (table->mask + 1) :
+            CONN_TABLE_MIN_SIZE;
+        unsigned int i;
+
+        new_table = calloc(1, sizeof(*new_table) + size * sizeof(conn_t *));
+        if (!new_table)
+            return PTL_NO_SPACE;
+
+        new_table->mask = size - 1;
+        new_table->old = table;
+
+        if (table) {
+            for (i = 0; i <= table->mask; i++) {
+                if (table->slots[i])
+                    conn_table_put(new_table, table->slots[i]);
+            }
+        }
+
+        /* Readers must see a complete table. */
+        __sync_synchronize();
+        ni->physical.conns = new_table;
+        table = new_table;
+    }
+
+    /* Readers must see a complete conn. */
+    __sync_synchronize();
+    conn_table_put(table, conn);
+
+    return PTL_OK;
 }
 
 /**
  * Get connection info for a given process id.
  *
  * For logical NIs the connection is contained in the rank table.
- * For physical NIs the connection is held in a binary tree using
- * the ID as a sorting value.
+ * For physical NIs the connection is held in a hash table indexed
+ * by the ID, which is looked up without taking the lock.
  *
  * For physical NIs if this is the first time we are sending a message
  * to this process create a new conn_t. For logical NIs the conn_t
@@ -129,7 +227,6 @@ static int compare_conn_id(const void *a, const void *b)
 conn_t *get_conn(ni_t *ni, ptl_process_t id)
 {
     conn_t *conn;
-    void **ret;
 
     if (ni->options & PTL_NI_LOGICAL) {
         if (unlikely(id.rank >= ni->logical.map_size)) {
@@ -141,15 +238,17 @@ conn_t *get_conn(ni_t *ni, ptl_process_t id)
         conn = ni->logical.rank_table[id.rank].connect;
         conn_get(conn);
     } else {
-        conn_t conn_search;
+        conn = conn_table_find(ni->physical.conns, id);
+        if (likely(conn != NULL)) {
+            conn_get(conn);
+            return conn;
+        }
 
         PTL_FASTLOCK_LOCK(&ni->physical.lock);
 
-        /* lookup in binary tree */
-        conn_search.id = id;
-        ret = tfind(&conn_search, &ni->physical.tree, compare_conn_id);
-        if (ret) {
-            conn = *ret;
+        /* Another thread may have inserted it in the meantime. */
+        conn = conn_table_find(ni->physical.conns, id);
+        if (conn) {
             conn_get(conn);
         } else {
             /* Not found. Allocate and insert. */
@@ -179,9 +278,7 @@ conn_t *get_conn(ni_t *ni, ptl_process_t id)
             conn->sin.sin_addr.s_addr = nid_to_addr(id.phys.nid);
             conn->sin.sin_port = pid_to_port(id.phys.pid);
 
-            /* insert new conn into binary tree */
-            ret = tsearch(conn, &ni->physical.tree, compare_conn_id);
-            if (!ret) {
+            if (conn_table_insert(ni, conn)) {
                 WARN();
                 conn_put(conn);
                 conn = NULL;
@@ -264,17 +361,6 @@ static void initiate_disconnect_one(conn_t *conn)
     pthread_mutex_unlock(&conn->mutex);
 }
 
-static void initiate_disconnect_one_twalk(const void *data, const VISIT which,
-                                          const int depth)
-{
-    conn_t *conn = *(conn_t **)data;
-
-    if (which != leaf && which != postorder)
-        return;
-
-    initiate_disconnect_one(conn);
-}
-
 /* When an application destroy an NI, it cannot just close its
  * connections because there might be some packets in flight. So it
  * just informs the remote sides that it is ready to shutdown. */
@@ -290,8 +376,14 @@ void initiate_disconnect_all(ni_t *ni)
 
             initiate_disconnect_one(conn);
         }
-    } else {
-        twalk(ni->physical.tree, initiate_disconnect_one_twalk);
+    } else if (ni->physical.conns) {
+        struct conn_table *table = ni->physical.conns;
+        unsigned int i;
+
+        for (i = 0; i <= table->mask; i++) {
+            if (table->slots[i])
+                initiate_disconnect_one(table->slots[i]);
+        }
     }
 }
 
@@ -359,20 +451,46 @@ void destroy_conns(ni_t *ni)
                 entry->connect = NULL;
             }
         }
-    } else {
-#ifdef HAVE_TDESTROY
-        tdestroy(ni->physical.tree, destroy_conn);
-#else
-        while (ni->physical.tree != NULL) {
-            destroy_conn(*(void **)ni->physical.tree);
-            tdelete(*(void **)ni->physical.tree, &ni->physical.tree,
-                    compare_conn_id);
+    } else if (ni->physical.conns) {
+        struct conn_table *table = ni->physical.conns;
+        unsigned int i;
+
+        for (i = 0; i <= table->mask; i++) {
+            if (table->slots[i])
+                destroy_conn(table->slots[i]);
         }
-#endif
+
+        /* Free the table and the ones it replaced. */
+        while (table) {
+            struct conn_table *old = table->old;
+
+            free(table);
+            table = old;
+        }
+        ni->physical.conns = NULL;
     }
 }
 
 #if WITH_TRANSPORT_IB
+/**
+ * Pick the completion queue of a new QP.
+ *
+ * QPs are spread round robin over the completion queues of the NI, so
+ * each progress thread gets its share of the connections. All the
+ * completions of a QP go to the same queue, which keeps the messages
+ * from a peer in order.
+ *
+ * @param[in] ni
+ *
+ * @return the completion queue
+ */
+static struct ibv_cq *rdma_conn_cq(ni_t *ni)
+{
+    unsigned int i = atomic_inc(&ni->rdma.next_cq);
+
+    return ni->rdma.cqs[i % ni->rdma.num_cqs].cq;
+}
+
 /**
  * Retrieve some current parameters from the QP. Right now we only
  * need max_inline_data.
@@ -419,8 +537,8 @@ static int accept_connection_request(ni_t *ni, conn_t *conn,
 
     init_attr.qp_type = IBV_QPT_RC;
     init_attr.cap.max_send_wr = ni->iface->cap.max_send_wr;
-    init_attr.send_cq = ni->rdma.cq;
-    init_attr.recv_cq = ni->rdma.cq;
+    init_attr.send_cq = rdma_conn_cq(ni);
+    init_attr.recv_cq = init_attr.send_cq;
     init_attr.srq = ni->rdma.srq;
     init_attr.cap.max_send_sge = ni->iface->cap.max_send_sge;
 
@@ -485,8 +603,8 @@ static int accept_connection_self(ni_t *ni, conn_t *conn,
 
     memset(&init_attr, 0, sizeof(init_attr));
     init_attr.qp_type = IBV_QPT_RC;
-    init_attr.send_cq = ni->rdma.cq;
-    init_attr.recv_cq = ni->rdma.cq;
+    init_attr.send_cq = rdma_conn_cq(ni);
+    init_attr.recv_cq = init_attr.send_cq;
     init_attr.srq = ni->rdma.srq;
     init_attr.cap.max_send_wr = ni->iface->cap.max_send_wr;
     init_attr.cap.max_send_sge = ni->iface->cap.max_send_sge;
@@ -745,8 +863,8 @@ void process_cm_event(EV_P_ ev_io *w, int revents)
             /* Create the QP. */
             memset(&init, 0, sizeof(init));
             init.qp_context = ni;
-            init.send_cq = ni->rdma.cq;
-            init.recv_cq = ni->rdma.cq;
+            init.send_cq = rdma_conn_cq(ni);
+            init.recv_cq = init.send_cq;
             init.cap.max_send_wr = ni->iface->cap.max_send_wr;
             init.cap.max_send_sge = ni->iface->cap.max_send_sge;
             init.qp_type = IBV_QPT_RC;
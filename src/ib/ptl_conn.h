@@ -36,6 +36,9 @@ enum transport_type {
 #if WITH_TRANSPORT_UDP
     CONN_TYPE_UDP,
 #endif
+#if WITH_TRANSPORT_TCP
+    CONN_TYPE_TCP,
+#endif
 };
 
 struct md;
@@ -55,6 +58,10 @@ struct transport {
 
     /* Sends a short or long message. */
     int (*send_message) (struct buf * buf, int from_init);
+
+    /* Posts requests deferred by send_message while the NI was
+     * bundling (see ni_bundle_add()), in order. */
+    void (*send_bundle) (struct buf ** bufs, int num_bufs);
     int (*post_tgt_dma) (struct buf * buf);
 
     /* Sets some sent flags, which determine what to do once the
@@ -79,6 +86,7 @@ struct transport {
 
 extern struct transport transport_rdma;
 extern struct transport transport_udp;
+extern struct transport transport_tcp;
 extern struct transport transport_shmem;
 
 /**
@@ -155,13 +163,15 @@ struct conn {
             atomic_t fragment_seq;
             atomic_t is_waiting;    /* set if waiting for connection request response to arrive */
             struct list_head waiting_bufs;  /* list of bufs waiting for connection to be established */
-#if WITH_RUDP
-            atomic_t recv_seq_num;  /*sequence number for reliability */
-            atomic_t send_seq_num;
-            struct list_head rel_queued_bufs;   /*list of queued buffers for in-order delivery */
-#endif
         } udp;
 #endif
+
+#if WITH_TRANSPORT_TCP
+        struct {
+            /* Socket the requests to that peer are sent on. */
+            struct tcp_sock *sock;
+        } tcp;
+#endif
     };
 
 #if WITH_TRANSPORT_IB || WITH_TRANSPORT_UDP
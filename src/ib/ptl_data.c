@@ -52,6 +52,18 @@ int data_size(data_t *data)
             break;
 #endif
 
+#if WITH_TRANSPORT_UDP
+        case DATA_FMT_UDP:
+            /* The payload is not part of the message. */
+            break;
+#endif
+
+#if WITH_TRANSPORT_TCP
+        case DATA_FMT_TCP:
+            /* The payload is not part of the message. */
+            break;
+#endif
+
 #if WITH_TRANSPORT_SHMEM && USE_KNEM
         case DATA_FMT_KNEM_DMA:
             size += data->mem.num_mem_iovecs * sizeof(struct mem_iovec);
@@ -61,6 +73,18 @@ int data_size(data_t *data)
             break;
 #endif
 
+#if WITH_TRANSPORT_SHMEM && !USE_KNEM
+        case DATA_FMT_NOKNEM:
+            /* The payload goes through the bounce buffers. */
+            break;
+#endif
+
+#if USE_CMA
+        case DATA_FMT_CMA:
+            size += data->cma.num_iovecs * sizeof(ptl_iovec_t);
+            break;
+#endif
+
 #if IS_PPE
         case DATA_FMT_MEM_DMA:
             size += data->mem.num_mem_iovecs * sizeof(struct mem_iovec);
@@ -27,6 +27,10 @@ enum data_fmt {
     DATA_FMT_UDP,
 #endif
 
+#if WITH_TRANSPORT_TCP
+    DATA_FMT_TCP,
+#endif
+
 #if WITH_TRANSPORT_SHMEM && USE_KNEM
     DATA_FMT_KNEM_DMA,
     DATA_FMT_KNEM_INDIRECT,
@@ -36,6 +40,10 @@ enum data_fmt {
     DATA_FMT_NOKNEM,
 #endif
 
+#if USE_CMA
+    DATA_FMT_CMA,
+#endif
+
 #if IS_PPE
     DATA_FMT_MEM_DMA,
     DATA_FMT_MEM_INDIRECT,
@@ -67,6 +75,16 @@ struct data {
             uint8_t data[0];
         } immediate;
 
+#if WITH_TRANSPORT_TCP
+                /** Payload following the message in the stream. It
+                 * has the layout of immediate data, so the receiver
+                 * turns it into immediate data once it is read. */
+        struct {
+            __le32 data_length;
+            uint8_t data[0];
+        } tcp;
+#endif
+
 #if WITH_TRANSPORT_IB
                 /** DMA or Indirect RDMA data */
         struct {
@@ -86,20 +104,17 @@ struct data {
 #if (WITH_TRANSPORT_SHMEM && !USE_KNEM)
         /* State memory shared by both sides of the transfer. */
         struct noknem {
-            /* Transfer state.
-             * 0 = initiator to process (set by initiator)
-             * 1 = initiator processing (set by initiator)
-             * 2 = target to process (set by target)
-             * 3 = target processing (set by target)
-             * 4 = transfer done (set by target only.)
-             */
-            int state;
-
-            /* Length being transfered. Only the current owner can modify it. */
-            int length;
-
-            /* Bounce buffer. */
+            /* Bytes put into and taken out of the bounce ring since
+             * the start of the transfer. The producer only writes
+             * produced, and the consumer only writes consumed. */
+            ptl_size_t produced;
+            ptl_size_t consumed;
+
+            /* Bounce buffer, used as a ring of num_slots slots. Set
+             * by the initiator. */
             off_t bounce_offset;
+            unsigned int slot_size;
+            unsigned int num_slots;
 
             /* Transfer done. Set by the target only. */
             int init_done;
@@ -107,6 +122,16 @@ struct data {
         } noknem;
 #endif
 
+#if USE_CMA
+        /* Initiator memory, read or written directly by the target
+         * with process_vm_readv/writev. */
+        struct {
+            uint32_t pid;
+            uint32_t num_iovecs;
+            ptl_iovec_t iovecs[0];
+        } cma;
+#endif
+
 #if WITH_TRANSPORT_UDP
         /* UDP state structure used by both sides of the transfer. */
         struct udp {
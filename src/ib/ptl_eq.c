@@ -36,7 +36,7 @@ void eq_cleanup(void *arg)
 
     if (eq->eqe_list) {
         PTL_FASTLOCK_DESTROY(&eq->eqe_list->lock);
-        free(eq->eqe_list);
+        huge_free(eq->eqe_list, eq->eqe_list_size, eq->eqe_list_huge);
     }
     eq->eqe_list = NULL;
 }
@@ -113,7 +113,15 @@ int _PtlEQAlloc(PPEGBL ptl_handle_ni_t ni_handle, ptl_size_t count,
     count += ni->limits.max_pt_index + 1;
 
     eq->eqe_list_size = sizeof(struct eqe_list) + count * sizeof(eqe_t);
-    eq->eqe_list = calloc(1, eq->eqe_list_size);
+
+    /* Large event queues may go in huge pages. */
+    if (huge_pages && eq->eqe_list_size >= hugepagesize / 2) {
+        eq->eqe_list = huge_alloc(eq->eqe_list_size, "eq",
+                                  &eq->eqe_list_huge);
+    } else {
+        eq->eqe_list = calloc(1, eq->eqe_list_size);
+        eq->eqe_list_huge = HUGE_NONE;
+    }
     if (!eq->eqe_list) {
         err = PTL_NO_SPACE;
         (void)__sync_fetch_and_sub(&ni->current.max_eqs, 1);
@@ -123,11 +131,12 @@ int _PtlEQAlloc(PPEGBL ptl_handle_ni_t ni_handle, ptl_size_t count,
 
     eqe_list = eq->eqe_list;
 
-    eqe_list->producer = 0;
-    eqe_list->consumer = 0;
+    eqe_list->prod_pos = EQ_POS(0, 0);
+    eqe_list->owner = 0;
+    eqe_list->shared = 0;
+    eqe_list->in_fast = 0;
+    eqe_list->cons_pos = EQ_POS(0, 0);
     eqe_list->used = 0;
-    eqe_list->prod_gen = 0;
-    eqe_list->cons_gen = 0;
     eqe_list->interrupt = 0;
     eqe_list->count = count;
 
@@ -421,35 +430,268 @@ int _PtlEQPoll(PPEGBL const ptl_handle_eq_t * eq_handles, unsigned int size,
     return err;
 }
 
-static inline ptl_event_t *reserve_ev(eq_t *restrict eq)
+/**
+ * @brief Get up to max events from an event queue.
+ *
+ * @param[in] eq_handle The handle of the event queue.
+ * @param[out] events The array of returned events.
+ * @param[in] max The size of the array.
+ * @param[out] count_p The address of the number of returned events.
+ *
+ * @return PTL_OK Indicates success.
+ * @return PTL_EQ_DROPPED Indicates success (i.e., some events are
+ * returned) and that at least one event before one of the returned
+ * events has been dropped due to limited space in the event queue.
+ * @return PTL_NO_INIT Indicates that the portals API has not been
+ * successfully initialized.
+ * @return PTL_EQ_EMPTY Indicates that eq_handle is empty.
+ * @return PTL_ARG_INVALID Indicates that eq_handle is not a valid event
+ * queue handle or that max is 0.
+ */
+int _PtlEQGetBatch(PPEGBL ptl_handle_eq_t eq_handle, ptl_event_t *events,
+                   unsigned int max, unsigned int *count_p)
+{
+    int err;
+    eq_t *eq;
+
+#ifndef NO_ARG_VALIDATION
+    err = gbl_get();
+    if (err)
+        goto err0;
+
+    if (max == 0) {
+        err = PTL_ARG_INVALID;
+        goto err1;
+    }
+
+    err = to_eq(MYGBL_ eq_handle, &eq);
+    if (err)
+        goto err1;
+
+    if (!eq) {
+        err = PTL_ARG_INVALID;
+        goto err1;
+    }
+#else
+    eq = to_obj(MYGBL_ POOL_ANY, eq_handle);
+#endif
+
+    err = PtlEQGetBatch_work(eq->eqe_list, events, max, count_p);
+
+    eq_put(eq);
+#ifndef NO_ARG_VALIDATION
+  err1:
+    gbl_put();
+  err0:
+#endif
+    return err;
+}
+
+/**
+ * @brief Poll for events in an array of event queues.
+ *
+ * @param[in] eq_handles array of event queue handles
+ * @param[in] size the size of the array
+ * @param[in] timeout how long to poll in msec
+ * @param[out] events array of returned events
+ * @param[in] max the size of the events array
+ * @param[out] count_p address of the number of returned events
+ * @param[out] which array of max returned indexes in eq_handles, one
+ * per event. Can be NULL.
+ *
+ * @return PTL_OK Indicates success.
+ * @return PTL_EQ_DROPPED Indicates success (i.e., some events are
+ * returned) and that at least one event before one of the returned
+ * events has been dropped due to limited space in its event queue.
+ * @return PTL_NO_INIT Indicates that the portals API has not been
+ * successfully initialized.
+ * @return PTL_ARG_INVALID Indicates that an invalid argument was passed.
+ * @return PTL_EQ_EMPTY Indicates that the timeout has been reached and all
+ * of the event queues are empty.
+ * @return PTL_INTERRUPTED Indicates that PtlEQFree() or PtlNIFini() was
+ * called by another thread while this thread was waiting in
+ * PtlEQPollBatch().
+ */
+int _PtlEQPollBatch(PPEGBL const ptl_handle_eq_t * eq_handles,
+                    unsigned int size, ptl_time_t timeout,
+                    ptl_event_t *events, unsigned int max,
+                    unsigned int *count_p, unsigned int *which)
+{
+    int err;
+    eq_t *eqs[size];
+    struct eqe_list *eqes_list[size];
+    int i;
+    int i2;
+
+#ifndef NO_ARG_VALIDATION
+    ni_t *ni = NULL;
+
+    err = gbl_get();
+    if (err)
+        goto err0;
+#endif
+
+    if (size == 0 || max == 0) {
+        err = PTL_ARG_INVALID;
+        goto err1;
+    }
+#ifndef NO_ARG_VALIDATION
+    i2 = -1;
+    for (i = 0; i < size; i++) {
+        err = to_eq(MYGBL_ eq_handles[i], &eqs[i]);
+        if (unlikely(err || !eqs[i])) {
+            err = PTL_ARG_INVALID;
+            goto err2;
+        }
+        eqes_list[i] = eqs[i]->eqe_list;
+
+        i2 = i;
+
+        if (i == 0)
+            ni = obj_to_ni(eqs[0]);
+
+        if (ni != obj_to_ni(eqs[i])) {
+            err = PTL_ARG_INVALID;
+            goto err2;
+        }
+    }
+#else
+    for (i = 0; i < size; i++) {
+        eqs[i] = to_obj(MYGBL_ POOL_ANY, eq_handles[i]);
+        eqes_list[i] = eqs[i]->eqe_list;
+    }
+    i2 = size - 1;
+#endif
+
+    err = PtlEQPollBatch_work(eqes_list, size, timeout, events, max,
+                              count_p, which);
+
+#ifndef NO_ARG_VALIDATION
+  err2:
+#endif
+    for (i = i2; i >= 0; i--)
+        eq_put(eqs[i]);
+  err1:
+#ifndef NO_ARG_VALIDATION
+    gbl_put();
+  err0:
+#endif
+    return err;
+}
+
+/**
+ * @brief Start adding events to an event queue.
+ *
+ * The first thread to add an event becomes the single producer, and
+ * adds its events without taking the lock. When another thread adds
+ * an event, all the producers switch to taking the lock for good.
+ *
+ * @param[in] eqe_list the event queue entries
+ *
+ * @return 1 if the lock was taken, 0 otherwise
+ */
+static inline int produce_begin(struct eqe_list *eqe_list)
+{
+    const unsigned long self = (unsigned long)pthread_self();
+
+    if (likely(!eqe_list->shared)) {
+        if (likely(eqe_list->owner == self) ||
+            (eqe_list->owner == 0 &&
+             __sync_bool_compare_and_swap(&eqe_list->owner, 0, self))) {
+            eqe_list->in_fast = 1;
+            __sync_synchronize();
+            if (likely(!eqe_list->shared))
+                return 0;
+
+            eqe_list->in_fast = 0;
+        } else {
+            eqe_list->shared = 1;
+            __sync_synchronize();
+        }
+    }
+
+    /* Let the single producer finish the event it may be adding
+     * without the lock. */
+    while (*(volatile int *)&eqe_list->in_fast)
+        SPINLOCK_BODY();
+
+    PTL_FASTLOCK_LOCK(&eqe_list->lock);
+
+    return 1;
+}
+
+/**
+ * @brief Done adding events to an event queue.
+ *
+ * @param[in] eqe_list the event queue entries
+ * @param[in] locked the value returned by produce_begin()
+ */
+static inline void produce_end(struct eqe_list *eqe_list, int locked)
+{
+    if (locked) {
+        PTL_FASTLOCK_UNLOCK(&eqe_list->lock);
+    } else {
+        __sync_synchronize();
+        eqe_list->in_fast = 0;
+    }
+}
+
+/**
+ * @brief Reserve the next entry of an event queue.
+ *
+ * The entry is invalid until publish_ev() is called.
+ *
+ * @param[in] eq the event queue
+ * @param[out] gen_p the generation to give to publish_ev()
+ *
+ * @return the entry
+ */
+static inline eqe_t *reserve_ev(eq_t *restrict eq, unsigned int *gen_p)
 {
-    ptl_event_t *ev;
     eqe_t *eqe;
     struct eqe_list *eqe_list;
+    unsigned int producer;
+    unsigned int prod_gen;
 
     eqe_list = eq->eqe_list;
-    eqe = &eqe_list->eqe[eqe_list->producer];
+    producer = EQ_POS_INDEX(eqe_list->prod_pos);
+    prod_gen = EQ_POS_GEN(eqe_list->prod_pos);
+    eqe = &eqe_list->eqe[producer];
 
-    eqe->generation = eqe_list->prod_gen;
-    ev = &eqe->event;
+    /* Invalidate the entry for the consumers reading it. */
+    eqe->generation = 0;
+    __sync_synchronize();
 
-    eqe_list->producer++;
-    if (eqe_list->producer >= eqe_list->count) {
-        eqe_list->producer = 0;
-        eqe_list->prod_gen++;
-    }
+    *gen_p = prod_gen + 1;
 
-    eqe_list->used++;
+    producer++;
+    if (producer >= eqe_list->count)
+        eqe_list->prod_pos = EQ_POS(prod_gen + 1, 0);
+    else
+        eqe_list->prod_pos = EQ_POS(prod_gen, producer);
 
     /* If all unreserved entries are used, then the queue is
      * overflowing. It matters only if an attached PT wants flow
      * control. TODO: we should not be counting already inserted
      * reserved entries. */
-    if (eqe_list->used == eq->count_simple && !list_empty(&eq->flowctrl_list)) {
+    if (__sync_add_and_fetch(&eqe_list->used, 1) == eq->count_simple &&
+        !list_empty(&eq->flowctrl_list)) {
         eq->overflowing = 1;
     }
 
-    return ev;
+    return eqe;
+}
+
+/**
+ * @brief Make a reserved entry visible to the consumers.
+ *
+ * @param[in] eqe the entry returned by reserve_ev()
+ * @param[in] gen the generation returned by reserve_ev()
+ */
+static inline void publish_ev(eqe_t *eqe, unsigned int gen)
+{
+    __sync_synchronize();
+    eqe->generation = gen;
 }
 
 /* Overflow situation. The EQ lock must be taken. */
@@ -459,7 +701,8 @@ static void process_overflowing(eq_t *restrict eq)
      * using one of the reserved EQ entries. */
     struct list_head *l;
     pt_t *pt;
-    ptl_event_t *ev;
+    eqe_t *eqe;
+    unsigned int gen;
 
     assert(eq->overflowing);
 
@@ -471,17 +714,47 @@ static void process_overflowing(eq_t *restrict eq)
 
             /* Note/TODO: this will take a reserved entry but it
              * will be counted as a regular entry later. */
-            ev = reserve_ev(eq);
+            eqe = reserve_ev(eq, &gen);
 
-            ev->type = PTL_EVENT_PT_DISABLED;
-            ev->pt_index = pt->index;
-            ev->ni_fail_type = PTL_NI_PT_DISABLED;
+            eqe->event.type = PTL_EVENT_PT_DISABLED;
+            eqe->event.pt_index = pt->index;
+            eqe->event.ni_fail_type = PTL_NI_PT_DISABLED;
+
+            publish_ev(eqe, gen);
         }
     }
 
     eq->overflowing = 0;
 }
 
+/**
+ * @brief Finish adding an event to an event queue.
+ *
+ * Handles the flow control, and releases the producer side.
+ *
+ * @param[in] eq the event queue
+ * @param[in] locked the value returned by produce_begin()
+ */
+static inline void produce_done(eq_t *restrict eq, int locked)
+{
+    /* If the EQ is overflowing, warn every PT not already stopped by
+     * using one of the reserved EQ entries. The single producer takes
+     * the lock to walk the flow control list. */
+    if (unlikely(eq->overflowing)) {
+        if (!locked)
+            PTL_FASTLOCK_LOCK(&eq->eqe_list->lock);
+
+        process_overflowing(eq);
+
+        if (!locked)
+            PTL_FASTLOCK_UNLOCK(&eq->eqe_list->lock);
+    }
+
+    produce_end(eq->eqe_list, locked);
+
+    check_waiter(eq->eqe_list);
+}
+
 /**
  * @brief Make and add a new event to the event queue from a buf.
  *
@@ -500,10 +773,14 @@ void make_init_event(buf_t *restrict buf, eq_t *restrict eq,
     }
 
     ptl_event_t *ev;
+    eqe_t *eqe;
+    unsigned int gen;
+    int locked;
 
-    PTL_FASTLOCK_LOCK(&eq->eqe_list->lock);
+    locked = produce_begin(eq->eqe_list);
 
-    ev = reserve_ev(eq);
+    eqe = reserve_ev(eq, &gen);
+    ev = &eqe->event;
     ev->type = type;
     ev->user_ptr = buf->user_ptr;
 
@@ -522,14 +799,9 @@ void make_init_event(buf_t *restrict buf, eq_t *restrict eq,
         ev->ptl_list = buf->matching_list;
     }
 
-    /* If the EQ is overflowing, warn every PT not already stopped by
-     * using one of the reserved EQ entries. */
-    if (eq->overflowing)
-        process_overflowing(eq);
-
-    PTL_FASTLOCK_UNLOCK(&eq->eqe_list->lock);
+    publish_ev(eqe, gen);
 
-    check_waiter(eq->eqe_list);
+    produce_done(eq, locked);
 }
 
 /**
@@ -573,16 +845,17 @@ void fill_target_event(buf_t *restrict buf, ptl_event_kind_t type,
  */
 void send_target_event(eq_t *restrict eq, ptl_event_t *restrict ev)
 {
-    PTL_FASTLOCK_LOCK(&eq->eqe_list->lock);
-
-    *(reserve_ev(eq)) = *ev;
+    eqe_t *eqe;
+    unsigned int gen;
+    int locked;
 
-    if (eq->overflowing)
-        process_overflowing(eq);
+    locked = produce_begin(eq->eqe_list);
 
-    PTL_FASTLOCK_UNLOCK(&eq->eqe_list->lock);
+    eqe = reserve_ev(eq, &gen);
+    eqe->event = *ev;
+    publish_ev(eqe, gen);
 
-    check_waiter(eq->eqe_list);
+    produce_done(eq, locked);
 }
 
 /**
@@ -597,20 +870,17 @@ void send_target_event(eq_t *restrict eq, ptl_event_t *restrict ev)
 void make_target_event(buf_t *restrict buf, eq_t *restrict eq,
                        ptl_event_kind_t type, void *user_ptr, void *start)
 {
-    ptl_event_t *ev;
-
-    PTL_FASTLOCK_LOCK(&eq->eqe_list->lock);
-
-    ev = reserve_ev(eq);
-
-    fill_target_event(buf, type, user_ptr, start, ev);
+    eqe_t *eqe;
+    unsigned int gen;
+    int locked;
 
-    if (eq->overflowing)
-        process_overflowing(eq);
+    locked = produce_begin(eq->eqe_list);
 
-    PTL_FASTLOCK_UNLOCK(&eq->eqe_list->lock);
+    eqe = reserve_ev(eq, &gen);
+    fill_target_event(buf, type, user_ptr, start, &eqe->event);
+    publish_ev(eqe, gen);
 
-    check_waiter(eq->eqe_list);
+    produce_done(eq, locked);
 }
 
 /**
@@ -625,19 +895,19 @@ void make_le_event(le_t *restrict le, eq_t *restrict eq,
                    ptl_event_kind_t type, ptl_ni_fail_t fail_type)
 {
     ptl_event_t *ev;
+    eqe_t *eqe;
+    unsigned int gen;
+    int locked;
 
-    PTL_FASTLOCK_LOCK(&eq->eqe_list->lock);
+    locked = produce_begin(eq->eqe_list);
 
-    ev = reserve_ev(eq);
+    eqe = reserve_ev(eq, &gen);
+    ev = &eqe->event;
     ev->type = type;
     ev->pt_index = le->pt_index;
     ev->user_ptr = le->user_ptr;
     ev->ni_fail_type = fail_type;
+    publish_ev(eqe, gen);
 
-    if (eq->overflowing)
-        process_overflowing(eq);
-
-    PTL_FASTLOCK_UNLOCK(&eq->eqe_list->lock);
-
-    check_waiter(eq->eqe_list);
+    produce_done(eq, locked);
 }
@@ -19,6 +19,7 @@ struct eq {
     struct eqe_list *eqe_list;                  /**< circular buffer for
 									   holding events */
     int eqe_list_size;
+    enum huge_mode eqe_list_huge;               /**< how eqe_list is backed */
     unsigned int count_simple;                          /**< size of event queue minus reserved entries */
 
         /** to attach the PTs supporting flow control. **/
@@ -27,19 +27,28 @@ extern atomic_t keep_polling;
  * @param[in] eq the event queue
  *
  * @return non-zero if the queue is empty. The result is not
- * guaranteed unless the eq->lock is taken. However it is sufficient
- * to give an idea whether get_event() can be called. This avoids
- * taking a lock.
+ * guaranteed, since the producers and the other consumers don't stop.
+ * However it is sufficient to give an idea whether get_event() can be
+ * called.
  */
 static int inline is_queue_empty(struct eqe_list *eqe_list)
 {
-    return ((eqe_list->producer == eqe_list->consumer) &&
-            (eqe_list->prod_gen == eqe_list->cons_gen));
+    const uint64_t pos = *(volatile uint64_t *)&eqe_list->cons_pos;
+    const unsigned int gen =
+        *(volatile unsigned int *)&eqe_list->eqe[EQ_POS_INDEX(pos)].
+        generation;
+
+    return gen == 0 || gen <= EQ_POS_GEN(pos);
 }
 
 /**
  * @brief Find next event in event queue.
  *
+ * Lock free. The event is copied, then the entry generation is checked
+ * again in case the producer overwrote it meanwhile. The consumer
+ * position is advanced with a compare and swap, in case there are
+ * several consumers.
+ *
  * @param[in] eq the event queue
  * @param[out] event_p the address of the returned event
  *
@@ -51,38 +60,182 @@ static int inline is_queue_empty(struct eqe_list *eqe_list)
 static int get_event(struct eqe_list *restrict eqe_list,
                      ptl_event_t *restrict event_p)
 {
+    volatile unsigned int *generation;
+    unsigned int consumer;
+    unsigned int cons_gen;
+    unsigned int gen;
+    uint64_t pos;
+    uint64_t next;
     int dropped = 0;
 
-    PTL_FASTLOCK_LOCK(&eqe_list->lock);
+    while (1) {
+        pos = *(volatile uint64_t *)&eqe_list->cons_pos;
+        consumer = EQ_POS_INDEX(pos);
+        cons_gen = EQ_POS_GEN(pos);
+        generation = &eqe_list->eqe[consumer].generation;
+
+        if (consumer + 1 == eqe_list->count)
+            next = EQ_POS(cons_gen + 1, 0);
+        else
+            next = EQ_POS(cons_gen, consumer + 1);
+
+        gen = *generation;
+
+        if (gen == 0 || gen <= cons_gen) {
+            /* Nothing there. After a gap, it is the next event being
+             * written, so wait for it. */
+            if (dropped && gen == 0) {
+                SPINLOCK_BODY();
+                continue;
+            }
+            return PTL_EQ_EMPTY;
+        }
 
-    /* check to see if the queue is empty */
-    if (is_queue_empty(eqe_list)) {
-        PTL_FASTLOCK_UNLOCK(&eqe_list->lock);
-        return PTL_EQ_EMPTY;
-    }
+        if (gen > cons_gen + 1) {
+            /* We have been lapped by the producer. Jump to the oldest
+             * entry not overwritten, which is the next one the
+             * producer will write. */
+            const uint64_t prod = *(volatile uint64_t *)&eqe_list->prod_pos;
+            const uint64_t oldest =
+                EQ_POS(EQ_POS_GEN(prod) - 1, EQ_POS_INDEX(prod));
+
+            if (oldest > next)
+                next = oldest;
+
+            if (__sync_bool_compare_and_swap(&eqe_list->cons_pos, pos, next)) {
+                __sync_fetch_and_sub(&eqe_list->used,
+                                     (EQ_POS_GEN(next) - cons_gen) *
+                                     eqe_list->count + EQ_POS_INDEX(next) -
+                                     consumer);
+                dropped = 1;
+            }
+            continue;
+        }
+
+        __sync_synchronize();
+        *event_p = eqe_list->eqe[consumer].event;
+        __sync_synchronize();
 
-    /* if we have been lapped by the producer advance the
-     * consumer pointer until we catch up */
-    while (eqe_list->cons_gen < eqe_list->eqe[eqe_list->consumer].generation) {
-        eqe_list->consumer++;
-        if (eqe_list->consumer == eqe_list->count) {
-            eqe_list->consumer = 0;
-            eqe_list->cons_gen++;
+        if (*generation != gen) {
+            /* Overwritten while we were reading it. */
+            dropped = 1;
+            continue;
         }
-        dropped = 1;
-        eqe_list->used--;
+
+        if (__sync_bool_compare_and_swap(&eqe_list->cons_pos, pos, next))
+            break;
     }
 
-    /* return the next valid event and update the consumer pointer */
-    *event_p = eqe_list->eqe[eqe_list->consumer++].event;
-    if (eqe_list->consumer >= eqe_list->count) {
-        eqe_list->consumer = 0;
-        eqe_list->cons_gen++;
+    __sync_fetch_and_sub(&eqe_list->used, 1);
+
+    return dropped ? PTL_EQ_DROPPED : PTL_OK;
+}
+
+/**
+ * @brief Get consecutive events from an event queue at once.
+ *
+ * Copies the valid events following the consumer position, then
+ * advances the position once for all of them. Stops at the first
+ * entry that is not a valid event of the current generation, so the
+ * gaps are left to get_event().
+ *
+ * @param[in] eq the event queue
+ * @param[out] events the array of returned events
+ * @param[in] max the size of the array
+ *
+ * @return the number of events returned
+ */
+static unsigned int get_events(struct eqe_list *restrict eqe_list,
+                               ptl_event_t *restrict events,
+                               unsigned int max)
+{
+    volatile unsigned int *generation;
+    unsigned int consumer;
+    unsigned int cons_gen;
+    unsigned int gen;
+    unsigned int n;
+    uint64_t pos;
+
+    do {
+        pos = *(volatile uint64_t *)&eqe_list->cons_pos;
+        consumer = EQ_POS_INDEX(pos);
+        cons_gen = EQ_POS_GEN(pos);
+
+        for (n = 0; n < max; n++) {
+            generation = &eqe_list->eqe[consumer].generation;
+
+            gen = *generation;
+            if (gen != cons_gen + 1)
+                break;
+
+            __sync_synchronize();
+            events[n] = eqe_list->eqe[consumer].event;
+            __sync_synchronize();
+
+            if (*generation != gen)
+                break;
+
+            consumer++;
+            if (consumer == eqe_list->count) {
+                consumer = 0;
+                cons_gen++;
+            }
+        }
+
+        if (n == 0)
+            return 0;
+    } while (!__sync_bool_compare_and_swap(&eqe_list->cons_pos, pos,
+                                           EQ_POS(cons_gen, consumer)));
+
+    __sync_fetch_and_sub(&eqe_list->used, n);
+
+    return n;
+}
+
+/**
+ * @brief Drain up to max events from an event queue.
+ *
+ * @param[in] eq the event queue
+ * @param[out] events the array of returned events
+ * @param[in] max the size of the array
+ * @param[out] count_p the number of events returned
+ *
+ * @return PTL_EQ_EMPTY if there are no events in the queue
+ * @return PTL_EQ_DROPPED if some events were returned, and there was a
+ * gap before at least one of them
+ * @return PTL_EQ_OK if some events were returned, without gap
+ */
+static int get_event_batch(struct eqe_list *restrict eqe_list,
+                           ptl_event_t *restrict events, unsigned int max,
+                           unsigned int *count_p)
+{
+    unsigned int n = 0;
+    int dropped = 0;
+    int err;
+
+    while (n < max) {
+        unsigned int got = get_events(eqe_list, &events[n], max - n);
+
+        if (got) {
+            n += got;
+            continue;
+        }
+
+        /* Empty, lapped by the producer, or racing with another
+         * consumer. */
+        err = get_event(eqe_list, &events[n]);
+        if (err == PTL_EQ_EMPTY)
+            break;
+
+        if (err == PTL_EQ_DROPPED)
+            dropped = 1;
+        n++;
     }
 
-    eqe_list->used--;
+    *count_p = n;
 
-    PTL_FASTLOCK_UNLOCK(&eqe_list->lock);
+    if (n == 0)
+        return PTL_EQ_EMPTY;
 
     return dropped ? PTL_EQ_DROPPED : PTL_OK;
 }
@@ -197,3 +350,88 @@ int PtlEQPoll_work(struct eqe_list *eqe_list_in[], unsigned int size,
     atomic_dec(&keep_polling);
     return err;
 }
+
+/**
+ * Do the work for PtlEQGetBatch
+ */
+int PtlEQGetBatch_work(struct eqe_list *eqe_list, ptl_event_t *events,
+                       unsigned int max, unsigned int *count_p)
+{
+    return get_event_batch(eqe_list, events, max, count_p);
+}
+
+/**
+ * Do the work for PtlEQPollBatch. Sweeps all the queues, and returns
+ * as soon as a sweep found some events.
+ */
+int PtlEQPollBatch_work(struct eqe_list *eqe_list_in[], unsigned int size,
+                        ptl_time_t timeout, ptl_event_t *events,
+                        unsigned int max, unsigned int *count_p,
+                        unsigned int *which)
+{
+    int err;
+    uint64_t nstart;
+    uint64_t timeout_ns;
+    TIMER_TYPE start;
+    int i;
+    const int forever = (timeout == PTL_TIME_FOREVER);
+    unsigned int n = 0;
+    int dropped = 0;
+
+    /* compute expiration of poll time */
+    MARK_TIMER(start);
+    nstart = TIMER_INTS(start);
+
+    timeout_ns = MILLI_TO_TIMER_INTS(timeout);
+    atomic_inc(&keep_polling);
+
+    while (1) {
+        for (i = 0; i < size && n < max; i++) {
+            struct eqe_list *eqe_list = eqe_list_in[i];
+            unsigned int got;
+            unsigned int k;
+
+            if (!is_queue_empty(eqe_list)) {
+                err = get_event_batch(eqe_list, &events[n], max - n, &got);
+
+                if (err != PTL_EQ_EMPTY) {
+                    if (err == PTL_EQ_DROPPED)
+                        dropped = 1;
+
+                    if (which) {
+                        for (k = 0; k < got; k++)
+                            which[n + k] = i;
+                    }
+                    n += got;
+                    continue;
+                }
+            }
+
+            if (eqe_list->interrupt && n == 0) {
+                err = PTL_INTERRUPTED;
+                goto out;
+            }
+        }
+
+        if (n) {
+            err = dropped ? PTL_EQ_DROPPED : PTL_OK;
+            goto out;
+        }
+
+        if (!forever) {
+            TIMER_TYPE tp;
+            MARK_TIMER(tp);
+            if ((TIMER_INTS(tp) - nstart) >= timeout_ns) {
+                err = PTL_EQ_EMPTY;
+                goto out;
+            }
+        }
+
+        sched_yield();
+    }
+
+  out:
+    atomic_dec(&keep_polling);
+    *count_p = n;
+    return err;
+}
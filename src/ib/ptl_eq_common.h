@@ -14,29 +14,51 @@
  * Event queue entry.
  */
 typedef struct {
-    unsigned int generation;                    /**< increments each time the producer
-									   pointer wraps */
+    unsigned int generation;                    /**< producer generation + 1
+									   once the event is valid, 0
+									   while it is written */
     ptl_event_t event;                          /**< portals event */
 } eqe_t;
 
-// todo: reorder fields for better performance. use align.
+/* A position in the queue packs a generation and an index, so that
+ * both are read and advanced at once. */
+#define EQ_POS(gen, index)	(((uint64_t)(gen) << 32) | (index))
+#define EQ_POS_GEN(pos)		((unsigned int)((pos) >> 32))
+#define EQ_POS_INDEX(pos)	((unsigned int)(pos))
+
+/*
+ * The events are added without lock as long as a single thread
+ * produces them. Once a second producer is seen, the producers take
+ * the lock. The consumers never take it: they check the generation of
+ * an entry before and after copying it.
+ */
 struct eqe_list {
-    unsigned int producer;                      /**< producer index */
-    unsigned int consumer;                      /**< consumer index */
-    unsigned int prod_gen;                      /**< producer generation */
-    unsigned int cons_gen;                      /**< consumer generation */
+    /* Producer side. */
+    uint64_t prod_pos;                          /**< producer position */
+    unsigned long owner;                        /**< the single producer thread */
+    int shared;                                 /**< set once there are several
+									   producers */
+    int in_fast;                                /**< the single producer is
+									   adding an event without the
+									   lock */
+
+    PTL_FASTLOCK_TYPE lock;             /**< lock for adding, and for
+									   the flow control list */
+
     int interrupt;                                              /**< if set eq is being
 									   freed or destroyed */
     unsigned int used;                          /**< number of slots used */
     unsigned int count;                         /**< size of event queue */
 
-    PTL_FASTLOCK_TYPE lock;             /**< lock for adding */
-
     pthread_mutex_t mutex;     /**< mutex for eq condition */
     pthread_cond_t cond;
 
     atomic_t waiter;
 
+    /* Consumer side, on its own cache line. */
+    uint64_t cons_pos __attribute__ ((aligned(64)));    /**< consumer
+									   position */
+
     eqe_t eqe[0];
 };
 
@@ -45,5 +67,11 @@ int PtlEQWait_work(struct eqe_list *eqe_list, ptl_event_t *event_p);
 int PtlEQPoll_work(struct eqe_list *eqe_list_in[], unsigned int size,
                    ptl_time_t timeout, ptl_event_t *event_p,
                    unsigned int *which_p);
+int PtlEQGetBatch_work(struct eqe_list *eqe_list, ptl_event_t *events,
+                       unsigned int max, unsigned int *count_p);
+int PtlEQPollBatch_work(struct eqe_list *eqe_list_in[], unsigned int size,
+                        ptl_time_t timeout, ptl_event_t *events,
+                        unsigned int max, unsigned int *count_p,
+                        unsigned int *which);
 
 #endif /* PTL_EQ_COMMON_H */
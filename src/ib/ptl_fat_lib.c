@@ -93,6 +93,7 @@ static void dump_everything(int unused)
 
         for (j = 0; j < 4; j++) {
             ni_t *ni = gbl->iface[i].ni[j];
+            struct pool_stats stats;
 
             if (!ni)
                 continue;
@@ -101,7 +102,11 @@ static void dump_everything(int unused)
             printf("  options: %x\n", ni->options);
             printf("  recv_list: %d\n", list_empty(&ni->rdma.recv_list));
 
-            printf("  buffers used: %d\n", atomic_read(&ni->buf_pool.count));
+            pool_get_stats(&ni->buf_pool, &stats);
+            printf("  buffers used: %ld, cached: %lu\n", stats.in_use,
+                   stats.cached);
+            printf("  buffer memory: %lu bytes, peak: %lu bytes\n",
+                   stats.bytes, stats.peak_bytes);
 
             printf("  limits.max_entries = %d\n", ni->limits.max_entries);
             printf("  limits.max_unexpected_headers = %d\n",
@@ -211,7 +216,7 @@ static void dump_everything(int unused)
                  * on something. */
                 struct ibv_wc wc;
                 printf("  polling CQ: ret=%d\n",
-                       ibv_poll_cq(ni->rdma.cq, 1, &wc));
+                       ibv_poll_cq(ni->rdma.cqs[0].cq, 1, &wc));
             }
 #endif
 
@@ -96,10 +96,6 @@ typedef struct req_hdr {
     __le64 hdr_data;
     __le32 pt_index;
     __le32 uid;
-#if WITH_TRANSPORT_UDP
-    unsigned int udp_is_large:1;
-    unsigned int fragment_seq:8;
-#endif
 } req_hdr_t;
 
 /* Header for an ack or a reply. */
@@ -109,4 +105,83 @@ typedef struct ack_hdr {
     __le64 moffset;
 } ack_hdr_t;
 
+#if WITH_TRANSPORT_UDP
+/* Type of a UDP datagram. */
+enum udp_msg_type {
+    UDP_MSG_DATA = 1,                  /* portals request, ack or reply */
+    UDP_MSG_CONN_REQ,                  /* connection request */
+    UDP_MSG_CONN_REP,                  /* connection reply */
+    UDP_MSG_ACK,                       /* reliable UDP ack, header only */
+};
+
+/**
+ * @brief Header of every UDP datagram.
+ *
+ * It is followed by hdr_len bytes of portals header, and by a struct
+ * udp_conn_msg for the connection messages. A large message is sent
+ * as one or more datagrams with the UDP_HDR_LARGE flag; in those the
+ * portals header is followed by the bytes
+ * [frag_seq * frag_size, (frag_seq + 1) * frag_size[ of the payload.
+ * All of them but the last one have the same size, so that the kernel
+ * can cut and coalesce them (UDP_SEGMENT, UDP_GRO).
+ *
+ * With reliable UDP, the datagrams are numbered per pair of sockets,
+ * and each one acknowledges the datagrams received from the peer:
+ * ack is the next sequence number expected, and bit i of sack is set
+ * if ack + 1 + i was received.
+ */
+struct udp_hdr {
+    uint8_t type;                      /* enum udp_msg_type */
+    uint8_t flags;
+#define UDP_HDR_LARGE	(1 << 0)
+#define UDP_HDR_SEQ	(1 << 1)           /* seq_num is valid */
+#define UDP_HDR_ACK	(1 << 2)           /* ack and sack are valid */
+    __le16 hdr_len;
+    __le32 seq_num;                    /* reliable UDP sequence number */
+    __le32 frag_seq;
+    __le32 frag_size;
+    __le64 rlength;                    /* payload length */
+#if WITH_RUDP
+    __le32 ack;
+    __le32 reserved;
+    __le64 sack;
+#endif
+};
+
+/* Largest payload of a UDP datagram. */
+#define UDP_MAX_DATAGRAM	(65507)
+#endif
+
+#if WITH_TRANSPORT_TCP
+/* Type of a TCP frame. */
+enum tcp_msg_type {
+    TCP_MSG_HELLO = 1,                 /* first frame on a new socket */
+    TCP_MSG_DATA,                      /* portals request, ack or reply */
+};
+
+/**
+ * @brief Header of every frame on a TCP socket.
+ *
+ * It is followed by hdr_len bytes of portals header, then by data_len
+ * bytes of payload. The payload belongs to the DATA_FMT_TCP data
+ * descriptor that ends the portals header.
+ */
+struct tcp_hdr {
+    uint8_t type;                      /* enum tcp_msg_type */
+    uint8_t reserved1;
+    __le16 hdr_len;
+    __le32 reserved2;
+    __le64 data_len;
+};
+
+/* Body of a TCP_MSG_HELLO frame. It tells the accepting side which NI
+ * the socket is for, and which process is connecting. */
+struct tcp_hello {
+    __le32 src_nid;                    /* or rank for a logical NI */
+    __le32 src_pid;
+    uint8_t ni_type;
+    uint8_t reserved[7];
+};
+#endif
+
 #endif /* PTL_HDR_H */
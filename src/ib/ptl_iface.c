@@ -45,6 +45,13 @@ void cleanup_iface(iface_t *iface)
     close(iface->udp.connect_s);
 #endif
 
+#if WITH_TRANSPORT_TCP
+    if (iface->tcp.listen_s != -1) {
+        close(iface->tcp.listen_s);
+        iface->tcp.listen_s = -1;
+    }
+#endif
+
     iface->ifname[0] = 0;
 }
 
@@ -84,7 +91,7 @@ int init_iface_table(gbl_t *gbl)
     int i;
     int num_iface = get_param(PTL_MAX_IFACE);
 
-#if WITH_TRANSPORT_SHMEM || IS_PPE || WITH_TRANSPORT_UDP
+#if WITH_TRANSPORT_SHMEM || IS_PPE || WITH_TRANSPORT_UDP || WITH_TRANSPORT_TCP
     /* Clip the number of interfaces for shmem.
      * Note: Is that really necessary? */
     num_iface = 1;
@@ -117,7 +124,7 @@ int init_iface_table(gbl_t *gbl)
         
 #endif
 
-#if WITH_TRANSPORT_UDP
+#if WITH_TRANSPORT_UDP || WITH_TRANSPORT_TCP
         /* the interface name is "eth" followed by the interface id */
         sprintf(gbl->iface[i].ifname, "eth%d", current_if_num);
 
@@ -157,11 +164,16 @@ int init_iface_table(gbl_t *gbl)
                          gbl->iface[i].ifname, current_if_num);
             }
         }
+#endif
 
-
+#if WITH_TRANSPORT_UDP
         gbl->iface[i].udp.connect_s = -1;
 #endif
 
+#if WITH_TRANSPORT_TCP
+        gbl->iface[i].tcp.listen_s = -1;
+#endif
+
     }
 
     return PTL_OK;
@@ -70,8 +70,32 @@ struct iface {
         /* Used to determine when to close the shared */
         /* connection socket */
         int ni_count;
+
+        /* Largest datagram sent on the socket, and size of the
+         * datagrams the kernel cuts a UDP_SEGMENT send into (0 when
+         * segmentation offload is not used). */
+        int max_msg;
+        int gso_size;
+
+#if WITH_RUDP
+        /* Reliability state of the shared socket. */
+        struct rudp *rudp;
+#endif
     } udp;
 #endif
+
+#if WITH_TRANSPORT_TCP
+    struct {
+        /* Listening socket, shared by the NIs of the interface. */
+        int listen_s;
+
+                /** IPV4 address of this interface */
+        struct sockaddr_in sin;
+
+        /* Number of NIs using the listening socket. */
+        int ni_count;
+    } tcp;
+#endif
 };
 
 typedef struct iface iface_t;
@@ -312,17 +312,17 @@ static int init_rdma_srq(ni_t *ni)
     return PTL_OK;
 }
 
-static int ni_rcqp_cleanup(ni_t *ni)
+static int ni_rcqp_cleanup(ni_t *ni, struct ibv_cq *cq)
 {
     struct ibv_wc wc;
     int n;
     buf_t *buf;
 
-    if (!ni->rdma.cq)
+    if (!cq)
         return PTL_OK;
 
     while (1) {
-        n = ibv_poll_cq(ni->rdma.cq, 1, &wc);
+        n = ibv_poll_cq(cq, 1, &wc);
         if (n < 0)
             WARN();
 
@@ -358,6 +358,7 @@ static int ni_rcqp_cleanup(ni_t *ni)
 void cleanup_rdma(ni_t *ni)
 {
     buf_t *buf;
+    int i;
 
     EVL_WATCH(ev_io_stop(evl.loop, &ni->rdma.async_watcher));
 
@@ -370,16 +371,20 @@ void cleanup_rdma(ni_t *ni)
         ni->rdma.srq = NULL;
     }
 
-    ni_rcqp_cleanup(ni);
+    if (ni->rdma.cqs) {
+        for (i = 0; i < ni->rdma.num_cqs; i++) {
+            ni_rcqp_cleanup(ni, ni->rdma.cqs[i].cq);
 
-    if (ni->rdma.cq) {
-        ibv_destroy_cq(ni->rdma.cq);
-        ni->rdma.cq = NULL;
-    }
+            if (ni->rdma.cqs[i].cq)
+                ibv_destroy_cq(ni->rdma.cqs[i].cq);
+
+            if (ni->rdma.cqs[i].ch)
+                ibv_destroy_comp_channel(ni->rdma.cqs[i].ch);
+        }
 
-    if (ni->rdma.ch) {
-        ibv_destroy_comp_channel(ni->rdma.ch);
-        ni->rdma.ch = NULL;
+        free(ni->rdma.cqs);
+        ni->rdma.cqs = NULL;
+        ni->rdma.num_cqs = 0;
     }
 
     /* Release the buffers still on the send_list and recv_list. */
@@ -402,6 +407,8 @@ static int init_rdma(iface_t *iface, ni_t *ni)
 {
     int err;
     int cqe;
+    int num_cqs;
+    int i;
 
     ni->id.phys.nid = addr_to_nid(&iface->sin);
 
@@ -429,32 +436,49 @@ static int init_rdma(iface_t *iface, ni_t *ni)
         ptl_info("set iface pid(1) = %x\n", iface->id.phys.pid);
     }
 
-    /* Create CC, CQ, SRQ. */
-    ni->rdma.ch = ibv_create_comp_channel(iface->ibv_context);
-    if (!ni->rdma.ch) {
-        ptl_warn("unable to create comp channel\n");
+    /* Create a CC and a CQ for each progress thread. The PPE has a
+     * single progress thread for all the NIs. */
+#if IS_PPE
+    num_cqs = 1;
+#else
+    num_cqs = get_param(PTL_PROGRESS_THREADS);
+#endif
+    ni->rdma.cqs = calloc(num_cqs, sizeof(*ni->rdma.cqs));
+    if (!ni->rdma.cqs) {
         WARN();
         goto err1;
     }
+    ni->rdma.num_cqs = num_cqs;
+    atomic_set(&ni->rdma.next_cq, 0);
 
     /* TODO: this is not enough, but we don't know the number of ranks yet. */
     cqe = ni->iface->cap.max_send_wr * 10 + ni->iface->cap.max_srq_wr + 10;
     if (cqe > ni->iface->cap.device_attr.max_cqe)
         cqe = ni->iface->cap.device_attr.max_cqe;
 
-    ni->rdma.cq = ibv_create_cq(iface->ibv_context, cqe, ni, ni->rdma.ch, 0);
-    if (!ni->rdma.cq) {
-        WARN();
-        ptl_warn("unable to create cq\n");
-        WARN();
-        goto err1;
-    }
+    for (i = 0; i < num_cqs; i++) {
+        ni->rdma.cqs[i].ch = ibv_create_comp_channel(iface->ibv_context);
+        if (!ni->rdma.cqs[i].ch) {
+            ptl_warn("unable to create comp channel\n");
+            WARN();
+            goto err1;
+        }
 
-    err = ibv_req_notify_cq(ni->rdma.cq, 0);
-    if (err) {
-        ptl_warn("unable to req notify\n");
-        WARN();
-        goto err1;
+        ni->rdma.cqs[i].cq =
+            ibv_create_cq(iface->ibv_context, cqe, ni, ni->rdma.cqs[i].ch, 0);
+        if (!ni->rdma.cqs[i].cq) {
+            WARN();
+            ptl_warn("unable to create cq\n");
+            WARN();
+            goto err1;
+        }
+
+        err = ibv_req_notify_cq(ni->rdma.cqs[i].cq, 0);
+        if (err) {
+            ptl_warn("unable to req notify\n");
+            WARN();
+            goto err1;
+        }
     }
 
     return PTL_OK;
@@ -0,0 +1,205 @@
+/**
+ * @file ptl_iface_tcp.c
+ *
+ * @brief Interface support for TCP transport.
+ */
+#include "ptl_loc.h"
+
+/**
+ * @brief Get an IPv4 address from network device name (e.g. eth0).
+ *
+ * Returns INADDR_ANY on error or if address is not assigned.
+ *
+ * @param[in] ifname The network interface name to use
+ *
+ * @return IPV4 address as an in_addr_t in network byte order
+ */
+static in_addr_t get_ip_address(const char *ifname)
+{
+    int fd;
+    struct ifreq devinfo;
+    struct sockaddr_in *sin = (struct sockaddr_in *)&devinfo.ifr_addr;
+    in_addr_t addr;
+
+    fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (fd < 0)
+        return INADDR_ANY;
+
+    strncpy(devinfo.ifr_name, ifname, IFNAMSIZ);
+
+    if (ioctl(fd, SIOCGIFADDR, &devinfo) == 0)
+        addr = sin->sin_addr.s_addr;
+    else
+        addr = INADDR_ANY;
+
+    close(fd);
+
+    return addr;
+}
+
+/**
+ * @brief Initialize interface.
+ *
+ * @param[in] iface The iface to init
+ *
+ * @return status
+ */
+int init_iface_tcp(iface_t *iface)
+{
+    int err;
+    in_addr_t addr;
+
+    /* check to see if interface is already initialized. */
+    if (iface->tcp.listen_s != -1)
+        return PTL_OK;
+
+    /* check to see if interface has a valid IPV4 address */
+    addr = get_ip_address(iface->ifname);
+    if (addr == INADDR_ANY) {
+        ptl_warn
+            ("interface %d doesn't exist or doesn't have an IPv4 address\n",
+             iface->iface_id);
+        err = PTL_FAIL;
+        goto err1;
+    }
+
+    iface->tcp.sin.sin_family = AF_INET;
+    iface->tcp.sin.sin_addr.s_addr = addr;
+
+    return PTL_OK;
+
+  err1:
+    cleanup_iface(iface);
+    return err;
+}
+
+/**
+ * @brief Create the listening socket of an interface.
+ *
+ * The port is the PID requested for the NI, or any port if no PID was
+ * given. The PID of the interface is the port the socket is bound to.
+ *
+ * @param[in] iface The iface to listen on
+ * @param[in] ni The NI being initialized
+ *
+ * @return status
+ */
+static int iface_listen_tcp(iface_t *iface, ni_t *ni)
+{
+    int s;
+    int on = 1;
+    int flags;
+    struct sockaddr_in addr;
+    socklen_t addrlen = sizeof(addr);
+
+    s = socket(AF_INET, SOCK_STREAM, 0);
+    if (s == -1) {
+        ptl_warn("Failed to create socket\n");
+        return PTL_FAIL;
+    }
+
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    addr = iface->tcp.sin;
+    addr.sin_port = pid_to_port(ni->id.phys.pid);
+
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        ptl_warn("unable to bind to local address:port %x:%d (errno=%d)\n",
+                 addr.sin_addr.s_addr, ntohs(addr.sin_port), errno);
+        goto error;
+    }
+
+    if (listen(s, SOMAXCONN) == -1) {
+        WARN();
+        goto error;
+    }
+
+    flags = fcntl(s, F_GETFL);
+    if (fcntl(s, F_SETFL, flags | O_NONBLOCK) == -1) {
+        ptl_warn("cannot set listening socket to non blocking\n");
+        goto error;
+    }
+
+    if (getsockname(s, (struct sockaddr *)&addr, &addrlen) == -1) {
+        WARN();
+        goto error;
+    }
+
+    iface->tcp.sin.sin_port = addr.sin_port;
+    iface->tcp.listen_s = s;
+    iface->id.phys.pid = port_to_pid(addr.sin_port);
+
+    ptl_info("TCP listening on %s:%d\n", inet_ntoa(addr.sin_addr),
+             ntohs(addr.sin_port));
+
+    return PTL_OK;
+
+  error:
+    close(s);
+    return PTL_FAIL;
+}
+
+int PtlNIInit_tcp(gbl_t *gbl, ni_t *ni)
+{
+    int err;
+    iface_t *iface = ni->iface;
+
+    ni->id.phys.nid = addr_to_nid(&iface->tcp.sin);
+
+    if (iface->id.phys.nid == PTL_NID_ANY) {
+        iface->id.phys.nid = ni->id.phys.nid;
+    } else if (iface->id.phys.nid != ni->id.phys.nid) {
+        WARN();
+        return PTL_FAIL;
+    }
+
+    ptl_info("setting ni->id.phys.nid = %x\n", ni->id.phys.nid);
+
+    /* The first NI of the interface creates the listening
+     * socket. All the NIs accept connections on it. */
+    if (iface->tcp.listen_s == -1) {
+        err = iface_listen_tcp(iface, ni);
+        if (err)
+            return err;
+    }
+
+    if ((ni->options & PTL_NI_PHYSICAL) && (ni->id.phys.pid == PTL_PID_ANY)) {
+        /* No well known PID was given. Retrieve the pid given by
+         * bind. */
+        ni->id.phys.pid = iface->id.phys.pid;
+        ptl_info("set iface pid(1) = %x\n", iface->id.phys.pid);
+    }
+
+    ni->tcp.zerocopy_min = get_param(PTL_TCP_ZEROCOPY);
+
+    err = tcp_init_sockets(ni);
+    if (err)
+        goto error;
+
+    iface->tcp.ni_count++;
+
+    return PTL_OK;
+
+  error:
+    if (iface->tcp.ni_count == 0) {
+        close(iface->tcp.listen_s);
+        iface->tcp.listen_s = -1;
+    }
+    return err;
+}
+
+void cleanup_tcp(ni_t *ni)
+{
+    iface_t *iface = ni->iface;
+
+    if (ni->tcp.epfd == -1)
+        return;
+
+    tcp_fini_sockets(ni);
+
+    iface->tcp.ni_count--;
+    if (iface->tcp.ni_count <= 0 && iface->tcp.listen_s != -1) {
+        close(iface->tcp.listen_s);
+        iface->tcp.listen_s = -1;
+    }
+}
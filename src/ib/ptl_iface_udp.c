@@ -37,6 +37,96 @@ static in_addr_t get_ip_address(const char *ifname)
     return addr;
 }
 
+#if defined(UDP_SEGMENT) && !WITH_RUDP
+/**
+ * @brief Get the MTU of a network device.
+ *
+ * @param[in] ifname The network interface name to use
+ *
+ * @return the MTU, or 0 on error
+ */
+static int get_mtu(const char *ifname)
+{
+    int fd;
+    struct ifreq devinfo;
+    int mtu;
+
+    fd = socket(PF_INET, SOCK_DGRAM, IPPROTO_IP);
+    if (fd < 0)
+        return 0;
+
+    strncpy(devinfo.ifr_name, ifname, IFNAMSIZ);
+
+    if (ioctl(fd, SIOCGIFMTU, &devinfo) == 0)
+        mtu = devinfo.ifr_mtu;
+    else
+        mtu = 0;
+
+    close(fd);
+
+    return mtu;
+}
+#endif
+
+/**
+ * @brief Find out the datagram sizes of the socket of an interface.
+ *
+ * Segmentation offload is used if the kernel supports UDP_SEGMENT,
+ * and if the MTU lets at least two datagrams fit in a send. Receive
+ * offload is enabled if the kernel supports UDP_GRO.
+ *
+ * @param[in] iface The iface of the socket
+ * @param[in] fd The socket
+ */
+static void init_offload_udp(iface_t *iface, int fd)
+{
+    int sndbuf;
+    socklen_t len = sizeof(sndbuf);
+
+    //65507 is the max IPv4 UDP message size (65536 - 8 byte UDP header - 20 byte IP header)
+    //Send buffers can sometimes exceed this size, so we need to cap the max packet size
+    iface->udp.max_msg = 1488;
+    if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0)
+        iface->udp.max_msg = sndbuf;
+    if (iface->udp.max_msg > UDP_MAX_DATAGRAM)
+        iface->udp.max_msg = UDP_MAX_DATAGRAM;
+
+    iface->udp.gso_size = 0;
+
+    if (!get_param(PTL_UDP_OFFLOAD))
+        return;
+
+#if defined(UDP_SEGMENT) && !WITH_RUDP
+    /* Reliable UDP sequences every datagram, so it sends them one by
+     * one. */
+    {
+        int mtu = get_mtu(iface->ifname);
+        int seg = mtu - sizeof(struct iphdr) - sizeof(struct udphdr);
+        int off = 0;
+
+        /* Check that the kernel knows the option, without leaving
+         * it set; it is given with each send instead. */
+        if (seg > 0 && seg <= iface->udp.max_msg / 2 &&
+            setsockopt(fd, SOL_UDP, UDP_SEGMENT, &seg, sizeof(seg)) == 0) {
+            setsockopt(fd, SOL_UDP, UDP_SEGMENT, &off, sizeof(off));
+            iface->udp.gso_size = seg;
+        }
+    }
+#endif
+
+#ifdef UDP_GRO
+    {
+        int on = 1;
+
+        if (setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == -1)
+            ptl_info("UDP receive offload not available\n");
+    }
+#endif
+
+    ptl_info("max udp message size is: %i, segment size: %i\n",
+             iface->udp.max_msg, iface->udp.gso_size);
+}
+
 /**
  * @brief Initialize interface.
  *
@@ -86,6 +176,10 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
     //if already initialized
     if (ni->id.phys.pid == (port_to_pid(ni->iface->udp.sin.sin_port))) {
         ptl_warn("attempting to re-initialize the interface \n");
+        err = udp_init_recv(ni);
+        if (err)
+            return err;
+
         ni->udp.dest_addr = &iface->udp.sin;
         ni->id.phys.nid = iface->id.phys.nid;
         ni->udp.s = ni->iface->udp.connect_s;
@@ -161,6 +255,20 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
     ni->iface->udp.sin.sin_port = htons(port);
     ni->iface->udp.connect_s = ni->udp.s;
 
+    init_offload_udp(iface, ni->udp.s);
+
+    err = udp_init_recv(ni);
+    if (err)
+        goto error;
+
+#if WITH_RUDP
+    ni->iface->udp.rudp = rudp_create(ni->udp.s);
+    if (!ni->iface->udp.rudp) {
+        err = PTL_NO_SPACE;
+        goto error;
+    }
+#endif
+
     //set NI pid and nid
     ni->id.phys.pid = port_to_pid(ni->iface->udp.sin.sin_port);
     ni->id.phys.nid = addr_to_nid((struct sockaddr_in *)&ni->iface->udp.sin);
@@ -192,10 +300,6 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
     //bounce_head_offset = ni->udp.comm_pad_size;
     //ni->udp.comm_pad_size += ROUND_UP(sizeof(struct udp_bounce_head), pagesize);
 
-    atomic_set(&ni->udp.self_recv, 0);
-    ni->udp.self_recv_addr = NULL;
-    ni->udp.self_recv_len = 0;
-
     ni->udp.udp_buf.buf_size = get_param(PTL_BOUNCE_BUF_SIZE);
     ni->udp.udp_buf.num_bufs = get_param(PTL_BOUNCE_NUM_BUFS);
 
@@ -207,6 +311,7 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
     return PTL_OK;
 
   error:
+    udp_fini_recv(ni);
     if (ni->udp.s != -1) {
         close(ni->udp.s);
         ni->udp.s = -1;
@@ -216,11 +321,16 @@ int PtlNIInit_UDP(gbl_t *gbl, ni_t *ni)
 
 void cleanup_udp(ni_t *ni)
 {
+    udp_fini_recv(ni);
 
     ni->iface->udp.ni_count--;
     if (ni->iface->udp.ni_count <= 0) {
         //remove address information
         ni->udp.dest_addr = NULL;
+#if WITH_RUDP
+        rudp_destroy(ni->iface->udp.rudp);
+        ni->iface->udp.rudp = NULL;
+#endif
         //close the socket
         close(ni->udp.s);
     }
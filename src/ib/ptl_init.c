@@ -490,6 +490,9 @@ static int send_req(buf_t *buf)
         list_add_tail(&buf->list, &ni->shmem.noknem_list);
         PTL_FASTLOCK_UNLOCK(&ni->shmem.noknem_lock);
 
+        /* The first progress thread handles the list. */
+        progress_thread_wakeup(ni, 0);
+
         if (buf->data_in && buf->data_in->data_fmt == DATA_FMT_NOKNEM)
             state = STATE_INIT_COPY_IN;
         else
@@ -544,90 +547,60 @@ static int send_error(buf_t *buf)
 static int init_copy_in(buf_t *buf)
 {
     struct noknem *noknem = buf->transfer.noknem.noknem;
-    ptl_size_t to_copy;
+    int target_done;
     int ret;
 
-    /* Copy the data from the bounce buffer. */
-    to_copy = noknem->length;
-
-    /* Target should never send more than requested. */
-    assert(to_copy <= buf->transfer.noknem.length_left);
+    /* The target is done once it has filled its last slot, so read
+     * the flag first and then drain the ring. */
+    target_done = noknem->target_done;
+    __sync_synchronize();
 
-    ret =
-        iov_copy_in(buf->transfer.noknem.data, buf->transfer.noknem.iovecs,
-                    NULL, buf->transfer.noknem.num_iovecs,
-                    buf->transfer.noknem.offset, to_copy);
+    /* Copy the data from the bounce ring. The target never sends
+     * more than requested. */
+    ret = noknem_copy(buf, &buf->transfer.noknem.length_left);
     if (ret == PTL_FAIL) {
         WARN();
         return STATE_INIT_ERROR;
     }
 
-    if (noknem->target_done)
+    if (target_done)
         return STATE_INIT_COPY_DONE;
 
-    buf->transfer.noknem.length_left -= to_copy;
-    buf->transfer.noknem.offset += to_copy;
-
-    /* Tell the target the data is ready. */
-    __sync_synchronize();
-    noknem->state = 2;
-
     return STATE_INIT_COPY_IN;
 }
 
 static int init_copy_out(buf_t *buf)
 {
     struct noknem *noknem = buf->transfer.noknem.noknem;
-    ptl_size_t to_copy;
     int ret;
 
     if (noknem->target_done)
         return STATE_INIT_COPY_DONE;
 
-    noknem->state = 1;
-
-    /* Copy the data to the bounce buffer. */
-    to_copy = buf->transfer.noknem.data_length;
-    if (to_copy > buf->transfer.noknem.length_left)
-        to_copy = buf->transfer.noknem.length_left;
-
-    ret =
-        iov_copy_out(buf->transfer.noknem.data, buf->transfer.noknem.iovecs,
-                     NULL, buf->transfer.noknem.num_iovecs,
-                     buf->transfer.noknem.offset, to_copy);
+    /* Copy the data to the free slots of the bounce ring. */
+    ret = noknem_copy(buf, &buf->transfer.noknem.length_left);
     if (ret == PTL_FAIL) {
         WARN();
         return STATE_INIT_ERROR;
     }
 
-    buf->transfer.noknem.length_left -= to_copy;
-    buf->transfer.noknem.offset += to_copy;
-
-    noknem->length = to_copy;
-
-    /* Tell the target the data is ready. */
-    __sync_synchronize();
-    noknem->state = 2;
-
     return STATE_INIT_COPY_OUT;
 }
 
 static int init_copy_done(buf_t *buf)
 {
-    ni_t *ni = obj_to_ni(buf);
     struct noknem *noknem = buf->transfer.noknem.noknem;
 
     /* Ack. */
-    noknem->init_done = 1;
     __sync_synchronize();
-    noknem->state = 2;
+    noknem->init_done = 1;
 
     /* Free the bounce buffer allocated in init_append_data. */
     if (buf->transfer.noknem.data)
-        ll_enqueue_obj_alien(&ni->shmem.bounce_buf.head->free_list,
+        ll_enqueue_obj_alien(&buf->transfer.noknem.bounce_head->free_list,
                              buf->transfer.noknem.data,
-                             ni->shmem.bounce_buf.head,
-                             ni->shmem.bounce_buf.head->head_index0);
+                             buf->transfer.noknem.bounce_head,
+                             buf->transfer.noknem.bounce_head->head_index0);
 
     /* Only called from the progress thread, so ni->shmem.noknem_lock is
      * already locked. */
@@ -1153,9 +1126,6 @@ static void cleanup(buf_t *buf)
     }
 #if WITH_TRANSPORT_UDP
     //TODO: check the source of these memory leaks
-    //ni_t * ni = obj_to_ni(buf);
-    //if (atomic_read(&ni->udp.self_recv) > 0)
-    //   return;
 //      if (atomic_read(&buf->conn->obj.obj_ref.ref_cnt) < 1)
 #endif
 
@@ -1264,18 +1234,6 @@ int process_init(buf_t *buf)
                 state = STATE_INIT_CLEANUP;
                 break;
             case STATE_INIT_CLEANUP:
-#if WITH_TRANSPORT_UDP
-                if (buf->conn->transport.type == CONN_TYPE_UDP) {
-                    pthread_mutex_unlock(&buf->mutex);
-                    ni_t *ni;
-                    ni = obj_to_ni(buf);
-                    while (atomic_read(&ni->udp.self_recv) > 0) {
-                        sched_yield();
-                        SPINLOCK_BODY();
-                    }
-                    pthread_mutex_lock(&buf->mutex);
-                }
-#endif
                 cleanup(buf);
                 buf->init_state = STATE_INIT_DONE;
                 pthread_mutex_unlock(&buf->mutex);
@@ -78,6 +78,58 @@ void le_post_unlink_event(le_t *le)
         le->do_auto_free = 1;
 }
 
+/**
+ * @brief Unlink an entry from its PT list, with the PT lock held.
+ *
+ * The reference held by the PT list is not dropped, since that could
+ * free the entry. The caller must call le_unlink_put() once the lock
+ * is released if the entry was unlinked.
+ *
+ * @param[in] le The LE object to unlink.
+ * @param[in] auto_event A flag indicating if an auto unlink event
+ * should be generated.
+ *
+ * @return 1 if the entry was unlinked, 0 if it already was.
+ */
+int le_unlink_locked(le_t *le, int auto_event)
+{
+    pt_t *pt = le->pt;
+
+    /* Avoid a race between PTLMeUnlink and autounlink. */
+    if (!pt)
+        return 0;
+
+    if (le->ptl_list == PTL_PRIORITY_LIST)
+        pt->priority_size--;
+    else if (le->ptl_list == PTL_OVERFLOW_LIST)
+        pt->overflow_size--;
+    list_del_init(&le->list);
+
+    if (le->type == TYPE_ME)
+        pt_match_index_del(pt, (me_t *)le);
+
+    if (auto_event)
+        le_post_unlink_event(le);
+
+    le->pt = NULL;
+
+    return 1;
+}
+
+/**
+ * @brief Remove the reference held by the PT list of an entry
+ * unlinked with le_unlink_locked().
+ *
+ * @param[in] le The LE object unlinked.
+ */
+void le_unlink_put(le_t *le)
+{
+    if (le->type == TYPE_ME)
+        me_put((me_t *)le);
+    else
+        le_put(le);
+}
+
 /**
  * @brief Unlink an entry from a PT list and remove
  * the reference held by the PT list.
@@ -92,27 +144,10 @@ void le_unlink(le_t *le, int auto_event)
 
     if (pt) {
         PTL_FASTLOCK_LOCK(&pt->lock);
-
-        /* Avoid a race between PTLMeUnlink and autounlink. */
-        if (le->pt) {
-            if (le->ptl_list == PTL_PRIORITY_LIST)
-                pt->priority_size--;
-            else if (le->ptl_list == PTL_OVERFLOW_LIST)
-                pt->overflow_size--;
-            list_del_init(&le->list);
-
-            if (auto_event)
-                le_post_unlink_event(le);
-
-            le->pt = NULL;
-        }
-
+        le_unlink_locked(le, auto_event);
         PTL_FASTLOCK_UNLOCK(&pt->lock);
 
-        if (le->type == TYPE_ME)
-            me_put((me_t *)le);
-        else
-            le_put(le);
+        le_unlink_put(le);
     }
 }
 
@@ -262,6 +297,9 @@ int le_append_pt(ni_t *ni, le_t *le)
         list_add_tail(&le->list, &pt->overflow_list);
     }
 
+    if (le->type == TYPE_ME)
+        pt_match_index_add(pt, (me_t *)le);
+
     if (le->eq && !(le->options & PTL_LE_EVENT_LINK_DISABLE))
         make_le_event(le, le->eq, PTL_EVENT_LINK, PTL_NI_OK);
 
@@ -282,14 +320,34 @@ static void __match_le_unexpected(const le_t *le,
 {
     ni_t *ni = obj_to_ni(le);
     pt_t *pt = &ni->pt[le->pt_index];
+    struct list_head *bucket;
     buf_t *buf;
     buf_t *n;
 
     INIT_LIST_HEAD(buf_list);
 
+    /* An ME without wildcards can only match the messages in
+     * one bucket of the unexpected index. */
+    bucket = pt_unexpected_bucket(pt, le);
+    if (bucket) {
+        list_for_each_entry_safe(buf, n, bucket, unexpected_match_list) {
+            if (check_match(buf, (me_t *)le)) {
+                pt_unexpected_del(pt, buf);
+                list_del(&buf->unexpected_list);
+                list_add_tail(&buf->unexpected_list, buf_list);
+
+                if (le->options & PTL_LE_USE_ONCE)
+                    break;
+            }
+        }
+
+        return;
+    }
+
     list_for_each_entry_safe(buf, n, &pt->unexpected_list, unexpected_list) {
 
         if ((le->type == TYPE_LE || check_match(buf, (me_t *)le))){
+            pt_unexpected_del(pt, buf);
             list_del(&buf->unexpected_list);
             list_add_tail(&buf->unexpected_list, buf_list);
 
@@ -394,25 +452,42 @@ int check_overflow_search_only(le_t *le)
 {
     ni_t *ni = obj_to_ni(le);
     pt_t *pt = &ni->pt[le->pt_index];
+    struct list_head *bucket;
     buf_t *buf;
-    buf_t *n;
     int found = 0;
     PTL_FASTLOCK_LOCK(&pt->lock);
     ptl_event_t event[atomic_read(&pt->unexpected_size)];
 
-    list_for_each_entry_safe(buf, n, &pt->unexpected_list, unexpected_list) {
+    bucket = pt_unexpected_bucket(pt, le);
+    if (bucket) {
+        list_for_each_entry(buf, bucket, unexpected_match_list) {
+            if (check_match(buf, (me_t *)le)) {
+                if (le->eq && !(le->options & PTL_LE_EVENT_COMM_DISABLE)) {
+                    buf->matching_list = PTL_OVERFLOW_LIST;
+                    fill_target_event(buf, PTL_EVENT_SEARCH, le->user_ptr,
+                                      NULL, &event[found]);
+                }
 
-        if ((le->type == TYPE_LE || check_match(buf, (me_t *)le))) {
-            if (le->eq && !(le->options & PTL_LE_EVENT_COMM_DISABLE)) {
-                buf->matching_list = PTL_OVERFLOW_LIST;
-                fill_target_event(buf, PTL_EVENT_SEARCH, le->user_ptr, NULL,
-                                  &event[found]);
+                found++;
+                if (le->options & PTL_LE_USE_ONCE)
+                    break;
             }
+        }
+    } else {
+        list_for_each_entry(buf, &pt->unexpected_list, unexpected_list) {
 
-            found++;
-            if (le->options & PTL_LE_USE_ONCE)
-                break;
+            if ((le->type == TYPE_LE || check_match(buf, (me_t *)le))) {
+                if (le->eq && !(le->options & PTL_LE_EVENT_COMM_DISABLE)) {
+                    buf->matching_list = PTL_OVERFLOW_LIST;
+                    fill_target_event(buf, PTL_EVENT_SEARCH, le->user_ptr,
+                                      NULL, &event[found]);
+                }
+
+                found++;
+                if (le->options & PTL_LE_USE_ONCE)
+                    break;
 
+            }
         }
     }
 
@@ -71,6 +71,8 @@ int le_append_pt(ni_t *ni, le_t *le);
 
 void le_post_unlink_event(le_t *le);
 void le_unlink(le_t *le, int send_event);
+int le_unlink_locked(le_t *le, int send_event);
+void le_unlink_put(le_t *le);
 
 int le_append_check(int type, ni_t *ni, ptl_pt_index_t pt_index,
                     const ptl_le_t *le_init, ptl_list_t ptl_list,
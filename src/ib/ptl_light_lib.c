@@ -1662,6 +1662,73 @@ int PtlEQPoll(const ptl_handle_eq_t * eq_handles, unsigned int size,
     return err;
 }
 
+int PtlEQGetBatch(ptl_handle_eq_t eq_handle, ptl_event_t *events,
+                  unsigned int max, unsigned int *count)
+{
+    const struct light_eq *eq;
+    int err;
+
+#ifndef NO_ARG_VALIDATION
+    if (!ppe.ppe_comm_pad)
+        return PTL_NO_INIT;
+
+    if (max == 0)
+        return PTL_ARG_INVALID;
+#endif
+
+    eq = get_light_eq(eq_handle);
+    if (eq) {
+        err = PtlEQGetBatch_work(eq->eqe_list, events, max, count);
+    } else {
+        err = PTL_ARG_INVALID;
+    }
+
+    return err;
+}
+
+int PtlEQPollBatch(const ptl_handle_eq_t * eq_handles, unsigned int size,
+                   ptl_time_t timeout, ptl_event_t *events, unsigned int max,
+                   unsigned int *count, unsigned int *which)
+{
+    int err;
+    int i;
+    struct eqe_list **eqes_list = NULL;
+
+#ifndef NO_ARG_VALIDATION
+    if (!ppe.ppe_comm_pad)
+        return PTL_NO_INIT;
+#endif
+
+    if (size == 0 || max == 0) {
+        err = PTL_ARG_INVALID;
+        goto done;
+    }
+
+    eqes_list = malloc(size * sizeof(struct eqe_list *));
+    if (!eqes_list) {
+        err = PTL_NO_SPACE;
+        goto done;
+    }
+
+    for (i = 0; i < size; i++) {
+        struct light_eq *eq = get_light_eq(eq_handles[i]);
+        if (!eq) {
+            err = PTL_ARG_INVALID;
+            goto done;
+        }
+        eqes_list[i] = eq->eqe_list;
+    }
+
+    err = PtlEQPollBatch_work(eqes_list, size, timeout, events, max, count,
+                              which);
+
+  done:
+    if (eqes_list)
+        free(eqes_list);
+
+    return err;
+}
+
 int PtlTriggeredPut(ptl_handle_md_t md_handle, ptl_size_t local_offset,
                     ptl_size_t length, ptl_ack_req_t ack_req,
                     ptl_process_t target_id, ptl_pt_index_t pt_index,
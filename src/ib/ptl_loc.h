@@ -16,6 +16,7 @@
 #include <net/if.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <netinet/udp.h>
 #include <pthread.h>
 #include <sched.h>
 #include <stddef.h>
@@ -43,6 +44,12 @@
 
 #include "tree.h"
 
+/* Without KNEM, large shared memory transfers can be done in a single
+ * copy with Cross Memory Attach. */
+#if WITH_TRANSPORT_SHMEM && !USE_KNEM && HAVE_PROCESS_VM_READV
+#define USE_CMA 1
+#endif
+
 #if WITH_TRANSPORT_IB
 #include <rdma/rdma_cma.h>
 #include <infiniband/verbs.h>
@@ -57,6 +64,7 @@
 #include "ptl_sync.h"
 #include "ptl_ref.h"
 #include "ptl_atomic.h"
+#include "ptl_atomic_simd.h"
 #include "ptl_param.h"
 #include "ptl_evloop.h"
 #include "ptl_pool.h"
@@ -76,9 +84,9 @@
 #include "ptl_le.h"
 #include "ptl_me.h"
 #include "ptl_ct.h"
+#include "ptl_hdr.h"
 #include "ptl_buf.h"
 #include "ptl_eq.h"
-#include "ptl_hdr.h"
 #include "ptl_misc.h"
 #include "ptl_knem.h"
 
@@ -200,6 +208,7 @@ extern struct transport_ops transport_local_shmem;
 extern struct transport_ops transport_local_ppe;
 extern struct transport_ops transport_remote_rdma;
 extern struct transport_ops transport_remote_udp;
+extern struct transport_ops transport_remote_tcp;
 
 /* Functions for intra and inter nodes transport (ie. IB or UDP). There can be
  * only one instance of it in the library; which also means there can
@@ -234,6 +243,16 @@ int check_match(buf_t *buf, const me_t *me);
 
 int check_perm(buf_t *buf, const le_t *le);
 
+void ni_bundle_start(ni_t *ni);
+
+void ni_bundle_end(ni_t *ni);
+
+int ni_bundle_add(ni_t *ni, buf_t *buf);
+
+void ni_bundle_flush(ni_t *ni);
+
+void ni_shrink_pools(ni_t *ni);
+
 /* IB transport. */
 int PtlNIInit_rdma(gbl_t *gbl, ni_t *ni);
 void cleanup_rdma(ni_t *ni);
@@ -242,10 +261,11 @@ void initiate_disconnect_all(ni_t *ni);
 
 #if WITH_TRANSPORT_IB
 void disconnect_conn_locked(conn_t *conn);
-void progress_thread_rdma(ni_t *ni);
+int progress_thread_rdma(ni_t *ni, int shard);
 #else
-static inline void progress_thread_rdma(ni_t *ni)
+static inline int progress_thread_rdma(ni_t *ni, int shard)
 {
+    return 0;
 }
 #endif
 
@@ -253,9 +273,14 @@ static inline void progress_thread_rdma(ni_t *ni)
 int PtlSetMap_mem(ni_t *ni, ptl_size_t map_size,
                   const ptl_process_t *mapping);
 void shmem_enqueue(ni_t *ni, buf_t *buf, ptl_pid_t dest);
-buf_t *shmem_dequeue(ni_t *ni);
+buf_t *shmem_dequeue(ni_t *ni, int shard);
+int shmem_wait_prepare(ni_t *ni, int shard);
 void process_recv_mem(ni_t *ni, buf_t *buf);
 int mem_do_transfer(buf_t *buf);
+#if WITH_TRANSPORT_SHMEM && !USE_KNEM
+int noknem_copy(buf_t *buf, ptl_size_t *length);
+int noknem_ready(buf_t *buf);
+#endif
 
 #if WITH_TRANSPORT_SHMEM || IS_PPE
 ptl_size_t copy_mem_to_mem(ni_t *ni, data_dir_t dir,
@@ -273,12 +298,42 @@ void PtlSetMap_udp(ni_t *ni, ptl_size_t map_size,
                    const ptl_process_t *mapping);
 void disconnect_conn_locked(conn_t *conn);
 void udp_send(ni_t *ni, buf_t *buf, struct sockaddr_in *dest);
+ssize_t udp_send_hdr(ni_t *ni, buf_t *buf, struct sockaddr_in *dest);
+void udp_send_start(ni_t *ni);
+void udp_send_flush(ni_t *ni);
 buf_t *udp_receive(ni_t *ni);
+int udp_init_recv(ni_t *ni);
+void udp_fini_recv(ni_t *ni);
+int udp_recv_pending(ni_t *ni);
+
+int udp_wait_fd(ni_t *ni);
+#if WITH_RUDP
+struct rudp *rudp_create(int sockfd);
+void rudp_destroy(struct rudp *rudp);
+void rudp_progress(ni_t *ni);
+int rudp_busy(ni_t *ni);
+#endif
 void process_recv_udp(ni_t *ni, buf_t *buf);
-void progress_thread_udp(ni_t *ni);
+int progress_thread_udp(ni_t *ni);
+#else
+static inline int progress_thread_udp(ni_t *ni)
+{
+    return 0;
+}
+#endif
+
+/* TCP transport. */
+#if WITH_TRANSPORT_TCP
+int init_iface_tcp(iface_t *iface);
+int PtlNIInit_tcp(gbl_t *gbl, ni_t *ni);
+void cleanup_tcp(ni_t *ni);
+int tcp_init_sockets(ni_t *ni);
+void tcp_fini_sockets(ni_t *ni);
+int progress_thread_tcp(ni_t *ni);
 #else
-static inline void progress_thread_udp(ni_t *ni)
+static inline int progress_thread_tcp(ni_t *ni)
 {
+    return 0;
 }
 #endif
 
@@ -302,13 +357,22 @@ static inline void stop_progress_thread(ni_t *ni)
 {
 }
 
+static inline void progress_thread_wakeup(ni_t *ni, int index)
+{
+}
+
 #else
 
 #define addr_to_ppe(addr,dontcare) (addr)
 
-/* There is a progress thread per NI when the PPE is not used. */
+/* There are PTL_PROGRESS_THREADS progress threads per NI when the PPE
+ * is not used. */
 int start_progress_thread(ni_t *ni);
 void stop_progress_thread(ni_t *ni);
+
+/* Wake up a progress thread blocked waiting for messages. An index of
+ * -1 wakes up all the threads. */
+void progress_thread_wakeup(ni_t *ni, int index);
 #endif
 
 int _PtlInit(gbl_t *gbl);
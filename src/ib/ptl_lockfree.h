@@ -122,6 +122,53 @@ static inline void ll_enqueue_obj_alien(union counted_ptr *free_list,
     } while (tmpv.c16 != oldv.c16);
 }
 
+/**
+ * Add a chain of objects to a freelist at once.
+ *
+ * @param free_list the freelist
+ * @param first the first object of the chain
+ * @param last the last object of the chain, linked to the freelist
+ */
+static inline void ll_enqueue_list(union counted_ptr *free_list,
+                                   void *first, void *last)
+{
+    union counted_ptr oldv, newv, tmpv;
+
+    tmpv.c16 = free_list->c16;
+
+    do {
+        oldv = tmpv;
+        /* first field of obj is the next ptr */
+        *(void **)last = tmpv.head;
+        newv.head = first;
+        newv.counter = oldv.counter + 1;
+        tmpv.c16 = PtlInternalAtomicCas128(&free_list->c16, oldv, newv);
+    } while (tmpv.c16 != oldv.c16);
+}
+
+/**
+ * Take all the objects of a freelist at once.
+ *
+ * @param free_list the freelist
+ *
+ * @return the first object of the chain, or NULL if the list was empty
+ */
+static inline void *ll_dequeue_all(union counted_ptr *free_list)
+{
+    union counted_ptr oldv, newv, tmpv;
+
+    tmpv.c16 = free_list->c16;
+
+    do {
+        oldv = tmpv;
+        newv.head = NULL;
+        newv.counter = oldv.counter + 1;
+        tmpv.c16 = PtlInternalAtomicCas128(&free_list->c16, oldv, newv);
+    } while (tmpv.c16 != oldv.c16);
+
+    return oldv.head;
+}
+
 static inline void ll_init(union counted_ptr *free_list)
 {
     free_list->head = NULL;
@@ -172,6 +219,30 @@ static inline void ll_enqueue_obj_alien(union counted_ptr *free_list,
     PTL_FASTLOCK_UNLOCK(&free_list->lock);
 }
 
+static inline void ll_enqueue_list(union counted_ptr *free_list,
+                                   void *first, void *last)
+{
+    PTL_FASTLOCK_LOCK(&free_list->lock);
+
+    /* first field of obj is the next ptr */
+    *(void **)last = free_list->head;
+    free_list->head = first;
+
+    PTL_FASTLOCK_UNLOCK(&free_list->lock);
+}
+
+static inline void *ll_dequeue_all(union counted_ptr *free_list)
+{
+    void *ret;
+
+    PTL_FASTLOCK_LOCK(&free_list->lock);
+    ret = free_list->head;
+    free_list->head = NULL;
+    PTL_FASTLOCK_UNLOCK(&free_list->lock);
+
+    return ret;
+}
+
 static inline void ll_init(union counted_ptr *free_list)
 {
     free_list->head = NULL;
@@ -39,6 +39,13 @@ void md_cleanup(void *arg)
         md->sge_list_mr = NULL;
     }
 
+#if WITH_TRANSPORT_SHMEM && USE_KNEM
+    if (md->knem_mr) {
+        mr_put(md->knem_mr);
+        md->knem_mr = NULL;
+    }
+#endif
+
     if (md->internal_data) {
         free(md->internal_data);
         md->internal_data = NULL;
@@ -57,6 +57,12 @@ struct md {
     struct mem_iovec *mem_iovecs;
 #endif
 
+#if WITH_TRANSPORT_SHMEM && USE_KNEM
+        /** mr of the last direct transfer from a non iovec md,
+	 * reused with its KNEM cookie by the next ones it covers */
+    mr_t *knem_mr;
+#endif
+
 #if IS_PPE
     struct {
         mr_t *mr_start;         /* mr containing start */
@@ -109,6 +109,7 @@ static int me_append_or_search(PPEGBL ptl_handle_ni_t ni_handle,
     pt = &ni->pt[pt_index];
 
     INIT_LIST_HEAD(&me->list);
+    INIT_LIST_HEAD(&me->match_list);
     me->pt_index = pt_index;
     me->eq = pt->eq;
     me->uid = me_init->uid;
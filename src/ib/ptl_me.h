@@ -22,6 +22,8 @@ struct me {
     uint64_t match_bits;
     uint64_t ignore_bits;
     ptl_process_t id;
+    struct list_head match_list;        /* on a pt match index */
+    uint64_t match_seq;                 /* append order on the pt */
 };
 
 /**
@@ -88,9 +88,16 @@ static ptl_size_t do_mem_copy(buf_t *buf, ptl_size_t rem_len,
             if (len > iov->iov_len - *loc_off)
                 len = iov->iov_len - *loc_off;
 
-            err = mr_lookup_app(obj_to_ni(buf), addr, len, &mr);
-            if (err)
-                break;
+            /* The ME/LE holds an mr for each of its iovecs, with its
+             * KNEM cookie, for as long as it is linked. */
+            if (me->mr_list && me->mr_list[*loc_index]) {
+                mr = me->mr_list[*loc_index];
+                mr_get(mr);
+            } else {
+                err = mr_lookup_app(obj_to_ni(buf), addr, len, &mr);
+                if (err)
+                    break;
+            }
 
             copy_mem_to_mem(ni, dir, iovec, addr, mr, len);
             advance_remote_addr(iovec, len);
@@ -119,9 +126,15 @@ static ptl_size_t do_mem_copy(buf_t *buf, ptl_size_t rem_len,
 
             addr = me->start + *loc_off;
 
-            err = mr_lookup_app(ni, addr, len, &mr);
-            if (err)
-                break;
+            /* Same for the whole ME/LE, if it was registered. */
+            if (me->mr_start) {
+                mr = me->mr_start;
+                mr_get(mr);
+            } else {
+                err = mr_lookup_app(ni, addr, len, &mr);
+                if (err)
+                    break;
+            }
 
             copy_mem_to_mem(ni, dir, iovec, addr, mr, len);
             advance_remote_addr(iovec, len);
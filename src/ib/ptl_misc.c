@@ -6,6 +6,11 @@
 
 #include "ptl_loc.h"
 
+#include <sys/syscall.h>
+#ifdef HAVE_LINUX_MEMPOLICY_H
+#include <linux/mempolicy.h>
+#endif
+
 /* Internal debug tuning variables. */
 int debug;
 int ptl_log_level;
@@ -15,10 +20,263 @@ int ptl_disable_ummu;
 unsigned long pagesize;
 unsigned int linesize;
 
+/* PTL_HUGE_PAGES, and the size of a huge page when it is set. */
+int huge_pages;
+unsigned long hugepagesize;
+
 #if !IS_LIGHT_LIB
 struct transports transports;
 #endif
 
+static const char *const huge_mode_names[] = {
+    [HUGE_NONE] = "regular pages",
+    [HUGE_THP] = "transparent huge pages",
+    [HUGE_TLB] = "hugetlb pages",
+};
+
+/* Read the default huge page size of the system. */
+static void huge_init(void)
+{
+    FILE *f;
+    char line[128];
+    unsigned long kb;
+
+    huge_pages = get_param(PTL_HUGE_PAGES);
+    if (!huge_pages)
+        return;
+
+    hugepagesize = 2 * 1024 * 1024;
+
+    f = fopen("/proc/meminfo", "r");
+    if (!f)
+        return;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+            hugepagesize = kb * 1024;
+            break;
+        }
+    }
+
+    fclose(f);
+}
+
+/**
+ * @brief Name of a huge page mode, for reporting.
+ *
+ * @param[in] mode the mode
+ *
+ * @return the name
+ */
+const char *huge_mode_name(enum huge_mode mode)
+{
+    return huge_mode_names[mode];
+}
+
+/**
+ * @brief Allocate memory backed by huge pages if PTL_HUGE_PAGES asks
+ * for them.
+ *
+ * hugetlb pages are tried first if requested, then transparent huge
+ * pages. The memory is page aligned, zero filled, and falls back to
+ * regular pages if neither is available.
+ *
+ * @param[in] size the size to allocate
+ * @param[in] what what the memory is for, for reporting
+ * @param[out] mode_p how the memory is backed, for huge_free()
+ *
+ * @return the memory, or NULL
+ */
+void *huge_alloc(size_t size, const char *what, enum huge_mode *mode_p)
+{
+    enum huge_mode mode = HUGE_NONE;
+    size_t len;
+    void *p;
+
+    if (!huge_pages) {
+        if (posix_memalign(&p, pagesize, size))
+            return NULL;
+
+        memset(p, 0, size);
+        *mode_p = HUGE_NONE;
+        return p;
+    }
+
+    len = ROUND_UP(size, hugepagesize);
+
+    if (huge_pages == 2) {
+        p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            mode = HUGE_TLB;
+            goto done;
+        }
+    }
+
+    if (posix_memalign(&p, hugepagesize, len))
+        return NULL;
+
+    if (madvise(p, len, MADV_HUGEPAGE) == 0)
+        mode = HUGE_THP;
+
+    memset(p, 0, len);
+
+  done:
+    ptl_info("%s: %zu bytes backed by %s\n", what, len,
+             huge_mode_names[mode]);
+
+    *mode_p = mode;
+    return p;
+}
+
+/**
+ * @brief Free memory allocated by huge_alloc().
+ *
+ * @param[in] p the memory
+ * @param[in] size the size given to huge_alloc()
+ * @param[in] mode the mode returned by huge_alloc()
+ */
+void huge_free(void *p, size_t size, enum huge_mode mode)
+{
+    size_t len;
+
+    if (mode == HUGE_TLB) {
+        len = ROUND_UP(size, hugepagesize);
+        munmap(p, len);
+    } else {
+        free(p);
+    }
+}
+
+/**
+ * @brief Number of NUMA nodes of the system.
+ *
+ * @return the number of nodes, 1 if it can't be found
+ */
+int numa_num_nodes(void)
+{
+    DIR *dir;
+    struct dirent *ent;
+    int node;
+    int num_nodes = 1;
+
+    dir = opendir("/sys/devices/system/node");
+    if (!dir)
+        return 1;
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (sscanf(ent->d_name, "node%d", &node) == 1 &&
+            node >= num_nodes)
+            num_nodes = node + 1;
+    }
+
+    closedir(dir);
+
+    return num_nodes;
+}
+
+/**
+ * @brief Return the NUMA node of a CPU.
+ *
+ * @param[in] cpu the CPU
+ *
+ * @return the node, or -1 if it can't be found
+ */
+static int numa_cpu_node(int cpu)
+{
+    DIR *dir;
+    struct dirent *ent;
+    char path[64];
+    int node = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    dir = opendir(path);
+    if (!dir)
+        return -1;
+
+    while ((ent = readdir(dir)) != NULL) {
+        if (sscanf(ent->d_name, "node%d", &node) == 1)
+            break;
+    }
+
+    closedir(dir);
+
+    return ent ? node : -1;
+}
+
+/**
+ * @brief Return the NUMA node the calling thread runs on.
+ *
+ * The node comes from the CPU affinity of the thread, so it is only
+ * known if all its CPUs belong to the same node.
+ *
+ * @return the node, or -1
+ */
+int numa_this_node(void)
+{
+    cpu_set_t set;
+    int cpu;
+    int node = -1;
+
+    if (sched_getaffinity(0, sizeof(set), &set))
+        return -1;
+
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        int n;
+
+        if (!CPU_ISSET(cpu, &set))
+            continue;
+
+        n = numa_cpu_node(cpu);
+        if (n == -1 || (node != -1 && n != node))
+            return -1;
+
+        node = n;
+    }
+
+    return node;
+}
+
+/**
+ * @brief Ask for the pages of a memory range to be placed on a NUMA
+ * node.
+ *
+ * Only the whole pages of the range are bound. The pages already
+ * present are moved if possible. The node is preferred rather than
+ * enforced, so the allocations fall back to the other nodes when it
+ * is full.
+ *
+ * @param[in] addr the start of the range
+ * @param[in] len the length of the range
+ * @param[in] node the node
+ * @param[in] align the size of the pages backing the range
+ *
+ * @return 0 on success, -1 on error
+ */
+int numa_bind(void *addr, size_t len, int node, size_t align)
+{
+#if defined(HAVE_LINUX_MEMPOLICY_H) && defined(SYS_mbind)
+    unsigned long mask[4] = { 0 };
+    uintptr_t start = (uintptr_t)addr;
+    uintptr_t end = start + len;
+
+    if (node < 0 || node >= 8 * sizeof(mask))
+        return -1;
+
+    start = ROUND_UP(start, align);
+    end &= ~(align - 1);
+    if (start >= end)
+        return 0;
+
+    mask[node / (8 * sizeof(mask[0]))] |= 1UL << (node % (8 * sizeof(mask[0])));
+
+    return syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask,
+                   8 * sizeof(mask), MPOL_MF_MOVE) ? -1 : 0;
+#else
+    return -1;
+#endif
+}
+
 #ifdef IS_PPE
 
 /* Various initalizations that must be done once. */
@@ -37,6 +295,7 @@ int ppe_misc_init_once(void)
 #else
     linesize = 64;
 #endif
+    huge_init();
 
 #if WITH_TRANSPORT_SHMEM
     if (get_param(PTL_ENABLE_MEM)) {
@@ -48,6 +307,8 @@ int ppe_misc_init_once(void)
     transports.local = transport_local_ppe;
 #endif
 
+    atom_op_init();
+
 #if WITH_TRANSPORT_IB
     transports.remote = transport_remote_rdma;
 #endif
@@ -77,9 +338,12 @@ int misc_init_once(void)
 #else
     linesize = 64;
 #endif
+    huge_init();
 
 #if !IS_LIGHT_LIB
 
+    atom_op_init();
+
 #if WITH_TRANSPORT_SHMEM
     if (get_param(PTL_ENABLE_MEM)) {
         transports.local = transport_local_shmem;
@@ -94,6 +358,9 @@ int misc_init_once(void)
 #if WITH_TRANSPORT_UDP
     transports.remote = transport_remote_udp;
 #endif
+#if WITH_TRANSPORT_TCP
+    transports.remote = transport_remote_tcp;
+#endif
 
 #endif /* !IS_LIGHT_LIB */
 
@@ -3,6 +3,17 @@ extern int ptl_log_level;
 extern unsigned long pagesize;
 extern unsigned int linesize;
 
+extern int huge_pages;
+extern unsigned long hugepagesize;
+
+const char *huge_mode_name(enum huge_mode mode);
+void *huge_alloc(size_t size, const char *what, enum huge_mode *mode_p);
+void huge_free(void *p, size_t size, enum huge_mode mode);
+
+int numa_num_nodes(void);
+int numa_this_node(void);
+int numa_bind(void *addr, size_t len, int node, size_t align);
+
 #ifdef IS_PPE
 int ppe_misc_init_once(void);
 #else
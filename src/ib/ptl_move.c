@@ -35,6 +35,11 @@ static int get_transport_buf(ni_t *ni, ptl_process_t target_id,
     assert(buf->type == BUF_FREE);
     buf->type = BUF_INIT;
 
+    /* The buf may last have been used on the target side, which
+     * shares this space. */
+    buf->completed = 0;
+    buf->recv_buf = NULL;
+
     buf->conn = conn;
 
     *retbuf = buf;
@@ -1198,6 +1203,10 @@ int _PtlTriggeredSwap(PPEGBL ptl_handle_md_t get_md_handle,
 /**
  * @brief Start a bundle.
  *
+ * Until the matching PtlEndBundle, the requests sent on this NI are
+ * queued and posted together, so the transports can amortize the
+ * doorbell/syscall over several messages. Bundles can be nested.
+ *
  * @return status
  */
 int _PtlStartBundle(PPEGBL ptl_handle_ni_t ni_handle)
@@ -1218,7 +1227,7 @@ int _PtlStartBundle(PPEGBL ptl_handle_ni_t ni_handle)
         goto err1;
     }
 
-    /* TODO implement start bundle */
+    ni_bundle_start(ni);
 
     ni_put(ni);
     gbl_put();
@@ -1234,6 +1243,8 @@ int _PtlStartBundle(PPEGBL ptl_handle_ni_t ni_handle)
 /**
  * @brief End a bundle.
  *
+ * Post the requests deferred since the outermost PtlStartBundle.
+ *
  * @return status
  */
 int _PtlEndBundle(PPEGBL ptl_handle_ni_t ni_handle)
@@ -1254,7 +1265,7 @@ int _PtlEndBundle(PPEGBL ptl_handle_ni_t ni_handle)
         goto err1;
     }
 
-    /* TODO implement end bundle */
+    ni_bundle_end(ni);
 
     ni_put(ni);
     gbl_put();
@@ -447,8 +447,18 @@ int mr_lookup(ni_t *ni, struct ni_mr_tree *tree, void *start,
             mr_put(mr);
         }
 
-        /* Finally we can insert the new MR in the tree. */
+        /* Finally we can insert the new MR in the tree. Without the
+         * cache, an MR starting on the same page may already be
+         * there. Its users keep it alive; the tree only keeps the
+         * newest one. */
         mr = *mr_p;
+        if (global_umn_init != 1) {
+            res = RB_FIND(the_root, &tree->tree, mr);
+            if (res) {
+                RB_REMOVE(the_root, &tree->tree, res);
+                mr_put(res);
+            }
+        }
         mr_get(mr);
         res = RB_INSERT(the_root, &tree->tree, mr);
 //this can happen if using Qlogic
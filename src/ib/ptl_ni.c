@@ -146,7 +146,13 @@ static int init_pools(ni_t *ni)
     ni->buf_pool.init = buf_init;
     ni->buf_pool.fini = buf_fini;
     ni->buf_pool.cleanup = buf_cleanup;
-    ni->buf_pool.slab_size = 128 * 1024;
+    /* With huge pages, a slab fills a huge page. */
+    if (huge_pages) {
+        ni->buf_pool.use_huge_pages = 1;
+        ni->buf_pool.slab_size = hugepagesize;
+    } else {
+        ni->buf_pool.slab_size = 128 * 1024;
+    }
 
     err =
         pool_init(gbl, &ni->buf_pool, "buf", real_buf_t_size(), POOL_BUF,
@@ -215,6 +221,31 @@ static int create_tables(ni_t *ni)
     return PTL_OK;
 }
 
+/*
+ * atomic_locks_init
+ *	allocate the locks serializing the atomic operations
+ *	the number of locks is rounded up to a power of 2
+ */
+static int atomic_locks_init(ni_t *ni)
+{
+    unsigned int num_locks = 1;
+    unsigned int i;
+
+    while (num_locks < get_param(PTL_ATOMIC_LOCKS))
+        num_locks <<= 1;
+
+    ni->atomic_locks = calloc(num_locks, sizeof(*ni->atomic_locks));
+    if (!ni->atomic_locks)
+        return PTL_NO_SPACE;
+
+    for (i = 0; i < num_locks; i++)
+        pthread_mutex_init(&ni->atomic_locks[i], NULL);
+
+    ni->atomic_lock_mask = num_locks - 1;
+
+    return PTL_OK;
+}
+
 enum {
     NI_INIT_CLEANUP,
     NI_WAIT_DISCONNECT_ALL,
@@ -320,6 +351,13 @@ int _PtlNIInit(gbl_t *gbl, ptl_interface_t iface_id, unsigned int options,
 #if WITH_TRANSPORT_UDP
     PTL_FASTLOCK_INIT(&ni->udp_lock);
     INIT_LIST_HEAD(&ni->udp_list);
+    INIT_LIST_HEAD(&ni->udp_recv_list);
+    queue_init(&ni->udp.self_queue);
+#endif
+#if WITH_TRANSPORT_TCP
+    ni->tcp.epfd = -1;
+    PTL_FASTLOCK_INIT(&ni->tcp.lock);
+    INIT_LIST_HEAD(&ni->tcp.sock_list);
 #endif
     RB_INIT(&ni->mr_self.tree);
     PTL_FASTLOCK_INIT(&ni->mr_self.tree_lock);
@@ -330,8 +368,8 @@ int _PtlNIInit(gbl_t *gbl, ptl_interface_t iface_id, unsigned int options,
 #endif
     PTL_FASTLOCK_INIT(&ni->md_list_lock);
     PTL_FASTLOCK_INIT(&ni->ct_list_lock);
-    pthread_mutex_init(&ni->atomic_mutex, NULL);
     pthread_mutex_init(&ni->pt_mutex, NULL);
+    pthread_mutex_init(&ni->bundle.mutex, NULL);
 
 #if WITH_TRANSPORT_SHMEM && !USE_KNEM
     PTL_FASTLOCK_INIT(&ni->shmem.noknem_lock);
@@ -384,6 +422,21 @@ int _PtlNIInit(gbl_t *gbl, ptl_interface_t iface_id, unsigned int options,
         goto err3;
     }
 
+    ni->bundle.size = get_param(PTL_BUNDLE_SIZE);
+    if (ni->bundle.size) {
+        ni->bundle.bufs = calloc(ni->bundle.size, sizeof(*ni->bundle.bufs));
+        if (unlikely(!ni->bundle.bufs)) {
+            WARN();
+            err = PTL_NO_SPACE;
+            goto err3;
+        }
+    }
+
+    err = atomic_locks_init(ni);
+    if (unlikely(err)) {
+        WARN();
+        goto err3;
+    }
 
     /* Add a progress thread. */
     err = start_progress_thread(ni);
@@ -588,6 +641,153 @@ static void interrupt_cts(ni_t *ni)
     PTL_FASTLOCK_UNLOCK(&ni->ct_list_lock);
 }
 
+/**
+ * @brief Post the requests deferred in the current bundle.
+ *
+ * Consecutive bufs using the same transport are handed over in a
+ * single send_bundle call, so each transport can batch them.
+ *
+ * @param[in] ni the network interface, with the bundle mutex held.
+ */
+static void ni_bundle_flush_locked(ni_t *ni)
+{
+    buf_t **bufs = ni->bundle.bufs;
+    unsigned int num_bufs = ni->bundle.num_bufs;
+    unsigned int i;
+    unsigned int j;
+
+    for (i = 0; i < num_bufs; i = j) {
+        struct transport *transport = &bufs[i]->conn->transport;
+
+        for (j = i + 1; j < num_bufs; j++) {
+            if (bufs[j]->conn->transport.type != transport->type)
+                break;
+        }
+
+        transport->send_bundle(&bufs[i], j - i);
+    }
+
+    /* Drop the references taken by ni_bundle_add. */
+    for (i = 0; i < num_bufs; i++)
+        buf_put(bufs[i]);
+
+    ni->bundle.num_bufs = 0;
+}
+
+/**
+ * @brief Enter a (possibly nested) bundle.
+ *
+ * The bundle belongs to the calling thread. While it is open, the
+ * calls of the other threads don't defer anything.
+ *
+ * @param[in] ni the network interface.
+ */
+void ni_bundle_start(ni_t *ni)
+{
+    pthread_mutex_lock(&ni->bundle.mutex);
+    if (ni->bundle.depth == 0) {
+        ni->bundle.owner = pthread_self();
+        ni->bundle.depth = 1;
+    } else if (pthread_equal(ni->bundle.owner, pthread_self())) {
+        ni->bundle.depth++;
+    }
+    pthread_mutex_unlock(&ni->bundle.mutex);
+}
+
+/**
+ * @brief Leave a bundle, and post the deferred requests.
+ *
+ * @param[in] ni the network interface.
+ */
+void ni_bundle_end(ni_t *ni)
+{
+    pthread_mutex_lock(&ni->bundle.mutex);
+    if (ni->bundle.depth > 0 &&
+        pthread_equal(ni->bundle.owner, pthread_self())) {
+        ni->bundle.depth--;
+        ni_bundle_flush_locked(ni);
+    }
+    pthread_mutex_unlock(&ni->bundle.mutex);
+}
+
+/**
+ * @brief Defer the send of an initiator request to the end of the
+ * bundle.
+ *
+ * Called by the transports send_message with a buf ready to be
+ * posted. The buf is kept until it has been handed to the transport
+ * send_bundle. Only the requests of the thread owning the bundle are
+ * deferred; those sent by the progress threads or by other
+ * application threads go out at once.
+ *
+ * @param[in] ni the network interface.
+ * @param[in] buf the request buf.
+ *
+ * @return PTL_OK if the buf has been queued, PTL_FAIL if the NI is not
+ * bundling and the caller must post the buf itself.
+ */
+int ni_bundle_add(ni_t *ni, buf_t *buf)
+{
+    /* Only a hint. The owner always sees its own updates of depth,
+     * and the other threads check again under the lock. */
+    if (likely(ni->bundle.depth == 0))
+        return PTL_FAIL;
+
+    pthread_mutex_lock(&ni->bundle.mutex);
+
+    if (ni->bundle.depth == 0 || ni->bundle.size == 0 ||
+        !pthread_equal(ni->bundle.owner, pthread_self())) {
+        pthread_mutex_unlock(&ni->bundle.mutex);
+        return PTL_FAIL;
+    }
+
+    buf_get(buf);
+    ni->bundle.bufs[ni->bundle.num_bufs++] = buf;
+
+    if (ni->bundle.num_bufs == ni->bundle.size)
+        ni_bundle_flush_locked(ni);
+
+    pthread_mutex_unlock(&ni->bundle.mutex);
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Post all the requests deferred on an NI.
+ *
+ * Also used by the transports before sending a request that cannot be
+ * bundled, to keep the requests ordered.
+ *
+ * @param[in] ni the network interface.
+ */
+void ni_bundle_flush(ni_t *ni)
+{
+    /* Same hint as in ni_bundle_add. */
+    if (likely(ni->bundle.depth == 0))
+        return;
+
+    pthread_mutex_lock(&ni->bundle.mutex);
+    ni_bundle_flush_locked(ni);
+    pthread_mutex_unlock(&ni->bundle.mutex);
+}
+
+/**
+ * @brief Give back the memory of the free slabs of the NI pools.
+ *
+ * @param[in] ni the network interface.
+ */
+void ni_shrink_pools(ni_t *ni)
+{
+    pool_shrink(&ni->mr_pool);
+    pool_shrink(&ni->md_pool);
+    pool_shrink(&ni->me_pool);
+    pool_shrink(&ni->le_pool);
+    pool_shrink(&ni->eq_pool);
+    pool_shrink(&ni->ct_pool);
+    pool_shrink(&ni->buf_pool);
+    pool_shrink(&ni->conn_pool);
+}
+
 static void ni_cleanup(ni_t *ni)
 {
     /* if PtlSetMap has not yet been called, set
@@ -599,6 +799,12 @@ static void ni_cleanup(ni_t *ni)
     }
 
     if (ni->cleanup_state == NI_INIT_CLEANUP) {
+        /* Don't leave requests behind in an unterminated bundle. */
+        pthread_mutex_lock(&ni->bundle.mutex);
+        ni_bundle_flush_locked(ni);
+        ni->bundle.depth = 0;
+        pthread_mutex_unlock(&ni->bundle.mutex);
+
         ni->shutting_down = 1;
         __sync_synchronize();
 
@@ -655,12 +861,33 @@ static void ni_cleanup(ni_t *ni)
     pool_fini(&ni->mr_pool);
 
     if (ni->pt) {
+        int i;
+
+        for (i = 0; i <= ni->limits.max_pt_index; i++) {
+            if (ni->pt[i].in_use)
+                pt_match_index_fini(&ni->pt[i]);
+        }
+
         free(ni->pt);
         ni->pt = NULL;
     }
 
-    pthread_mutex_destroy(&ni->atomic_mutex);
+    if (ni->bundle.bufs) {
+        free(ni->bundle.bufs);
+        ni->bundle.bufs = NULL;
+    }
+
+    if (ni->atomic_locks) {
+        unsigned int i;
+
+        for (i = 0; i <= ni->atomic_lock_mask; i++)
+            pthread_mutex_destroy(&ni->atomic_locks[i]);
+        free(ni->atomic_locks);
+        ni->atomic_locks = NULL;
+    }
+
     pthread_mutex_destroy(&ni->pt_mutex);
+    pthread_mutex_destroy(&ni->bundle.mutex);
     PTL_FASTLOCK_DESTROY(&ni->md_list_lock);
     PTL_FASTLOCK_DESTROY(&ni->ct_list_lock);
     PTL_FASTLOCK_DESTROY(&ni->mr_self.tree_lock);
@@ -686,6 +913,7 @@ int _PtlNIFini(gbl_t *gbl, ptl_handle_ni_t ni_handle)
 
 #if !IS_PPE
     ni->catcher_nosleep = 1;
+    progress_thread_wakeup(ni, -1);
 #endif
 
     pthread_mutex_lock(&gbl->gbl_mutex);
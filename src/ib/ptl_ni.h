@@ -9,6 +9,8 @@
 
 struct queue;
 struct conn;
+struct buf;
+struct progress_thread;
 
 /*
  * rank_entry_t
@@ -30,6 +32,13 @@ struct shmem_pid_table {
 
     /* Set to 1 when id is valid. */
     int valid;
+
+    /* Set to 1 if the rank can use Cross Memory Attach. */
+    int cma;
+
+    /* Number of shared memory queues. Only set by rank 0, as soon as
+     * the comm pad is mapped. */
+    int num_queues;
 };
 
 struct shmem_bounce_head {
@@ -38,6 +47,13 @@ struct shmem_bounce_head {
                                  * 0. Invariant. */
 };
 
+/* Consumer state of the rings of a queue shard. */
+struct shmem_spsc_reader {
+    int cur;                    /* sender whose ring is drained, or -1 */
+    int left;                   /* messages left in its batch */
+    int next;                   /* sender to start the next scan at */
+};
+
 struct udp_bounce_head {
     union counted_ptr free_list;    /* head of free list of bounce buffers */
     void *head_index0;          /* logical address of the head of local index
@@ -77,8 +93,23 @@ typedef struct ni {
 
     int shutting_down;
 
-    /* Serialize atomic operations on this NI. */
-    pthread_mutex_t atomic_mutex;
+    /* Serialize atomic operations on this NI. Each lock covers the
+     * blocks of target memory whose number modulo the number of locks
+     * is its index. */
+    pthread_mutex_t *atomic_locks;
+    unsigned int atomic_lock_mask; /* number of locks - 1 */
+
+    /* Requests deferred between PtlStartBundle and PtlEndBundle. A
+     * bundle belongs to the thread that opened it; the requests of
+     * the other threads are not deferred. */
+    struct {
+        pthread_mutex_t mutex;
+        pthread_t owner;        /* valid when depth > 0 */
+        int depth;              /* PtlStartBundle nesting level */
+        unsigned int size;      /* capacity of bufs, 0 if disabled */
+        unsigned int num_bufs;
+        struct buf **bufs;
+    } bundle;
 
     pt_t *pt;
     pthread_mutex_t pt_mutex;
@@ -107,9 +138,11 @@ typedef struct ni {
     ptl_uid_t uid;
 
 #if !IS_PPE
-    /* Progress thread. */
-    pthread_t catcher;
-    int has_catcher;
+    /* Progress threads. Thread i polls the completion queue and the
+     * shared memory queue shard i. Thread 0 also polls UDP and the
+     * noknem list. */
+    struct progress_thread *catchers;
+    int num_catchers;
     int catcher_stop;
     int catcher_nosleep;
 #endif
@@ -119,8 +152,14 @@ typedef struct ni {
 #if WITH_TRANSPORT_IB
     /* RDMA transport specific */
     struct {
-        struct ibv_cq *cq;
-        struct ibv_comp_channel *ch;
+        /* One completion queue per progress thread. The QPs are
+         * spread over them as they are created. */
+        struct {
+            struct ibv_cq *cq;
+            struct ibv_comp_channel *ch;
+        } *cqs;
+        int num_cqs;
+        atomic_t next_cq;
         ev_io async_watcher;
 
         struct ibv_srq *srq;
@@ -151,24 +190,67 @@ typedef struct ni {
         size_t per_proc_comm_buf_size;
         int per_proc_comm_buf_numbers;
         int knem_fd;
-        struct queue *queue;    /* own queue, in the comm pad */
+        struct queue *queue;    /* own queues, in the comm pad */
+        int num_queues;         /* queue shards per rank */
+        int *doorbells;         /* sockets to wake up the consumer of
+                                 * each own queue */
+        int doorbell_s;         /* socket to ring the other doorbells */
+        char *doorbell_name;
         void *first_queue;      /* addr of rank 0 queue, in the comm pad */
         char *comm_pad_shm_name;
+        char *comm_pad_huge_name;       /* comm pad file in hugetlbfs */
+        enum huge_mode comm_pad_huge;
+
+        /* With PTL_SHMEM_NUMA on a NUMA machine, each rank binds its
+         * part of the comm pad to the node it runs on, and the bounce
+         * buffers are split between the nodes. numa_node is -1 if
+         * the rank runs on several nodes. */
+        int numa_nodes;         /* 1 if the placement is left alone */
+        int numa_node;
+
+        /* With PTL_SHMEM_RINGS, the messages go through one ring per
+         * pair of local ranks instead of the queues. Each rank has
+         * the rings of all its senders, and for each queue shard a
+         * bitmap of the senders with pending messages. The queues
+         * are still used to sleep and wake up. */
+        struct {
+            void *first;        /* addr of rank 0 rings, in the comm pad */
+            size_t per_proc_size;
+            size_t bitmap_size; /* per shard, cacheline aligned */
+            size_t ring_size;
+            unsigned int entries;       /* per ring, a power of 2 */
+            PTL_FASTLOCK_TYPE *locks;   /* one per destination ring */
+            struct shmem_spsc_reader *readers;  /* one per shard */
+        } spsc;
 
 #if !USE_KNEM
         /* Bounce buffers used when KNEM is not available. They are
          * created and linked by rank 0. */
         struct {
-            struct shmem_bounce_head *head;
+            struct shmem_bounce_head *head;     /* one per part */
             void *bbs;          /* local address of the bounce buffers */
 
             size_t buf_size;
             unsigned int num_bufs;
+
+            /* The buffers are split in one part per NUMA node, each
+             * with its own free list. */
+            unsigned int num_parts;
+            size_t part_size;
+
+            /* Each buffer is used as a ring of slots. */
+            unsigned int slot_size;
+            unsigned int num_slots;
         } bounce_buf;
 
         PTL_FASTLOCK_TYPE noknem_lock;
         struct list_head noknem_list;
 #endif
+
+#if USE_CMA
+        /* Large transfers use process_vm_readv/writev. */
+        int cma;
+#endif
     } shmem;
 #endif
 
@@ -198,12 +280,22 @@ typedef struct ni {
 
         int map_done;
 
-        //we use these to signal sends to self, as UDP can't safely communicate with itself on the same
-        //machine over the same port
-        atomic_t self_recv;
-        atomic_t self_recv_complete;
-        void *self_recv_addr;   // in udp datagram?
-        size_t self_recv_len;
+        /* Messages sent to this NI by the process itself, already
+         * unpacked; they never go through the socket. Filled by
+         * udp_send_self() and drained by udp_receive(). */
+        queue_t self_queue;
+
+        /* Datagrams received by the last recvmmsg, see
+         * udp_receive(). */
+        struct udp_recv_batch *recv_batch;
+
+        /* Datagrams sent by the progress thread, flushed at the end
+         * of each pass. See udp_send_start(). */
+        struct udp_send_batch *send_batch;
+
+        /* io_uring engine, used instead of the batch when
+         * PTL_UDP_ENGINE selects it. */
+        struct udp_uring *uring;
 
 
         size_t per_proc_comm_buf_size;
@@ -229,6 +321,27 @@ typedef struct ni {
 #if WITH_TRANSPORT_UDP
     PTL_FASTLOCK_TYPE udp_lock;
     struct list_head udp_list;
+
+    /* Datagrams for this NI received by another NI sharing the
+     * socket. Protected by udp_lock. */
+    struct list_head udp_recv_list;
+#endif
+
+#if WITH_TRANSPORT_TCP
+    /* TCP transport specific */
+    struct {
+        /* Polled by the first progress thread for the sockets of
+         * this NI, and for the listening socket of the interface. */
+        int epfd;
+
+        /* All the sockets of this NI. Protected by lock. */
+        struct list_head sock_list;
+        PTL_FASTLOCK_TYPE lock;
+
+        /* Payloads of at least that size are sent with MSG_ZEROCOPY
+         * (0 if disabled). */
+        ptl_size_t zerocopy_min;
+    } tcp;
 #endif
 
     /* object allocation pools */
@@ -261,8 +374,10 @@ typedef struct ni {
         } logical;
 
         struct {
-            /* Physical NI. */
-            void *tree;
+            /* Physical NI. The connections are in a hash table
+             * indexed by process ID, see ptl_conn.c. The lock
+             * serializes the insertions; lookups don't take it. */
+            struct conn_table *volatile conns;
             PTL_FASTLOCK_TYPE lock;
         } physical;
     };
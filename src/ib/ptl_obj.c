@@ -4,7 +4,8 @@
 
 #include "ptl_loc.h"
 
-/* Maximum number of stored objects ever. */
+/* Maximum number of object indexes. The range of a released slab is
+ * reused by the next slab of its pool. */
 #define MAX_INDEX	(256*1024)
 
 /**
@@ -32,26 +33,25 @@ void index_fini(gbl_t *gbl)
 }
 
 /**
- * Get index for object and save address.
+ * Get a range of indexes for the objects of a slab.
  *
- * @param obj
- * @param index_p
+ * @param num number of indexes
+ * @param index_p address of the first index
  *
  * @output status
  */
-static inline int index_get(gbl_t *gbl, obj_t *obj, unsigned int *index_p)
+static inline int index_get_range(gbl_t *gbl, unsigned int num,
+                                  unsigned int *index_p)
 {
     unsigned int index;
 
-    index = atomic_inc(&gbl->next_index);
+    index = atomic_add(&gbl->next_index, num);
 
-    if (index >= MAX_INDEX) {
+    if (index + num > MAX_INDEX) {
         ptl_warn("Index > MAX Index, index was: %i \n", index);
         return PTL_FAIL;
     }
 
-    gbl->index_map[index] = obj;
-
     *index_p = index;
 
     return PTL_OK;
@@ -81,28 +81,167 @@ static inline int index_lookup(gbl_t *gbl, unsigned int index, obj_t **obj_p)
 
 #define HANDLE_SHIFT ((sizeof(ptl_handle_any_t)*8)-8)
 
+/**
+ * A magazine holds free objects of a pool for a single thread. The
+ * objects it holds keep their reference to the pool parent, so the
+ * parent is only touched when the magazine is refilled or flushed.
+ */
+struct pool_mag {
+        /** number of objects in objs */
+    unsigned int num;
+
+        /** objects allocated minus objects released through it */
+    long count;
+
+        /** statistics, see struct pool_stats */
+    unsigned long hits;
+    unsigned long refills;
+    unsigned long flushes;
+
+        /** the free objects, pool->mag_size entries */
+    obj_t *objs[0];
+};
+
+/* Threads owning a magazine slot. A slot is given back when its
+ * thread exits; the next thread to take it inherits the objects left
+ * in its magazines. */
+static pthread_mutex_t mag_slot_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t mag_slot_once = PTHREAD_ONCE_INIT;
+static pthread_key_t mag_slot_key;
+static unsigned char mag_slot_used[POOL_MAG_THREADS];
+
+/* Magazine slot of the calling thread, -1 if not known yet, -2 if
+ * the thread has none. */
+static __thread int mag_slot = -1;
+
+/**
+ * Give back the magazine slot of an exiting thread.
+ *
+ * @param arg the slot number plus 1
+ */
+static void mag_slot_release(void *arg)
+{
+    int slot = (int)(uintptr_t) arg - 1;
+
+    /* Objects released from now on, by another destructor, go to the
+     * free list. */
+    mag_slot = -2;
+
+    pthread_mutex_lock(&mag_slot_mutex);
+    mag_slot_used[slot] = 0;
+    pthread_mutex_unlock(&mag_slot_mutex);
+}
+
+static void mag_slot_init(void)
+{
+    if (pthread_key_create(&mag_slot_key, mag_slot_release))
+        WARN();
+}
+
+/**
+ * Get the magazine slot of the calling thread.
+ *
+ * @return the slot, or -1 if the thread has none
+ */
+static int mag_slot_get(void)
+{
+    int slot;
+
+    if (likely(mag_slot >= 0))
+        return mag_slot;
+
+    if (mag_slot == -2)
+        return -1;
+
+    mag_slot = -2;
+
+    pthread_once(&mag_slot_once, mag_slot_init);
+
+    pthread_mutex_lock(&mag_slot_mutex);
+    for (slot = 0; slot < POOL_MAG_THREADS; slot++) {
+        if (!mag_slot_used[slot]) {
+            mag_slot_used[slot] = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mag_slot_mutex);
+
+    if (slot == POOL_MAG_THREADS)
+        return -1;
+
+    if (pthread_setspecific(mag_slot_key, (void *)(uintptr_t) (slot + 1))) {
+        /* The slot could not be given back at exit. */
+        pthread_mutex_lock(&mag_slot_mutex);
+        mag_slot_used[slot] = 0;
+        pthread_mutex_unlock(&mag_slot_mutex);
+        return -1;
+    }
+
+    mag_slot = slot;
+
+    return slot;
+}
+
+/**
+ * Get the magazine of the calling thread for a pool.
+ *
+ * @param pool the pool
+ *
+ * @return the magazine, or NULL if the thread must use the free list
+ */
+static inline struct pool_mag *pool_mag(pool_t *pool)
+{
+    struct pool_mag *mag;
+    int slot;
+
+    if (!pool->mags)
+        return NULL;
+
+    slot = mag_slot_get();
+    if (unlikely(slot < 0))
+        return NULL;
+
+    mag = pool->mags[slot];
+    if (unlikely(!mag)) {
+        /* Only the owner of the slot creates its magazine. */
+        if (posix_memalign((void **)&mag, linesize,
+                           sizeof(*mag) + pool->mag_size * sizeof(obj_t *)))
+            return NULL;
+
+        memset(mag, 0, sizeof(*mag));
+        pool->mags[slot] = mag;
+    }
+
+    return mag;
+}
+
 /**
  * Return a new zero filled slab.
  *
  * The slab will be used by caller to hold a new
  * batch of objects. Normal behavior is to allocate
- * page aligned memory. In the special case that
- * we are creating objects in shared memory the pool
- * has a pre allocated chunk of shared memory that is
- * used instead.
+ * page aligned memory, possibly backed by huge pages.
+ * In the special case that we are creating objects in
+ * shared memory the pool has a pre allocated chunk of
+ * shared memory that is used instead.
  *
  * @param pool the pool for which slab is created.
+ * @param info the slab descriptor, to record how it is backed
  *
  * @return address of slab or null if unable to allocate memory
  */
-static void *pool_get_slab(pool_t *pool)
+static void *pool_get_slab(pool_t *pool, slab_info_t *info)
 {
     int err;
     void *slab;
 
+    info->huge = HUGE_NONE;
+
     if (pool->use_pre_alloc_buffer) {
         slab = pool->pre_alloc_buffer;
         pool->pre_alloc_buffer = NULL;
+    } else if (pool->use_huge_pages) {
+        slab = huge_alloc(pool->slab_size, pool->name, &info->huge);
     } else {
         err = posix_memalign(&slab, pagesize, pool->slab_size);
         if (unlikely(err))
@@ -116,51 +255,67 @@ static void *pool_get_slab(pool_t *pool)
 }
 
 /**
- * get chunk hold new slab.
- * note that we currently never free objects so there are
- * never any holes in chunk->slab_list
+ * Free the memory of a slab from pool_get_slab().
+ *
+ * @param pool the pool
+ * @param info the slab descriptor
+ */
+static void pool_put_slab(pool_t *pool, slab_info_t *info)
+{
+    if (pool->use_pre_alloc_buffer)
+        return;
+
+    if (pool->use_huge_pages)
+        huge_free(info->addr, pool->slab_size, info->huge);
+    else
+        free(info->addr);
+
+    info->addr = NULL;
+}
+
+/**
+ * Get a slab descriptor with a range of object indexes.
+ *
+ * The descriptor of a released slab is reused first.
  *
  * @pre caller should hold pool->mutex
  *
- * @param pool the pool for which to get chunk
- * @param chunk_p address of return value
+ * @param pool the pool
+ * @param slab_p address of return value
  *
  * @return status
  */
-static int pool_get_chunk(pool_t *pool, chunk_t **chunk_p)
+static int pool_get_slab_info(pool_t *pool, slab_info_t **slab_p)
 {
     int err;
-    chunk_t *chunk;
-
-    /* see if there is a chunk with room at head of list */
-    if (likely(!list_empty(&pool->chunk_list))) {
-        chunk = list_first_entry(&pool->chunk_list, chunk_t, list);
-        if (chunk->num_slabs < chunk->max_slabs) {
-            *chunk_p = chunk;
-            return PTL_OK;
-        }
+    slab_info_t *slab;
+
+    if (!list_empty(&pool->spare_list)) {
+        slab = list_first_entry(&pool->spare_list, slab_info_t, list);
+        list_del(&slab->list);
+        *slab_p = slab;
+        return PTL_OK;
     }
 
-    /* have to allocate a new chunk */
-    err = posix_memalign((void *)&chunk, pagesize, pagesize);
-    if (unlikely(err))
+    slab = calloc(1, sizeof(*slab));
+    if (unlikely(!slab))
         return PTL_NO_SPACE;
 
-    memset(chunk, 0, pagesize);
-
-    chunk->max_slabs =
-        (pagesize - sizeof(*chunk)) / sizeof(chunk->slab_list[0]);
-    chunk->num_slabs = 0;
-
-    list_add(&chunk->list, &pool->chunk_list);
+    err = index_get_range(pool->gbl, pool->obj_per_slab, &slab->index);
+    if (unlikely(err)) {
+        free(slab);
+        return err;
+    }
 
-    *chunk_p = chunk;
+    *slab_p = slab;
     return PTL_OK;
 }
 
 /**
  * Allocate a new slab of objects for a given pool
  *
+ * @pre caller should hold pool->mutex
+ *
  * @param pool
  *
  * @return status
@@ -168,23 +323,22 @@ static int pool_get_chunk(pool_t *pool, chunk_t **chunk_p)
 static int pool_alloc_slab(pool_t *pool)
 {
     int err;
-    chunk_t *chunk = NULL;
     uint8_t *p;
     int i;
     obj_t *obj;
     struct ibv_mr *mr = NULL;
-    struct list_head temp_list;
     slab_info_t *slab;
 
-    err = pool_get_chunk(pool, &chunk);
+    err = pool_get_slab_info(pool, &slab);
     if (unlikely(err))
         return err;
 
-    p = pool_get_slab(pool);
-    if (unlikely(!p))
+    p = pool_get_slab(pool, slab);
+    if (unlikely(!p)) {
+        list_add(&slab->list, &pool->spare_list);
         return PTL_NO_SPACE;
+    }
 
-    slab = &chunk->slab_list[chunk->num_slabs];
     slab->addr = p;
 
 #if WITH_TRANSPORT_IB
@@ -197,31 +351,26 @@ static int pool_alloc_slab(pool_t *pool)
                         IBV_ACCESS_LOCAL_WRITE);
         if (!mr) {
             WARN();
-            free(p);
+            pool_put_slab(pool, slab);
+            list_add(&slab->list, &pool->spare_list);
             return PTL_FAIL;
         }
         slab->mr = mr;
     }
 #endif
 
-    INIT_LIST_HEAD(&temp_list);
-
     for (i = 0; i < pool->obj_per_slab; i++) {
-        unsigned int index;
+        unsigned int index = slab->index + i;
 
         obj = (obj_t *)p;
         obj->obj_free = 1;
         obj->obj_pool = pool;
+        obj->obj_slab = slab;
         ref_set(&obj->obj_ref, 0);
         obj->obj_parent = pool->parent;
         obj->obj_ni = (pool->parent) ? pool->parent->obj_ni : (ni_t *)obj;
 
-        err = index_get(pool->gbl, obj, &index);
-        if (err) {
-            WARN();
-            //todo: leak
-            return err;
-        }
+        pool->gbl->index_map[index] = obj;
         obj->obj_handle = ((uint64_t) (pool->type) << HANDLE_SHIFT) | index;
 
         if (pool->init) {
@@ -236,11 +385,352 @@ static int pool_alloc_slab(pool_t *pool)
         p += pool->round_size;
     }
 
-    chunk->num_slabs++;
+    list_add(&slab->list, &pool->slab_list);
+
+    pool->num_slabs++;
+    if (pool->num_slabs > pool->peak_slabs)
+        pool->peak_slabs = pool->num_slabs;
 
     return PTL_OK;
 }
 
+/**
+ * Release the memory of a slab whose objects are all free.
+ *
+ * The objects must not be on the free list anymore. The slab
+ * descriptor moves to the spare list, keeping its index range.
+ *
+ * @pre caller should hold pool->mutex
+ *
+ * @param pool the pool
+ * @param slab the slab to release
+ */
+static void pool_free_slab(pool_t *pool, slab_info_t *slab)
+{
+    uint8_t *p = slab->addr;
+    int i;
+
+    for (i = 0; i < pool->obj_per_slab; i++) {
+        obj_t *obj = (obj_t *)p;
+
+        assert(obj->obj_free == 1);
+
+        if (pool->fini)
+            pool->fini(obj);
+
+        pool->gbl->index_map[slab->index + i] = NULL;
+        p += pool->round_size;
+    }
+
+#if WITH_TRANSPORT_IB
+    if (slab->mr) {
+        ibv_dereg_mr(slab->mr);
+        slab->mr = NULL;
+    }
+#endif
+
+    pool_put_slab(pool, slab);
+
+    list_del(&slab->list);
+    list_add(&slab->list, &pool->spare_list);
+    pool->num_slabs--;
+    pool->released++;
+}
+
+/**
+ * Take an object from the pool free list, if any.
+ *
+ * @param pool the pool
+ *
+ * @return the object, or NULL if the free list is empty
+ */
+static inline obj_t *pool_pop(pool_t *pool)
+{
+    obj_t *obj;
+
+    atomic_inc(&pool->dequeuers);
+    obj = ll_dequeue_obj(&pool->free_list);
+    atomic_dec(&pool->dequeuers);
+
+    return obj;
+}
+
+/**
+ * Take an object from the pool free list.
+ *
+ * If the free list is empty allocate a new
+ * slab of objects first.
+ *
+ * @param pool the pool
+ * @param obj_p pointer to returned object
+ *
+ * @return status
+ */
+static int pool_dequeue(pool_t *pool, obj_t **obj_p)
+{
+    int err;
+    obj_t *obj;
+
+    obj = pool_pop(pool);
+    if (unlikely(!obj)) {
+        if (pool->use_pre_alloc_buffer) {
+            /* The pool cannot expand, for instance in the case of the
+             * SBUF pool, so we must busy wait until a new buffer appears
+             * on the list. */
+            do {
+                SPINLOCK_BODY();
+            } while ((obj = ll_dequeue_obj(&pool->free_list)) == NULL);
+        } else {
+            do {
+                pthread_mutex_lock(&pool->mutex);
+
+                /* Another thread may have grown the pool, or
+                 * pool_shrink() given the objects back, while we
+                 * waited for the lock. */
+                obj = pool_pop(pool);
+                if (obj) {
+                    pthread_mutex_unlock(&pool->mutex);
+                    break;
+                }
+
+                err = pool_alloc_slab(pool);
+                pthread_mutex_unlock(&pool->mutex);
+
+                if (unlikely(err)) {
+                    WARN();
+                    return err;
+                }
+            } while ((obj = pool_pop(pool)) == NULL);
+        }
+    }
+
+    *obj_p = obj;
+
+    return PTL_OK;
+}
+
+/**
+ * Give back the slabs of a pool whose objects are all free.
+ *
+ * The free list is taken as a whole to count the free objects of
+ * each slab. One fully free slab is kept to absorb the next
+ * allocations, and the objects of the slabs in use are put back on
+ * the free list. Objects cached in magazines are not free for this
+ * count, so their slabs are kept.
+ *
+ * Does nothing if the pool is being grown by another thread.
+ *
+ * @param pool the pool
+ *
+ * @return the number of slabs released
+ */
+int pool_shrink(pool_t *pool)
+{
+    slab_info_t *slab, *t;
+    slab_info_t *reserve = NULL;
+    obj_t *obj, *next;
+    obj_t *first = NULL, *last = NULL;
+    int released = 0;
+
+    if (!pool->name || pool->use_pre_alloc_buffer)
+        return 0;
+
+    if (pthread_mutex_trylock(&pool->mutex))
+        return 0;
+
+    if (pool->num_slabs <= 1)
+        goto done;
+
+    obj = ll_dequeue_all(&pool->free_list);
+
+    /* A thread may have read the head of the list before it was
+     * taken, and still be reading the next pointer of an object we
+     * might release. Threads coming after only see objects that were
+     * released since. */
+    while (atomic_read(&pool->dequeuers))
+        SPINLOCK_BODY();
+
+    list_for_each_entry(slab, &pool->slab_list, list)
+        slab->num_free = 0;
+
+    for (next = obj; next; next = next->next)
+        next->obj_slab->num_free++;
+
+    list_for_each_entry(slab, &pool->slab_list, list) {
+        if (slab->num_free == pool->obj_per_slab) {
+            reserve = slab;
+            break;
+        }
+    }
+
+    /* Put the objects of the slabs we keep back on the free list. */
+    for (; obj; obj = next) {
+        next = obj->next;
+
+        if (obj->obj_slab->num_free == pool->obj_per_slab &&
+            obj->obj_slab != reserve)
+            continue;
+
+        if (first)
+            last->next = obj;
+        else
+            first = obj;
+        last = obj;
+    }
+
+    if (first)
+        ll_enqueue_list(&pool->free_list, first, last);
+
+    list_for_each_entry_safe(slab, t, &pool->slab_list, list) {
+        if (slab->num_free == pool->obj_per_slab && slab != reserve) {
+            pool_free_slab(pool, slab);
+            released++;
+        }
+    }
+
+  done:
+    pthread_mutex_unlock(&pool->mutex);
+
+    return released;
+}
+
+/**
+ * Move free objects from a magazine back to the pool free list.
+ *
+ * @param pool the pool
+ * @param mag the magazine
+ * @param num the number of objects to move, from the top of the magazine
+ */
+static void pool_mag_flush(pool_t *pool, struct pool_mag *mag,
+                           unsigned int num)
+{
+    obj_t **objs = &mag->objs[mag->num - num];
+    unsigned int i;
+
+    if (num == 0)
+        return;
+
+    for (i = 0; i < num - 1; i++)
+        objs[i]->next = objs[i + 1];
+
+    ll_enqueue_list(&pool->free_list, objs[0], objs[num - 1]);
+
+    mag->num -= num;
+    mag->flushes++;
+
+    if (pool->parent &&
+        atomic_sub(&pool->parent->obj_ref.ref_cnt, num) == 0)
+        obj_release(&pool->parent->obj_ref);
+}
+
+/**
+ * Fill an empty magazine with half its size of free objects.
+ *
+ * The pool grows if its free list is empty.
+ *
+ * @param pool the pool
+ * @param mag the magazine
+ *
+ * @return status
+ */
+static int pool_mag_refill(pool_t *pool, struct pool_mag *mag)
+{
+    const unsigned int batch = (pool->mag_size + 1) / 2;
+    obj_t *obj;
+    int err;
+
+    err = pool_dequeue(pool, &obj);
+    if (unlikely(err))
+        return err;
+
+    mag->objs[mag->num++] = obj;
+
+    atomic_inc(&pool->dequeuers);
+    while (mag->num < batch &&
+           (obj = ll_dequeue_obj(&pool->free_list)) != NULL)
+        mag->objs[mag->num++] = obj;
+    atomic_dec(&pool->dequeuers);
+
+    if (pool->parent)
+        atomic_add(&pool->parent->obj_ref.ref_cnt, mag->num);
+
+    mag->refills++;
+
+    return PTL_OK;
+}
+
+/**
+ * Empty and free the magazines of a pool.
+ *
+ * @pre no other thread uses the pool
+ *
+ * @param pool the pool
+ */
+static void pool_mag_fini(pool_t *pool)
+{
+    struct pool_stats stats;
+    int i;
+
+    if (!pool->mags)
+        return;
+
+    pool_get_stats(pool, &stats);
+    ptl_info("pool %s: %lu magazine hits, %lu refills, %lu flushes\n",
+             pool->name, stats.hits, stats.refills, stats.flushes);
+
+    for (i = 0; i < POOL_MAG_THREADS; i++) {
+        struct pool_mag *mag = pool->mags[i];
+
+        if (!mag)
+            continue;
+
+        pool_mag_flush(pool, mag, mag->num);
+        atomic_add(&pool->count, mag->count);
+        free(mag);
+    }
+
+    free(pool->mags);
+    pool->mags = NULL;
+}
+
+/**
+ * Get the statistics of a pool.
+ *
+ * The magazines of the other threads are read without
+ * synchronization, so the numbers are approximate while the pool is
+ * in use.
+ *
+ * @param pool the pool
+ * @param stats the statistics to fill
+ */
+void pool_get_stats(pool_t *pool, struct pool_stats *stats)
+{
+    int i;
+
+    memset(stats, 0, sizeof(*stats));
+
+    stats->in_use = atomic_read(&pool->count);
+    stats->bytes = (unsigned long)pool->num_slabs * pool->slab_size;
+    stats->peak_bytes = (unsigned long)pool->peak_slabs * pool->slab_size;
+    stats->released = pool->released;
+
+    if (!pool->mags)
+        return;
+
+    for (i = 0; i < POOL_MAG_THREADS; i++) {
+        const struct pool_mag *mag = pool->mags[i];
+
+        if (!mag)
+            continue;
+
+        stats->in_use += mag->count;
+        stats->cached += mag->num;
+        stats->hits += mag->hits;
+        stats->refills += mag->refills;
+        stats->flushes += mag->flushes;
+    }
+}
+
 /**
  * Cleanup an object pool.
  *
@@ -250,16 +740,21 @@ static int pool_alloc_slab(pool_t *pool)
  */
 int pool_fini(pool_t *pool)
 {
-    struct list_head *l, *t;
+    slab_info_t *slab, *t;
     obj_t *obj;
-    chunk_t *chunk;
-    int i;
     int err = PTL_OK;
 
     /* avoid getting called from cleanup during PtlNIInit */
     if (!pool->name)
         return err;
 
+    pool_mag_fini(pool);
+
+    ptl_info("pool %s: peak %u slabs (%lu bytes), %lu released\n",
+             pool->name, pool->peak_slabs,
+             (unsigned long)pool->peak_slabs * pool->slab_size,
+             pool->released);
+
     /*
      * if pool has a fini routine call it on
      * each free object
@@ -281,24 +776,23 @@ int pool_fini(pool_t *pool)
     pthread_mutex_destroy(&pool->mutex);
 
     /*
-     * free slabs and chunks
+     * free slabs and their descriptors
      */
-    list_for_each_safe(l, t, &pool->chunk_list) {
-        list_del(l);
-        chunk = list_entry(l, chunk_t, list);
+    list_for_each_entry_safe(slab, t, &pool->slab_list, list) {
+        list_del(&slab->list);
 
-        for (i = 0; i < chunk->num_slabs; i++) {
 #if WITH_TRANSPORT_IB
-            struct ibv_mr *mr = chunk->slab_list[i].mr;
-            if (mr)
-                ibv_dereg_mr(mr);
+        if (slab->mr)
+            ibv_dereg_mr(slab->mr);
 #endif
 
-            if (!pool->use_pre_alloc_buffer)
-                free(chunk->slab_list[i].addr);
-        }
+        pool_put_slab(pool, slab);
+        free(slab);
+    }
 
-        free(chunk);
+    list_for_each_entry_safe(slab, t, &pool->spare_list, list) {
+        list_del(&slab->list);
+        free(slab);
     }
 
     return err;
@@ -345,9 +839,22 @@ int pool_init(gbl_t *gbl, pool_t *pool, char *name, int size,
 
     atomic_set(&pool->count, 0);
     ll_init(&pool->free_list);
-    INIT_LIST_HEAD(&pool->chunk_list);
+    INIT_LIST_HEAD(&pool->slab_list);
+    INIT_LIST_HEAD(&pool->spare_list);
+    pool->num_slabs = 0;
+    pool->peak_slabs = 0;
+    pool->released = 0;
+    atomic_set(&pool->dequeuers, 0);
     pthread_mutex_init(&pool->mutex, NULL);
 
+    /* A preallocated pool is shared with other processes, which
+     * can't see the magazines. */
+    pool->mag_size = get_param(PTL_POOL_MAGAZINE);
+    if (pool->mag_size && !pool->use_pre_alloc_buffer)
+        pool->mags = calloc(POOL_MAG_THREADS, sizeof(*pool->mags));
+    else
+        pool->mags = NULL;
+
     if (pool->use_pre_alloc_buffer) {
         /* This pool cannot expand. Allocate its slab now. */
         assert(pool->pre_alloc_buffer);
@@ -369,10 +876,25 @@ void obj_release(ref_t *ref)
 {
     obj_t *obj = container_of(ref, obj_t, obj_ref);
     pool_t *pool = obj->obj_pool;
+    struct pool_mag *mag;
 
     if (pool->cleanup)
         pool->cleanup(obj);
 
+    mag = pool_mag(pool);
+    if (likely(mag != NULL)) {
+        /* Keep the object, and its reference to the parent. */
+        if (unlikely(mag->num == pool->mag_size))
+            pool_mag_flush(pool, mag, (pool->mag_size + 1) / 2);
+
+        assert(obj->obj_free == 0);
+        obj->obj_free = 1;
+
+        mag->objs[mag->num++] = obj;
+        mag->count--;
+        return;
+    }
+
     if (obj->obj_parent)
         obj_put(obj->obj_parent);
 
@@ -388,8 +910,8 @@ void obj_release(ref_t *ref)
 /**
  * Allocate a new object.
  *
- * If the free list is empty allocate a new
- * slab of objects first.
+ * The object comes from the magazine of the calling thread, which
+ * is refilled from the free list when empty.
  *
  * @param pool pool to get object from
  * @param obj_p pointer to returned object
@@ -400,32 +922,33 @@ int obj_alloc(pool_t *pool, obj_t **obj_p)
 {
     int err;
     obj_t *obj;
-
-    /* reserve an object */
-    atomic_inc(&pool->count);
-
-    obj = ll_dequeue_obj(&pool->free_list);
-    if (unlikely(!obj)) {
-        if (pool->use_pre_alloc_buffer) {
-            /* The pool cannot expand, for instance in the case of the
-             * SBUF pool, so we must busy wait until a new buffer appears
-             * on the list. */
-            do {
-                SPINLOCK_BODY();
-            } while ((obj = ll_dequeue_obj(&pool->free_list)) == NULL);
+    struct pool_mag *mag;
+
+    mag = pool_mag(pool);
+    if (likely(mag != NULL)) {
+        if (unlikely(mag->num == 0)) {
+            err = pool_mag_refill(pool, mag);
+            if (unlikely(err))
+                return err;
         } else {
-            do {
-                pthread_mutex_lock(&pool->mutex);
-                err = pool_alloc_slab(pool);
-                pthread_mutex_unlock(&pool->mutex);
+            mag->hits++;
+        }
 
-                if (unlikely(err)) {
-                    atomic_dec(&pool->count);
-                    WARN();
-                    return err;
-                }
-            } while ((obj = ll_dequeue_obj(&pool->free_list)) == NULL);
+        /* The magazine holds the reference to the parent. */
+        obj = mag->objs[--mag->num];
+        mag->count++;
+    } else {
+        /* reserve an object */
+        atomic_inc(&pool->count);
+
+        err = pool_dequeue(pool, &obj);
+        if (unlikely(err)) {
+            atomic_dec(&pool->count);
+            return err;
         }
+
+        if (pool->parent)
+            obj_get(pool->parent);
     }
 
     assert(obj->obj_free == 1);
@@ -433,9 +956,6 @@ int obj_alloc(pool_t *pool, obj_t **obj_p)
 
     ref_set(&obj->obj_ref, 1);
 
-    if (pool->parent)
-        obj_get(pool->parent);
-
     /*
      * if any type specific per allocation initialization do it
      */
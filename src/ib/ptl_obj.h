@@ -36,6 +36,9 @@ struct obj {
         /** backpointer to pool that owns object */
     pool_t *obj_pool;
 
+        /** slab holding the object */
+    struct slab_info *obj_slab;
+
         /** backpointer to parent that owns pool */
     struct obj *obj_parent;
 
@@ -64,6 +67,10 @@ int pool_init(struct gbl *gbl, pool_t *pool, char *name, int size,
 
 int pool_fini(pool_t *pool);
 
+int pool_shrink(pool_t *pool);
+
+void pool_get_stats(pool_t *pool, struct pool_stats *stats);
+
 void obj_release(ref_t *ref);
 
 int obj_alloc(pool_t *pool, obj_t **p_obj);
@@ -279,6 +279,159 @@ param_t param[] = {
                                    .max = 1,
                                    .val = 0,
                                   },
+    /* 0 = linear list walk, 1 = hashed index, 2 = hashed index
+     * checked against the linear walk */
+    [PTL_MATCH_INDEX] = {
+                         .name = "PTL_MATCH_INDEX",
+                         .min = 0,
+                         .max = 2,
+                         .val = 1,
+                         },
+    /* rounded up to a power of 2 */
+    [PTL_MATCH_HASH_SIZE] = {
+                             .name = "PTL_MATCH_HASH_SIZE",
+                             .min = 1,
+                             .max = 16 * MiB,
+                             .val = 256,
+                             },
+    /* sends deferred by PtlStartBundle before a forced flush, 0
+     * disables bundling */
+    [PTL_BUNDLE_SIZE] = {
+                         .name = "PTL_BUNDLE_SIZE",
+                         .min = 0,
+                         .max = 4096,
+                         .val = 64,
+                         },
+    /* highest instruction set used by the atomic kernels: 0 = scalar,
+     * 1 = SSE2, 2 = AVX2, 3 = AVX-512 */
+    [PTL_ATOMIC_SIMD] = {
+                         .name = "PTL_ATOMIC_SIMD",
+                         .min = 0,
+                         .max = 3,
+                         .val = 3,
+                         },
+    /* number of locks serializing atomic operations on an NI, rounded
+     * up to a power of 2 */
+    [PTL_ATOMIC_LOCKS] = {
+                          .name = "PTL_ATOMIC_LOCKS",
+                          .min = 1,
+                          .max = 65536,
+                          .val = 64,
+                          },
+    /* progress threads per NI, each polling its own share of the
+     * completion and shared memory queues */
+    [PTL_PROGRESS_THREADS] = {
+                              .name = "PTL_PROGRESS_THREADS",
+                              .min = 1,
+                              .max = 64,
+                              .val = 1,
+                              },
+    /* datagrams read by a single recvmmsg on the UDP socket */
+    [PTL_UDP_RECV_BATCH] = {
+                            .name = "PTL_UDP_RECV_BATCH",
+                            .min = 1,
+                            .max = 1024,
+                            .val = 16,
+                            },
+    /* use UDP segmentation and receive offloads when available */
+    [PTL_UDP_OFFLOAD] = {
+                         .name = "PTL_UDP_OFFLOAD",
+                         .min = 0,
+                         .max = 1,
+                         .val = 1,
+                         },
+    /* UDP socket I/O: 0 recvmmsg/sendmmsg, 1 io_uring */
+    [PTL_UDP_ENGINE] = {
+                        .name = "PTL_UDP_ENGINE",
+                        .min = 0,
+                        .max = 1,
+                        .val = 0,
+                        },
+    /* io_uring SQ polling thread idle time in ms, 0 to disable it */
+    [PTL_UDP_URING_SQPOLL] = {
+                              .name = "PTL_UDP_URING_SQPOLL",
+                              .min = 0,
+                              .max = 60000,
+                              .val = 0,
+                              },
+    /* initial reliable UDP retransmission timeout, in ms */
+    [PTL_RUDP_RTO] = {
+                      .name = "PTL_RUDP_RTO",
+                      .min = 1,
+                      .max = 60000,
+                      .val = 20,
+                      },
+    /* reliable UDP datagrams dropped on purpose, per million */
+    [PTL_RUDP_LOSS] = {
+                       .name = "PTL_RUDP_LOSS",
+                       .min = 0,
+                       .max = 1000000,
+                       .val = 0,
+                       },
+    /* smallest TCP payload sent with MSG_ZEROCOPY, 0 to disable it */
+    [PTL_TCP_ZEROCOPY] = {
+                          .name = "PTL_TCP_ZEROCOPY",
+                          .min = 0,
+                          .max = LONG_MAX,
+                          .val = 32768,
+                          },
+    /* free objects each thread caches per pool, 0 disables the
+     * magazines */
+    [PTL_POOL_MAGAZINE] = {
+                           .name = "PTL_POOL_MAGAZINE",
+                           .min = 0,
+                           .max = 4096,
+                           .val = 32,
+                           },
+    /* milliseconds between two releases of the free slabs of the NI
+     * pools, 0 disables it */
+    [PTL_POOL_SHRINK_INTERVAL] = {
+                                  .name = "PTL_POOL_SHRINK_INTERVAL",
+                                  .min = 0,
+                                  .max = 3600000,
+                                  .val = 1000,
+                                  },
+    /* huge pages for buffer slabs, the shared memory comm pad and
+     * event queues: 0 none, 1 transparent, 2 hugetlb then
+     * transparent */
+    [PTL_HUGE_PAGES] = {
+                        .name = "PTL_HUGE_PAGES",
+                        .min = 0,
+                        .max = 2,
+                        .val = 0,
+                        },
+    /* use Cross Memory Attach for large shared memory transfers when
+     * KNEM isn't used and the kernel allows it */
+    [PTL_SHMEM_CMA] = {
+                       .name = "PTL_SHMEM_CMA",
+                       .min = 0,
+                       .max = 1,
+                       .val = 1,
+                       },
+    /* number of slots each bounce buffer is split into, so both sides
+     * of a shared memory transfer without KNEM copy at the same time */
+    [PTL_BOUNCE_NUM_SLOTS] = {
+                              .name = "PTL_BOUNCE_NUM_SLOTS",
+                              .min = 1,
+                              .max = 64,
+                              .val = 4,
+                              },
+    /* send the shared memory messages through one ring per pair of
+     * local ranks instead of one queue per receiver */
+    [PTL_SHMEM_RINGS] = {
+                         .name = "PTL_SHMEM_RINGS",
+                         .min = 0,
+                         .max = 1,
+                         .val = 0,
+                         },
+    /* place the shared memory queues, buffers and bounce buffers on
+     * the NUMA node of their owner */
+    [PTL_SHMEM_NUMA] = {
+                        .name = "PTL_SHMEM_NUMA",
+                        .min = 0,
+                        .max = 1,
+                        .val = 1,
+                        },
 };
 
 /**
@@ -54,6 +54,26 @@ enum {
     PTL_BOUNCE_NUM_BUFS,
     PTL_BOUNCE_BUF_SIZE,
     PTL_DISABLE_MEM_REG_CACHE,
+    PTL_MATCH_INDEX,
+    PTL_MATCH_HASH_SIZE,
+    PTL_BUNDLE_SIZE,
+    PTL_ATOMIC_SIMD,
+    PTL_ATOMIC_LOCKS,
+    PTL_PROGRESS_THREADS,
+    PTL_UDP_RECV_BATCH,
+    PTL_UDP_OFFLOAD,
+    PTL_UDP_ENGINE,
+    PTL_UDP_URING_SQPOLL,
+    PTL_RUDP_RTO,
+    PTL_RUDP_LOSS,
+    PTL_TCP_ZEROCOPY,
+    PTL_POOL_MAGAZINE,
+    PTL_POOL_SHRINK_INTERVAL,
+    PTL_HUGE_PAGES,
+    PTL_SHMEM_CMA,
+    PTL_BOUNCE_NUM_SLOTS,
+    PTL_SHMEM_RINGS,
+    PTL_SHMEM_NUMA,
     PTL_PARAM_LAST,             /* keep me last */
 };
 
@@ -8,24 +8,31 @@
  * deallocation of fixed sized objects without fragmentation and allows
  * memory usage to grow as needed.
  *
- * Slabs are maintained in 'chunks' which are page sized arrays of
- * slab_info structs.
- *
- * And chunks are maintained in circular lists within pools. The
- * current design is very simple and only allows the object resources
- * in a pool to grow. Additional work would allow this design to
- * dynamically grow and shrink the amount of memory used in a given
- * pool.
+ * Each slab is described by a slab_info struct, kept on a list in its
+ * pool. A pool grows by a slab when its free list is empty, and
+ * pool_shrink() gives back the slabs whose objects are all on the
+ * free list. A slab owns a range of object indexes, which is kept by
+ * the pool when the slab is released and reused by the next slab.
  *
  * Pools are designed to allow an object to 'own' pools of other objects
  * in a heirarchy. All objects eventually belong to an NI which is the
  * root of Portals4 resources.
+ *
+ * In front of the shared free list, each thread has a magazine per
+ * pool: a small stack of free objects it allocates from and releases
+ * to without any atomic operation. Magazines are refilled from and
+ * flushed to the free list by batches.
  */
 
 #ifndef PTL_POOL_H
 #define PTL_POOL_H
 
 struct ni;
+struct pool_mag;
+
+/* Most threads with their own magazines. The other threads use the
+ * free lists directly. */
+#define POOL_MAG_THREADS	64
 
 /**
  * Pool types.
@@ -46,6 +53,15 @@ enum obj_type {
     POOL_LAST,                  /* keep me last */
 };
 
+/**
+ * How memory from huge_alloc() is backed.
+ */
+enum huge_mode {
+    HUGE_NONE,                  /* regular pages */
+    HUGE_THP,                   /* transparent huge pages */
+    HUGE_TLB,                   /* hugetlb pages */
+};
+
 /**
  * A slab_info struct holds information about a 'slab'.
  * If the pool is used to hold buffers the priv pointer
@@ -54,9 +70,21 @@ enum obj_type {
  * buffer separately.
  */
 struct slab_info {
-        /** address of slab */
+        /** list head to add to pool slab list */
+    struct list_head list;
+
+        /** address of slab, NULL once released */
     void *addr;
 
+        /** index of the first object of the slab */
+    unsigned int index;
+
+        /** number of free objects, counted by pool_shrink() */
+    unsigned int num_free;
+
+        /** how the slab memory is backed */
+    enum huge_mode huge;
+
         /** slab private data */
 #if WITH_TRANSPORT_IB
     struct ibv_mr *mr;
@@ -65,27 +93,6 @@ struct slab_info {
 
 typedef struct slab_info slab_info_t;
 
-/**
- * A chunk is a page sized structure that holds an array
- * of slab_info structs.  Chunks are kept on a circular list
- * in a pool.
- */
-struct chunk {
-        /** list head to add to pool chunk list */
-    struct list_head list;
-
-        /** number of entries in chunk->slab_list */
-    unsigned int max_slabs;
-
-        /** next slab_list entry to allocate */
-    unsigned int num_slabs;
-
-        /** space for slab_list with max_slabs entries */
-    slab_info_t slab_list[0];
-};
-
-typedef struct chunk chunk_t;
-
 /**
  * A pool struct holds information about a type of object
  * that it manages.
@@ -111,8 +118,23 @@ struct pool {
         /** if set, called when object moved to the free list */
     void (*cleanup) (void *arg);
 
-        /** list of chunks each of which holds an array of slab descriptors */
-    struct list_head chunk_list;
+        /** list of slabs in use */
+    struct list_head slab_list;
+
+        /** released slabs, kept for their index range */
+    struct list_head spare_list;
+
+        /** number of slabs in use */
+    unsigned int num_slabs;
+
+        /** highest number of slabs ever in use */
+    unsigned int peak_slabs;
+
+        /** number of slabs given back by pool_shrink() */
+    unsigned long released;
+
+        /** threads reading the free list, see pool_shrink() */
+    atomic_t dequeuers;
 
         /** lock to protect pool */
     pthread_mutex_t mutex;
@@ -143,8 +165,46 @@ struct pool {
 
         /** address of preallocated slab */
     void *pre_alloc_buffer;
+
+        /** slabs are allocated with huge_alloc() */
+    int use_huge_pages;
+
+        /** per thread magazines, NULL if the pool has none */
+    struct pool_mag **mags;
+
+        /** number of objects a magazine can hold */
+    unsigned int mag_size;
 };
 
 typedef struct pool pool_t;
 
+/**
+ * Pool statistics, see pool_get_stats().
+ */
+struct pool_stats {
+        /** number of objects currently allocated */
+    long in_use;
+
+        /** number of free objects held in magazines */
+    unsigned long cached;
+
+        /** allocations served by a magazine without refill */
+    unsigned long hits;
+
+        /** magazine refills from the free list */
+    unsigned long refills;
+
+        /** magazine flushes to the free list */
+    unsigned long flushes;
+
+        /** memory held by the pool slabs, in bytes */
+    unsigned long bytes;
+
+        /** highest memory ever held by the pool slabs, in bytes */
+    unsigned long peak_bytes;
+
+        /** number of slabs given back by pool_shrink() */
+    unsigned long released;
+};
+
 #endif
@@ -497,6 +497,12 @@ int _PtlEQWait(PPEGBL ptl_handle_eq_t eq_handle, ptl_event_t *event_p);
 int _PtlEQPoll(PPEGBL const ptl_handle_eq_t * eq_handles, unsigned int size,
                ptl_time_t timeout, ptl_event_t *event_p,
                unsigned int *which_p);
+int _PtlEQGetBatch(PPEGBL ptl_handle_eq_t eq_handle, ptl_event_t *events,
+                   unsigned int max, unsigned int *count_p);
+int _PtlEQPollBatch(PPEGBL const ptl_handle_eq_t * eq_handles,
+                    unsigned int size, ptl_time_t timeout,
+                    ptl_event_t *events, unsigned int max,
+                    unsigned int *count_p, unsigned int *which);
 int _PtlGetUid(PPEGBL ptl_handle_ni_t ni_handle, ptl_uid_t *uid_p);
 int _PtlGetId(PPEGBL ptl_handle_ni_t ni_handle, ptl_process_t *id_p);
 int _PtlGetPhysId(PPEGBL ptl_handle_ni_t ni_handle, ptl_process_t *id_p);
@@ -636,7 +642,9 @@ int _PtlPTEnable(PPEGBL ptl_handle_ni_t ni_handle, ptl_pt_index_t pt_index);
 #define _PtlEQAlloc PtlEQAlloc
 #define _PtlEQFree PtlEQFree
 #define _PtlEQGet PtlEQGet
+#define _PtlEQGetBatch PtlEQGetBatch
 #define _PtlEQPoll PtlEQPoll
+#define _PtlEQPollBatch PtlEQPollBatch
 #define _PtlEQWait PtlEQWait
 #define _PtlEndBundle PtlEndBundle
 #define _PtlFetchAtomic PtlFetchAtomic
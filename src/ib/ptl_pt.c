@@ -7,6 +7,324 @@
 
 #include "ptl_loc.h"
 
+/**
+ * Allocate hash buckets.
+ *
+ * @param[in] num_buckets to allocate
+ *
+ * @return the initialized buckets or NULL
+ */
+static struct list_head *alloc_buckets(unsigned int num_buckets)
+{
+    struct list_head *buckets;
+    unsigned int i;
+
+    buckets = malloc(num_buckets * sizeof(*buckets));
+    if (!buckets)
+        return NULL;
+
+    for (i = 0; i < num_buckets; i++)
+        INIT_LIST_HEAD(&buckets[i]);
+
+    return buckets;
+}
+
+/**
+ * Initialize one match index.
+ *
+ * @param[in] index to initialize
+ * @param[in] num_buckets a power of 2
+ *
+ * @return PTL_OK		on success
+ * @return PTL_NO_SPACE		if the buckets could not be allocated
+ */
+static int match_index_init(struct match_index *index,
+                            unsigned int num_buckets)
+{
+    index->buckets = alloc_buckets(num_buckets);
+    if (!index->buckets)
+        return PTL_NO_SPACE;
+
+    INIT_LIST_HEAD(&index->wildcard_list);
+    index->hash_mask = num_buckets - 1;
+
+    return PTL_OK;
+}
+
+/**
+ * Setup the match and unexpected indexes of a pt entry.
+ *
+ * The indexes are only used when the NI does matching and the
+ * PTL_MATCH_INDEX parameter asks for them.
+ *
+ * @param[in] pt entry to setup
+ * @param[in] matching whether the NI is a matching NI
+ *
+ * @return PTL_OK		on success
+ * @return PTL_NO_SPACE		if the buckets could not be allocated
+ */
+int pt_match_index_init(pt_t *pt, int matching)
+{
+    unsigned int num_buckets = 1;
+    int err;
+
+    pt->match_seq = 0;
+    pt->priority_index.buckets = NULL;
+    pt->overflow_index.buckets = NULL;
+    pt->unexpected_index.buckets = NULL;
+
+    if (!matching || get_param(PTL_MATCH_INDEX) == PT_MATCH_LINEAR) {
+        pt->match_mode = PT_MATCH_LINEAR;
+        return PTL_OK;
+    }
+
+    pt->match_mode = get_param(PTL_MATCH_INDEX);
+
+    while (num_buckets < get_param(PTL_MATCH_HASH_SIZE))
+        num_buckets <<= 1;
+
+    err = match_index_init(&pt->priority_index, num_buckets);
+    if (err)
+        return err;
+
+    err = match_index_init(&pt->overflow_index, num_buckets);
+    if (err)
+        goto err1;
+
+    pt->unexpected_index.buckets = alloc_buckets(num_buckets);
+    if (!pt->unexpected_index.buckets) {
+        err = PTL_NO_SPACE;
+        goto err2;
+    }
+    pt->unexpected_index.hash_mask = num_buckets - 1;
+
+    return PTL_OK;
+
+  err2:
+    free(pt->overflow_index.buckets);
+    pt->overflow_index.buckets = NULL;
+  err1:
+    free(pt->priority_index.buckets);
+    pt->priority_index.buckets = NULL;
+    return err;
+}
+
+/**
+ * Release the match and unexpected indexes of a pt entry.
+ *
+ * @param[in] pt entry to cleanup
+ */
+void pt_match_index_fini(pt_t *pt)
+{
+    free(pt->priority_index.buckets);
+    pt->priority_index.buckets = NULL;
+
+    free(pt->overflow_index.buckets);
+    pt->overflow_index.buckets = NULL;
+
+    free(pt->unexpected_index.buckets);
+    pt->unexpected_index.buckets = NULL;
+
+    pt->match_mode = PT_MATCH_LINEAR;
+}
+
+/**
+ * Add an ME to the match index of the list it is on.
+ *
+ * @pre caller should hold the pt spinlock.
+ *
+ * @param[in] pt entry the ME was appended to
+ * @param[in] me the appended ME
+ */
+void pt_match_index_add(pt_t *pt, me_t *me)
+{
+    struct match_index *index;
+
+    me->match_seq = pt->match_seq++;
+
+    if (pt->match_mode == PT_MATCH_LINEAR)
+        return;
+
+    index = (me->ptl_list == PTL_PRIORITY_LIST) ?
+        &pt->priority_index : &pt->overflow_index;
+
+    if (me->ignore_bits == 0)
+        list_add_tail(&me->match_list,
+                      match_index_bucket(index, me->match_bits));
+    else
+        list_add_tail(&me->match_list, &index->wildcard_list);
+}
+
+/**
+ * Remove an ME from the match index.
+ *
+ * This is safe to call on an ME that was never indexed.
+ *
+ * @pre caller should hold the pt spinlock.
+ *
+ * @param[in] pt entry the ME is unlinked from
+ * @param[in] me the ME being unlinked
+ */
+void pt_match_index_del(pt_t *pt, me_t *me)
+{
+    list_del_init(&me->match_list);
+}
+
+/**
+ * Find the first ME in list order that matches a message.
+ *
+ * @param[in] index to search
+ * @param[in] buf the message
+ * @param[in] match_bits the match bits of the message
+ *
+ * @return the ME or NULL if none match
+ */
+static me_t *match_index_lookup(struct match_index *index, buf_t *buf,
+                                uint64_t match_bits)
+{
+    me_t *me;
+    me_t *exact = NULL;
+
+    list_for_each_entry(me, match_index_bucket(index, match_bits),
+                        match_list) {
+        if (me->match_bits == match_bits && check_match(buf, me)) {
+            exact = me;
+            break;
+        }
+    }
+
+    /* A wildcard ME wins only if it was appended before the exact
+     * match, so stop looking once past it. */
+    list_for_each_entry(me, &index->wildcard_list, match_list) {
+        if (exact && me->match_seq > exact->match_seq)
+            break;
+
+        if (check_match(buf, me))
+            return me;
+    }
+
+    return exact;
+}
+
+/**
+ * Find the ME a message matches, looking at the priority list
+ * first and then at the overflow list.
+ *
+ * @pre caller should hold the pt spinlock.
+ *
+ * @param[in] pt entry the message is addressed to
+ * @param[in] buf the message
+ *
+ * @return the ME or NULL if none match
+ */
+me_t *pt_match_index_find(pt_t *pt, buf_t *buf)
+{
+    const req_hdr_t *hdr = (req_hdr_t *) buf->data;
+    uint64_t match_bits = le64_to_cpu(hdr->match_bits);
+    me_t *me;
+
+    me = match_index_lookup(&pt->priority_index, buf, match_bits);
+    if (!me)
+        me = match_index_lookup(&pt->overflow_index, buf, match_bits);
+
+    return me;
+}
+
+/**
+ * Return the source key of a message, as used by the unexpected
+ * index.
+ *
+ * @param[in] ni the message was received on
+ * @param[in] hdr of the message
+ *
+ * @return the key
+ */
+static inline uint64_t buf_source_key(const ni_t *ni, const req_hdr_t *hdr)
+{
+    if (ni->options & PTL_NI_LOGICAL)
+        return le32_to_cpu(hdr->h1.src_rank);
+    else
+        return ((uint64_t)le32_to_cpu(hdr->h1.src_nid) << 32) |
+            le32_to_cpu(hdr->h1.src_pid);
+}
+
+/**
+ * Add a buf to the unexpected index.
+ *
+ * @pre caller should hold the pt spinlock.
+ *
+ * @param[in] pt entry the buf was put on the unexpected list of
+ * @param[in] buf the unexpected message
+ */
+void pt_unexpected_add(pt_t *pt, buf_t *buf)
+{
+    const req_hdr_t *hdr = (req_hdr_t *) buf->data;
+
+    if (pt->match_mode == PT_MATCH_LINEAR)
+        return;
+
+    list_add_tail(&buf->unexpected_match_list,
+                  unexpected_index_bucket(&pt->unexpected_index,
+                                          le64_to_cpu(hdr->match_bits),
+                                          buf_source_key(obj_to_ni(buf),
+                                                         hdr)));
+}
+
+/**
+ * Remove a buf from the unexpected index.
+ *
+ * This is safe to call on a buf that was never indexed.
+ *
+ * @pre caller should hold the pt spinlock.
+ *
+ * @param[in] pt entry the buf is removed from
+ * @param[in] buf the unexpected message
+ */
+void pt_unexpected_del(pt_t *pt, buf_t *buf)
+{
+    list_del_init(&buf->unexpected_match_list);
+}
+
+/**
+ * Find the bucket of the unexpected index that holds all the
+ * messages an ME can match.
+ *
+ * Only MEs with no ignore bits and a fully specified source can
+ * use the index; everything else has to walk the unexpected list.
+ *
+ * @pre caller should hold the pt spinlock.
+ *
+ * @param[in] pt entry to search
+ * @param[in] le the LE/ME to match
+ *
+ * @return the bucket or NULL if the index can't be used
+ */
+struct list_head *pt_unexpected_bucket(pt_t *pt, const le_t *le)
+{
+    const ni_t *ni = obj_to_ni(le);
+    const me_t *me = (me_t *)le;
+    uint64_t source;
+
+    if (pt->match_mode == PT_MATCH_LINEAR || le->type != TYPE_ME ||
+        me->ignore_bits != 0)
+        return NULL;
+
+    if (ni->options & PTL_NI_LOGICAL) {
+        if (me->id.rank == PTL_RANK_ANY)
+            return NULL;
+
+        source = me->id.rank;
+    } else {
+        if (me->id.phys.nid == PTL_NID_ANY || me->id.phys.pid == PTL_PID_ANY)
+            return NULL;
+
+        source = ((uint64_t)me->id.phys.nid << 32) | me->id.phys.pid;
+    }
+
+    return unexpected_index_bucket(&pt->unexpected_index, me->match_bits,
+                                   source);
+}
+
 /**
  * Get pt index.
  *
@@ -121,6 +439,13 @@ int _PtlPTAlloc(PPEGBL ptl_handle_ni_t ni_handle, unsigned int options,
     }
 
     pt = &ni->pt[index];
+
+    err = pt_match_index_init(pt, ni->options & PTL_NI_MATCHING);
+    if (unlikely(err)) {
+        pthread_mutex_unlock(&ni->pt_mutex);
+        goto err3;
+    }
+
     pt->in_use = 1;
     pthread_mutex_unlock(&ni->pt_mutex);
 
@@ -212,6 +537,8 @@ int _PtlPTFree(PPEGBL ptl_handle_ni_t ni_handle, ptl_pt_index_t pt_index)
 
     PTL_FASTLOCK_DESTROY(&pt->lock);
 
+    pt_match_index_fini(pt);
+
     pt->in_use = 0;
     pt->state = PT_DISABLED;
 
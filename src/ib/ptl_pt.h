@@ -12,6 +12,9 @@
 #include "ptl_locks.h"
 
 struct eq;
+struct le;
+struct me;
+struct buf;
 
 /**
  * pt state variables.
@@ -23,6 +26,51 @@ enum pt_state {
     PT_AUTO_DISABLED = 1 << 1,
 };
 
+/**
+ * How incoming messages are matched against the ME lists,
+ * selected by the PTL_MATCH_INDEX parameter.
+ */
+enum pt_match_mode {
+    PT_MATCH_LINEAR = 0,        /* walk the priority/overflow lists */
+    PT_MATCH_HASHED = 1,        /* use the match-bits index */
+    PT_MATCH_VERIFY = 2,        /* use the index and check it against
+                                 * the linear walk */
+};
+
+/**
+ * Match-bits index over one of the pt ME lists.
+ *
+ * MEs with no ignore bits are hashed on their match bits. All
+ * others go on the wildcard list. Both keep append order, and
+ * the sequence stamp of each ME lets the first match in list
+ * order be picked between the two.
+ */
+struct match_index {
+        /** number of hash buckets - 1 */
+    unsigned int hash_mask;
+
+        /** hash buckets of exact match MEs */
+    struct list_head *buckets;
+
+        /** MEs with some ignore bits set */
+    struct list_head wildcard_list;
+};
+
+/**
+ * Index over the unexpected list.
+ *
+ * Bufs are hashed on their match bits and source, so an ME with
+ * no wildcard only has to look at one bucket. Buckets keep the
+ * arrival order.
+ */
+struct unexpected_index {
+        /** number of hash buckets - 1 */
+    unsigned int hash_mask;
+
+        /** hash buckets of unexpected bufs */
+    struct list_head *buckets;
+};
+
 /**
  * pt class into.
  */
@@ -57,12 +105,27 @@ struct pt {
         /** list of overflow me/le's */
     struct list_head overflow_list;
 
+        /** how messages are matched on this pt */
+    enum pt_match_mode match_mode;
+
+        /** next sequence stamp given to an appended me */
+    uint64_t match_seq;
+
+        /** index over the priority list */
+    struct match_index priority_index;
+
+        /** index over the overflow list */
+    struct match_index overflow_index;
+
         /** size of unexpected list */
     atomic_t unexpected_size;
 
         /** list of unexpected xt's */
     struct list_head unexpected_list;
 
+        /** index over the unexpected list */
+    struct unexpected_index unexpected_index;
+
         /** to attach on the EQ flow control list if this PT does it. **/
     struct list_head flowctrl_list;
 
@@ -72,4 +135,70 @@ struct pt {
 
 typedef struct pt pt_t;
 
+int pt_match_index_init(pt_t *pt, int matching);
+
+void pt_match_index_fini(pt_t *pt);
+
+void pt_match_index_add(pt_t *pt, struct me *me);
+
+void pt_match_index_del(pt_t *pt, struct me *me);
+
+struct me *pt_match_index_find(pt_t *pt, struct buf *buf);
+
+void pt_unexpected_add(pt_t *pt, struct buf *buf);
+
+void pt_unexpected_del(pt_t *pt, struct buf *buf);
+
+struct list_head *pt_unexpected_bucket(pt_t *pt, const struct le *le);
+
+/**
+ * @brief Hash a key to a bucket number.
+ *
+ * @param[in] key The key to hash.
+ * @param[in] hash_mask The number of buckets - 1.
+ *
+ * @return the bucket number.
+ */
+static inline unsigned int match_hash(uint64_t key, unsigned int hash_mask)
+{
+    /* Fibonacci hashing, so that keys that only differ in
+     * their upper bits still spread over the buckets. */
+    return ((key * 0x9e3779b97f4a7c15ULL) >> 32) & hash_mask;
+}
+
+/**
+ * @brief Hash match bits to a bucket of a match index.
+ *
+ * @param[in] index The match index.
+ * @param[in] match_bits The match bits to hash.
+ *
+ * @return the bucket.
+ */
+static inline struct list_head *match_index_bucket(const struct match_index
+                                                   *index,
+                                                   uint64_t match_bits)
+{
+    return &index->buckets[match_hash(match_bits, index->hash_mask)];
+}
+
+/**
+ * @brief Find the bucket of the unexpected index for a message.
+ *
+ * @param[in] index The unexpected index.
+ * @param[in] match_bits The match bits of the message.
+ * @param[in] source The rank, or the nid and pid, of the initiator.
+ *
+ * @return the bucket.
+ */
+static inline struct list_head *unexpected_index_bucket(const struct
+                                                        unexpected_index
+                                                        *index,
+                                                        uint64_t match_bits,
+                                                        uint64_t source)
+{
+    return &index->buckets[match_hash(match_bits ^
+                                      (source * 0xff51afd7ed558ccdULL),
+                                      index->hash_mask)];
+}
+
 #endif /* PTL_PT_H */
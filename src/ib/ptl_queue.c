@@ -33,6 +33,39 @@ void enqueue(const void *comm_pad, queue_t *restrict queue, obj_t *obj)
         OFF2PTR(comm_pad, off_prev)->next = (void *)off;
 }
 
+/**
+ * @brief enqueue several bufs on a queue at once.
+ *
+ * The objects are linked together first, so the queue tail is
+ * swapped only once for all of them.
+ *
+ * @param[in] queue the queue.
+ * @param[in] objs the objects to enqueue, in order.
+ * @param[in] num_objs the number of objects, at least 1.
+ */
+void enqueue_list(const void *comm_pad, queue_t *restrict queue,
+                  obj_t **objs, int num_objs)
+{
+    unsigned long off;
+    unsigned long off_prev;
+    int i;
+
+    for (i = 0; i < num_objs - 1; i++)
+        objs[i]->next = (void *)PTR2OFF(comm_pad, objs[i + 1]);
+    objs[num_objs - 1]->next = NULL;
+
+    off = PTR2OFF(comm_pad, objs[num_objs - 1]);
+    off_prev =
+        (uintptr_t) atomic_swap_ptr((void **)(uintptr_t) & (queue->tail),
+                                    (void *)(uintptr_t) off);
+
+    off = PTR2OFF(comm_pad, objs[0]);
+    if (off_prev == 0)
+        queue->head = off;
+    else
+        OFF2PTR(comm_pad, off_prev)->next = (void *)off;
+}
+
 /**
  * @brief dequeue a buf from a shared memory queue.
  *
@@ -79,6 +112,72 @@ obj_t *dequeue(const void *comm_pad, queue_t *queue)
     return obj;
 }
 
+/**
+ * @brief Announce that the consumer is about to sleep.
+ *
+ * The consumer must then only sleep if the queue is still empty, and
+ * call queue_wait_done() when it wakes up.
+ *
+ * @param[in] queue the queue.
+ *
+ * @return 1 if the queue is empty and the consumer can sleep, 0 if
+ * it must dequeue instead.
+ */
+int queue_wait_prepare(queue_t *queue)
+{
+    queue->waiting = 1;
+    __sync_synchronize();
+
+    if (queue->shadow_head || queue->tail) {
+        queue->waiting = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * @brief Announce that the consumer is awake.
+ *
+ * @param[in] queue the queue.
+ */
+void queue_wait_done(queue_t *queue)
+{
+    queue->waiting = 0;
+}
+
+/**
+ * @brief Check whether the consumer must be woken up after an enqueue.
+ *
+ * Only one of the producers racing gets a positive answer.
+ *
+ * @param[in] queue the queue.
+ *
+ * @return 1 if the caller must wake the consumer up, 0 otherwise.
+ */
+int queue_wake_needed(queue_t *queue)
+{
+    __sync_synchronize();
+
+    return queue->waiting &&
+        __sync_bool_compare_and_swap(&queue->waiting, 1, 0);
+}
+
+/**
+ * @brief Check whether a queue is empty.
+ *
+ * The answer is only reliable for the consumer; a producer can be
+ * adding an object at the same time.
+ *
+ * @param[in] queue the queue.
+ *
+ * @return 1 if the queue is empty, 0 otherwise.
+ */
+int queue_is_empty(const queue_t *queue)
+{
+    return !queue->shadow_head && !queue->tail;
+}
+
 /**
  * @brief Initialize a queue.
  *
@@ -89,4 +188,105 @@ void queue_init(queue_t *queue)
     queue->head = 0;
     queue->tail = 0;
     queue->shadow_head = 0;
+    queue->waiting = 0;
+    queue->wake_time = 0;
+}
+
+/**
+ * @brief Initialize a single producer, single consumer ring.
+ *
+ * @param[in] spsc the ring to initialize
+ */
+void spsc_init(spsc_t *spsc)
+{
+    spsc->tail = 0;
+    spsc->head_cache = 0;
+    spsc->head = 0;
+    spsc->tail_cache = 0;
+}
+
+/**
+ * @brief enqueue several bufs on a ring at once.
+ *
+ * Only one thread at a time may enqueue on a ring. The consumer sees
+ * all the objects at once.
+ *
+ * @param[in] spsc the ring.
+ * @param[in] size the number of entries of the ring, a power of 2.
+ * @param[in] objs the objects to enqueue, in order.
+ * @param[in] num_objs the number of objects.
+ *
+ * @return 1 if the objects were enqueued, 0 if there is not enough
+ * room for all of them.
+ */
+int spsc_enqueue(const void *comm_pad, spsc_t *spsc, unsigned int size,
+                 obj_t **objs, int num_objs)
+{
+    unsigned long tail = spsc->tail;
+    int i;
+
+    /* Only look at the consumer cacheline when the ring looks
+     * full. */
+    if (tail + num_objs - spsc->head_cache > size) {
+        spsc->head_cache = spsc->head;
+        if (tail + num_objs - spsc->head_cache > size)
+            return 0;
+    }
+
+    for (i = 0; i < num_objs; i++)
+        spsc->entries[(tail + i) & (size - 1)] =
+            PTR2OFF(comm_pad, objs[i]);
+
+    /* Write the entries before publishing them. */
+    __sync_synchronize();
+    spsc->tail = tail + num_objs;
+
+    return 1;
+}
+
+/**
+ * @brief dequeue a buf from a ring.
+ *
+ * @param[in] spsc the ring.
+ * @param[in] size the number of entries of the ring, a power of 2.
+ *
+ * @return an object, or NULL if the ring is empty.
+ */
+obj_t *spsc_dequeue(const void *comm_pad, spsc_t *spsc, unsigned int size)
+{
+    unsigned long head = spsc->head;
+    unsigned long off;
+
+    /* Only look at the producer cacheline when all the entries seen
+     * so far are consumed. */
+    if (head == spsc->tail_cache) {
+        spsc->tail_cache = spsc->tail;
+        if (head == spsc->tail_cache)
+            return NULL;
+
+        /* Read the entries after the tail. */
+        __sync_synchronize();
+    }
+
+    off = spsc->entries[head & (size - 1)];
+
+    /* Read the entry before giving it back to the producer. */
+    __sync_synchronize();
+    spsc->head = head + 1;
+
+    return OFF2PTR(comm_pad, off);
+}
+
+/**
+ * @brief Check whether a ring is empty.
+ *
+ * The answer is only reliable for the consumer.
+ *
+ * @param[in] spsc the ring.
+ *
+ * @return 1 if the ring is empty, 0 otherwise.
+ */
+int spsc_is_empty(const spsc_t *spsc)
+{
+    return spsc->head == spsc->tail;
 }
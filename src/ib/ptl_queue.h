@@ -18,14 +18,50 @@ struct queue {
     /* The Second Cacheline */
     unsigned long shadow_head;
     uint8_t pad2[CACHELINE_WIDTH - sizeof(unsigned long)];
+    /* The Third Cacheline, to sleep while the queue is empty */
+    unsigned long waiting;
+    uint64_t wake_time;         /* when the sleeper was woken up, in ns */
+    uint8_t pad3[CACHELINE_WIDTH - sizeof(unsigned long) - sizeof(uint64_t)];
 };
 
 typedef struct queue queue_t;
+
+/**
+ * @brief shared memory single producer, single consumer ring of
+ * buffers
+ */
+struct spsc {
+    /* The First Cacheline, written by the producer */
+    unsigned long tail;
+    unsigned long head_cache;   /* last head seen by the producer */
+    uint8_t pad1[CACHELINE_WIDTH - (2 * sizeof(unsigned long))];
+    /* The Second Cacheline, written by the consumer */
+    unsigned long head;
+    unsigned long tail_cache;   /* last tail seen by the consumer */
+    uint8_t pad2[CACHELINE_WIDTH - (2 * sizeof(unsigned long))];
+    /* Buffer offsets in the comm pad */
+    unsigned long entries[0];
+};
+
+typedef struct spsc spsc_t;
 struct obj;
 
 void queue_init(queue_t *queue);
 void enqueue(const void *comm_pad, queue_t *restrict queue, struct obj *obj);
+void enqueue_list(const void *comm_pad, queue_t *restrict queue,
+                  struct obj **objs, int num_objs);
 struct obj *dequeue(const void *comm_pad, queue_t *queue);
+int queue_wait_prepare(queue_t *queue);
+void queue_wait_done(queue_t *queue);
+int queue_wake_needed(queue_t *queue);
+int queue_is_empty(const queue_t *queue);
+
+void spsc_init(spsc_t *spsc);
+int spsc_enqueue(const void *comm_pad, spsc_t *spsc, unsigned int size,
+                 struct obj **objs, int num_objs);
+struct obj *spsc_dequeue(const void *comm_pad, spsc_t *spsc,
+                         unsigned int size);
+int spsc_is_empty(const spsc_t *spsc);
 
 
 #endif /* PTL_QUEUE_H */
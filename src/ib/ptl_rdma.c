@@ -65,6 +65,9 @@ static int rdma_init_connect(ni_t *ni, conn_t *conn)
 /**
  * @brief Build and post an send work request to transfer
  *
+ * While the NI is bundling, requests from the initiator are only
+ * built here, and posted later by rdma_send_bundle().
+ *
  * @param[in] buf A buf holding state for the send operation.
  *
  * @return status
@@ -73,15 +76,15 @@ static int rdma_send_message(buf_t *buf, int from_init)
 {
     int err;
     struct ibv_send_wr *bad_wr;
-    struct ibv_send_wr wr;
-    struct ibv_sge sg_list;
+    struct ibv_send_wr *wr = &buf->transfer.rdma.send_wr;
+    struct ibv_sge *sg_list = &buf->transfer.rdma.send_sge;
     conn_t *conn = buf->conn;
 
-    wr.wr_id = (uintptr_t) buf;
-    wr.next = NULL;
-    wr.sg_list = &sg_list;
-    wr.num_sge = 1;
-    wr.opcode = IBV_WR_SEND;
+    wr->wr_id = (uintptr_t) buf;
+    wr->next = NULL;
+    wr->sg_list = sg_list;
+    wr->num_sge = 1;
+    wr->opcode = IBV_WR_SEND;
 
     if ((buf->event_mask & XX_SIGNALED) ||
         (atomic_inc(&buf->conn->rdma.send_comp_threshold) ==
@@ -92,30 +95,30 @@ static int rdma_send_message(buf_t *buf, int from_init)
                                                      get_param
                                                      (PTL_MAX_SEND_COMP_THRESHOLD)))
     {
-        wr.send_flags = IBV_SEND_SIGNALED;
+        wr->send_flags = IBV_SEND_SIGNALED;
         atomic_set(&buf->conn->rdma.send_comp_threshold, 0);
 
         /* Keep the buffer from being freed until we get the
          * completion. */
         buf_get(buf);
     } else {
-        wr.send_flags = 0;
+        wr->send_flags = 0;
     }
 
     if (buf->event_mask & XX_INLINE) {
-        wr.send_flags |= IBV_SEND_INLINE;
+        wr->send_flags |= IBV_SEND_INLINE;
 
-        if (wr.send_flags == IBV_SEND_INLINE) {
+        if (wr->send_flags == IBV_SEND_INLINE) {
             /* Inline and no completion required: fire and forget. If
              * there is an error, we will get a completion anyway, so
              * we must ignore it. */
-            wr.wr_id = 0;
+            wr->wr_id = 0;
         }
     }
 
-    sg_list.addr = (uintptr_t) buf->internal_data;
-    sg_list.lkey = buf->rdma.lkey;
-    sg_list.length = buf->length;
+    sg_list->addr = (uintptr_t) buf->internal_data;
+    sg_list->lkey = buf->rdma.lkey;
+    sg_list->length = buf->length;
 
     buf->type = BUF_SEND;
 
@@ -131,6 +134,10 @@ static int rdma_send_message(buf_t *buf, int from_init)
         /* If the high water mark is reached, wait until we go back to
          * the low watermark (=1/2 high WM). */
         if (atomic_read(&buf->conn->rdma.num_req_posted) >= limit) {
+            /* The deferred requests must be posted for their
+             * completions to come back. */
+            ni_bundle_flush(obj_to_ni(buf));
+
             limit /= 2;
             while (atomic_read(&buf->conn->rdma.num_req_posted) >= limit) {
                 pthread_yield();
@@ -138,16 +145,19 @@ static int rdma_send_message(buf_t *buf, int from_init)
             }
         }
 
-        if (wr.send_flags & IBV_SEND_SIGNALED) {
+        if (wr->send_flags & IBV_SEND_SIGNALED) {
             /* Atomically set buf->init_req_completes to the current value of
              * conn->rdma.num_req_posted and set
              * conn->rdma.num_req_posted to 0. */
             buf->transfer.rdma.num_req_completes =
                 atomic_swap(&conn->rdma.num_req_not_comp, 0);
         }
+
+        if (ni_bundle_add(obj_to_ni(buf), buf) == PTL_OK)
+            return PTL_OK;
     }
 
-    err = ibv_post_send(buf->dest.rdma.qp, &wr, &bad_wr);
+    err = ibv_post_send(buf->dest.rdma.qp, wr, &bad_wr);
     if (err) {
         WARN();
 
@@ -157,6 +167,35 @@ static int rdma_send_message(buf_t *buf, int from_init)
     return PTL_OK;
 }
 
+/**
+ * @brief Post the send work requests of a bundle.
+ *
+ * The work requests of consecutive buffers going to the same QP are
+ * chained and posted with a single ibv_post_send.
+ *
+ * @param[in] bufs the buffers prepared by rdma_send_message.
+ * @param[in] num_bufs the number of buffers.
+ */
+static void rdma_send_bundle(buf_t **bufs, int num_bufs)
+{
+    struct ibv_send_wr *bad_wr;
+    int i;
+    int j;
+
+    for (i = 0; i < num_bufs; i = j) {
+        struct ibv_qp *qp = bufs[i]->dest.rdma.qp;
+
+        for (j = i + 1; j < num_bufs && bufs[j]->dest.rdma.qp == qp; j++)
+            bufs[j - 1]->transfer.rdma.send_wr.next =
+                &bufs[j]->transfer.rdma.send_wr;
+
+        bufs[j - 1]->transfer.rdma.send_wr.next = NULL;
+
+        if (ibv_post_send(qp, &bufs[i]->transfer.rdma.send_wr, &bad_wr))
+            WARN();
+    }
+}
+
 static void rdma_set_send_flags(buf_t *buf, int can_signal)
 {
     /* If the buffer fits in the work request inline data, then we can
@@ -675,6 +714,7 @@ struct transport transport_rdma = {
     .buf_alloc = buf_alloc,
     .init_connect = rdma_init_connect,
     .send_message = rdma_send_message,
+    .send_bundle = rdma_send_bundle,
     .set_send_flags = rdma_set_send_flags,
     .init_prepare_transfer = rdma_init_prepare_transfer,
     .post_tgt_dma = rdma_do_transfer,
@@ -4,8 +4,15 @@
  * Completion queue processing.
  */
 #include "ptl_loc.h"
+#include "ptl_timer.h"
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <sys/eventfd.h>
+
+#if WITH_TRANSPORT_SHMEM
+/* Shared memory messages processed in a row by a progress thread. */
+#define SHMEM_RECV_BATCH	16
+#endif
 
 /**
  * Receive state name for debug output.
@@ -29,9 +36,10 @@ extern atomic_t keep_polling;
 
 #if WITH_TRANSPORT_IB
 /**
- * Poll the rdma completion queue.
+ * Poll an rdma completion queue.
  *
  * @param ni the ni that owns the cq.
+ * @param shard the index of the cq.
  * @param num_wc the number of entries in wc_list and buf_list.
  * @param wc_list an array of work completion structs.
  * @param buf_list an array of buf pointers.
@@ -39,50 +47,21 @@ extern atomic_t keep_polling;
  * @return the number of work completions found if no error.
  * @return a negative number if an error occured.
  */
-static int comp_poll(ni_t *ni, int num_wc, struct ibv_wc wc_list[],
+static int comp_poll(ni_t *ni, int shard, int num_wc, struct ibv_wc wc_list[],
                      buf_t *buf_list[])
 {
+    struct ibv_cq *cq = ni->rdma.cqs[shard].cq;
     int ret = 0;
     int i;
     buf_t *buf;
-    int rep_poll = 0;
-
-#if WITH_TRANSPORT_IB && !WITH_TRANSPORT_SHMEM && !IS_PPE
-    while (ni->catcher_stop == 0 && ret == 0) {
-        ret = ibv_poll_cq(ni->rdma.cq, num_wc, wc_list);
-        if (ret <= 0) {
-            rep_poll++;
-            pthread_yield();
-
-            if (rep_poll >= 1000) {
-                if (rep_poll == 1000)
-                    ibv_req_notify_cq(ni->rdma.cq, 0);
-                else {
-                    if (atomic_read(&keep_polling) == 0 &&
-                        ni->catcher_nosleep == 0) {
-                        ret =
-                            ibv_get_cq_event(ni->rdma.ch, &ni->rdma.cq,
-                                             (void **)&ni->
-                                             iface->ibv_context);
-                        ibv_ack_cq_events(ni->rdma.cq, 1);
-                        rep_poll = 0;
-                    }
-                }
-            }
-        }
-    }
-    if (ret == 0)
-        return 0;
-    rep_poll = 0;
-#else
-    /* if there is some other interface the thread
-     * should continue polling others */
-    ret = ibv_poll_cq(ni->rdma.cq, num_wc, wc_list);
+
+    /* Never block here. The progress thread decides when to wait for
+     * a completion event. */
+    ret = ibv_poll_cq(cq, num_wc, wc_list);
     if (ret <= 0) {
         pthread_yield();
         return 0;
     }
-#endif
 
     /* convert from wc to buf and set initial state */
     for (i = 0; i < ret; i++) {
@@ -411,35 +390,10 @@ static int recv_init(PPEGBL buf_t *buf)
 
     init_buf->recv_buf = buf;
 
-#if WITH_TRANSPORT_UDP
-    conn_t *conn;
-    conn = get_conn(buf->obj.obj_ni, buf->obj.obj_ni->id);
-
-    if (conn->transport.type == CONN_TYPE_UDP) {
-        ptl_info("udp connection processing \n");
-        ni_t *ni = obj_to_ni(buf);
-
-        if (atomic_read(&ni->udp.self_recv) > 0) {
-            if (hdr->h1.operation == OP_CT_ACK || 
-                hdr->h1.operation == OP_ACK || hdr->h1.operation == OP_OC_ACK) {
-                init_buf->init_state = STATE_INIT_ACK_EVENT;
-                err = process_init(init_buf);
-            }
-        } else {
-            err = process_init(init_buf);
-        }
-    } else {
-#endif
-        /* Note: process_init must drop recv_buf, so buf will not be valid
-         * after the call. */
-        ptl_info("start processing \n");
-        err = process_init(init_buf);
-#if WITH_TRANSPORT_UDP
-    }
-
-    conn_put(conn);
-#endif
-
+    /* Note: process_init must drop recv_buf, so buf will not be valid
+     * after the call. */
+    ptl_info("start processing \n");
+    err = process_init(init_buf);
     if (err)
         WARN();
 
@@ -552,7 +506,16 @@ static void process_recv_rdma(ni_t *ni, buf_t *buf)
     return;
 }
 
-void progress_thread_rdma(ni_t *ni)
+/**
+ * Process the completions of one of the rdma completion queues.
+ *
+ * @param ni the ni that owns the cq.
+ * @param shard the index of the cq, nothing is done if the ni has no
+ * such cq.
+ *
+ * @return the number of completions processed.
+ */
+int progress_thread_rdma(ni_t *ni, int shard)
 {
     const int num_wc = get_param(PTL_WC_COUNT);
     buf_t *buf_list[num_wc];
@@ -560,40 +523,60 @@ void progress_thread_rdma(ni_t *ni)
     int num_buf;
     struct ibv_wc wc_list[num_wc];
 
-    num_buf = comp_poll(ni, num_wc, wc_list, buf_list);
+    if (shard >= ni->rdma.num_cqs)
+        return 0;
+
+    num_buf = comp_poll(ni, shard, num_wc, wc_list, buf_list);
 
     for (i = 0; i < num_buf; i++) {
         if (buf_list[i])
             process_recv_rdma(ni, buf_list[i]);
     }
+
+    return num_buf;
 }
 #endif
 
 #if WITH_TRANSPORT_UDP
-void progress_thread_udp(ni_t *ni)
+/**
+ * Receive and process the UDP messages already received, up to
+ * PTL_UDP_RECV_BATCH of them. The acks and replies they trigger are
+ * sent together at the end.
+ *
+ * @param ni the network interface.
+ *
+ * @return the number of messages received.
+ */
+int progress_thread_udp(ni_t *ni)
 {
+    int received = 0;
+
+#if WITH_RUDP
+    rudp_progress(ni);
+#endif
+
     /* Socket connection. */
 
     if (ni->udp.dest_addr && ni->udp.map_done != 0) {
 
         int err;
+        int release;
         buf_t *udp_buf;
 
-        udp_buf = udp_receive(ni);
+        udp_send_start(ni);
 
-        if (udp_buf != NULL) {
+        while (received < get_param(PTL_UDP_RECV_BATCH) &&
+               (received == 0 || udp_recv_pending(ni)) &&
+               (udp_buf = udp_receive(ni)) != NULL) {
+            received++;
+            release = 0;
             ptl_info("UDP progress thread, received data: %p type:%i\n",
                      udp_buf, udp_buf->type);
-        }
 
-
-        if (udp_buf != NULL) {
             ptl_info
                 ("received UDP buf type: %i, SEND=%i RETURN=%i RECV=%i CONN_REQ=%i CONN_REP=%i\n",
                  udp_buf->type, BUF_UDP_SEND, BUF_UDP_RETURN, BUF_UDP_RECEIVE,
                  BUF_UDP_CONN_REQ, BUF_UDP_CONN_REP);
-            ptl_info("start, self recv = %i \n",
-                     atomic_read(&ni->udp.self_recv));
             switch (udp_buf->type) {
                 case BUF_UDP_SEND:{
                     buf_t *buf;
@@ -638,7 +621,6 @@ void progress_thread_udp(ni_t *ni)
                     if (udp_buf->put_ct != NULL) {
                         ptl_info("putct is : %p \n", udp_buf->put_ct);
                     }
-                    pthread_mutex_init(&udp_buf->mutex, NULL);
                     udp_buf->obj.obj_ni = ni;
                     udp_buf->conn = get_conn(ni, ni->id);
                     udp_buf->conn->state = CONN_STATE_CONNECTED;
@@ -666,9 +648,9 @@ void progress_thread_udp(ni_t *ni)
                     msg.port = ntohs(ni->udp.src_port);
                     msg.req.options = ni->options;
                     msg.req.src_id = ni->id;
+                    msg.req_cookie = udp_buf->transfer.udp.conn_msg.req_cookie;
 
                     udp_buf->transfer.udp.conn_msg = msg;
-                    udp_buf->length = (sizeof(buf_t));
 
                     //send back to the requesting address
                     udp_buf->udp.dest_addr = &udp_buf->udp.src_addr;
@@ -678,6 +660,7 @@ void progress_thread_udp(ni_t *ni)
                     //REG: Note: this assumes that we have a reliable transport, otherwise things can go wrong here
                     ptl_info
                         ("Connection request reply sent, connection valid. \n");
+                    release = 1;
                     break;
 
                 }
@@ -703,6 +686,7 @@ void progress_thread_udp(ni_t *ni)
                         }
                     }
                     ptl_info("connection valid for reply\n");
+                    release = 1;
                     break;
                 }
 
@@ -710,25 +694,16 @@ void progress_thread_udp(ni_t *ni)
                     /* Should not happen. */
                     abort();
             }
-            //if a buffer was allocated for the recv, free it
-            if (atomic_read(&ni->udp.self_recv) == 0) {
-                if (udp_buf->completed) {
-                    ptl_info("free recv buf %p\n", &udp_buf);
-                    if (udp_buf->recv_buf)
-                        buf_put(udp_buf->recv_buf);
-                    if (udp_buf->conn)
-                        conn_put(udp_buf->conn);
-                    free(udp_buf);
-                }
-            }
-            //if we sent something to ourselves, flag it as processed
-            else if ((int)atomic_read(&ni->udp.self_recv) > 0) {
-                atomic_dec(&ni->udp.self_recv);
-                ptl_info(" self recv: %i \n",
-                         atomic_read(&ni->udp.self_recv));
+            //connection messages are done with; the data messages
+            //were handed to the state machines
+            if (release) {
+                /* The conn of a reply is not referenced by the buf. */
+                udp_buf->conn = NULL;
+                buf_put(udp_buf);
             }
-
         }
+
+        udp_send_flush(ni);
     }
 //TODO: do we need this for UDP?
 //#if WITH_TRANSPORT_SHMEM && !USE_KNEM
@@ -779,10 +754,12 @@ void progress_thread_udp(ni_t *ni)
 
 	PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
 //#endif*/
+
+    return received;
 }
 #endif
 
-#if WITH_TRANSPORT_SHMEM || IS_PPE || WITH_TRANSPORT_UDP
+#if WITH_TRANSPORT_SHMEM || IS_PPE || WITH_TRANSPORT_UDP || WITH_TRANSPORT_TCP
 /**
  * Process a received message in shared memory.
  *
@@ -890,14 +867,335 @@ void process_recv_udp(ni_t *ni, buf_t *buf)
 
 #if !IS_PPE
 /**
- * Progress thread. Waits for ib, udp, and/or shared memory messages.
+ * A progress thread and the share of its NI it polls.
+ */
+struct progress_thread {
+    ni_t *ni;
+    pthread_t thread;
+    int index;                  /* in ni->catchers */
+    int efd;                    /* eventfd to wake up the thread */
+    int sleeping;               /* about to block, or blocked */
+};
+
+#if WITH_TRANSPORT_SHMEM && !USE_KNEM
+/**
+ * Make progress on the shared memory transfers done without knem.
  *
- * @param arg opaque pointer to ni.
+ * @param ni the network interface.
+ */
+static void progress_noknem(ni_t *ni)
+{
+    struct list_head *l, *t;
+    int err;
+
+    /* TODO: instead of having a lock, the initiator should send
+     * the buf to itself, and on receiving it, the progress thread
+     * will put it on the list. That way, only the progress thread
+     * has access to the list. */
+    PTL_FASTLOCK_LOCK(&ni->shmem.noknem_lock);
+
+    list_for_each_safe(l, t, &ni->shmem.noknem_list) {
+        buf_t *buf = list_entry(l, buf_t, list);
+        struct noknem *noknem = buf->transfer.noknem.noknem;
+
+        if (noknem_ready(buf)) {
+            if (!buf->transfer.noknem.is_target) {
+                err = process_init(buf);
+                if (unlikely(err))
+                    ptl_warn("Error in non-knem shared memory initiator processing\n");
+            } else {
+                if (noknem->init_done) {
+                    buf_t *shmem_buf = buf->mem_buf;
+
+                    /* The transfer is now done. Remove from
+                     * noknem_list. */
+                    list_del(&buf->list);
+
+                    err = process_tgt(buf);
+                    if (unlikely(err))
+                        ptl_warn("Error in non-knem shared memory target processing");
+
+                    if (shmem_buf->type == BUF_SHMEM_SEND ||
+                        shmem_buf->shmem.index_owner != ni->mem.index) {
+                        /* Requested to send the buffer back, or not the
+                         * owner. Send the buffer back in both cases. */
+                        shmem_enqueue(ni, shmem_buf,
+                                      shmem_buf->shmem.index_owner);
+                    } else {
+                        /* It was returned to us with a message from a remote
+                         * rank. From send_message_shmem(). */
+                        buf_put(shmem_buf);
+                    }
+
+                } else {
+                    err = process_tgt(buf);
+                    if (unlikely(err))
+                        ptl_warn("Error in non-knem shared memory target processing");
+                }
+            }
+        }
+    }
+
+    PTL_FASTLOCK_UNLOCK(&ni->shmem.noknem_lock);
+}
+#endif
+
+/**
+ * Check whether a progress thread must keep polling. The noknem
+ * transfers progress through the comm pad, without any notification.
+ *
+ * @param pt the progress thread.
+ *
+ * @return 1 if the thread must not block, 0 otherwise.
+ */
+static int progress_busy(struct progress_thread *pt)
+{
+    ni_t *ni = pt->ni;
+
+    if (ni->catcher_stop || ni->catcher_nosleep ||
+        atomic_read(&keep_polling) > 0)
+        return 1;
+
+    if (pt->index != 0)
+        return 0;
+
+#if WITH_TRANSPORT_SHMEM && !USE_KNEM
+    if (!list_empty(&ni->shmem.noknem_list))
+        return 1;
+#endif
+
+#if WITH_TRANSPORT_UDP
+    if (udp_recv_pending(ni))
+        return 1;
+#endif
+
+#if WITH_RUDP
+    if (rudp_busy(ni))
+        return 1;
+#endif
+
+    return 0;
+}
+
+/**
+ * Announce that a progress thread is going to block. The thread must
+ * poll once more before blocking, to catch the messages that arrived
+ * before the announce.
+ *
+ * @param pt the progress thread.
+ *
+ * @return 1 if the thread can block, 0 if there is already some work.
+ */
+static int progress_arm(struct progress_thread *pt)
+{
+#if WITH_TRANSPORT_IB || WITH_TRANSPORT_SHMEM
+    ni_t *ni = pt->ni;
+#endif
+
+    pt->sleeping = 1;
+    __sync_synchronize();
+
+    if (progress_busy(pt))
+        goto busy;
+
+#if WITH_TRANSPORT_IB
+    if (pt->index < ni->rdma.num_cqs &&
+        ibv_req_notify_cq(ni->rdma.cqs[pt->index].cq, 0))
+        goto busy;
+#endif
+
+#if WITH_TRANSPORT_SHMEM
+    if (ni->shmem.queue && !shmem_wait_prepare(ni, pt->index))
+        goto busy;
+#endif
+
+    return 1;
+
+  busy:
+    pt->sleeping = 0;
+    return 0;
+}
+
+/**
+ * Cancel a progress_arm().
+ *
+ * @param pt the progress thread.
+ */
+static void progress_disarm(struct progress_thread *pt)
+{
+#if WITH_TRANSPORT_SHMEM
+    ni_t *ni = pt->ni;
+
+    if (ni->shmem.queue)
+        queue_wait_done(&ni->shmem.queue[pt->index]);
+#endif
+
+    pt->sleeping = 0;
+}
+
+/**
+ * Block a progress thread until a message arrives on one of the
+ * transports it polls, until it is woken up, or until the timeout
+ * expires. Updates the idle and wakeup status registers of the NI.
+ *
+ * @param pt the progress thread, armed.
+ * @param timeout the longest time to block in milliseconds, or -1.
+ */
+static void progress_block(struct progress_thread *pt, int timeout)
+{
+    ni_t *ni = pt->ni;
+    struct pollfd fds[4];
+    int nfds = 0;
+    int num_transports = 0;
+    int ret;
+#if WITH_TRANSPORT_IB
+    int rdma_fd = -1;
+#endif
+#if WITH_TRANSPORT_SHMEM
+    int shmem_fd = -1;
+#endif
+    TIMER_TYPE start, stop;
+    eventfd_t value;
+
+    fds[nfds].fd = pt->efd;
+    fds[nfds].events = POLLIN;
+    nfds++;
+
+#if WITH_TRANSPORT_IB
+    if (pt->index < ni->rdma.num_cqs) {
+        rdma_fd = nfds;
+        fds[nfds].fd = ni->rdma.cqs[pt->index].ch->fd;
+        fds[nfds].events = POLLIN;
+        nfds++;
+        num_transports++;
+    }
+#endif
+
+#if WITH_TRANSPORT_UDP
+    if (pt->index == 0 && ni->iface->udp.connect_s >= 0) {
+        fds[nfds].fd = udp_wait_fd(ni);
+        fds[nfds].events = POLLIN;
+        nfds++;
+        num_transports++;
+    }
+#endif
+
+#if WITH_TRANSPORT_TCP
+    if (pt->index == 0 && ni->tcp.epfd != -1) {
+        fds[nfds].fd = ni->tcp.epfd;
+        fds[nfds].events = POLLIN;
+        nfds++;
+        num_transports++;
+    }
+#endif
+
+#if WITH_TRANSPORT_SHMEM
+    if (ni->shmem.queue && ni->shmem.doorbells) {
+        shmem_fd = nfds;
+        fds[nfds].fd = ni->shmem.doorbells[pt->index];
+        fds[nfds].events = POLLIN;
+        nfds++;
+        num_transports++;
+    }
+#endif
+
+    /* Nothing would wake us up, except the NI fini. */
+    if (num_transports == 0 || progress_busy(pt)) {
+        progress_disarm(pt);
+        return;
+    }
+
+    MARK_TIMER(start);
+
+    ret = poll(fds, nfds, timeout);
+    if (ret == -1 && errno != EINTR)
+        WARN();
+
+    MARK_TIMER(stop);
+
+    __sync_fetch_and_add(&ni->status[PTL_SR_PROGRESS_IDLE_TIME],
+                         (TIMER_INTS(stop) - TIMER_INTS(start)) / 1000000);
+
+    /* Timed out; nothing woke us up. */
+    if (ret == 0) {
+        progress_disarm(pt);
+        return;
+    }
+
+    __sync_fetch_and_add(&ni->status[PTL_SR_PROGRESS_WAKEUPS], 1);
+
+    if (fds[0].revents & POLLIN)
+        eventfd_read(pt->efd, &value);
+
+#if WITH_TRANSPORT_IB
+    if (rdma_fd != -1 && (fds[rdma_fd].revents & POLLIN)) {
+        struct ibv_cq *ev_cq;
+        void *ev_ctx;
+
+        if (ibv_get_cq_event(ni->rdma.cqs[pt->index].ch, &ev_cq, &ev_ctx) ==
+            0)
+            ibv_ack_cq_events(ev_cq, 1);
+    }
+#endif
+
+#if WITH_TRANSPORT_SHMEM
+    if (shmem_fd != -1 && (fds[shmem_fd].revents & POLLIN)) {
+        queue_t *queue = &ni->shmem.queue[pt->index];
+        ptl_sr_value_t *max = &ni->status[PTL_SR_PROGRESS_WAKEUP_LATENCY];
+        uint64_t now = TIMER_INTS(stop);
+        uint64_t wake_time;
+        ptl_sr_value_t latency;
+        ptl_sr_value_t old;
+        char c;
+
+        while (recv(fds[shmem_fd].fd, &c, sizeof(c), MSG_DONTWAIT) > 0) ;
+
+        /* Keep the worst latency seen, in microseconds. */
+        wake_time = queue->wake_time;
+        if (wake_time && now > wake_time) {
+            if ((now - wake_time) / 1000 > INT_MAX)
+                latency = INT_MAX;
+            else
+                latency = (now - wake_time) / 1000;
+
+            do {
+                old = *max;
+            } while (old < latency &&
+                     !__sync_bool_compare_and_swap(max, old, latency));
+        }
+    }
+#endif
+
+    progress_disarm(pt);
+}
+
+/**
+ * Progress thread. Waits for ib, udp, tcp, and/or shared memory messages.
+ *
+ * The thread busy polls its transports, and blocks after the larger
+ * of PTL_EQ_POLL_LOOP_COUNT and PTL_CT_POLL_LOOP_COUNT consecutive
+ * passes find nothing; 0 for both never blocks. The first thread also
+ * shrinks the NI pools every PTL_POOL_SHRINK_INTERVAL milliseconds
+ * while idle, so it doesn't block past the next shrink.
+ *
+ * @param arg opaque pointer to the progress_thread.
  */
 
 static void *progress_thread(void *arg)
 {
-    ni_t *ni = arg;
+    struct progress_thread *pt = arg;
+    ni_t *ni = pt->ni;
+    const long eq_poll_loop_count = get_param(PTL_EQ_POLL_LOOP_COUNT);
+    const long ct_poll_loop_count = get_param(PTL_CT_POLL_LOOP_COUNT);
+    const long poll_loop_count = eq_poll_loop_count > ct_poll_loop_count ?
+        eq_poll_loop_count : ct_poll_loop_count;
+    const uint64_t shrink_interval =
+        (uint64_t)get_param(PTL_POOL_SHRINK_INTERVAL) * 1000000;
+    uint64_t shrink_time = 0;
+    TIMER_TYPE now;
+    long idle = 0;
+    int armed = 0;
+    int work;
 #if WITH_TRANSPORT_SHMEM
     int err = 0;
 #endif
@@ -908,19 +1206,28 @@ static void *progress_thread(void *arg)
 #endif
         ) {
 
-        progress_thread_rdma(ni);
+        work = progress_thread_rdma(ni, pt->index);
 
-        progress_thread_udp(ni);
+        /* There is a single UDP socket, and a single epoll set for
+         * the TCP sockets. */
+        if (pt->index == 0) {
+            work += progress_thread_udp(ni);
+            work += progress_thread_tcp(ni);
+        }
 
 #if WITH_TRANSPORT_SHMEM
         /* Shared memory. Physical NIs don't have a receive queue. */
         if (ni->shmem.queue) {
             
             buf_t *shmem_buf;
+            int n;
 
-            shmem_buf = shmem_dequeue(ni);
+            /* Take a few messages before polling the other
+             * transports again. */
+            for (n = 0; n < SHMEM_RECV_BATCH &&
+                 (shmem_buf = shmem_dequeue(ni, pt->index)) != NULL; n++) {
+                work++;
 
-            if (shmem_buf) {
                 switch (shmem_buf->type) {
                     case BUF_SHMEM_SEND:{
                         buf_t *buf;
@@ -989,81 +1296,183 @@ static void *progress_thread(void *arg)
 #endif
 
 #if WITH_TRANSPORT_SHMEM && !USE_KNEM
-        struct list_head *l, *t;
+        if (pt->index == 0)
+            progress_noknem(ni);
+#endif
 
-        /* TODO: instead of having a lock, the initiator should send
-         * the buf to itself, and on receiving it, the progress thread
-         * will put it on the list. That way, only the progress thread
-         * has access to the list. */
-        PTL_FASTLOCK_LOCK(&ni->shmem.noknem_lock);
+        if (!work && pt->index == 0 && shrink_interval) {
+            MARK_TIMER(now);
+            if (TIMER_INTS(now) >= shrink_time) {
+                if (shrink_time)
+                    ni_shrink_pools(ni);
+                shrink_time = TIMER_INTS(now) + shrink_interval;
+            }
+        }
 
-        list_for_each_safe(l, t, &ni->shmem.noknem_list) {
-            buf_t *buf = list_entry(l, buf_t, list);
-            struct noknem *noknem = buf->transfer.noknem.noknem;
+        if (work) {
+            if (armed)
+                progress_disarm(pt);
+            armed = 0;
+            idle = 0;
+        } else if (armed) {
+            int timeout = -1;
+
+            if (pt->index == 0 && shrink_interval) {
+                /* Wake up for the next shrink, rounded up to the
+                 * next millisecond. */
+                MARK_TIMER(now);
+                if (TIMER_INTS(now) >= shrink_time)
+                    timeout = 0;
+                else
+                    timeout = (shrink_time - TIMER_INTS(now) + 999999) /
+                        1000000;
+            }
 
-            if (buf->transfer.noknem.transfer_state_expected == noknem->state) {
-                if (noknem->state == 0){
-                    err = process_init(buf);
-                    if (unlikely(err))
-                        ptl_warn("Error in non-knem shared memory initiator processing\n");
-                }
-                else if (noknem->state == 2) {
-                    if (noknem->init_done) {
-                        buf_t *shmem_buf = buf->mem_buf;
+            progress_block(pt, timeout);
+            armed = 0;
+            idle = 0;
+        } else if (poll_loop_count && ++idle >= poll_loop_count) {
+            armed = progress_arm(pt);
+            idle = 0;
+        }
+    }
 
-                        /* The transfer is now done. Remove from
-                         * noknem_list. */
-                        list_del(&buf->list);
+    return NULL;
+}
 
-                        err = process_tgt(buf);
-                        if (unlikely(err))
-                            ptl_warn("Error in non-knem shared memory target processing");
+/**
+ * Parse a CPU list such as "0-3,8,10-11" into a CPU set.
+ *
+ * @param[in] list the CPU list.
+ * @param[out] cpus the CPU set.
+ *
+ * @return 0 on success, -1 if the list is malformed.
+ */
+static int parse_cpu_list(const char *list, cpu_set_t *cpus)
+{
+    const char *s = list;
 
-                        if (shmem_buf->type == BUF_SHMEM_SEND ||
-                            shmem_buf->shmem.index_owner != ni->mem.index) {
-                            /* Requested to send the buffer back, or not the
-                             * owner. Send the buffer back in both cases. */
-                            shmem_enqueue(ni, shmem_buf,
-                                          shmem_buf->shmem.index_owner);
-                        } else {
-                            /* It was returned to us with a message from a remote
-                             * rank. From send_message_shmem(). */
-                            buf_put(shmem_buf);
-                        }
+    CPU_ZERO(cpus);
 
-                    } else {
-                        err = process_tgt(buf);
-                        if (unlikely(err))
-                            ptl_warn("Error in non-knem shared memory target processing");
-                    }
-                }
-            }
+    while (*s) {
+        char *end;
+        long first;
+        long last;
+
+        first = strtol(s, &end, 10);
+        if (end == s || first < 0)
+            return -1;
+
+        last = first;
+        if (*end == '-') {
+            s = end + 1;
+            last = strtol(s, &end, 10);
+            if (end == s || last < first)
+                return -1;
         }
 
-        PTL_FASTLOCK_UNLOCK(&ni->shmem.noknem_lock);
-#endif
+        if (last >= CPU_SETSIZE)
+            return -1;
+
+        for (; first <= last; first++)
+            CPU_SET(first, cpus);
+
+        s = end;
+        if (*s == ',')
+            s++;
+        else if (*s)
+            return -1;
     }
 
-    return NULL;
+    return 0;
+}
+
+/**
+ * Bind a progress thread to one of the CPUs of PTL_PROGRESS_CPUS. The
+ * threads are distributed round robin over the CPUs of the set.
+ *
+ * @param pt the progress thread.
+ * @param cpus the CPUs of PTL_PROGRESS_CPUS.
+ */
+static void bind_progress_thread(struct progress_thread *pt,
+                                 const cpu_set_t *cpus)
+{
+    int num_cpus = CPU_COUNT(cpus);
+    cpu_set_t set;
+    int cpu;
+    int n;
+
+    if (num_cpus == 0)
+        return;
+
+    n = pt->index % num_cpus;
+    for (cpu = 0;; cpu++) {
+        if (CPU_ISSET(cpu, cpus) && n-- == 0)
+            break;
+    }
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+
+    if (pthread_setaffinity_np(pt->thread, sizeof(set), &set))
+        ptl_warn("unable to bind progress thread %d to CPU %d\n", pt->index,
+                 cpu);
 }
 
-/* Add a progress thread. */
+/* Add the progress threads. */
 int start_progress_thread(ni_t *ni)
 {
+    const int num_catchers = get_param(PTL_PROGRESS_THREADS);
+    const char *cpu_list = getenv("PTL_PROGRESS_CPUS");
+    cpu_set_t cpus;
     int ret;
+    int i;
+
+    CPU_ZERO(&cpus);
+    if (cpu_list && parse_cpu_list(cpu_list, &cpus)) {
+        ptl_warn("invalid PTL_PROGRESS_CPUS \"%s\", progress threads are "
+                 "left unbound\n", cpu_list);
+        CPU_ZERO(&cpus);
+    }
 
     /* Keep the communication thread active at the end to terminate it */
     ni->catcher_nosleep = 0;
     atomic_set(&keep_polling, 0);
-    ret = pthread_create(&ni->catcher, NULL, progress_thread, ni);
-    if (ret) {
+
+    ni->catchers = calloc(num_catchers, sizeof(*ni->catchers));
+    if (!ni->catchers) {
         WARN();
-        ret = PTL_FAIL;
-    } else {
-        ni->has_catcher = 1;
+        return PTL_NO_SPACE;
+    }
+
+    ret = PTL_OK;
+    for (i = 0; i < num_catchers; i++) {
+        struct progress_thread *pt = &ni->catchers[i];
+
+        pt->ni = ni;
+        pt->index = i;
+
+        pt->efd = eventfd(0, EFD_NONBLOCK);
+        if (pt->efd == -1) {
+            WARN();
+            ret = PTL_FAIL;
+            break;
+        }
+
+        if (pthread_create(&pt->thread, NULL, progress_thread, pt)) {
+            /* The threads already started are stopped by the NI
+             * cleanup. */
+            WARN();
+            close(pt->efd);
+            ret = PTL_FAIL;
+            break;
+        }
 
-        ret = PTL_OK;
+        ni->num_catchers++;
+
+        bind_progress_thread(pt, &cpus);
     }
+
     /* Give the priority to the communication thread */
     int which = PRIO_PROCESS;
     pid_t pid = getpid();
@@ -1072,16 +1481,52 @@ int start_progress_thread(ni_t *ni)
     return ret;
 }
 
-/* Stop the progress thread. */
+/* Stop the progress threads. */
 void stop_progress_thread(ni_t *ni)
 {
-    if (ni->has_catcher) {
+    int i;
+
+    if (!ni->catchers)
+        return;
+
+    ni->catcher_stop = 1;
+
+    for (i = 0; i < ni->num_catchers; i++) {
         int *status;
-        ni->catcher_stop = 1;
-        pthread_cancel(ni->catcher);
-        ni->has_catcher = 0;
-        pthread_join(ni->catcher, (void **)&status);
+
+        pthread_cancel(ni->catchers[i].thread);
+        pthread_join(ni->catchers[i].thread, (void **)&status);
         assert(status == 0 || status == PTHREAD_CANCELED);
+
+        close(ni->catchers[i].efd);
+    }
+
+    free(ni->catchers);
+    ni->catchers = NULL;
+    ni->num_catchers = 0;
+}
+
+/**
+ * Wake up a progress thread if it is blocked, or about to block. The
+ * caller must have made the reason for waking up visible first.
+ *
+ * @param ni the network interface.
+ * @param index the progress thread, or -1 for all of them.
+ */
+void progress_thread_wakeup(ni_t *ni, int index)
+{
+    int i;
+
+    if (!ni->catchers)
+        return;
+
+    __sync_synchronize();
+
+    for (i = 0; i < ni->num_catchers; i++) {
+        struct progress_thread *pt = &ni->catchers[i];
+
+        if ((index == -1 || index == i) && pt->sleeping)
+            eventfd_write(pt->efd, 1);
     }
 }
 
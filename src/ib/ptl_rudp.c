@@ -1,363 +1,672 @@
-/* TODO LIST:
- *      --send header needs to deal with iovecs 
- *      --need to handle NACKs retransmission
- *      --timeouts need to be handled (progress thread?)
- *      --needs to work for the PPE (NACK/ACK destination pids)
+/**
+ * @file ptl_rudp.c
+ *
+ * @brief Reliable UDP.
+ *
+ * The datagrams sent on the shared socket of an interface are
+ * numbered per destination socket (a peer). Up to RUDP_WINDOW of them
+ * can be in flight; the others wait on the peer backlog. Every
+ * numbered datagram keeps a copy until it is acknowledged, and is sent
+ * again when its timer expires on the timer wheel, with an exponential
+ * backoff.
  *
- * Notes:   On recv side, drop messages with seq_num below
- *          that of the current seq_num
+ * The receiver delivers the datagrams in order. The ones received
+ * ahead of a loss are copied and held until the gap is filled.
+ * Acknowledgements are cumulative, with a bitmap of the datagrams
+ * held (SACK). They are piggybacked on every datagram sent to the
+ * peer, or sent alone by the progress thread when no traffic went
+ * back. A datagram received out of order is acknowledged right away,
+ * and the sender retransmits the first missing datagram once without
+ * waiting for its timer.
+ *
+ * PTL_RUDP_LOSS drops datagrams on purpose before they are sent, to
+ * test all this over loopback.
  */
 
-
 #include "ptl_loc.h"
 #include "ptl_rudp.h"
+#include "ptl_udp_uring.h"
 
 #if WITH_RUDP
-int process_rudp_send_hdr(buf_t *buf, int len, ni_t *ni)
+
+/* Datagrams in flight per peer. Also the number of bits of sack. */
+#define RUDP_WINDOW		(64)
+
+/* Slots of the retransmission timer wheel, one per millisecond. Must
+ * be a power of 2. */
+#define RUDP_WHEEL_SIZE		(256)
+
+/* Buckets of the peer hash table. Must be a power of 2. */
+#define RUDP_PEER_BUCKETS	(256)
+
+/* Maximum backoff of the retransmission timeout, as a shift. */
+#define RUDP_MAX_BACKOFF	(6)
+
+/* Retransmissions of a datagram before it is reported. */
+#define RUDP_WARN_RETRIES	(32)
+
+struct rudp_peer;
+
+/* A numbered datagram, kept until it is acknowledged. */
+struct rudp_pkt {
+    struct list_head list;      /* on a wheel slot, or the backlog */
+    struct rudp_peer *peer;
+    uint32_t seq;
+    unsigned int retries;
+    uint64_t deadline;          /* in ms */
+    size_t len;
+    unsigned char data[0];      /* the datagram */
+};
+
+/* Reliability state of the exchanges with a remote socket. */
+struct rudp_peer {
+    struct list_head list;      /* in its hash bucket */
+    struct list_head ack_list;  /* on rudp->acks while an ack is owed */
+    struct sockaddr_in addr;
+
+    /* Send side. */
+    uint32_t send_next;         /* next sequence number */
+    uint32_t send_una;          /* oldest unacknowledged */
+    struct rudp_pkt *window[RUDP_WINDOW];
+    struct list_head backlog;
+
+    /* Receive side. */
+    uint32_t recv_next;         /* next sequence number expected */
+    uint64_t recv_sack;         /* bit i set if recv_next + 1 + i is held */
+    struct udp_fwd *held[RUDP_WINDOW];
+};
+
+struct rudp {
+    pthread_mutex_t mutex;
+    int sockfd;
+    struct list_head peers[RUDP_PEER_BUCKETS];
+    struct list_head wheel[RUDP_WHEEL_SIZE];
+    uint64_t tick;              /* last slot the wheel was run for, in ms */
+    unsigned int in_flight;     /* datagrams not acknowledged */
+    struct list_head acks;      /* peers owed an acknowledgement */
+    unsigned int rto;           /* retransmission timeout, in ms */
+    unsigned int loss;          /* datagrams dropped per million */
+    unsigned int seed;
+};
+
+static inline int seq_before(uint32_t a, uint32_t b)
 {
+    return (int32_t)(a - b) < 0;
+}
+
+static inline uint64_t rudp_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
 
-    int seq_num = 0;
-    if (buf->type != BUF_UDP_CONN_REP && buf->type != BUF_UDP_CONN_REQ) {
-        ptl_info("set sequence number \n");
-        seq_num = atomic_inc(&buf->conn->udp.send_seq_num);
-        buf->transfer.udp.seq_num = seq_num;
-        req_hdr_t *hdr;
-
-        if (buf->internal_data != NULL) {
-            hdr = (req_hdr_t *) buf->internal_data;
-        } else {
-            hdr = (req_hdr_t *) & buf->data;
+/**
+ * @brief Create the reliability state of a socket.
+ *
+ * @param[in] sockfd the socket
+ *
+ * @return the state, or NULL if out of memory
+ */
+struct rudp *rudp_create(int sockfd)
+{
+    struct rudp *rudp;
+    int i;
+
+    rudp = calloc(1, sizeof(*rudp));
+    if (!rudp)
+        return NULL;
+
+    pthread_mutex_init(&rudp->mutex, NULL);
+    rudp->sockfd = sockfd;
+    for (i = 0; i < RUDP_PEER_BUCKETS; i++)
+        INIT_LIST_HEAD(&rudp->peers[i]);
+    for (i = 0; i < RUDP_WHEEL_SIZE; i++)
+        INIT_LIST_HEAD(&rudp->wheel[i]);
+    INIT_LIST_HEAD(&rudp->acks);
+    rudp->tick = rudp_clock();
+    rudp->rto = get_param(PTL_RUDP_RTO);
+    rudp->loss = get_param(PTL_RUDP_LOSS);
+    rudp->seed = getpid();
+
+    return rudp;
+}
+
+/**
+ * @brief Destroy the reliability state of a socket.
+ *
+ * Datagrams still unacknowledged are lost.
+ *
+ * @param[in] rudp the state
+ */
+void rudp_destroy(struct rudp *rudp)
+{
+    struct list_head *l, *t;
+    int i, j;
+
+    for (i = 0; i < RUDP_PEER_BUCKETS; i++) {
+        list_for_each_safe(l, t, &rudp->peers[i]) {
+            struct rudp_peer *peer = list_entry(l, struct rudp_peer, list);
+            struct list_head *l2, *t2;
+
+            for (j = 0; j < RUDP_WINDOW; j++) {
+                free(peer->window[j]);
+                free(peer->held[j]);
+            }
+
+            list_for_each_safe(l2, t2, &peer->backlog)
+                free(list_entry(l2, struct rudp_pkt, list));
+
+            free(peer);
         }
+    }
 
-        conn_t *temp_conn;
+    pthread_mutex_destroy(&rudp->mutex);
+    free(rudp);
+}
 
-        temp_conn =
-            get_conn(ni, (ptl_process_t)le32_to_cpu(hdr->h1.src_rank));
-        if (temp_conn == NULL)
-            ptl_warn
-                ("RUDP couldn't fetch conn info, perhaps conn is closed?\n");
+/**
+ * @brief Find or create the state of a peer.
+ *
+ * @param[in] rudp the state of the socket, locked
+ * @param[in] addr the address of the peer
+ *
+ * @return the peer, or NULL if out of memory
+ */
+static struct rudp_peer *rudp_peer(struct rudp *rudp,
+                                   const struct sockaddr_in *addr)
+{
+    unsigned int hash = (addr->sin_addr.s_addr * 2654435761U) ^
+        addr->sin_port;
+    struct list_head *bucket = &rudp->peers[hash & (RUDP_PEER_BUCKETS - 1)];
+    struct rudp_peer *peer;
+    struct list_head *l;
+
+    list_for_each(l, bucket) {
+        peer = list_entry(l, struct rudp_peer, list);
+
+        if (peer->addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            peer->addr.sin_port == addr->sin_port)
+            return peer;
+    }
 
-        INIT_LIST_HEAD(&buf->list);
-        list_add_tail(&buf->list, &temp_conn->udp.rel_queued_bufs);
-        ptl_info("^^^added buf seq num: %i to rel_queue\n",
-                 buf->transfer.udp.seq_num);
-        buf->udp.in_progress = 1;
+    peer = calloc(1, sizeof(*peer));
+    if (!peer) {
+        WARN();
+        return NULL;
     }
-    ptl_info("send header assembly complete\n");
-    return 0;
+
+    peer->addr.sin_family = AF_INET;
+    peer->addr.sin_addr = addr->sin_addr;
+    peer->addr.sin_port = addr->sin_port;
+    INIT_LIST_HEAD(&peer->ack_list);
+    INIT_LIST_HEAD(&peer->backlog);
+    list_add(&peer->list, bucket);
+
+    return peer;
+}
+
+/**
+ * @brief Send a datagram to a peer, unless it is chosen to be lost.
+ */
+static void rudp_sendto(struct rudp *rudp, struct rudp_peer *peer,
+                        const void *data, size_t len)
+{
+    if (rudp->loss && rand_r(&rudp->seed) % 1000000 < rudp->loss)
+        return;
+
+    /* A failure is the same as a loss. */
+    sendto(rudp->sockfd, data, len, MSG_DONTWAIT,
+           (struct sockaddr *)&peer->addr, sizeof(peer->addr));
 }
 
+/**
+ * @brief Acknowledge what was received from a peer in a header.
+ */
+static void rudp_stamp_ack(struct rudp_peer *peer, struct udp_hdr *hdr)
+{
+    hdr->flags |= UDP_HDR_ACK;
+    hdr->ack = cpu_to_le32(peer->recv_next);
+    hdr->sack = cpu_to_le64(peer->recv_sack);
+
+    list_del_init(&peer->ack_list);
+}
 
-int process_rudp_recv_hdr(buf_t *buf, int len, ni_t *ni)
+/**
+ * @brief Send an acknowledgement alone.
+ */
+static void rudp_send_ack(struct rudp *rudp, struct rudp_peer *peer)
 {
+    struct udp_hdr hdr;
 
-    struct list_head *l, *t;
-    buf_t *temp_buf = NULL;
-    int found_one, ret = 0;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.type = UDP_MSG_ACK;
+    rudp_stamp_ack(peer, &hdr);
 
-    //Look at the incoming header to find the connection
-    req_hdr_t *hdr;
+    rudp_sendto(rudp, peer, &hdr, sizeof(hdr));
+}
 
-    if (buf->internal_data != NULL) {
-        hdr = (req_hdr_t *) buf->internal_data;
-    } else {
-        hdr = (req_hdr_t *) & buf->data;
-    }
+/**
+ * @brief (Re)transmit a datagram of the window and arm its timer.
+ */
+static void rudp_transmit(struct rudp *rudp, struct rudp_pkt *pkt)
+{
+    unsigned int backoff = pkt->retries < RUDP_MAX_BACKOFF ?
+        pkt->retries : RUDP_MAX_BACKOFF;
 
-    //get the connection for this communication
-    //this will be nid for physical addressing and rank for logical
-    __le32 src_id = le32_to_cpu(hdr->h1.src_rank);
-
-    ptl_process_t id;
-    id.rank = src_id;
-
-    conn_t *temp_conn;
-    ptl_info("get conn for rank %i at local rank: %i\n",
-             le32_to_cpu(hdr->h1.src_rank), ni->id.rank);
-    temp_conn = get_conn(ni, (ptl_process_t)le32_to_cpu(hdr->h1.src_rank));
-    if (temp_conn == NULL)
-        ptl_error("RUDP couldn't get conn info on recv\n");
-
-    ptl_info("got conn info \n");
-
-    int last_loop = -1;
-
-    //if(!list_empty(&temp_conn->udp.rel_queued_bufs))
-    if (buf->type == BUF_UDP_ACK || buf->type == BUF_UDP_NACK) {
-        list_for_each_safe(l, t, &temp_conn->udp.rel_queued_bufs) {
-            temp_buf = list_entry(l, buf_t, list);
-            assert(&temp_buf != NULL);
-            ptl_info("checking udp seq numbers %i:%i\n",
-                     temp_buf->transfer.udp.seq_num,
-                     buf->transfer.udp.seq_num);
-            if (temp_buf->transfer.udp.seq_num == buf->transfer.udp.seq_num) {
-                //if (!(list_empty(&temp_conn->udp.rel_queued_bufs))){
-                ptl_info("found one, delete it from queued bufs\n");
-                //if (buf->type != BUF_UDP_NACK)
-                //list_del(l);
-                found_one = 1;
-                //if (list_empty(&temp_conn->udp.rel_queued_bufs)){
-                //   INIT_LIST_HEAD(&temp_conn->udp.rel_queued_bufs); 
-                //}
-                break;
-                //}
-            } else {
-                ptl_info("no match\n");
-                if (last_loop == temp_buf->transfer.udp.seq_num)
-                    break;
-                last_loop = temp_buf->transfer.udp.seq_num;
-                if (temp_buf->transfer.udp.seq_num == 0)
-                    break;
-            }
-        }
-    }
+    rudp_stamp_ack(pkt->peer, (struct udp_hdr *)pkt->data);
 
-    ptl_info("RUDP received buf of type: %i \n", buf->type);
-
-    //Check to see if this receive is an ACK/NACK from a target
-    switch (buf->type) {
-            //For an ACK, just remove the buf from the current
-            //transfers list
-        case BUF_UDP_ACK:{
-            if (found_one == 1) {
-                ptl_info("***********ACK received seq: %i*********** \n",
-                         buf->transfer.udp.seq_num);
-                //if (!list_empty(&temp_conn->udp.rel_queued_bufs))
-                //list_del_init(l);
-                //if (list_empty(&temp_conn->udp.rel_queued_bufs))
-                //    INIT_LIST_HEAD(&temp_conn->udp.rel_queued_bufs);
-                break;
-            } else {
-                ptl_error("ACK for buf not in active transfer list\n");
-                break;
-            }
-        }
+    pkt->deadline = rudp_clock() + ((uint64_t)rudp->rto << backoff);
+    list_add_tail(&pkt->list,
+                  &rudp->wheel[pkt->deadline & (RUDP_WHEEL_SIZE - 1)]);
 
-            //For a NACK, we need to send the buf again
-        case BUF_UDP_NACK:{
-            if (found_one == 1) {
-                //only handles the non-large message case
-                ptl_info("@@@@ RUDP NACK sendto retransmission @@@@@\n");
-                ret =
-                    sendto(ni->iface->udp.connect_s, temp_buf,
-                           sizeof(*temp_buf), 0,
-                           (struct sockaddr *)temp_buf->udp.dest_addr,
-                           sizeof(*temp_buf->udp.dest_addr));
-                if (ret == -1)
-                    return ret;
-                //add the buffer back to the list
-                //INIT_LIST_HEAD(&temp_buf->list);
-                //list_add_tail(&temp_buf->list, &temp_conn->udp.rel_queued_bufs);
-            }
-            break;
-        }
+    rudp_sendto(rudp, pkt->peer, pkt->data, pkt->len);
+}
 
-            //send an ACK or NACK depending on the data received
-        case BUF_UDP_RECEIVE || BUF_TGT || BUF_TRIGGERED_ME:{
-            ptl_info("process recv for reliability want seq num: %i\n",
-                     atomic_read(&temp_conn->udp.recv_seq_num));
-            if (atomic_read(&temp_conn->udp.recv_seq_num) ==
-                buf->transfer.udp.seq_num) {
-                //got the correct message
-                atomic_inc(&temp_conn->udp.recv_seq_num);
-                ptl_info("next seq number set to: %i\n",
-                         atomic_read(&temp_conn->udp.recv_seq_num));
-                //now we need to send an ack
-                ptl_info("@@@@@@@send back ACK for seq num: %i to %s:%i\n",
-                         buf->transfer.udp.seq_num,
-                         inet_ntoa(temp_conn->sin.sin_addr),
-                         ntohs(temp_conn->sin.sin_port));
-                /*inet_ntoa(buf->udp.src_addr.sin_addr),
-                 * ntohs(buf->udp.src_addr.sin_port)); */
-                buf->type = BUF_UDP_ACK;
-            } else {
-                ptl_info("@@@@@@@@@send NACK for seq num: %i \n",
-                         buf->transfer.udp.seq_num);
-                buf->type = BUF_UDP_NACK;
-            }
+/**
+ * @brief Number a datagram, put it in the window and send it.
+ */
+static void rudp_transmit_new(struct rudp *rudp, struct rudp_pkt *pkt)
+{
+    struct rudp_peer *peer = pkt->peer;
+    struct udp_hdr *hdr = (struct udp_hdr *)pkt->data;
 
-            //now send either the ACK or NACK back
-            if (ni->options & PTL_NI_PHYSICAL) {
-                hdr->h1.src_nid = cpu_to_le32(ni->id.phys.nid);
-                hdr->h1.src_pid = cpu_to_le32(ni->id.phys.pid);
-            } else {
-                hdr->h1.src_rank = cpu_to_le32(ni->id.rank);
-            }
+    pkt->seq = peer->send_next++;
+    hdr->flags |= UDP_HDR_SEQ;
+    hdr->seq_num = cpu_to_le32(pkt->seq);
 
-            //TODO: strip out the data so we have less network load
-            //      on the ACK/NACK
-            sendto(ni->iface->udp.connect_s, buf, sizeof(*buf), 0,
-                   (struct sockaddr *)&temp_conn->sin,
-                   sizeof(*&temp_conn->sin));
-            break;
-        }
+    peer->window[pkt->seq % RUDP_WINDOW] = pkt;
+    rudp->in_flight++;
+
+    rudp_transmit(rudp, pkt);
+}
+
+/**
+ * @brief Forget an acknowledged datagram.
+ */
+static void rudp_release(struct rudp *rudp, struct rudp_peer *peer,
+                         uint32_t seq)
+{
+    struct rudp_pkt *pkt = peer->window[seq % RUDP_WINDOW];
 
-        default:
-            goto cleanup;
+    if (!pkt || pkt->seq != seq)
+        return;
 
+    peer->window[seq % RUDP_WINDOW] = NULL;
+    list_del(&pkt->list);
+    free(pkt);
+    rudp->in_flight--;
+}
 
-    }                                  //end switch
+/**
+ * @brief Process the acknowledgement received from a peer.
+ */
+static void rudp_ack(struct rudp *rudp, struct rudp_peer *peer,
+                     uint32_t ack, uint64_t sack)
+{
+    struct rudp_pkt *pkt;
+    uint32_t seq;
+    int i;
 
+    /* Ignore what was never sent. */
+    if (seq_before(peer->send_next, ack))
+        return;
 
-  cleanup:
-    conn_put(temp_conn);
-    if (buf->type != BUF_UDP_RECEIVE) {
-        //horrible hacking the errno return
-        //basically indicate back to the portals lib
-        //that nothing was there.
-        errno = EAGAIN;
-        return -1;
+    while (seq_before(peer->send_una, ack)) {
+        rudp_release(rudp, peer, peer->send_una);
+        peer->send_una++;
     }
-    return 0;
-}
-#endif
 
+    for (i = 0; i < RUDP_WINDOW && sack; i++, sack >>= 1) {
+        seq = ack + 1 + i;
+        if ((sack & 1) && seq_before(seq, peer->send_next))
+            rudp_release(rudp, peer, seq);
+    }
+
+    /* The peer has datagrams after ack, so ack was probably lost. */
+    pkt = peer->window[ack % RUDP_WINDOW];
+    if (sack && pkt && pkt->seq == ack && pkt->retries == 0) {
+        list_del(&pkt->list);
+        pkt->retries++;
+        rudp_transmit(rudp, pkt);
+    }
+
+    /* Fill the room made in the window. */
+    while (!list_empty(&peer->backlog) &&
+           peer->send_next - peer->send_una < RUDP_WINDOW) {
+        pkt = list_first_entry(&peer->backlog, struct rudp_pkt, list);
+        list_del(&pkt->list);
+        rudp_transmit_new(rudp, pkt);
+    }
+}
 
 /**
- * @brief Intercept sendmsg calls for reliability header processing
+ * @brief Send a datagram reliably.
  *
- * This allows the non-RUDP case to simply pass through to sendmsg
- * RUDP calls have a reliabilty header applied to it for the
- * given destination.
+ * The datagram is copied, so the caller can reuse its buffers.
  *
- * @param[in] sockfd The socket to use for the send
- * @param[in] msg    The message to be sent, in strcut msghdr form
- * @param[in] flags  Appropriate flags to pass for the sendmsg operation
- * @param[in] ni     The portals network interface to use 
+ * @param[in] ni the network interface
+ * @param[in] msg the datagram, starting with a struct udp_hdr
  *
- * @return size      Size of the message sent
+ * @return the size of the datagram, or -1
  */
-ssize_t ptl_sendmsg(int sockfd, const struct msghdr *msg, int flags, ni_t *ni)
+static ssize_t rudp_sendmsg(ni_t *ni, const struct msghdr *msg)
 {
-    ssize_t ret;
-#if !WITH_RUDP
-    ret = sendmsg(sockfd, msg, flags);
-#else
-    //send this reliably
-    int hdr_status;
-    hdr_status =
-        process_rudp_send_hdr((void *)(msg->msg_iov[0].iov_base),
-                              (int)(msg->msg_iov[0].iov_len), ni);
-
-    //begin the send
-    ptl_info("@@@@@@@@@ RUDP sendmsg @@@@@@@@@\n");
-    ret = sendmsg(sockfd, msg, flags);
-#endif
-    return ret;
+    struct rudp *rudp = ni->iface->udp.rudp;
+    struct rudp_peer *peer;
+    struct rudp_pkt *pkt;
+    size_t len = 0;
+    int was_idle;
+    int i;
+
+    for (i = 0; i < msg->msg_iovlen; i++)
+        len += msg->msg_iov[i].iov_len;
+
+    pkt = malloc(sizeof(*pkt) + len);
+    if (!pkt) {
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pkt->retries = 0;
+    pkt->len = 0;
+    for (i = 0; i < msg->msg_iovlen; i++) {
+        memcpy(pkt->data + pkt->len, msg->msg_iov[i].iov_base,
+               msg->msg_iov[i].iov_len);
+        pkt->len += msg->msg_iov[i].iov_len;
+    }
+
+    pthread_mutex_lock(&rudp->mutex);
+
+    peer = rudp_peer(rudp, msg->msg_name);
+    if (!peer) {
+        pthread_mutex_unlock(&rudp->mutex);
+        free(pkt);
+        errno = ENOMEM;
+        return -1;
+    }
+
+    pkt->peer = peer;
+    was_idle = (rudp->in_flight == 0);
+
+    if (peer->send_next - peer->send_una < RUDP_WINDOW &&
+        list_empty(&peer->backlog)) {
+        rudp_transmit_new(rudp, pkt);
+    } else {
+        list_add_tail(&pkt->list, &peer->backlog);
+    }
+
+    pthread_mutex_unlock(&rudp->mutex);
+
+    /* The progress thread must not sleep while the timers run. */
+    if (was_idle)
+        progress_thread_wakeup(ni, 0);
+
+    return len;
 }
 
 /**
- * @brief Intercept sendto calls for reliability header processing
+ * @brief Process the reliability information of a received datagram.
  *
- * This allows the non-RUDP case to simply pass through to sendto
- * RUDP calls have a reliabilty header applied to it for the
- * given destination.
+ * A datagram is delivered only in order. When it cannot be delivered
+ * right away by the caller, a copy is queued on the NI it is meant
+ * for.
  *
- * @param[in] sockfd     The socket to use for the send
- * @param[in] buf        The buffer to be sent
- * @param[in] len        The length of the buffer
- * @param[in] flags      Appropriate flags to pass for the sendmsg operation
- * @param[in] dest_addr  The destination address (struct sockaddr)
- * @param[in] addrlen    The length of the dest_addr struct
- * @param[in] ni         The portals network interface to use  
- *
- * @return size          Size of the message sent
+ * @param[in] ni the network interface that received the datagram
+ * @param[in] buf the buf holding the portals header, NULL for an
+ *                acknowledgement alone
+ * @param[in] whdr the UDP header
+ * @param[in] len the length of the datagram
+ * @param[in] body the bytes following the UDP header
+ * @param[in] src_addr the source of the datagram
  *
+ * @return RUDP_DELIVER if the caller must process the datagram,
+ *         RUDP_CONSUMED otherwise
  */
-ssize_t ptl_sendto(int sockfd, buf_t *buf, size_t len, int flags,
-                   struct sockaddr * dest_addr, socklen_t addrlen, ni_t *ni)
+int rudp_recv(ni_t *ni, buf_t *buf, const struct udp_hdr *whdr, size_t len,
+              const void *body, const struct sockaddr_in *src_addr)
 {
-    ssize_t ret;
-#if !WITH_RUDP
-    ret = sendto(sockfd, buf, len, flags, dest_addr, addrlen);
-#else
-    //send this reliably
-    int hdr_status;
-    hdr_status = process_rudp_send_hdr(buf, len, ni);
+    struct rudp *rudp = ni->iface->udp.rudp;
+    struct rudp_peer *peer;
+    struct udp_fwd *fwd;
+    ni_t *dest_ni;
+    uint32_t seq;
+    uint32_t diff;
+    int ret = RUDP_CONSUMED;
+
+    pthread_mutex_lock(&rudp->mutex);
+
+    peer = rudp_peer(rudp, src_addr);
+    if (!peer)
+        goto done;
+
+    if (whdr->flags & UDP_HDR_ACK)
+        rudp_ack(rudp, peer, le32_to_cpu(whdr->ack),
+                 le64_to_cpu(whdr->sack));
+
+    if (!buf)
+        goto done;
+
+    if (!(whdr->flags & UDP_HDR_SEQ)) {
+        ret = RUDP_DELIVER;
+        goto done;
+    }
 
-    //begin send
-    ptl_info("@@@@@@@@@ RUDP sendto @@@@@@@@@\n");
-    ret = sendto(sockfd, buf, len, flags, dest_addr, addrlen);
-    if (ret == -1)
-        return ret;
+    seq = le32_to_cpu(whdr->seq_num);
+    diff = seq - peer->recv_next;
+
+    if (diff == 0) {
+        /* In order. Queue it if an earlier datagram for the same NI
+         * is still queued. */
+        dest_ni = udp_dest_ni(ni, buf->internal_data);
+        if (dest_ni == ni && list_empty(&ni->udp_recv_list)) {
+            ret = RUDP_DELIVER;
+        } else if (dest_ni) {
+            fwd = udp_copy_datagram(whdr, len, body, src_addr);
+            if (!fwd)
+                goto done;
+            udp_queue_datagram(dest_ni, fwd);
+        }
 
+        /* Release the datagrams held behind it. */
+        peer->recv_next++;
+        while (peer->recv_sack & 1) {
+            peer->recv_sack >>= 1;
+            fwd = peer->held[peer->recv_next % RUDP_WINDOW];
+            peer->held[peer->recv_next % RUDP_WINDOW] = NULL;
+            peer->recv_next++;
+
+            dest_ni = udp_dest_ni(ni, fwd->data + sizeof(struct udp_hdr));
+            if (dest_ni)
+                udp_queue_datagram(dest_ni, fwd);
+            else
+                free(fwd);
+        }
+        peer->recv_sack >>= 1;
+
+        if (list_empty(&peer->ack_list))
+            list_add_tail(&peer->ack_list, &rudp->acks);
+    } else if (diff <= RUDP_WINDOW) {
+        /* Ahead of a loss. */
+        uint64_t bit = 1ULL << (diff - 1);
+
+        if (!(peer->recv_sack & bit)) {
+            fwd = udp_copy_datagram(whdr, len, body, src_addr);
+            if (fwd) {
+                peer->held[seq % RUDP_WINDOW] = fwd;
+                peer->recv_sack |= bit;
+            }
+        }
+
+        rudp_send_ack(rudp, peer);
+    } else {
+        /* Already received; the acknowledgement was probably lost. */
+        rudp_send_ack(rudp, peer);
+    }
+
+  done:
+    pthread_mutex_unlock(&rudp->mutex);
 
-#endif
     return ret;
 }
 
-
 /**
- * @brief Intercept recvmsg calls for reliability header processing
+ * @brief Run the retransmission timers and send the acknowledgements
+ * owed.
  *
- * This allows the non-RUDP case to simply pass through to recvmsg
- * RUDP calls have a reliabilty header processed
+ * Called by the progress thread.
+ *
+ * @param[in] ni the network interface
+ */
+void rudp_progress(ni_t *ni)
+{
+    struct rudp *rudp = ni->iface->udp.rudp;
+    struct list_head *l, *t;
+    uint64_t now;
+    uint64_t tick;
+
+    if (!rudp || (rudp->in_flight == 0 && list_empty(&rudp->acks)))
+        return;
+
+    /* Another NI on the same socket is doing it. */
+    if (pthread_mutex_trylock(&rudp->mutex))
+        return;
+
+    while (!list_empty(&rudp->acks))
+        rudp_send_ack(rudp, list_first_entry(&rudp->acks, struct rudp_peer,
+                                             ack_list));
+
+    /* Only this function moves the wheel on. The slots between the
+     * last run and now are all looked at, whatever was sent or
+     * received since. */
+    now = rudp_clock();
+    tick = rudp->tick;
+    if (now - tick > RUDP_WHEEL_SIZE)
+        tick = now - RUDP_WHEEL_SIZE;
+    rudp->tick = now;
+
+    for (; rudp->in_flight && tick < now; tick++) {
+        list_for_each_safe(l, t,
+                           &rudp->wheel[(tick + 1) & (RUDP_WHEEL_SIZE - 1)]) {
+            struct rudp_pkt *pkt = list_entry(l, struct rudp_pkt, list);
+
+            if (pkt->deadline > now)
+                continue;
+
+            list_del(&pkt->list);
+            if (++pkt->retries == RUDP_WARN_RETRIES)
+                ptl_warn("datagram %u to %s:%d not acknowledged after "
+                         "%d retransmissions\n", pkt->seq,
+                         inet_ntoa(pkt->peer->addr.sin_addr),
+                         ntohs(pkt->peer->addr.sin_port), pkt->retries);
+            rudp_transmit(rudp, pkt);
+        }
+    }
+
+    pthread_mutex_unlock(&rudp->mutex);
+}
+
+/**
+ * @brief Tell whether the progress thread must keep running for the
+ * reliability layer.
  *
- * @param[in] sockfd The socket to use for the recv
- * @param[in] msg    The message to be recvd, in strcut msghdr form
- * @param[in] flags  Appropriate flags to pass for the recvmsg operation
- * @param[in] ni     The portals network interface to use 
+ * @param[in] ni the network interface
  *
- * @return size      Size of the message received
+ * @return 1 if datagrams are in flight or acknowledgements owed
  */
+int rudp_busy(ni_t *ni)
+{
+    struct rudp *rudp = ni->iface->udp.rudp;
+
+    return rudp && (rudp->in_flight || !list_empty(&rudp->acks));
+}
+#endif
 
-ssize_t ptl_recvmsg(int sockfd, struct msghdr *msg, int flags, ni_t *ni)
+
+/**
+ * @brief Intercept sendmsg calls for reliability header processing
+ *
+ * This allows the non-RUDP case to simply pass through to sendmsg, or
+ * to the io_uring engine when it is used.
+ * RUDP calls have a reliabilty header applied to it for the
+ * given destination.
+ *
+ * @param[in] sockfd The socket to use for the send
+ * @param[in] msg    The message to be sent, in strcut msghdr form, starting
+ *                   with a struct udp_hdr
+ * @param[in] flags  Appropriate flags to pass for the sendmsg operation
+ * @param[in] ni     The portals network interface to use
+ *
+ * @return size      Size of the message sent
+ */
+ssize_t ptl_sendmsg(int sockfd, const struct msghdr *msg, int flags,
+                    ni_t *ni)
 {
     ssize_t ret;
 #if !WITH_RUDP
-    ret = recvmsg(sockfd, msg, flags);
+    if (ni->udp.uring)
+        ret = udp_uring_sendmsg(ni, msg);
+    else
+        ret = sendmsg(sockfd, msg, flags);
 #else
     //send this reliably
-    int hdr_status;
-    ptl_info("@@@@@@@@@ RUDP recvmsg @@@@@@@@@\n");
-    ret = recvmsg(sockfd, msg, flags);
-    if (ret == -1)
-        return ret;
-    if (flags == MSG_PEEK)
-        return ret;
-
-    hdr_status =
-        process_rudp_recv_hdr(msg->msg_iov[0].iov_base,
-                              msg->msg_iov[0].iov_len, ni);
+    ret = rudp_sendmsg(ni, msg);
 #endif
     return ret;
 }
 
 /**
- * @brief Intercept recvfrom calls for reliability header processing
+ * @brief Intercept sendmmsg calls for reliability header processing
  *
- * This allows the non-RUDP case to simply pass through to recvfrom
- * RUDP calls have a reliabilty header processed
+ * Same as ptl_sendmsg, for a batch of messages. Where sendmmsg is not
+ * available, the messages are sent one by one.
  *
- * @param[in] sockfd     The socket to use for the recv
- * @param[in] buf        A buffer to put the message in
- * @param[in] len        The length of the buffer
- * @param[in] flags      Flags to pass to the recvfrom operation
- * @param[in] src_addr   The source address (struct sockaddr)
- * @param[in] addrlen    The length of the src_addr struct
- * @param[in] ni         The portals network interface to use  
- *  
- * @return size          Size of the message received
+ * @param[in] sockfd The socket to use for the send
+ * @param[in] msgvec The messages to be sent
+ * @param[in] vlen   The number of messages in msgvec
+ * @param[in] flags  Appropriate flags to pass for the sendmsg operation
+ * @param[in] ni     The portals network interface to use
  *
+ * @return number of messages sent, or -1 if none could be sent
  */
-ssize_t ptl_recvfrom(int sockfd, buf_t *buf, size_t len, int flags,
-                     struct sockaddr * src_addr, socklen_t *addrlen, ni_t *ni)
+int ptl_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+                 int flags, ni_t *ni)
 {
-    ssize_t ret;
+#if WITH_RUDP || !defined(HAVE_SENDMMSG)
+    unsigned int i;
+#endif
+
 #if !WITH_RUDP
-    ret = recvfrom(sockfd, buf, len, flags, src_addr, addrlen);
+    if (ni->udp.uring)
+        return udp_uring_sendmmsg(ni, msgvec, vlen);
+#endif
+
+#if WITH_RUDP
+    //send these reliably
+    for (i = 0; i < vlen; i++) {
+        ssize_t ret = rudp_sendmsg(ni, &msgvec[i].msg_hdr);
+
+        if (ret == -1)
+            return i ? i : -1;
+
+        msgvec[i].msg_len = ret;
+    }
+
+    return vlen;
+#elif defined(HAVE_SENDMMSG)
+    return sendmmsg(sockfd, msgvec, vlen, flags);
 #else
-    //recv this reliably
-    int hdr_status;
-    ret = recvfrom(sockfd, buf, len, flags, src_addr, addrlen);
-    //error processing, just hand the error back to the caller
-    if (ret == -1 || ret == 0)
-        return ret;
-    if (flags == MSG_PEEK)
-        return ret;
+    for (i = 0; i < vlen; i++) {
+        ssize_t ret = sendmsg(sockfd, &msgvec[i].msg_hdr, flags);
 
-    hdr_status = process_rudp_recv_hdr(buf, len, ni);
+        if (ret == -1)
+            return i ? i : -1;
 
+        msgvec[i].msg_len = ret;
+    }
+
+    return vlen;
 #endif
-    return ret;
 }
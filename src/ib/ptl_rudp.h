@@ -7,14 +7,44 @@
 ssize_t ptl_sendmsg(int sockfd, const struct msghdr *msg, int flags,
                     ni_t *ni);
 
-ssize_t ptl_sendto(int sockfd, buf_t *buf, size_t len, int flags,
-                   struct sockaddr *dest_addr, socklen_t addrlen, ni_t *ni);
+#ifndef HAVE_SENDMMSG
+/* Some libcs declare the structure but not sendmmsg. */
+#define mmsghdr ptl_mmsghdr
+struct mmsghdr {
+    struct msghdr msg_hdr;
+    unsigned int msg_len;
+};
+#endif
 
-ssize_t ptl_recvfrom(int sockfd, buf_t *buf, size_t len, int flags,
-                     struct sockaddr *src_addr, socklen_t *addrlen, ni_t *ni);
+int ptl_sendmmsg(int sockfd, struct mmsghdr *msgvec, unsigned int vlen,
+                 int flags, ni_t *ni);
 
-ssize_t ptl_recvmsg(int sockfd, struct msghdr *msg, int flags, ni_t *ni);
+/* A copy of a received datagram, queued for later processing. */
+struct udp_fwd {
+    struct list_head list;
+    struct sockaddr_in src_addr;
+    size_t len;
+    unsigned char data[0];
+};
 
-int process_rudp_recv_hdr(buf_t *buf, int len, ni_t *ni);
+struct udp_fwd *udp_copy_datagram(const struct udp_hdr *whdr, size_t len,
+                                  const void *body,
+                                  const struct sockaddr_in *src_addr);
 
-int process_rudp_send_hdr(buf_t *buf, int len, ni_t *ni);
+ni_t *udp_dest_ni(ni_t *ni, const void *hdr);
+
+buf_t *udp_recv_datagram(ni_t *ni, const void *data, size_t len,
+                         const struct sockaddr_in *src_addr);
+
+void udp_queue_datagram(ni_t *ni, struct udp_fwd *fwd);
+
+#if WITH_RUDP
+/* Return values of rudp_recv. */
+enum {
+    RUDP_DELIVER,               /* process the datagram now */
+    RUDP_CONSUMED,              /* dropped, or kept by rudp_recv */
+};
+
+int rudp_recv(ni_t *ni, buf_t *buf, const struct udp_hdr *whdr, size_t len,
+              const void *body, const struct sockaddr_in *src_addr);
+#endif
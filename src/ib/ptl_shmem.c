@@ -3,6 +3,194 @@
  */
 
 #include "ptl_loc.h"
+#include "ptl_timer.h"
+
+#include <sys/un.h>
+#if USE_CMA
+#include <sys/prctl.h>
+#include <sys/uio.h>
+#endif
+
+/**
+ * @brief Return the queue to use to send to a local rank.
+ *
+ * Each rank has one queue per progress thread. A sender always uses
+ * the same queue of a given destination, so its messages stay ordered.
+ *
+ * @param[in] ni the network interface
+ * @param[in] dest the destination local rank
+ *
+ * @return the queue
+ */
+static queue_t *shmem_queue(ni_t *ni, ptl_rank_t dest)
+{
+    queue_t *queues =
+        (queue_t *)(ni->shmem.first_queue +
+                    (ni->shmem.per_proc_comm_buf_size * dest));
+
+    return &queues[ni->mem.index % ni->shmem.num_queues];
+}
+
+/* Messages taken from a ring before looking at the other senders. */
+#define SHMEM_SPSC_BATCH	16
+
+/**
+ * @brief Return the ring a local rank uses to send to another one.
+ *
+ * @param[in] ni the network interface
+ * @param[in] dest the destination local rank
+ * @param[in] src the source local rank
+ *
+ * @return the ring
+ */
+static spsc_t *shmem_spsc(ni_t *ni, ptl_rank_t dest, ptl_rank_t src)
+{
+    return ni->shmem.spsc.first + ni->shmem.spsc.per_proc_size * dest +
+        ni->shmem.spsc.bitmap_size * ni->shmem.num_queues +
+        ni->shmem.spsc.ring_size * src;
+}
+
+/**
+ * @brief Return the bitmap of the senders with pending messages for a
+ * queue shard of a local rank.
+ *
+ * @param[in] ni the network interface
+ * @param[in] dest the local rank owning the shard
+ * @param[in] shard the index of the shard
+ *
+ * @return the bitmap
+ */
+static uint64_t *shmem_spsc_bitmap(ni_t *ni, ptl_rank_t dest, int shard)
+{
+    return ni->shmem.spsc.first + ni->shmem.spsc.per_proc_size * dest +
+        ni->shmem.spsc.bitmap_size * shard;
+}
+
+/**
+ * @brief Find the next sender with pending messages.
+ *
+ * @param[in] bitmap the bitmap of the senders
+ * @param[in] num_words the number of words in the bitmap
+ * @param[in] start the sender to start the search at
+ *
+ * @return the local rank of the sender, or -1 if there is none
+ */
+static int spsc_next_sender(const uint64_t *bitmap, int num_words,
+                            int start)
+{
+    int i;
+
+    /* The first word is looked at twice, to wrap around. */
+    for (i = 0; i <= num_words; i++) {
+        int w = (start / 64 + i) % num_words;
+        uint64_t bits = bitmap[w];
+
+        if (i == 0)
+            bits &= ~0ULL << (start % 64);
+
+        if (bits)
+            return w * 64 + __builtin_ctzll(bits);
+    }
+
+    return -1;
+}
+
+/**
+ * @brief Build the address of the doorbell of a queue.
+ *
+ * The doorbells are datagram sockets in the abstract namespace, so
+ * they vanish with their process.
+ *
+ * @param[in] ni the network interface
+ * @param[in] rank the local rank owning the queue
+ * @param[in] shard the index of the queue
+ * @param[out] addr the address
+ *
+ * @return the length of the address
+ */
+static socklen_t shmem_doorbell_addr(ni_t *ni, ptl_rank_t rank, int shard,
+                                     struct sockaddr_un *addr)
+{
+    int len;
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+                   "%s-%d-%d", ni->shmem.doorbell_name, rank, shard);
+
+    return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+/**
+ * @brief Wake up the progress thread of a queue if it is blocked.
+ *
+ * Must be called after enqueuing to the queue.
+ *
+ * @param[in] ni the network interface
+ * @param[in] queue the queue
+ * @param[in] dest the local rank owning the queue
+ */
+static void shmem_ring(ni_t *ni, queue_t *queue, ptl_rank_t dest)
+{
+    struct sockaddr_un addr;
+    socklen_t len;
+    TIMER_TYPE now;
+
+    if (!queue_wake_needed(queue))
+        return;
+
+    MARK_TIMER(now);
+    queue->wake_time = TIMER_INTS(now);
+
+    len = shmem_doorbell_addr(ni, dest,
+                              ni->mem.index % ni->shmem.num_queues, &addr);
+
+    /* EAGAIN means the doorbell is already ringing. */
+    if (sendto(ni->shmem.doorbell_s, "", 1, 0, (struct sockaddr *)&addr, len)
+        == -1 && errno != EAGAIN)
+        ptl_warn("cannot wake up local rank %d (errno=%d)\n", dest, errno);
+}
+
+/**
+ * @brief Post some buffers to a local rank, and wake it up if needed.
+ *
+ * @param[in] ni the network interface
+ * @param[in] objs the buffers, in order
+ * @param[in] num_objs the number of buffers, at least 1
+ * @param[in] dest the destination local rank
+ */
+static void shmem_post(ni_t *ni, obj_t **objs, int num_objs,
+                       ptl_rank_t dest)
+{
+    queue_t *queue = shmem_queue(ni, dest);
+
+    if (ni->shmem.spsc.first) {
+        const ptl_rank_t me = ni->mem.index;
+        spsc_t *spsc = shmem_spsc(ni, dest, me);
+        uint64_t *word =
+            &shmem_spsc_bitmap(ni, dest, me % ni->shmem.num_queues)[me / 64];
+        const uint64_t mask = 1ULL << (me % 64);
+
+        /* A ring can hold all the buffers of both ranks, so it is
+         * never full for long. */
+        PTL_FASTLOCK_LOCK(&ni->shmem.spsc.locks[dest]);
+        while (!spsc_enqueue(ni->shmem.comm_pad, spsc,
+                             ni->shmem.spsc.entries, objs, num_objs))
+            SPINLOCK_BODY();
+        PTL_FASTLOCK_UNLOCK(&ni->shmem.spsc.locks[dest]);
+
+        /* Point the receiver to the ring. */
+        __sync_synchronize();
+        if (!(*word & mask))
+            __sync_fetch_and_or(word, mask);
+    } else if (num_objs == 1) {
+        enqueue(ni->shmem.comm_pad, queue, objs[0]);
+    } else {
+        enqueue_list(ni->shmem.comm_pad, queue, objs, num_objs);
+    }
+
+    shmem_ring(ni, queue, dest);
+}
 
 /**
  * @brief Send a message using shared memory.
@@ -27,11 +215,42 @@ static int shmem_send_message(buf_t *buf, int from_init)
 
     buf->shmem.index_owner = buf->obj.obj_ni->mem.index;
 
+    if (from_init && ni_bundle_add(buf->obj.obj_ni, buf) == PTL_OK)
+        return PTL_OK;
+
     shmem_enqueue(buf->obj.obj_ni, buf, buf->dest.shmem.local_rank);
 
     return PTL_OK;
 }
 
+/**
+ * @brief Send the messages of a bundle using shared memory.
+ *
+ * Consecutive buffers for the same local rank are linked together
+ * and enqueued at once.
+ *
+ * @param[in] bufs the buffers prepared by shmem_send_message.
+ * @param[in] num_bufs the number of buffers.
+ */
+static void shmem_send_bundle(buf_t **bufs, int num_bufs)
+{
+    ni_t *ni = bufs[0]->obj.obj_ni;
+    obj_t *objs[num_bufs];
+    int i;
+    int j;
+
+    for (i = 0; i < num_bufs; i = j) {
+        ptl_rank_t dest = bufs[i]->dest.shmem.local_rank;
+
+        objs[0] = &bufs[i]->obj;
+        for (j = i + 1; j < num_bufs && bufs[j]->dest.shmem.local_rank == dest;
+             j++)
+            objs[j - i] = &bufs[j]->obj;
+
+        shmem_post(ni, objs, j - i, dest);
+    }
+}
+
 static void shmem_set_send_flags(buf_t *buf, int can_signal)
 {
     /* The data is always in the buffer. */
@@ -61,6 +280,50 @@ static int shmem_init_connect(ni_t *ni, conn_t *conn)
 }
 
 #if USE_KNEM
+/**
+ * @brief Get the mr for a direct transfer from a non iovec md.
+ *
+ * The md keeps the mr of its previous transfer. It is reused when it
+ * covers the data, which saves a registration (and a KNEM region) for
+ * each transfer when the mr cache is disabled. The memory of the md
+ * can't change while it is bound, so the cookie stays valid.
+ *
+ * @param[in] md the md that contains the data
+ * @param[in] addr the start of the data
+ * @param[in] length the length of the data
+ * @param[out] mr_p address of return value
+ *
+ * @return status
+ */
+static int md_knem_mr(md_t *md, void *addr, ptl_size_t length,
+                      mr_t **mr_p)
+{
+    mr_t *mr;
+    int err;
+
+    /* Take the cached mr, so no other thread can drop it meanwhile. */
+    mr = __sync_lock_test_and_set(&md->knem_mr, NULL);
+
+    if (!mr || addr < mr->addr ||
+        addr + length > mr->addr + mr->length) {
+        if (mr)
+            mr_put(mr);
+
+        err = mr_lookup_app(obj_to_ni(md), addr, length, &mr);
+        if (err)
+            return err;
+    }
+
+    mr_get(mr);
+    *mr_p = mr;
+
+    /* Give it back, unless another thread already did. */
+    if (!__sync_bool_compare_and_swap(&md->knem_mr, NULL, mr))
+        mr_put(mr);
+
+    return PTL_OK;
+}
+
 static void append_init_data_shmem_direct(data_t *data, mr_t *mr, void *addr,
                                           ptl_size_t length, buf_t *buf)
 {
@@ -156,10 +419,9 @@ static int shmem_init_prepare_transfer(md_t *md, data_dir_t dir,
     } else {
         void *addr;
         mr_t *mr;
-        ni_t *ni = obj_to_ni(md);
 
         addr = md->start + offset;
-        err = mr_lookup_app(ni, addr, length, &mr);
+        err = md_knem_mr(md, addr, length, &mr);
         if (!err) {
             buf->mr_list[buf->num_mr++] = mr;
 
@@ -200,24 +462,52 @@ static int knem_tgt_data_out(buf_t *buf, data_t *data)
 }
 
 #else
+/**
+ * @brief Take a bounce buffer for a transfer.
+ *
+ * The buffers of the NUMA node of the initiator are tried first, then
+ * those of the other nodes.
+ *
+ * @param[in] buf the buf of the request
+ * @param[in] data the data segment of the request
+ */
 static void attach_bounce_buffer(buf_t *buf, data_t *data)
 {
     void *bb;
     ni_t *ni = obj_to_ni(buf);
+    const unsigned int num_parts = ni->shmem.bounce_buf.num_parts;
+    unsigned int first = 0;
+    unsigned int i = 0;
+    struct shmem_bounce_head *head;
+
+    if (ni->shmem.numa_node != -1 && ni->shmem.numa_node < num_parts)
+        first = ni->shmem.numa_node;
+
+    for (;;) {
+        head = &ni->shmem.bounce_buf.head[(first + i) % num_parts];
+        bb = ll_dequeue_obj_alien(&head->free_list, head,
+                                  head->head_index0);
+        if (bb)
+            break;
 
-    while ((bb =
-            ll_dequeue_obj_alien(&ni->shmem.bounce_buf.head->free_list,
-                                 ni->shmem.bounce_buf.head,
-                                 ni->shmem.bounce_buf.head->head_index0)) ==
-           NULL)
-        SPINLOCK_BODY();
+        if (++i == num_parts) {
+            i = 0;
+            SPINLOCK_BODY();
+        }
+    }
 
     buf->transfer.noknem.data = bb;
-    buf->transfer.noknem.data_length = ni->shmem.bounce_buf.buf_size;
+    buf->transfer.noknem.bounce_head = head;
+    buf->transfer.noknem.data_length =
+        ni->shmem.bounce_buf.slot_size * ni->shmem.bounce_buf.num_slots;
     buf->transfer.noknem.bounce_offset =
         bb - (void *)ni->shmem.bounce_buf.head;
 
     data->noknem.bounce_offset = buf->transfer.noknem.bounce_offset;
+    data->noknem.slot_size = ni->shmem.bounce_buf.slot_size;
+    data->noknem.num_slots = ni->shmem.bounce_buf.num_slots;
+    data->noknem.produced = 0;
+    data->noknem.consumed = 0;
 }
 
 static void append_init_data_noknem_iovec(data_t *data, md_t *md,
@@ -229,7 +519,7 @@ static void append_init_data_noknem_iovec(data_t *data, md_t *md,
     data->noknem.target_done = 0;
     data->noknem.init_done = 0;
 
-    buf->transfer.noknem.transfer_state_expected = 0;   /* always the initiator here */
+    buf->transfer.noknem.is_target = 0;
     buf->transfer.noknem.noknem = &data->noknem;
 
     attach_bounce_buffer(buf, data);
@@ -251,7 +541,7 @@ static void append_init_data_noknem_direct(data_t *data, mr_t *mr, void *addr,
     data->noknem.target_done = 0;
     data->noknem.init_done = 0;
 
-    buf->transfer.noknem.transfer_state_expected = 0;   /* always the initiator here */
+    buf->transfer.noknem.is_target = 0;
     buf->transfer.noknem.noknem = &data->noknem;
 
     attach_bounce_buffer(buf, data);
@@ -269,6 +559,100 @@ static void append_init_data_noknem_direct(data_t *data, mr_t *mr, void *addr,
     buf->length += sizeof(*data);
 }
 
+#if USE_CMA
+/**
+ * @brief Check whether the target of a request can read or write our
+ * memory with process_vm_readv/writev.
+ *
+ * @param[in] buf the request
+ *
+ * @return 1 if it can, 0 if not
+ */
+static int cma_peer(buf_t *buf)
+{
+    ni_t *ni = obj_to_ni(buf);
+    const struct shmem_pid_table *pid_table = ni->shmem.comm_pad;
+
+    if (!ni->shmem.cma)
+        return 0;
+
+    /* A physical NI only talks to itself. */
+    if (ni->options & PTL_NI_PHYSICAL)
+        return 1;
+
+    return pid_table[buf->conn->shmem.local_rank].cma;
+}
+
+/**
+ * @brief Build and append a data segment describing our memory, for
+ * the target to copy it directly.
+ *
+ * @param[in] md the md that contains the data
+ * @param[in] offset the offset into the md
+ * @param[in] length the length of the data
+ * @param[in] buf the buf the add the data segment to
+ *
+ * @return PTL_OK, or PTL_FAIL if the data doesn't fit in a descriptor
+ * and bounce buffers must be used
+ */
+static int append_init_data_cma(md_t *md, ptl_size_t offset,
+                                ptl_size_t length, buf_t *buf)
+{
+    data_t *data = (data_t *)(buf->data + buf->length);
+    ptl_size_t iov_start = 0;
+    ptl_size_t iov_offset = 0;
+    int num_sge;
+    int i;
+
+    if (md->options & PTL_IOVEC) {
+        ptl_iovec_t *iovecs = md->start;
+
+        num_sge =
+            iov_count_elem(iovecs, md->num_iov, offset, length, &iov_start,
+                           &iov_offset);
+        if (num_sge < 0 || num_sge > get_param(PTL_MAX_INLINE_SGE))
+            return PTL_FAIL;
+
+        /* Describe exactly the data, starting in the first IOV. */
+        for (i = 0; i < num_sge; i++) {
+            ptl_iovec_t iov = iovecs[iov_start + i];
+
+            if (i == 0) {
+                iov.iov_base += iov_offset;
+                iov.iov_len -= iov_offset;
+            }
+            if (iov.iov_len > length)
+                iov.iov_len = length;
+            length -= iov.iov_len;
+
+            data->cma.iovecs[i] = iov;
+        }
+    } else {
+        void *addr;
+        mr_t *mr;
+        ni_t *ni = obj_to_ni(md);
+
+        addr = md->start + offset;
+        if (mr_lookup_app(ni, addr, length, &mr))
+            return PTL_FAIL;
+
+        buf->mr_list[buf->num_mr++] = mr;
+
+        num_sge = 1;
+        data->cma.iovecs[0].iov_base = addr;
+        data->cma.iovecs[0].iov_len = length;
+    }
+
+    data->data_fmt = DATA_FMT_CMA;
+    data->cma.pid = getpid();
+    data->cma.num_iovecs = num_sge;
+
+    buf->length += sizeof(*data) + num_sge * sizeof(ptl_iovec_t);
+
+    return PTL_OK;
+}
+#endif
+
 /**
  * @brief Build and append a data segment to a request message.
  *
@@ -296,11 +680,15 @@ static int noknem_init_prepare_transfer(md_t *md, data_dir_t dir,
         err =
             append_immediate_data(md->start, NULL, md->num_iov, dir, offset,
                                   length, buf);
+#if USE_CMA
+    } else if (cma_peer(buf) &&
+               append_init_data_cma(md, offset, length, buf) == PTL_OK) {
+        /* The target copies the data itself. */
+#endif
     } else {
-        if (dir == DATA_DIR_IN)
-            buf->data_in->noknem.state = 2;
-        else
-            buf->data_out->noknem.state = 0;
+        /* We fill the bounce ring for a put, and the target does
+         * for a get. */
+        buf->transfer.noknem.producer = (dir == DATA_DIR_OUT);
 
         if (md->options & PTL_IOVEC) {
             ptl_iovec_t *iovecs = md->start;
@@ -343,69 +731,144 @@ static int noknem_init_prepare_transfer(md_t *md, data_dir_t dir,
     return err;
 }
 
-static int noknem_do_transfer(buf_t *buf)
+/**
+ * @brief Move data between the local memory and the bounce ring.
+ *
+ * The producer fills as many free slots as it can, and the consumer
+ * drains as many full slots as it can, so both sides of the transfer
+ * copy at the same time.
+ *
+ * @param[in] buf the initiator or target buf
+ * @param[in,out] length the number of bytes left to copy
+ *
+ * @return status
+ */
+int noknem_copy(buf_t *buf, ptl_size_t *length)
 {
     struct noknem *noknem = buf->transfer.noknem.noknem;
-    ptl_size_t *resid =
-        buf->rdma_dir == DATA_DIR_IN ? &buf->put_resid : &buf->get_resid;
+    const ptl_size_t ring = buf->transfer.noknem.data_length;
+    const ptl_size_t slot = noknem->slot_size;
+    ptl_size_t produced = noknem->produced;
+    ptl_size_t consumed = noknem->consumed;
     ptl_size_t to_copy;
     int err;
 
-    if (noknem->state != 2)
-        return PTL_OK;
+    if (buf->transfer.noknem.producer) {
+        while (*length && produced - noknem->consumed + slot <= ring) {
+            to_copy = slot;
+            if (to_copy > *length)
+                to_copy = *length;
 
-    if (noknem->init_done) {
-        assert(noknem->target_done);
-        return PTL_OK;
-    }
+            err =
+                iov_copy_out(buf->transfer.noknem.data + produced % ring,
+                             buf->transfer.noknem.iovecs, NULL,
+                             buf->transfer.noknem.num_iovecs,
+                             buf->transfer.noknem.offset, to_copy);
+            if (err)
+                return err;
+
+            buf->transfer.noknem.offset += to_copy;
+            *length -= to_copy;
+            produced += to_copy;
 
-    noknem->state = 3;
+            /* Hand the slot to the consumer. */
+            __sync_synchronize();
+            noknem->produced = produced;
+        }
+    } else {
+        while (*length && consumed != noknem->produced) {
+            to_copy = noknem->produced - consumed;
+            if (to_copy > slot)
+                to_copy = slot;
+            if (to_copy > *length)
+                to_copy = *length;
 
-    if (*resid) {
-        if (buf->rdma_dir == DATA_DIR_IN) {
-            to_copy = noknem->length;
-            if (to_copy > *resid)
-                to_copy = *resid;
+            /* Only read the slot after it is published. */
+            __sync_synchronize();
 
             err =
-                iov_copy_in(buf->transfer.noknem.data,
+                iov_copy_in(buf->transfer.noknem.data + consumed % ring,
                             buf->transfer.noknem.iovecs, NULL,
                             buf->transfer.noknem.num_iovecs,
                             buf->transfer.noknem.offset, to_copy);
-        } else {
-            to_copy = buf->transfer.noknem.data_length;
-            if (to_copy > *resid)
-                to_copy = *resid;
+            if (err)
+                return err;
 
-            err =
-                iov_copy_out(buf->transfer.noknem.data,
-                             buf->transfer.noknem.iovecs, NULL,
-                             buf->transfer.noknem.num_iovecs,
-                             buf->transfer.noknem.offset, to_copy);
+            buf->transfer.noknem.offset += to_copy;
+            *length -= to_copy;
+            consumed += to_copy;
 
-            noknem->length = to_copy;
+            /* Give the slot back to the producer. */
+            __sync_synchronize();
+            noknem->consumed = consumed;
         }
+    }
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Check whether a side of a transfer can make progress.
+ *
+ * @param[in] buf the initiator or target buf
+ *
+ * @return 1 if noknem_copy or the end of transfer has work to do
+ */
+int noknem_ready(buf_t *buf)
+{
+    const struct noknem *noknem = buf->transfer.noknem.noknem;
 
-        /* That should never happen since all lengths were properly
-         * computed before entering. */
-        assert(err == PTL_OK);
+    if (buf->transfer.noknem.is_target) {
+        if (noknem->init_done)
+            return 1;
 
+        /* Waiting for the initiator to finish. */
+        if (noknem->target_done)
+            return 0;
     } else {
-        /* Dropped case. Nothing to transfer, but the buffer must
-         * still be returned. */
-        to_copy = 0;
-        err = PTL_OK;
+        if (noknem->target_done)
+            return 1;
+
+        if (buf->transfer.noknem.length_left == 0)
+            return 0;
     }
 
-    buf->transfer.noknem.offset += to_copy;
-    *resid -= to_copy;
+    if (buf->transfer.noknem.producer)
+        return noknem->produced - noknem->consumed + noknem->slot_size <=
+            buf->transfer.noknem.data_length;
+    else
+        return noknem->produced != noknem->consumed;
+}
 
-    if (*resid == 0)
-        noknem->target_done = 1;
+static int noknem_do_transfer(buf_t *buf)
+{
+    struct noknem *noknem = buf->transfer.noknem.noknem;
+    ptl_size_t *resid =
+        buf->rdma_dir == DATA_DIR_IN ? &buf->put_resid : &buf->get_resid;
+    int err;
+
+    if (noknem->init_done) {
+        assert(noknem->target_done);
+        return PTL_OK;
+    }
+
+    if (noknem->target_done)
+        return PTL_OK;
+
+    /* In the dropped case, there is nothing to transfer, but the
+     * initiator must still be told. */
+    err = noknem_copy(buf, resid);
 
-    /* Tell the initiator the buffer is his again. */
-    __sync_synchronize();
-    noknem->state = 0;
+    /* That should never happen since all lengths were properly
+     * computed before entering. */
+    assert(err == PTL_OK);
+
+    if (*resid == 0) {
+        /* Tell the initiator we are done. For a get, it will still
+         * drain the ring. */
+        __sync_synchronize();
+        noknem->target_done = 1;
+    }
 
     return err;
 }
@@ -420,7 +883,8 @@ static int noknem_tgt_data_out(buf_t *buf, data_t *data)
         return STATE_TGT_ERROR;
     }
 
-    buf->transfer.noknem.transfer_state_expected = 2;   /* always the target here */
+    buf->transfer.noknem.is_target = 1;
+    buf->transfer.noknem.producer = (buf->rdma_dir == DATA_DIR_OUT);
     buf->transfer.noknem.noknem = &data->noknem;
 
     if ((buf->rdma_dir == DATA_DIR_IN && buf->put_resid) ||
@@ -441,52 +905,484 @@ static int noknem_tgt_data_out(buf_t *buf, data_t *data)
     buf->transfer.noknem.length_left = buf->get_resid;
     buf->transfer.noknem.data =
         (void *)ni->shmem.bounce_buf.head + data->noknem.bounce_offset;
-    buf->transfer.noknem.data_length = ni->shmem.bounce_buf.buf_size;
+    buf->transfer.noknem.data_length =
+        data->noknem.slot_size * data->noknem.num_slots;
 
     return STATE_TGT_START_COPY;
 }
-#endif
 
-struct transport transport_shmem = {
-    .type = CONN_TYPE_SHMEM,
-    .buf_alloc = sbuf_alloc,
-    .init_connect = shmem_init_connect,
-    .send_message = shmem_send_message,
-    .set_send_flags = shmem_set_send_flags,
-#if USE_KNEM
-    .init_prepare_transfer = shmem_init_prepare_transfer,
-    .post_tgt_dma = mem_do_transfer,
-    .tgt_data_out = knem_tgt_data_out,
-#else
-    .init_prepare_transfer = noknem_init_prepare_transfer,
-    .post_tgt_dma = noknem_do_transfer,
-    .tgt_data_out = noknem_tgt_data_out,
-#endif
-};
+#if USE_CMA
+/* Most iovecs given to a single process_vm_readv/writev call. */
+#define CMA_IOV_MAX	64
 
 /**
- * @brief Cleanup shared memory resources.
+ * @brief Describe a part of an iovec array with at most CMA_IOV_MAX
+ * iovecs.
  *
- * @param[in] ni
+ * @param[out] iov the iovecs to fill
+ * @param[in] src the iovec array
+ * @param[in] num_src the number of entries in src
+ * @param[in] offset the offset of the part in src
+ * @param[in] length the length of the part
+ *
+ * @return the number of iovecs filled
  */
-static void release_shmem_resources(ni_t *ni)
+static int cma_iov_fill(struct iovec *iov, const ptl_iovec_t *src,
+                        ptl_size_t num_src, ptl_size_t offset,
+                        ptl_size_t length)
 {
-    pool_fini(&ni->sbuf_pool);
+    int n = 0;
 
-    if (ni->shmem.comm_pad != MAP_FAILED) {
-        munmap(ni->shmem.comm_pad, ni->shmem.comm_pad_size);
-        ni->shmem.comm_pad = MAP_FAILED;
+    for (; num_src && offset >= src->iov_len; num_src--, src++)
+        offset -= src->iov_len;
+
+    for (; num_src && length && n < CMA_IOV_MAX; num_src--, src++) {
+        iov[n].iov_base = src->iov_base + offset;
+        iov[n].iov_len = src->iov_len - offset;
+        if (iov[n].iov_len > length)
+            iov[n].iov_len = length;
+
+        length -= iov[n].iov_len;
+        offset = 0;
+        n++;
+    }
+
+    return n;
+}
+
+/**
+ * @brief Copy the data between the initiator memory and the ME/LE, in
+ * a single copy.
+ *
+ * @param[in] buf the request
+ *
+ * @return status
+ */
+static int cma_do_transfer(buf_t *buf)
+{
+    const data_t *data =
+        buf->rdma_dir == DATA_DIR_IN ? buf->data_in : buf->data_out;
+    ptl_size_t *resid =
+        buf->rdma_dir == DATA_DIR_IN ? &buf->put_resid : &buf->get_resid;
+    const me_t *me = buf->me;
+    struct iovec local[CMA_IOV_MAX];
+    struct iovec remote[CMA_IOV_MAX];
+    ptl_iovec_t rem_iovecs[data->cma.num_iovecs];
+    const ptl_iovec_t *loc_iovecs;
+    ptl_size_t loc_num;
+    ptl_iovec_t one;
+    int nloc, nrem;
+    ssize_t ret;
+
+    /* The descriptor is packed; work on an aligned copy. */
+    memcpy(rem_iovecs, (const void *)data->cma.iovecs, sizeof(rem_iovecs));
+
+    if (me->options & PTL_IOVEC) {
+        loc_iovecs = me->start;
+        loc_num = me->num_iov;
+    } else {
+        one.iov_base = me->start;
+        one.iov_len = me->length;
+        loc_iovecs = &one;
+        loc_num = 1;
+    }
+
+    while (*resid) {
+        nloc = cma_iov_fill(local, loc_iovecs, loc_num,
+                            buf->moffset + buf->transfer.cma.done, *resid);
+        nrem = cma_iov_fill(remote, rem_iovecs, data->cma.num_iovecs,
+                            buf->transfer.cma.done, *resid);
+        if (nloc == 0 || nrem == 0) {
+            WARN();
+            return PTL_FAIL;
+        }
+
+        if (buf->rdma_dir == DATA_DIR_IN)
+            ret = process_vm_readv(data->cma.pid, local, nloc, remote, nrem,
+                                   0);
+        else
+            ret = process_vm_writev(data->cma.pid, local, nloc, remote,
+                                    nrem, 0);
+
+        if (ret <= 0) {
+            if (ret == -1 && errno == EINTR)
+                continue;
+
+            ptl_warn("CMA transfer with pid %d failed (errno=%d)\n",
+                     data->cma.pid, errno);
+            return PTL_FAIL;
+        }
+
+        buf->transfer.cma.done += ret;
+        *resid -= ret;
+    }
+
+    return PTL_OK;
+}
+
+static int cma_post_tgt_dma(buf_t *buf)
+{
+    const data_t *data =
+        buf->rdma_dir == DATA_DIR_IN ? buf->data_in : buf->data_out;
+
+    if (data->data_fmt == DATA_FMT_CMA)
+        return cma_do_transfer(buf);
+    else
+        return noknem_do_transfer(buf);
+}
+
+static int cma_tgt_data_out(buf_t *buf, data_t *data)
+{
+    if (data->data_fmt == DATA_FMT_CMA) {
+        buf->transfer.cma.done = 0;
+        return STATE_TGT_RDMA;
     }
 
+    return noknem_tgt_data_out(buf, data);
+}
+
+/**
+ * @brief Check whether process_vm_readv/writev can be used between
+ * the ranks.
+ *
+ * With the Yama security module, the ranks can't access each other
+ * from scope 1 on, unless one is the parent of the other.
+ *
+ * @return 1 if it can be used, 0 if not
+ */
+static int cma_probe(void)
+{
+    FILE *f;
+    int scope = 0;
+    int val = 1;
+    int copy = 0;
+    struct iovec local, remote;
+
+    f = fopen("/proc/sys/kernel/yama/ptrace_scope", "r");
+    if (f) {
+        if (fscanf(f, "%d", &scope) != 1)
+            scope = 0;
+        fclose(f);
+    }
+
+    if (scope >= 1) {
+        ptl_info("CMA not allowed by ptrace scope %d\n", scope);
+        return 0;
+    }
+
+    /* The other ranks can't access a non dumpable process. */
+    if (prctl(PR_GET_DUMPABLE, 0, 0, 0, 0) != 1) {
+        ptl_info("CMA not allowed, process is not dumpable\n");
+        return 0;
+    }
+
+    /* Check that the kernel supports it. */
+    local.iov_base = &copy;
+    local.iov_len = sizeof(copy);
+    remote.iov_base = &val;
+    remote.iov_len = sizeof(val);
+
+    if (process_vm_readv(getpid(), &local, 1, &remote, 1, 0) !=
+        sizeof(val) || copy != val) {
+        ptl_info("CMA not available (errno=%d)\n", errno);
+        return 0;
+    }
+
+    return 1;
+}
+#endif
+#endif
+
+struct transport transport_shmem = {
+    .type = CONN_TYPE_SHMEM,
+    .buf_alloc = sbuf_alloc,
+    .init_connect = shmem_init_connect,
+    .send_message = shmem_send_message,
+    .send_bundle = shmem_send_bundle,
+    .set_send_flags = shmem_set_send_flags,
+#if USE_KNEM
+    .init_prepare_transfer = shmem_init_prepare_transfer,
+    .post_tgt_dma = mem_do_transfer,
+    .tgt_data_out = knem_tgt_data_out,
+#elif USE_CMA
+    .init_prepare_transfer = noknem_init_prepare_transfer,
+    .post_tgt_dma = cma_post_tgt_dma,
+    .tgt_data_out = cma_tgt_data_out,
+#else
+    .init_prepare_transfer = noknem_init_prepare_transfer,
+    .post_tgt_dma = noknem_do_transfer,
+    .tgt_data_out = noknem_tgt_data_out,
+#endif
+};
+
+/**
+ * @brief Create the doorbells of our queues, and the socket to ring
+ * the other ranks' doorbells.
+ *
+ * @param[in] ni
+ *
+ * @return status
+ */
+static int setup_doorbells(ni_t *ni)
+{
+    struct sockaddr_un addr;
+    socklen_t len;
+    int i;
+
+    ni->shmem.doorbells = malloc(ni->shmem.num_queues * sizeof(int));
+    if (!ni->shmem.doorbells)
+        return PTL_NO_SPACE;
+
+    for (i = 0; i < ni->shmem.num_queues; i++)
+        ni->shmem.doorbells[i] = -1;
+    ni->shmem.doorbell_s = -1;
+
+    for (i = 0; i < ni->shmem.num_queues; i++) {
+        ni->shmem.doorbells[i] =
+            socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (ni->shmem.doorbells[i] == -1) {
+            ptl_warn("doorbell socket failed (errno=%d)\n", errno);
+            return PTL_FAIL;
+        }
+
+        len = shmem_doorbell_addr(ni, ni->mem.index, i, &addr);
+        if (bind(ni->shmem.doorbells[i], (struct sockaddr *)&addr, len)) {
+            ptl_warn("doorbell %s-%d-%d bind failed (errno=%d)\n",
+                     ni->shmem.doorbell_name, ni->mem.index, i, errno);
+            return PTL_FAIL;
+        }
+    }
+
+    ni->shmem.doorbell_s =
+        socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (ni->shmem.doorbell_s == -1) {
+        ptl_warn("doorbell socket failed (errno=%d)\n", errno);
+        return PTL_FAIL;
+    }
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Remove the comm pad files, and forget their names.
+ *
+ * @param[in] ni
+ */
+static void commpad_unlink(ni_t *ni)
+{
     if (ni->shmem.comm_pad_shm_name) {
-        /* Destroy the mmaped file so it doesn't pollute.
-         * All ranks try it in case rank 0 died. */
         shm_unlink(ni->shmem.comm_pad_shm_name);
-
         free(ni->shmem.comm_pad_shm_name);
         ni->shmem.comm_pad_shm_name = NULL;
     }
 
+    if (ni->shmem.comm_pad_huge_name) {
+        unlink(ni->shmem.comm_pad_huge_name);
+        free(ni->shmem.comm_pad_huge_name);
+        ni->shmem.comm_pad_huge_name = NULL;
+    }
+}
+
+/**
+ * @brief Create the comm pad file, with the size of the comm pad.
+ *
+ * @param[in] ni
+ * @param[in] huge create it in hugetlbfs instead of POSIX shared memory
+ *
+ * @return the file descriptor, or -1
+ */
+static int commpad_create(ni_t *ni, int huge)
+{
+    const char *name;
+    int fd;
+
+    if (huge) {
+        name = ni->shmem.comm_pad_huge_name;
+        unlink(name);
+        fd = open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    } else {
+        name = ni->shmem.comm_pad_shm_name;
+
+        /* Just in case, remove that file if it already exist. */
+        shm_unlink(name);
+        fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+    }
+
+    if (fd < 0) {
+        ptl_warn("open of %s failed (errno=%d)\n", name, errno);
+        return -1;
+    }
+
+    /* Enlarge the memory zone to the size we need. */
+    if (ftruncate(fd, ni->shmem.comm_pad_size) != 0) {
+        ptl_warn("share memory ftruncate failed");
+        close(fd);
+        if (huge)
+            unlink(name);
+        else
+            shm_unlink(name);
+        return -1;
+    }
+
+    return fd;
+}
+
+/**
+ * @brief Open the comm pad file created by rank 0.
+ *
+ * @param[in] ni
+ * @param[in,out] huge_p whether to look in hugetlbfs first; cleared if
+ * the file was found in POSIX shared memory
+ *
+ * @return the file descriptor, or -1
+ */
+static int commpad_open(ni_t *ni, int *huge_p)
+{
+    int fd;
+
+    if (*huge_p) {
+        fd = open(ni->shmem.comm_pad_huge_name, O_RDWR);
+        if (fd != -1)
+            return fd;
+    }
+
+    fd = shm_open(ni->shmem.comm_pad_shm_name, O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd != -1)
+        *huge_p = 0;
+
+    return fd;
+}
+
+/**
+ * @brief Map the comm pad file.
+ *
+ * Without hugetlbfs, transparent huge pages are requested if
+ * PTL_HUGE_PAGES is set.
+ *
+ * @param[in] ni
+ * @param[in] fd the comm pad file
+ * @param[in] huge whether the file is in hugetlbfs
+ *
+ * @return status
+ */
+static int commpad_map(ni_t *ni, int fd, int huge)
+{
+    ni->shmem.comm_pad =
+        (uint8_t *) mmap(NULL, ni->shmem.comm_pad_size,
+                         PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ni->shmem.comm_pad == MAP_FAILED) {
+        ptl_warn("mmap failed (%d)\n", errno);
+        return PTL_FAIL;
+    }
+
+    if (huge)
+        ni->shmem.comm_pad_huge = HUGE_TLB;
+    else if (huge_pages &&
+             madvise(ni->shmem.comm_pad, ni->shmem.comm_pad_size,
+                     MADV_HUGEPAGE) == 0)
+        ni->shmem.comm_pad_huge = HUGE_THP;
+    else
+        ni->shmem.comm_pad_huge = HUGE_NONE;
+
+    ptl_info("comm pad: %zu bytes backed by %s\n", ni->shmem.comm_pad_size,
+             huge_mode_name(ni->shmem.comm_pad_huge));
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Check that the rank uses as many queues as rank 0.
+ *
+ * The layout of the comm pad depends on the number of queues, so it
+ * is checked before mapping the whole file. Rank 0 publishes its
+ * number in the pid table, which comes first whatever the layout.
+ *
+ * @param[in] ni
+ * @param[in] fd the comm pad file
+ * @param[in] huge whether the file is in hugetlbfs
+ * @param[in] pid_table_size the size of the pid table
+ *
+ * @return status
+ */
+static int commpad_check_queues(ni_t *ni, int fd, int huge,
+                                size_t pid_table_size)
+{
+    size_t len = pid_table_size;
+    volatile struct shmem_pid_table *pid_table;
+    int num_queues;
+
+    /* A hugetlbfs mapping must cover whole huge pages. */
+    if (huge)
+        len = ROUND_UP(len, hugepagesize);
+
+    pid_table = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    if (pid_table == MAP_FAILED) {
+        WARN();
+        return PTL_FAIL;
+    }
+
+    /* Rank 0 sets it as soon as it has mapped the comm pad. */
+    while ((num_queues = pid_table[0].num_queues) == 0)
+        SPINLOCK_BODY();
+
+    munmap((void *)pid_table, len);
+
+    if (num_queues != ni->shmem.num_queues) {
+        ptl_error("rank %d has %d progress threads but rank 0 has %d; "
+                  "PTL_PROGRESS_THREADS must be the same for all the "
+                  "ranks of a node\n", ni->mem.index, ni->shmem.num_queues,
+                  num_queues);
+        return PTL_FAIL;
+    }
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Cleanup shared memory resources.
+ *
+ * @param[in] ni
+ */
+static void release_shmem_resources(ni_t *ni)
+{
+    int i;
+
+    pool_fini(&ni->sbuf_pool);
+
+    ni->shmem.spsc.first = NULL;
+    if (ni->shmem.spsc.locks) {
+        for (i = 0; i < ni->mem.node_size; i++)
+            PTL_FASTLOCK_DESTROY(&ni->shmem.spsc.locks[i]);
+        free((void *)ni->shmem.spsc.locks);
+        ni->shmem.spsc.locks = NULL;
+    }
+    free(ni->shmem.spsc.readers);
+    ni->shmem.spsc.readers = NULL;
+
+    if (ni->shmem.doorbells) {
+        for (i = 0; i < ni->shmem.num_queues; i++) {
+            if (ni->shmem.doorbells[i] != -1)
+                close(ni->shmem.doorbells[i]);
+        }
+        free(ni->shmem.doorbells);
+        ni->shmem.doorbells = NULL;
+
+        if (ni->shmem.doorbell_s != -1)
+            close(ni->shmem.doorbell_s);
+    }
+
+    free(ni->shmem.doorbell_name);
+    ni->shmem.doorbell_name = NULL;
+
+    if (ni->shmem.comm_pad != MAP_FAILED) {
+        munmap(ni->shmem.comm_pad, ni->shmem.comm_pad_size);
+        ni->shmem.comm_pad = MAP_FAILED;
+    }
+
+    /* Destroy the mmaped file so it doesn't pollute.
+     * All ranks try it in case rank 0 died. */
+    commpad_unlink(ni);
+
     knem_fini(ni);
 
 #if !USE_KNEM
@@ -494,6 +1390,25 @@ static void release_shmem_resources(ni_t *ni)
 #endif
 }
 
+/**
+ * @brief Bind a part of the comm pad to a NUMA node.
+ *
+ * @param[in] ni the network interface
+ * @param[in] addr the start of the part
+ * @param[in] len the length of the part
+ * @param[in] node the node
+ */
+static void numa_bind_commpad(ni_t *ni, void *addr, size_t len, int node)
+{
+    /* hugetlb pages can only be bound whole. */
+    size_t align =
+        ni->shmem.comm_pad_huge == HUGE_TLB ? hugepagesize : pagesize;
+
+    if (numa_bind(addr, len, node, align))
+        ptl_info("couldn't bind %zu bytes of the comm pad to node %d\n",
+                 len, node);
+}
+
 /**
  * @brief Initialize shared memory resources.
  *
@@ -511,6 +1426,7 @@ static int setup_commpad(ni_t *ni)
     int err;
     int i;
     int pid_table_size;
+    off_t spsc_offset = 0;
 
     /*
      * Buffers in shared memory. The buffers will be allocated later,
@@ -534,6 +1450,12 @@ static int setup_commpad(ni_t *ni)
         goto exit_fail;
     }
 
+#if USE_CMA
+    ni->shmem.cma = get_param(PTL_SHMEM_CMA) && cma_probe();
+    ptl_info("large shared memory transfers use %s\n",
+             ni->shmem.cma ? "CMA" : "bounce buffers");
+#endif
+
     if (ni->options & PTL_NI_PHYSICAL) {
         /* Create a unique name for the shared memory file. */
         snprintf(comm_pad_shm_name, sizeof(comm_pad_shm_name),
@@ -546,9 +1468,54 @@ static int setup_commpad(ni_t *ni)
     }
     ni->shmem.comm_pad_shm_name = strdup(comm_pad_shm_name);
 
-    /* Allocate a pool of buffers in the mmapped region. */
+    /* With hugetlb pages, the comm pad is first looked for in
+     * hugetlbfs. */
+    if (huge_pages == 2) {
+        const char *dir = getenv("PTL_HUGETLBFS");
+        char path[PATH_MAX];
+
+        if (!dir)
+            dir = "/dev/hugepages";
+
+        snprintf(path, sizeof(path), "%s%s", dir, comm_pad_shm_name);
+        ni->shmem.comm_pad_huge_name = strdup(path);
+    }
+
+    /* The doorbells are named after the comm pad. */
+    ni->shmem.doorbell_name = strdup(comm_pad_shm_name + 1);
+
+    /* Allocate the queues, one per progress thread, and a pool of
+     * buffers in the mmapped region. All the ranks on the node must
+     * use the same number of progress threads. */
+    ni->shmem.num_queues = get_param(PTL_PROGRESS_THREADS);
+
+    /* The doorbells must exist before the queues are used, since
+     * the other ranks ring them as soon as we wait on a queue. */
+    if (!ni->shmem.comm_pad_shm_name || !ni->shmem.doorbell_name ||
+        setup_doorbells(ni)) {
+        WARN();
+        goto exit_fail;
+    }
+    /* The placement follows the CPU affinity of the rank at this
+     * point. All the ranks compute the same layout, since it only
+     * depends on the number of nodes. */
+    ni->shmem.numa_nodes = 1;
+    ni->shmem.numa_node = -1;
+    if (get_param(PTL_SHMEM_NUMA) && numa_num_nodes() > 1) {
+        ni->shmem.numa_nodes = numa_num_nodes();
+        ni->shmem.numa_node = numa_this_node();
+        ptl_info("rank %d is on NUMA node %d of %d\n", ni->mem.index,
+                 ni->shmem.numa_node, ni->shmem.numa_nodes);
+    }
+
     ni->shmem.per_proc_comm_buf_size =
-        sizeof(queue_t) + ni->sbuf_pool.slab_size;
+        sizeof(queue_t) * ni->shmem.num_queues + ni->sbuf_pool.slab_size;
+
+    /* Each rank area must have its own pages to be bound to its
+     * node. */
+    if (ni->shmem.numa_nodes > 1)
+        ni->shmem.per_proc_comm_buf_size =
+            ROUND_UP(ni->shmem.per_proc_comm_buf_size, pagesize);
 
     pid_table_size = ni->mem.node_size * sizeof(struct shmem_pid_table);
     pid_table_size = ROUND_UP(pid_table_size, pagesize);
@@ -562,50 +1529,113 @@ static int setup_commpad(ni_t *ni)
     off_t bounce_buf_offset;
     off_t bounce_head_offset;
 
+    ni->shmem.bounce_buf.num_parts = ni->shmem.numa_nodes;
+
     bounce_head_offset = ni->shmem.comm_pad_size;
     ni->shmem.comm_pad_size +=
-        ROUND_UP(sizeof(struct shmem_bounce_head), pagesize);
+        ROUND_UP(ni->shmem.bounce_buf.num_parts *
+                 sizeof(struct shmem_bounce_head), pagesize);
 
     ni->shmem.bounce_buf.buf_size = get_param(PTL_BOUNCE_BUF_SIZE);
     ni->shmem.bounce_buf.num_bufs = get_param(PTL_BOUNCE_NUM_BUFS);
 
+    /* Each part has at least one buffer. */
+    ni->shmem.bounce_buf.num_bufs /= ni->shmem.bounce_buf.num_parts;
+    if (ni->shmem.bounce_buf.num_bufs == 0)
+        ni->shmem.bounce_buf.num_bufs = 1;
+
+    ni->shmem.bounce_buf.num_slots = get_param(PTL_BOUNCE_NUM_SLOTS);
+    if (ni->shmem.bounce_buf.num_slots > ni->shmem.bounce_buf.buf_size)
+        ni->shmem.bounce_buf.num_slots = ni->shmem.bounce_buf.buf_size;
+    ni->shmem.bounce_buf.slot_size =
+        ni->shmem.bounce_buf.buf_size / ni->shmem.bounce_buf.num_slots;
+
+    ni->shmem.bounce_buf.part_size =
+        ni->shmem.bounce_buf.buf_size * ni->shmem.bounce_buf.num_bufs;
+    if (ni->shmem.bounce_buf.num_parts > 1)
+        ni->shmem.bounce_buf.part_size =
+            ROUND_UP(ni->shmem.bounce_buf.part_size, pagesize);
+
     bounce_buf_offset = ni->shmem.comm_pad_size;
     ni->shmem.comm_pad_size +=
-        ni->shmem.bounce_buf.buf_size * ni->shmem.bounce_buf.num_bufs;
+        ni->shmem.bounce_buf.part_size * ni->shmem.bounce_buf.num_parts;
 #endif
 
+    /* Each ring can hold all the buffers of both its ranks, so a
+     * sender never has to wait for room. */
+    ni->shmem.spsc.entries = 0;
+    if (get_param(PTL_SHMEM_RINGS)) {
+        size_t size;
+
+        ni->shmem.spsc.entries = 2;
+        while (ni->shmem.spsc.entries <
+               2 * ni->shmem.per_proc_comm_buf_numbers)
+            ni->shmem.spsc.entries *= 2;
+
+        size = sizeof(spsc_t) + ni->shmem.spsc.entries * sizeof(unsigned long);
+        ni->shmem.spsc.ring_size = ROUND_UP(size, CACHELINE_WIDTH);
+
+        size = ((ni->mem.node_size + 63) / 64) * sizeof(uint64_t);
+        ni->shmem.spsc.bitmap_size = ROUND_UP(size, CACHELINE_WIDTH);
+
+        ni->shmem.spsc.per_proc_size =
+            ni->shmem.spsc.bitmap_size * ni->shmem.num_queues +
+            ni->shmem.spsc.ring_size * ni->mem.node_size;
+        if (ni->shmem.numa_nodes > 1)
+            ni->shmem.spsc.per_proc_size =
+                ROUND_UP(ni->shmem.spsc.per_proc_size, pagesize);
+
+        spsc_offset = ni->shmem.comm_pad_size;
+        ni->shmem.comm_pad_size +=
+            ni->shmem.spsc.per_proc_size * ni->mem.node_size;
+    }
+
+    /* A huge page mapping must cover whole huge pages. */
+    if (huge_pages)
+        ni->shmem.comm_pad_size =
+            ROUND_UP(ni->shmem.comm_pad_size, hugepagesize);
+
     /* Open the communication pad. Let rank 0 create the shared memory. */
     assert(ni->shmem.comm_pad == MAP_FAILED);
 
     if (ni->mem.index == 0) {
-        /* Just in case, remove that file if it already exist. */
-        shm_unlink(comm_pad_shm_name);
+        int huge;
 
-        shm_fd =
-            shm_open(comm_pad_shm_name, O_RDWR | O_CREAT | O_EXCL,
-                     S_IRUSR | S_IWUSR);
-        assert(shm_fd >= 0);
+        /* Fall back to POSIX shared memory if there is no hugetlbfs,
+         * or not enough huge pages in it. */
+        for (huge = ni->shmem.comm_pad_huge_name != NULL; huge >= 0; huge--) {
+            shm_fd = commpad_create(ni, huge);
+            if (shm_fd == -1)
+                continue;
 
-        if (shm_fd < 0) {
-            ptl_warn("shm_open of %s failed (errno=%d)", comm_pad_shm_name,
-                     errno);
-            goto exit_fail;
+            if (commpad_map(ni, shm_fd, huge) == PTL_OK)
+                break;
+
+            close(shm_fd);
+            shm_fd = -1;
+            if (huge)
+                unlink(ni->shmem.comm_pad_huge_name);
+            else
+                shm_unlink(ni->shmem.comm_pad_shm_name);
         }
 
-        /* Enlarge the memory zone to the size we need. */
-        if (ftruncate(shm_fd, ni->shmem.comm_pad_size) != 0) {
-            ptl_warn("share memory ftruncate failed");
-            shm_unlink(comm_pad_shm_name);
+        if (shm_fd == -1)
             goto exit_fail;
-        }
+
+        /* Let the other ranks check their number of queues. */
+        ((struct shmem_pid_table *)ni->shmem.comm_pad)->num_queues =
+            ni->shmem.num_queues;
     } else {
+        int huge = ni->shmem.comm_pad_huge_name != NULL;
+        struct stat buf;
         int try_count;
 
+      reopen:
         /* Try for 10 seconds. That should leave enough time for rank
          * 0 to create the file. */
         try_count = 100;
         do {
-            shm_fd = shm_open(comm_pad_shm_name, O_RDWR, S_IRUSR | S_IWUSR);
+            shm_fd = commpad_open(ni, &huge);
 
             if (shm_fd != -1)
                 break;
@@ -620,38 +1650,49 @@ static int setup_commpad(ni_t *ni)
             goto exit_fail;
         }
 
-        /* Wait for the file to have the right size before mmaping
-         * it. */
+        /* Wait for rank 0 to size the file before mmaping it. */
         try_count = 100;
         do {
-            struct stat buf;
-
             if (fstat(shm_fd, &buf) == -1) {
                 ptl_warn("Couldn't fstat the shared memory file\n");
                 goto exit_fail;
             }
 
-            if (buf.st_size >= ni->shmem.comm_pad_size)
+            if (buf.st_size > 0)
                 break;
 
             usleep(100000);            /* 100ms */
             try_count--;
         } while (try_count);
 
-        if (try_count >= 100000) {
+        if (try_count == 0) {
             ptl_warn("Shared memory file has wrong size\n");
             goto exit_fail;
         }
-    }
 
-    /* Fill our portion of the comm pad. */
-    ni->shmem.comm_pad =
-        (uint8_t *) mmap(NULL, ni->shmem.comm_pad_size,
-                         PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (ni->shmem.comm_pad == MAP_FAILED) {
-        ptl_warn("mmap failed (%d)", errno);
-        perror("");
-        goto exit_fail;
+        if ((ni->options & PTL_NI_LOGICAL) &&
+            commpad_check_queues(ni, shm_fd, huge, pid_table_size))
+            goto exit_fail;
+
+        if (buf.st_size < ni->shmem.comm_pad_size) {
+            ptl_error("rank %d and rank 0 disagree on the shared memory "
+                      "layout; the PTL_ parameters must be the same for "
+                      "all the ranks of a node\n", ni->mem.index);
+            goto exit_fail;
+        }
+
+        if (commpad_map(ni, shm_fd, huge)) {
+            close(shm_fd);
+            shm_fd = -1;
+
+            /* Rank 0 gives up on the hugetlbfs file in the same
+             * case. */
+            if (huge) {
+                huge = 0;
+                goto reopen;
+            }
+            goto exit_fail;
+        }
     }
 
     /* The share memory is mmaped, so we can close the file. */
@@ -663,10 +1704,27 @@ static int setup_commpad(ni_t *ni)
     ni->shmem.queue =
         (queue_t *)(ni->shmem.first_queue +
                     (ni->shmem.per_proc_comm_buf_size * ni->mem.index));
-    queue_init(ni->shmem.queue);
 
-    /* The buffer is right after the nemesis queue. */
-    ni->sbuf_pool.pre_alloc_buffer = (void *)(ni->shmem.queue + 1);
+    /* Bind our queues, buffers and rings before touching them, so
+     * they end up on our node. The other ranks' pages are left
+     * alone. */
+    if (ni->shmem.numa_node != -1) {
+        numa_bind_commpad(ni, ni->shmem.queue,
+                          ni->shmem.per_proc_comm_buf_size,
+                          ni->shmem.numa_node);
+        if (ni->shmem.spsc.entries)
+            numa_bind_commpad(ni, ni->shmem.comm_pad + spsc_offset +
+                              ni->shmem.spsc.per_proc_size * ni->mem.index,
+                              ni->shmem.spsc.per_proc_size,
+                              ni->shmem.numa_node);
+    }
+
+    for (i = 0; i < ni->shmem.num_queues; i++)
+        queue_init(&ni->shmem.queue[i]);
+
+    /* The buffer is right after the nemesis queues. */
+    ni->sbuf_pool.pre_alloc_buffer =
+        (void *)(ni->shmem.queue + ni->shmem.num_queues);
 
     err =
         pool_init(ni->iface->gbl, &ni->sbuf_pool, "sbuf", real_buf_t_size(),
@@ -675,6 +1733,34 @@ static int setup_commpad(ni_t *ni)
         WARN();
         goto exit_fail;
     }
+
+    /* Initialize the rings we receive from. */
+    if (ni->shmem.spsc.entries) {
+        ni->shmem.spsc.locks =
+            calloc(ni->mem.node_size, sizeof(PTL_FASTLOCK_TYPE));
+        ni->shmem.spsc.readers =
+            calloc(ni->shmem.num_queues, sizeof(struct shmem_spsc_reader));
+        if (!ni->shmem.spsc.locks || !ni->shmem.spsc.readers) {
+            WARN();
+            goto exit_fail;
+        }
+
+        for (i = 0; i < ni->mem.node_size; i++)
+            PTL_FASTLOCK_INIT(&ni->shmem.spsc.locks[i]);
+
+        for (i = 0; i < ni->shmem.num_queues; i++)
+            ni->shmem.spsc.readers[i].cur = -1;
+
+        ni->shmem.spsc.first = ni->shmem.comm_pad + spsc_offset;
+
+        memset(shmem_spsc_bitmap(ni, ni->mem.index, 0), 0,
+               ni->shmem.spsc.bitmap_size * ni->shmem.num_queues);
+        for (i = 0; i < ni->mem.node_size; i++)
+            spsc_init(shmem_spsc(ni, ni->mem.index, i));
+
+        ptl_info("shared memory messages use %d entries rings\n",
+                 ni->shmem.spsc.entries);
+    }
 #if !USE_KNEM
     /* Initialize the bounce buffers and let index 0 link them
      * together. */
@@ -682,14 +1768,26 @@ static int setup_commpad(ni_t *ni)
     ni->shmem.bounce_buf.bbs = ni->shmem.comm_pad + bounce_buf_offset;
 
     if (ni->mem.index == 0) {
-        ni->shmem.bounce_buf.head->head_index0 = ni->shmem.bounce_buf.head;
-        ll_init(&ni->shmem.bounce_buf.head->free_list);
+        unsigned int part;
+
+        for (part = 0; part < ni->shmem.bounce_buf.num_parts; part++) {
+            struct shmem_bounce_head *head = &ni->shmem.bounce_buf.head[part];
+            void *bbs = ni->shmem.bounce_buf.bbs +
+                part * ni->shmem.bounce_buf.part_size;
+
+            /* Part n lives on node n. */
+            if (ni->shmem.bounce_buf.num_parts > 1)
+                numa_bind_commpad(ni, bbs, ni->shmem.bounce_buf.part_size,
+                                  part);
 
-        for (i = 0; i < ni->shmem.bounce_buf.num_bufs; i++) {
-            void *bb =
-                ni->shmem.bounce_buf.bbs + i * ni->shmem.bounce_buf.buf_size;
+            head->head_index0 = head;
+            ll_init(&head->free_list);
 
-            ll_enqueue_obj(&ni->shmem.bounce_buf.head->free_list, bb);
+            for (i = 0; i < ni->shmem.bounce_buf.num_bufs; i++) {
+                void *bb = bbs + i * ni->shmem.bounce_buf.buf_size;
+
+                ll_enqueue_obj(&head->free_list, bb);
+            }
         }
     }
 #endif
@@ -702,6 +1800,9 @@ static int setup_commpad(ni_t *ni)
             (struct shmem_pid_table *)ni->shmem.comm_pad;
 
         pid_table[ni->mem.index].id = ni->id;
+#if USE_CMA
+        pid_table[ni->mem.index].cma = ni->shmem.cma;
+#endif
         __sync_synchronize();          /* ensure "valid" is not written before pid. */
         pid_table[ni->mem.index].valid = 1;
 
@@ -714,11 +1815,12 @@ static int setup_commpad(ni_t *ni)
         }
 
         /* All ranks have mmaped the memory. Get rid of the file. */
-        shm_unlink(ni->shmem.comm_pad_shm_name);
-        free(ni->shmem.comm_pad_shm_name);
-        ni->shmem.comm_pad_shm_name = NULL;
+        commpad_unlink(ni);
     }
 
+    /* Let the progress threads wait on the new queues. */
+    progress_thread_wakeup(ni, -1);
+
     return PTL_OK;
 
   exit_fail:
@@ -739,23 +1841,117 @@ static int setup_commpad(ni_t *ni)
  */
 void shmem_enqueue(ni_t *ni, buf_t *buf, ptl_pid_t dest)
 {
-    queue_t *queue =
-        (queue_t *)(ni->shmem.first_queue +
-                    (ni->shmem.per_proc_comm_buf_size * dest));
+    obj_t *obj = &buf->obj;
 
     buf->obj.next = NULL;
 
-    enqueue(ni->shmem.comm_pad, queue, &buf->obj);
+    shmem_post(ni, &obj, 1, dest);
+}
+
+/**
+ * @brief dequeue a buf from the rings of a queue shard.
+ *
+ * The senders with pending messages are served round robin, up to
+ * SHMEM_SPSC_BATCH messages each.
+ *
+ * @param[in] ni the network interface.
+ * @param[in] shard the index of the progress thread calling.
+ *
+ * @return a buf, or NULL if there is none.
+ */
+static buf_t *shmem_spsc_dequeue(ni_t *ni, int shard)
+{
+    struct shmem_spsc_reader *reader = &ni->shmem.spsc.readers[shard];
+    uint64_t *bitmap = shmem_spsc_bitmap(ni, ni->mem.index, shard);
+    const int num_words = (ni->mem.node_size + 63) / 64;
+    obj_t *obj;
+    int sender;
+
+    while (1) {
+        if (reader->cur != -1) {
+            spsc_t *spsc = shmem_spsc(ni, ni->mem.index, reader->cur);
+
+            if (reader->left) {
+                obj = spsc_dequeue(ni->shmem.comm_pad, spsc,
+                                   ni->shmem.spsc.entries);
+                if (obj) {
+                    reader->left--;
+                    return (buf_t *)obj;
+                }
+            } else if (!spsc_is_empty(spsc)) {
+                /* End of the batch. Come back to that sender after
+                 * the others. */
+                __sync_fetch_and_or(&bitmap[reader->cur / 64],
+                                    1ULL << (reader->cur % 64));
+            }
+
+            reader->next = (reader->cur + 1) % ni->mem.node_size;
+            reader->cur = -1;
+        }
+
+        sender = spsc_next_sender(bitmap, num_words, reader->next);
+        if (sender == -1)
+            return NULL;
+
+        /* Clear the bit before looking at the ring, so a message
+         * posted meanwhile sets it again. */
+        __sync_fetch_and_and(&bitmap[sender / 64], ~(1ULL << (sender % 64)));
+
+        reader->cur = sender;
+        reader->left = SHMEM_SPSC_BATCH;
+    }
 }
 
 /**
  * @brief dequeue a buf using shared memory.
  *
  * @param[in] ni the network interface.
+ * @param[in] shard the index of the progress thread calling.
  */
-buf_t *shmem_dequeue(ni_t *ni)
+buf_t *shmem_dequeue(ni_t *ni, int shard)
 {
-    return (buf_t *)dequeue(ni->shmem.comm_pad, ni->shmem.queue);
+    if (shard >= ni->shmem.num_queues)
+        return NULL;
+
+    if (ni->shmem.spsc.first)
+        return shmem_spsc_dequeue(ni, shard);
+
+    return (buf_t *)dequeue(ni->shmem.comm_pad, &ni->shmem.queue[shard]);
+}
+
+/**
+ * @brief Announce that the progress thread of a queue shard is about
+ * to sleep.
+ *
+ * On success, the thread must call queue_wait_done() when it wakes
+ * up.
+ *
+ * @param[in] ni the network interface.
+ * @param[in] shard the index of the progress thread calling.
+ *
+ * @return 1 if nothing is pending and the thread can sleep, 0 if it
+ * must dequeue instead.
+ */
+int shmem_wait_prepare(ni_t *ni, int shard)
+{
+    queue_t *queue = &ni->shmem.queue[shard];
+
+    if (!queue_wait_prepare(queue))
+        return 0;
+
+    if (ni->shmem.spsc.first) {
+        const uint64_t *bitmap = shmem_spsc_bitmap(ni, ni->mem.index, shard);
+        int i;
+
+        for (i = 0; i < (ni->mem.node_size + 63) / 64; i++) {
+            if (bitmap[i]) {
+                queue_wait_done(queue);
+                return 0;
+            }
+        }
+    }
+
+    return 1;
 }
 
 /**
@@ -0,0 +1,1392 @@
+/**
+ * @file ptl_tcp.c
+ *
+ * @brief TCP transport.
+ *
+ * An NI sends its requests, acks and replies to a peer on a single
+ * stream socket, connected the first time the peer is addressed. The
+ * sockets accepted by the listening socket of the interface are
+ * received on, and are also used to send to the peer if the NI has no
+ * socket to it yet.
+ *
+ * Every message is a frame: a struct tcp_hdr, then the portals
+ * message, then the payload. A payload too large to be immediate data
+ * follows the message in the stream instead of going through a bounce
+ * buffer, and the receiver turns it back into immediate data. Large
+ * puts are sent with MSG_ZEROCOPY when the kernel supports it.
+ *
+ * All the sockets of an NI are in an epoll set polled by its first
+ * progress thread, which does all the reads. A send writes what the
+ * socket takes and queues a copy of the rest, flushed by the progress
+ * thread when the socket is writable again.
+ */
+
+#include "ptl_loc.h"
+
+#include <fcntl.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <linux/errqueue.h>
+
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+#define TCP_HAVE_ZEROCOPY	1
+#else
+#define TCP_HAVE_ZEROCOPY	0
+#endif
+
+/* Size of the receive buffer of a socket. Messages are read into it,
+ * and so are the payloads that fit. */
+#define TCP_RX_SIZE		(64 * 1024)
+
+/* Most iovecs given to a single sendmsg. */
+#define TCP_SEND_IOV		(64)
+
+/* Most epoll events handled in one call. */
+#define TCP_EVENTS		(32)
+
+/* Most frames received from a socket in one call, so that a busy
+ * socket doesn't starve the others. */
+#define TCP_RX_FRAMES		(64)
+
+/* Size of the first frame on an accepted socket. */
+#define TCP_HELLO_LEN		(sizeof(struct tcp_hdr) + sizeof(struct tcp_hello))
+
+/* Bytes of frames that could not be sent yet. */
+struct tcp_chunk {
+    struct list_head list;
+    size_t len;
+    size_t off;
+    unsigned char data[0];
+};
+
+/* A stream socket to a peer. */
+struct tcp_sock {
+    /* On the NI sock_list. */
+    struct list_head list;
+
+    int fd;
+    ni_t *ni;
+
+    /* Set once the hello is sent or received. Until then an accepted
+     * socket isn't attached to its NI. */
+    int routed;
+
+    /* Send side, protected by lock. */
+    PTL_FASTLOCK_TYPE lock;
+    int dead;
+    int zerocopy;
+    struct list_head tx_queue;
+    uint32_t zc_next;
+    struct list_head zc_list;
+
+    /* Receive side, only used by the progress thread. rx_buf is the
+     * buf whose payload is being read, with rx_left bytes missing at
+     * rx_dst. */
+    buf_t *rx_buf;
+    unsigned char *rx_dst;
+    size_t rx_left;
+    size_t rx_start;
+    size_t rx_end;
+    unsigned char rx[TCP_RX_SIZE];
+};
+
+/**
+ * @brief Return the size of the frame of a buf.
+ *
+ * @param[in] buf the buf
+ *
+ * @return the size in bytes
+ */
+static inline size_t tcp_frame_len(buf_t *buf)
+{
+    return sizeof(struct tcp_hdr) + buf->length + buf->transfer.tcp.length;
+}
+
+/**
+ * @brief Fill an iovec array with the bytes of a frame.
+ *
+ * The frame is the frame header, the message in buf->data and the
+ * payload described by buf->transfer.tcp.
+ *
+ * @param[in] buf the buf being sent
+ * @param[in] skip the number of bytes of the frame to skip
+ * @param[out] iov the iovec array
+ * @param[in] max the size of the array
+ *
+ * @return the number of iovecs filled
+ */
+static int tcp_frame_iov(buf_t *buf, size_t skip, struct iovec *iov,
+                         int max)
+{
+    ptl_iovec_t *src = buf->transfer.tcp.iovecs;
+    ptl_size_t num = buf->transfer.tcp.num_iovecs;
+    ptl_size_t left = buf->transfer.tcp.length;
+    ptl_size_t offset;
+    size_t len;
+    int n = 0;
+
+    len = sizeof(buf->transfer.tcp.frame);
+    if (skip < len) {
+        iov[n].iov_base = (unsigned char *)&buf->transfer.tcp.frame + skip;
+        iov[n].iov_len = len - skip;
+        n++;
+        skip = 0;
+    } else {
+        skip -= len;
+    }
+
+    len = buf->length;
+    if (skip < len) {
+        iov[n].iov_base = (unsigned char *)buf->data + skip;
+        iov[n].iov_len = len - skip;
+        n++;
+        skip = 0;
+    } else {
+        skip -= len;
+    }
+
+    if (skip >= left)
+        return n;
+
+    left -= skip;
+    offset = buf->transfer.tcp.offset + skip;
+
+    while (num && offset >= src->iov_len) {
+        offset -= src->iov_len;
+        src++;
+        num--;
+    }
+
+    while (n < max && left && num) {
+        len = src->iov_len - offset;
+        if (len > left)
+            len = left;
+
+        iov[n].iov_base = (unsigned char *)src->iov_base + offset;
+        iov[n].iov_len = len;
+        n++;
+
+        left -= len;
+        offset = 0;
+        src++;
+        num--;
+    }
+
+    return n;
+}
+
+/**
+ * @brief Watch a socket for writability, or stop doing so.
+ *
+ * @param[in] sock the socket
+ * @param[in] out whether the socket has bytes queued
+ */
+static void tcp_watch_out(struct tcp_sock *sock, int out)
+{
+    struct epoll_event ev;
+
+    ev.events = EPOLLIN | (out ? EPOLLOUT : 0);
+    ev.data.ptr = sock;
+
+    if (epoll_ctl(sock->ni->tcp.epfd, EPOLL_CTL_MOD, sock->fd, &ev) == -1)
+        WARN();
+}
+
+/**
+ * @brief Tell whether a send error only means the socket is full.
+ *
+ * @param[in] err the errno of the send
+ *
+ * @return 1 if the bytes can be queued and sent later
+ */
+static inline int tcp_send_again(int err)
+{
+    return err == EAGAIN || err == EWOULDBLOCK || err == EINTR ||
+        err == ENOBUFS;
+}
+
+/**
+ * @brief Send the frames of some bufs on a socket.
+ *
+ * Write what the socket takes, and queue a copy of the rest. Frames
+ * are never interleaved since the socket is locked.
+ *
+ * A frame sent with MSG_ZEROCOPY keeps a reference on its buf until
+ * the kernel tells it no longer uses the pages. If nothing could be
+ * sent without a copy, the buf is completed right away.
+ *
+ * @param[in] sock the socket
+ * @param[in] bufs the bufs to send
+ * @param[in] num_bufs the number of bufs
+ *
+ * @return status
+ */
+static int tcp_send(struct tcp_sock *sock, buf_t **bufs, int num_bufs)
+{
+    struct iovec iov[TCP_SEND_IOV];
+    struct msghdr msg;
+    struct tcp_chunk *chunk;
+    size_t skip = 0;
+    size_t left;
+    ssize_t ret;
+    int zerocopy = 0;
+    int zc_sent = 0;
+    int queued;
+    int i = 0;
+    int j;
+    int n;
+
+    for (j = 0; j < num_bufs; j++) {
+        struct tcp_hdr *frame = &bufs[j]->transfer.tcp.frame;
+
+        frame->type = TCP_MSG_DATA;
+        frame->reserved1 = 0;
+        frame->hdr_len = cpu_to_le16(bufs[j]->length);
+        frame->reserved2 = 0;
+        frame->data_len = cpu_to_le64(bufs[j]->transfer.tcp.length);
+    }
+
+#if TCP_HAVE_ZEROCOPY
+    zerocopy = num_bufs == 1 && bufs[0]->transfer.tcp.zerocopy &&
+        sock->zerocopy;
+#endif
+
+    PTL_FASTLOCK_LOCK(&sock->lock);
+
+    if (sock->dead) {
+        PTL_FASTLOCK_UNLOCK(&sock->lock);
+        return PTL_FAIL;
+    }
+
+    queued = !list_empty(&sock->tx_queue);
+
+    /* Write directly, unless older bytes are still queued. */
+    while (!queued && i < num_bufs) {
+        size_t wanted = 0;
+        size_t s = skip;
+        int num_iov = 0;
+
+        for (j = i; j < num_bufs && num_iov < TCP_SEND_IOV - 1; j++) {
+            size_t len = 0;
+
+            n = tcp_frame_iov(bufs[j], s, &iov[num_iov],
+                              TCP_SEND_IOV - num_iov);
+            while (n--)
+                len += iov[num_iov++].iov_len;
+            wanted += len;
+
+            /* The array is full. */
+            if (len < tcp_frame_len(bufs[j]) - s)
+                break;
+
+            s = 0;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = num_iov;
+
+        ret = sendmsg(sock->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL
+#if TCP_HAVE_ZEROCOPY
+                      | (zerocopy ? MSG_ZEROCOPY : 0)
+#endif
+            );
+        if (ret == -1) {
+            if (tcp_send_again(errno))
+                break;
+
+            ptl_warn("TCP send failed: %s\n", strerror(errno));
+            sock->dead = 1;
+            PTL_FASTLOCK_UNLOCK(&sock->lock);
+            return PTL_FAIL;
+        }
+
+        if (zerocopy) {
+            /* One notification per send. The rest of the frame, if
+             * any, is copied. */
+            buf_t *buf = bufs[0];
+
+            buf_get(buf);
+            buf->transfer.tcp.zc_id = sock->zc_next++;
+            list_add_tail(&buf->transfer.tcp.zc_list, &sock->zc_list);
+            zerocopy = 0;
+            zc_sent = 1;
+        }
+
+        /* Skip the bytes sent. */
+        left = ret;
+        while (i < num_bufs) {
+            size_t len = tcp_frame_len(bufs[i]) - skip;
+
+            if (left < len) {
+                skip += left;
+                break;
+            }
+
+            left -= len;
+            skip = 0;
+            i++;
+        }
+
+        if (ret < wanted)
+            break;
+    }
+
+    /* Nothing references the pages. */
+    if (num_bufs == 1 && bufs[0]->transfer.tcp.zerocopy && !zc_sent)
+        bufs[0]->completed = 1;
+
+    if (i == num_bufs) {
+        PTL_FASTLOCK_UNLOCK(&sock->lock);
+        return PTL_OK;
+    }
+
+    /* Queue a copy of the bytes left. */
+    left = tcp_frame_len(bufs[i]) - skip;
+    for (j = i + 1; j < num_bufs; j++)
+        left += tcp_frame_len(bufs[j]);
+
+    chunk = malloc(sizeof(*chunk) + left);
+    if (!chunk) {
+        WARN();
+        sock->dead = 1;
+        PTL_FASTLOCK_UNLOCK(&sock->lock);
+        return PTL_NO_SPACE;
+    }
+
+    chunk->len = left;
+    chunk->off = 0;
+
+    left = 0;
+    for (; i < num_bufs; i++) {
+        size_t len = tcp_frame_len(bufs[i]);
+
+        while (skip < len) {
+            n = tcp_frame_iov(bufs[i], skip, iov, TCP_SEND_IOV);
+            for (j = 0; j < n; j++) {
+                memcpy(chunk->data + left, iov[j].iov_base, iov[j].iov_len);
+                left += iov[j].iov_len;
+                skip += iov[j].iov_len;
+            }
+        }
+
+        skip = 0;
+    }
+
+    list_add_tail(&chunk->list, &sock->tx_queue);
+
+    /* The progress thread sends it when the socket drains. */
+    if (!queued)
+        tcp_watch_out(sock, 1);
+
+    PTL_FASTLOCK_UNLOCK(&sock->lock);
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Send the queued bytes of a socket.
+ *
+ * Called by the progress thread when the socket is writable.
+ *
+ * @param[in] sock the socket
+ *
+ * @return status
+ */
+static int tcp_sock_flush(struct tcp_sock *sock)
+{
+    struct iovec iov[TCP_SEND_IOV];
+    struct msghdr msg;
+    struct tcp_chunk *chunk;
+    struct tcp_chunk *next;
+    int err = PTL_OK;
+    size_t wanted;
+    ssize_t ret;
+    int n;
+
+    PTL_FASTLOCK_LOCK(&sock->lock);
+
+    while (!sock->dead && !list_empty(&sock->tx_queue)) {
+        n = 0;
+        wanted = 0;
+        list_for_each_entry(chunk, &sock->tx_queue, list) {
+            iov[n].iov_base = chunk->data + chunk->off;
+            iov[n].iov_len = chunk->len - chunk->off;
+            wanted += iov[n].iov_len;
+            if (++n == TCP_SEND_IOV)
+                break;
+        }
+
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = n;
+
+        ret = sendmsg(sock->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (ret == -1) {
+            if (tcp_send_again(errno))
+                break;
+
+            ptl_warn("TCP send failed: %s\n", strerror(errno));
+            sock->dead = 1;
+            err = PTL_FAIL;
+            break;
+        }
+
+        list_for_each_entry_safe(chunk, next, &sock->tx_queue, list) {
+            size_t len = chunk->len - chunk->off;
+
+            if ((size_t)ret < len) {
+                chunk->off += ret;
+                break;
+            }
+
+            ret -= len;
+            list_del(&chunk->list);
+            free(chunk);
+        }
+
+        if (ret < wanted)
+            break;
+    }
+
+    if (!sock->dead && list_empty(&sock->tx_queue))
+        tcp_watch_out(sock, 0);
+
+    PTL_FASTLOCK_UNLOCK(&sock->lock);
+
+    return err;
+}
+
+/**
+ * @brief Complete the bufs whose pages were sent without copy.
+ *
+ * Restart the initiator state machine of the bufs waiting for their
+ * send completion, like a signaled send completion of the IB
+ * transport, and drop the references taken by tcp_send.
+ *
+ * @param[in] done the list of bufs
+ * @param[in] complete whether to run the state machines
+ */
+static void tcp_zc_done(struct list_head *done, int complete)
+{
+    buf_t *buf;
+    buf_t *next;
+
+    list_for_each_entry_safe(buf, next, done, transfer.tcp.zc_list) {
+        list_del(&buf->transfer.tcp.zc_list);
+
+        if (complete && (buf->event_mask & XX_SIGNALED)) {
+            buf->completed = 1;
+            if (process_init(buf))
+                ptl_warn("Error processing send completion\n");
+        }
+
+        buf_put(buf);
+    }
+}
+
+/**
+ * @brief Read the zero copy notifications of a socket.
+ *
+ * @param[in] sock the socket
+ */
+static void tcp_sock_zc_complete(struct tcp_sock *sock)
+{
+#if TCP_HAVE_ZEROCOPY
+    char control[128];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct list_head done;
+
+    INIT_LIST_HEAD(&done);
+
+    while (1) {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        if (recvmsg(sock->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1)
+            break;
+
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err *serr;
+            buf_t *buf;
+            buf_t *next;
+            uint32_t lo;
+            uint32_t hi;
+
+            if (cm->cmsg_level != SOL_IP || cm->cmsg_type != IP_RECVERR)
+                continue;
+
+            serr = (struct sock_extended_err *)CMSG_DATA(cm);
+            if (serr->ee_errno != 0 ||
+                serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+
+            /* The sends ee_info to ee_data are done. */
+            lo = serr->ee_info;
+            hi = serr->ee_data;
+
+            PTL_FASTLOCK_LOCK(&sock->lock);
+            list_for_each_entry_safe(buf, next, &sock->zc_list,
+                                     transfer.tcp.zc_list) {
+                uint32_t id = buf->transfer.tcp.zc_id;
+
+                if ((int32_t)(id - lo) >= 0 && (int32_t)(hi - id) >= 0) {
+                    list_del(&buf->transfer.tcp.zc_list);
+                    list_add_tail(&buf->transfer.tcp.zc_list, &done);
+                }
+            }
+            PTL_FASTLOCK_UNLOCK(&sock->lock);
+        }
+    }
+
+    tcp_zc_done(&done, 1);
+#endif
+}
+
+/**
+ * @brief Enable zero copy sends on a socket if the NI wants them.
+ *
+ * @param[in] sock the socket
+ */
+static void tcp_sock_set_zerocopy(struct tcp_sock *sock)
+{
+#if TCP_HAVE_ZEROCOPY
+    int on = 1;
+
+    if (sock->ni->tcp.zerocopy_min &&
+        setsockopt(sock->fd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) == 0)
+        sock->zerocopy = 1;
+#endif
+}
+
+/**
+ * @brief Add a connected socket to an NI.
+ *
+ * @param[in] ni the network interface
+ * @param[in] fd the socket
+ * @param[in] routed whether the socket is known to be for that NI
+ *
+ * @return the socket, or NULL on error
+ */
+static struct tcp_sock *tcp_sock_add(ni_t *ni, int fd, int routed)
+{
+    struct tcp_sock *sock;
+    struct epoll_event ev;
+    int flags;
+    int on = 1;
+
+    sock = calloc(1, sizeof(*sock));
+    if (!sock) {
+        WARN();
+        return NULL;
+    }
+
+    sock->fd = fd;
+    sock->ni = ni;
+    sock->routed = routed;
+    PTL_FASTLOCK_INIT(&sock->lock);
+    INIT_LIST_HEAD(&sock->tx_queue);
+    INIT_LIST_HEAD(&sock->zc_list);
+
+    flags = fcntl(fd, F_GETFL);
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        ptl_warn("cannot set socket to non blocking\n");
+        free(sock);
+        return NULL;
+    }
+
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+
+    if (routed)
+        tcp_sock_set_zerocopy(sock);
+
+    PTL_FASTLOCK_LOCK(&ni->tcp.lock);
+    list_add_tail(&sock->list, &ni->tcp.sock_list);
+    PTL_FASTLOCK_UNLOCK(&ni->tcp.lock);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = sock;
+
+    if (epoll_ctl(ni->tcp.epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        WARN();
+        PTL_FASTLOCK_LOCK(&ni->tcp.lock);
+        list_del(&sock->list);
+        PTL_FASTLOCK_UNLOCK(&ni->tcp.lock);
+        free(sock);
+        return NULL;
+    }
+
+    return sock;
+}
+
+/**
+ * @brief Close a socket.
+ *
+ * The structure stays on the NI list until the NI is destroyed, since
+ * a conn can still point to it. Sending on it fails.
+ *
+ * @param[in] sock the socket
+ * @param[in] complete whether to complete the zero copy sends
+ */
+static void tcp_sock_close(struct tcp_sock *sock, int complete)
+{
+    struct tcp_chunk *chunk;
+    struct tcp_chunk *next;
+    struct list_head done;
+
+    INIT_LIST_HEAD(&done);
+
+    epoll_ctl(sock->ni->tcp.epfd, EPOLL_CTL_DEL, sock->fd, NULL);
+
+    PTL_FASTLOCK_LOCK(&sock->lock);
+
+    sock->dead = 1;
+    close(sock->fd);
+    sock->fd = -1;
+
+    list_for_each_entry_safe(chunk, next, &sock->tx_queue, list) {
+        list_del(&chunk->list);
+        free(chunk);
+    }
+
+    /* The kernel no longer uses the pages. */
+    list_splice_init(&sock->zc_list, &done);
+
+    PTL_FASTLOCK_UNLOCK(&sock->lock);
+
+    tcp_zc_done(&done, complete);
+
+    if (sock->rx_buf) {
+        buf_put(sock->rx_buf);
+        sock->rx_buf = NULL;
+    }
+}
+
+/**
+ * @brief Use an accepted socket to send to its peer.
+ *
+ * That is only done if the NI doesn't have a socket to the peer, and
+ * isn't connecting one. Otherwise the socket is only received on.
+ *
+ * @param[in] sock the socket
+ * @param[in] hello the hello received on it
+ */
+static void tcp_adopt(struct tcp_sock *sock, const struct tcp_hello *hello)
+{
+    ni_t *ni = sock->ni;
+    ptl_process_t id;
+    conn_t *conn;
+
+    if (ni->options & PTL_NI_LOGICAL) {
+        id.rank = le32_to_cpu(hello->src_nid);
+
+        /* The map may not be set yet. */
+        if (!ni->logical.rank_table || id.rank >= ni->logical.map_size)
+            return;
+    } else {
+        id.phys.nid = le32_to_cpu(hello->src_nid);
+        id.phys.pid = le32_to_cpu(hello->src_pid);
+    }
+
+    conn = get_conn(ni, id);
+    if (!conn)
+        return;
+
+    if (conn->state == CONN_STATE_DISCONNECTED &&
+        conn->transport.type == CONN_TYPE_TCP &&
+        pthread_mutex_trylock(&conn->mutex) == 0) {
+        if (conn->state == CONN_STATE_DISCONNECTED) {
+            tcp_sock_set_zerocopy(sock);
+            conn->tcp.sock = sock;
+            conn->state = CONN_STATE_CONNECTED;
+        }
+        pthread_mutex_unlock(&conn->mutex);
+    }
+
+    conn_put(conn);
+}
+
+/**
+ * @brief Attach an accepted socket to the NI its hello is for.
+ *
+ * @param[in] sock the socket
+ * @param[in] hello the hello received on it
+ *
+ * @return 1 if the socket stays on this NI, 0 if it was moved to
+ * another one, -1 on error
+ */
+static int tcp_recv_hello(struct tcp_sock *sock,
+                          const struct tcp_hello *hello)
+{
+    ni_t *ni = sock->ni;
+    ni_t *dest;
+    struct epoll_event ev;
+
+    if (sock->routed || hello->ni_type >= MAX_NI_TYPES)
+        return -1;
+
+    dest = ni->iface->ni[hello->ni_type];
+    if (!dest || dest->tcp.epfd == -1) {
+        ptl_warn("no NI of type %d for an incoming TCP connection\n",
+                 hello->ni_type);
+        return -1;
+    }
+
+    sock->routed = 1;
+
+    if (dest == ni) {
+        tcp_adopt(sock, hello);
+        return 1;
+    }
+
+    /* All the NIs of the interface accept on the same socket. Hand
+     * this one over. Nothing was read past the hello. */
+    epoll_ctl(ni->tcp.epfd, EPOLL_CTL_DEL, sock->fd, NULL);
+
+    PTL_FASTLOCK_LOCK(&ni->tcp.lock);
+    list_del(&sock->list);
+    PTL_FASTLOCK_UNLOCK(&ni->tcp.lock);
+
+    sock->ni = dest;
+
+    PTL_FASTLOCK_LOCK(&dest->tcp.lock);
+    list_add_tail(&sock->list, &dest->tcp.sock_list);
+    PTL_FASTLOCK_UNLOCK(&dest->tcp.lock);
+
+    tcp_adopt(sock, hello);
+
+    ev.events = EPOLLIN;
+    ev.data.ptr = sock;
+
+    if (epoll_ctl(dest->tcp.epfd, EPOLL_CTL_ADD, sock->fd, &ev) == -1) {
+        WARN();
+        tcp_sock_close(sock, 1);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Process the frame at the start of the receive buffer.
+ *
+ * A message is copied into a new buf, followed by the part of its
+ * payload already received. The rest of the payload is read directly
+ * into the buf.
+ *
+ * @param[in] sock the socket
+ *
+ * @return 1 if a frame was processed, 0 if more bytes are needed, 2 if
+ * the socket was moved to another NI, -1 on error
+ */
+static int tcp_recv_frame(struct tcp_sock *sock)
+{
+    ni_t *ni = sock->ni;
+    size_t avail = sock->rx_end - sock->rx_start;
+    unsigned char *p = &sock->rx[sock->rx_start];
+    struct tcp_hdr frame;
+    struct tcp_hello hello;
+    size_t hdr_len;
+    uint64_t data_len;
+    data_t *data;
+    buf_t *buf;
+    size_t n;
+    int err;
+
+    if (avail < sizeof(frame))
+        return 0;
+
+    memcpy(&frame, p, sizeof(frame));
+    hdr_len = le16_to_cpu(frame.hdr_len);
+    data_len = le64_to_cpu(frame.data_len);
+
+    switch (frame.type) {
+        case TCP_MSG_HELLO:
+            if (hdr_len != sizeof(hello) || data_len)
+                return -1;
+
+            if (avail < TCP_HELLO_LEN)
+                return 0;
+
+            memcpy(&hello, p + sizeof(frame), sizeof(hello));
+            sock->rx_start += TCP_HELLO_LEN;
+
+            err = tcp_recv_hello(sock, &hello);
+            return err == 0 ? 2 : err;
+
+        case TCP_MSG_DATA:
+            if (!sock->routed || hdr_len < sizeof(struct hdr_common) ||
+                hdr_len > BUF_DATA_SIZE || data_len > UINT32_MAX)
+                return -1;
+
+            if (avail < sizeof(frame) + hdr_len)
+                return 0;
+
+            err = buf_alloc(ni, &buf);
+            if (err) {
+                WARN();
+                return -1;
+            }
+
+            if (hdr_len + data_len > BUF_DATA_SIZE) {
+                buf->transfer.tcp.bounce = malloc(hdr_len + data_len);
+                if (!buf->transfer.tcp.bounce) {
+                    WARN();
+                    buf_put(buf);
+                    return -1;
+                }
+                buf->data = buf->transfer.tcp.bounce;
+            }
+
+            memcpy(buf->data, p + sizeof(frame), hdr_len);
+            buf->length = hdr_len + data_len;
+            sock->rx_start += sizeof(frame) + hdr_len;
+            avail -= sizeof(frame) + hdr_len;
+
+            if (data_len) {
+                /* The payload belongs to the descriptor ending the
+                 * message. */
+                data = (data_t *)(buf->data + hdr_len - sizeof(*data));
+                if (hdr_len < sizeof(struct hdr_common) + sizeof(*data) ||
+                    data->data_fmt != DATA_FMT_TCP ||
+                    le32_to_cpu(data->tcp.data_length) != data_len) {
+                    WARN();
+                    buf_put(buf);
+                    return -1;
+                }
+
+                data->data_fmt = DATA_FMT_IMMEDIATE;
+
+                n = avail < data_len ? avail : data_len;
+                memcpy(buf->data + hdr_len, &sock->rx[sock->rx_start], n);
+                sock->rx_start += n;
+
+                if (n < data_len) {
+                    sock->rx_buf = buf;
+                    sock->rx_dst = (unsigned char *)buf->data + hdr_len + n;
+                    sock->rx_left = data_len - n;
+                    return 1;
+                }
+            }
+
+            process_recv_mem(ni, buf);
+            return 1;
+
+        default:
+            return -1;
+    }
+}
+
+/**
+ * @brief Receive the frames available on a socket.
+ *
+ * @param[in] sock the socket
+ *
+ * @return the number of frames received, or -1 if the socket must be
+ * closed
+ */
+static int tcp_sock_read(struct tcp_sock *sock)
+{
+    int frames = 0;
+    ssize_t ret;
+    size_t want;
+    size_t n;
+    buf_t *buf;
+
+    while (frames < TCP_RX_FRAMES) {
+        if (sock->rx_buf) {
+            /* Rest of a large payload. */
+            n = sock->rx_end - sock->rx_start;
+            if (n) {
+                if (n > sock->rx_left)
+                    n = sock->rx_left;
+                memcpy(sock->rx_dst, &sock->rx[sock->rx_start], n);
+                sock->rx_start += n;
+            } else {
+                ret = recv(sock->fd, sock->rx_dst, sock->rx_left,
+                           MSG_DONTWAIT);
+                if (ret <= 0)
+                    goto check;
+                n = ret;
+            }
+
+            sock->rx_dst += n;
+            sock->rx_left -= n;
+
+            if (sock->rx_left == 0) {
+                buf = sock->rx_buf;
+                sock->rx_buf = NULL;
+                process_recv_mem(sock->ni, buf);
+                frames++;
+            }
+            continue;
+        }
+
+        ret = tcp_recv_frame(sock);
+        if (ret == -1)
+            return -1;
+        if (ret == 2)
+            return frames;
+        if (ret == 1) {
+            frames++;
+            continue;
+        }
+
+        /* Need more bytes. Keep the partial frame at the start of the
+         * buffer; it is smaller than a message. */
+        n = sock->rx_end - sock->rx_start;
+        if (sock->rx_start) {
+            memmove(sock->rx, &sock->rx[sock->rx_start], n);
+            sock->rx_start = 0;
+            sock->rx_end = n;
+        }
+
+        /* Don't read past the hello of an accepted socket, the rest
+         * may be for another NI. */
+        if (sock->routed)
+            want = TCP_RX_SIZE - n;
+        else
+            want = TCP_HELLO_LEN - n;
+
+        ret = recv(sock->fd, &sock->rx[n], want, MSG_DONTWAIT);
+        if (ret <= 0)
+            goto check;
+
+        sock->rx_end += ret;
+    }
+
+    return frames;
+
+  check:
+    if (ret == 0)
+        return -1;
+
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        return frames;
+
+    ptl_info("TCP receive failed: %s\n", strerror(errno));
+    return -1;
+}
+
+/**
+ * @brief Accept the pending connections.
+ *
+ * @param[in] ni the network interface
+ */
+static void tcp_accept(ni_t *ni)
+{
+    int fd;
+
+    while ((fd = accept4(ni->iface->tcp.listen_s, NULL, NULL,
+                         SOCK_CLOEXEC)) != -1) {
+        if (!tcp_sock_add(ni, fd, 0))
+            close(fd);
+    }
+}
+
+/**
+ * @brief Handle the events of a socket.
+ *
+ * @param[in] sock the socket
+ * @param[in] events the epoll events
+ *
+ * @return the number of frames received
+ */
+static int tcp_sock_event(struct tcp_sock *sock, uint32_t events)
+{
+    int ret;
+
+    if (events & EPOLLERR)
+        tcp_sock_zc_complete(sock);
+
+    if ((events & EPOLLOUT) && tcp_sock_flush(sock)) {
+        tcp_sock_close(sock, 1);
+        return 0;
+    }
+
+    ret = tcp_sock_read(sock);
+    if (ret == -1) {
+        tcp_sock_close(sock, 1);
+        return 0;
+    }
+
+    return ret;
+}
+
+/**
+ * @brief Poll the sockets of an NI.
+ *
+ * Called by the first progress thread.
+ *
+ * @param[in] ni the network interface
+ *
+ * @return the number of events handled
+ */
+int progress_thread_tcp(ni_t *ni)
+{
+    struct epoll_event events[TCP_EVENTS];
+    int work = 0;
+    int n;
+    int i;
+
+    if (ni->tcp.epfd == -1)
+        return 0;
+
+    n = epoll_wait(ni->tcp.epfd, events, TCP_EVENTS, 0);
+
+    for (i = 0; i < n; i++) {
+        struct tcp_sock *sock = events[i].data.ptr;
+
+        if (!sock)
+            tcp_accept(ni);
+        else
+            tcp_sock_event(sock, events[i].events);
+
+        work++;
+    }
+
+    return work;
+}
+
+/**
+ * @brief Create the epoll set of an NI.
+ *
+ * @param[in] ni the network interface
+ *
+ * @return status
+ */
+int tcp_init_sockets(ni_t *ni)
+{
+    struct epoll_event ev;
+
+    ni->tcp.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (ni->tcp.epfd == -1) {
+        WARN();
+        return PTL_FAIL;
+    }
+
+    /* Every NI of the interface accepts connections; the hello tells
+     * which one a socket is for. */
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+
+    if (epoll_ctl(ni->tcp.epfd, EPOLL_CTL_ADD, ni->iface->tcp.listen_s,
+                  &ev) == -1) {
+        WARN();
+        close(ni->tcp.epfd);
+        ni->tcp.epfd = -1;
+        return PTL_FAIL;
+    }
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Close all the sockets of an NI.
+ *
+ * @param[in] ni the network interface, whose progress thread is
+ * stopped
+ */
+void tcp_fini_sockets(ni_t *ni)
+{
+    struct tcp_sock *sock;
+    struct tcp_sock *next;
+
+    list_for_each_entry_safe(sock, next, &ni->tcp.sock_list, list) {
+        list_del(&sock->list);
+        if (sock->fd != -1)
+            tcp_sock_close(sock, 0);
+        free(sock);
+    }
+
+    close(ni->tcp.epfd);
+    ni->tcp.epfd = -1;
+}
+
+/**
+ * @param[in] ni
+ * @param[in] conn
+ *
+ * @return status
+ *
+ * conn must be locked
+ */
+static int init_connect_tcp(ni_t *ni, conn_t *conn)
+{
+    struct {
+        struct tcp_hdr frame;
+        struct tcp_hello hello;
+    } msg;
+    struct tcp_sock *sock;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        WARN();
+        return PTL_FAIL;
+    }
+
+    if (connect(fd, (struct sockaddr *)&conn->sin, sizeof(conn->sin)) == -1) {
+        ptl_warn("cannot connect to %s:%d: %s\n",
+                 inet_ntoa(conn->sin.sin_addr), ntohs(conn->sin.sin_port),
+                 strerror(errno));
+        goto error;
+    }
+
+    /* Tell the peer who we are, and which of its NIs we want. */
+    memset(&msg, 0, sizeof(msg));
+    msg.frame.type = TCP_MSG_HELLO;
+    msg.frame.hdr_len = cpu_to_le16(sizeof(msg.hello));
+    if (ni->options & PTL_NI_LOGICAL) {
+        msg.hello.src_nid = cpu_to_le32(ni->id.rank);
+    } else {
+        msg.hello.src_nid = cpu_to_le32(ni->id.phys.nid);
+        msg.hello.src_pid = cpu_to_le32(ni->id.phys.pid);
+    }
+    msg.hello.ni_type = ni->ni_type;
+
+    if (send(fd, &msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg)) {
+        WARN();
+        goto error;
+    }
+
+    sock = tcp_sock_add(ni, fd, 1);
+    if (!sock)
+        goto error;
+
+    conn->tcp.sock = sock;
+    conn->state = CONN_STATE_CONNECTED;
+
+    return PTL_OK;
+
+  error:
+    close(fd);
+    return PTL_FAIL;
+}
+
+/**
+ * @brief Send a message using TCP.
+ *
+ * @param[in] buf
+ * @param[in] from_init
+ *
+ * @return status
+ */
+static int send_message_tcp(buf_t *buf, int from_init)
+{
+    int err;
+
+    if (from_init) {
+        ni_t *ni = obj_to_ni(buf);
+
+        /* Only messages without a payload are bundled; flush the
+         * bundle before the others to keep the order. */
+        if (!buf->transfer.tcp.length) {
+            if (ni_bundle_add(ni, buf) == PTL_OK)
+                return PTL_OK;
+        } else {
+            ni_bundle_flush(ni);
+        }
+    }
+
+    err = tcp_send(buf->dest.tcp.sock, &buf, 1);
+    if (err)
+        WARN();
+
+    return err;
+}
+
+/**
+ * @brief Send the messages of a bundle, with one sendmsg per socket.
+ *
+ * @param[in] bufs the buffers queued by send_message_tcp.
+ * @param[in] num_bufs the number of buffers.
+ */
+static void send_bundle_tcp(buf_t **bufs, int num_bufs)
+{
+    int i;
+    int j;
+
+    for (i = 0; i < num_bufs; i = j) {
+        struct tcp_sock *sock = bufs[i]->dest.tcp.sock;
+
+        for (j = i + 1; j < num_bufs; j++) {
+            if (bufs[j]->dest.tcp.sock != sock)
+                break;
+        }
+
+        if (tcp_send(sock, &bufs[i], j - i))
+            WARN();
+    }
+}
+
+static void tcp_set_send_flags(buf_t *buf, int can_signal)
+{
+    /* The data is copied to the socket, unless the pages are
+     * sent. */
+    if (!buf->transfer.tcp.zerocopy)
+        buf->event_mask |= XX_INLINE;
+}
+
+/**
+ * @brief Build and append a data segment to a request message.
+ *
+ * A payload too large to be immediate data is sent after the message.
+ *
+ * @param[in] md the md that contains the data
+ * @param[in] dir the data direction, in or out
+ * @param[in] offset the offset into the md
+ * @param[in] length the length of the data
+ * @param[in] buf the buf the add the data segment to
+ *
+ * @return status
+ */
+static int init_prepare_transfer_tcp(md_t *md, data_dir_t dir,
+                                     ptl_size_t offset, ptl_size_t length,
+                                     buf_t *buf)
+{
+    data_t *data = (data_t *)(buf->data + buf->length);
+    ni_t *ni = obj_to_ni(md);
+
+    if (length <= get_param(PTL_MAX_INLINE_DATA))
+        return append_immediate_data(md->start, NULL, md->num_iov, dir,
+                                     offset, length, buf);
+
+    if (length > UINT32_MAX) {
+        WARN();
+        return PTL_FAIL;
+    }
+
+    data->data_fmt = DATA_FMT_TCP;
+    buf->length += sizeof(*data);
+
+    if (dir == DATA_DIR_IN) {
+        /* The target sends the payload after its reply. */
+        data->tcp.data_length = 0;
+        return PTL_OK;
+    }
+
+    data->tcp.data_length = cpu_to_le32(length);
+
+    if (md->num_iov) {
+        buf->transfer.tcp.iovecs = md->start;
+        buf->transfer.tcp.num_iovecs = md->num_iov;
+    } else {
+        buf->transfer.tcp.my_iovec.iov_base = md->start;
+        buf->transfer.tcp.my_iovec.iov_len = md->length;
+        buf->transfer.tcp.iovecs = &buf->transfer.tcp.my_iovec;
+        buf->transfer.tcp.num_iovecs = 1;
+    }
+
+    buf->transfer.tcp.offset = offset;
+    buf->transfer.tcp.length = length;
+
+    if (ni->tcp.zerocopy_min && length >= ni->tcp.zerocopy_min) {
+        buf->transfer.tcp.zerocopy = 1;
+        buf->completed = 0;
+    }
+
+    return PTL_OK;
+}
+
+static int tcp_tgt_data_out(buf_t *buf, data_t *data)
+{
+    buf_t *send_buf = buf->send_buf;
+    ack_hdr_t *send_hdr = (ack_hdr_t *) send_buf->data;
+    data_t *reply = (data_t *)(send_buf->data + send_buf->length);
+    me_t *me = buf->me;
+
+    if (data->data_fmt != DATA_FMT_TCP || buf->rdma_dir != DATA_DIR_OUT) {
+        WARN();
+        return STATE_TGT_ERROR;
+    }
+
+    send_hdr->h1.data_out = 1;
+    send_buf->length += sizeof(*reply);
+
+    /* The initiator expects immediate data. An empty one has nothing
+     * to follow the reply. */
+    if (!buf->mlength) {
+        reply->data_fmt = DATA_FMT_IMMEDIATE;
+        reply->immediate.data_length = 0;
+        return STATE_TGT_COMM_EVENT;
+    }
+
+    reply->data_fmt = DATA_FMT_TCP;
+    reply->tcp.data_length = cpu_to_le32(buf->mlength);
+
+    /* The comm event is delivered before the reply is sent, so send a
+     * copy of the payload. */
+    send_buf->transfer.tcp.bounce = malloc(buf->mlength);
+    if (!send_buf->transfer.tcp.bounce) {
+        WARN();
+        return STATE_TGT_ERROR;
+    }
+
+    if (me->num_iov) {
+        if (iov_copy_out(send_buf->transfer.tcp.bounce, me->start, NULL,
+                         me->num_iov, buf->moffset, buf->mlength)) {
+            WARN();
+            return STATE_TGT_ERROR;
+        }
+    } else {
+        memcpy(send_buf->transfer.tcp.bounce, me->start + buf->moffset,
+               buf->mlength);
+    }
+
+    send_buf->transfer.tcp.my_iovec.iov_base = send_buf->transfer.tcp.bounce;
+    send_buf->transfer.tcp.my_iovec.iov_len = buf->mlength;
+    send_buf->transfer.tcp.iovecs = &send_buf->transfer.tcp.my_iovec;
+    send_buf->transfer.tcp.num_iovecs = 1;
+    send_buf->transfer.tcp.offset = 0;
+    send_buf->transfer.tcp.length = buf->mlength;
+
+    return STATE_TGT_COMM_EVENT;
+}
+
+/**
+ * @brief Tell whether an NI has sent everything it queued.
+ *
+ * @param[in] ni the network interface
+ *
+ * @return 1 if nothing is left to send
+ */
+static int tcp_is_disconnected_all(ni_t *ni)
+{
+    struct tcp_sock *sock;
+    int idle = 1;
+
+    PTL_FASTLOCK_LOCK(&ni->tcp.lock);
+    list_for_each_entry(sock, &ni->tcp.sock_list, list) {
+        PTL_FASTLOCK_LOCK(&sock->lock);
+        if (!sock->dead && (!list_empty(&sock->tx_queue) ||
+                            !list_empty(&sock->zc_list)))
+            idle = 0;
+        PTL_FASTLOCK_UNLOCK(&sock->lock);
+
+        if (!idle)
+            break;
+    }
+    PTL_FASTLOCK_UNLOCK(&ni->tcp.lock);
+
+    return idle;
+}
+
+struct transport transport_tcp = {
+    .type = CONN_TYPE_TCP,
+    .buf_alloc = buf_alloc,
+    .init_connect = init_connect_tcp,
+    .send_message = send_message_tcp,
+    .send_bundle = send_bundle_tcp,
+    .set_send_flags = tcp_set_send_flags,
+    .init_prepare_transfer = init_prepare_transfer_tcp,
+    .tgt_data_out = tcp_tgt_data_out,
+};
+
+struct transport_ops transport_remote_tcp = {
+    .init_iface = init_iface_tcp,
+    .NIInit = PtlNIInit_tcp,
+    .NIFini = cleanup_tcp,
+    .is_disconnected_all = tcp_is_disconnected_all,
+};
@@ -164,6 +164,77 @@ static int tgt_copy_in(buf_t *buf, me_t *me, void *data)
     return err;
 }
 
+/* Size of the blocks of target memory covered by one atomic lock. */
+#define ATOMIC_LOCK_SHIFT (6)
+
+/**
+ * @brief Lock the target memory of an atomic operation.
+ *
+ * Block n of the target memory is covered by lock n modulo the number
+ * of locks, so an operation takes a contiguous, possibly wrapping, range
+ * of locks. They are always taken in increasing index order. Operations
+ * on an iovec list element take all the locks.
+ *
+ * @param[in] ni The network interface.
+ * @param[in] buf The message buf received by the target.
+ */
+static void atomic_lock(ni_t *ni, buf_t *buf)
+{
+    const unsigned int mask = ni->atomic_lock_mask;
+    me_t *me = buf->me;
+    unsigned int i;
+
+    if (!me || me->num_iov) {
+        buf->atomic_lock_first = 0;
+        buf->atomic_lock_last = mask;
+    } else {
+        uintptr_t start = (uintptr_t)me->start + buf->moffset;
+        uintptr_t first = start >> ATOMIC_LOCK_SHIFT;
+        uintptr_t last = buf->mlength ?
+            (start + buf->mlength - 1) >> ATOMIC_LOCK_SHIFT : first;
+
+        if (last - first >= mask) {
+            buf->atomic_lock_first = 0;
+            buf->atomic_lock_last = mask;
+        } else {
+            buf->atomic_lock_first = first & mask;
+            buf->atomic_lock_last = last & mask;
+        }
+    }
+
+    if (buf->atomic_lock_last < buf->atomic_lock_first) {
+        for (i = 0; i <= buf->atomic_lock_last; i++)
+            pthread_mutex_lock(&ni->atomic_locks[i]);
+        for (i = buf->atomic_lock_first; i <= mask; i++)
+            pthread_mutex_lock(&ni->atomic_locks[i]);
+    } else {
+        for (i = buf->atomic_lock_first; i <= buf->atomic_lock_last; i++)
+            pthread_mutex_lock(&ni->atomic_locks[i]);
+    }
+
+    buf->in_atomic = 1;
+}
+
+/**
+ * @brief Release the locks taken by atomic_lock.
+ *
+ * @param[in] ni The network interface.
+ * @param[in] buf The message buf received by the target.
+ */
+static void atomic_unlock(ni_t *ni, buf_t *buf)
+{
+    unsigned int i = buf->atomic_lock_first;
+
+    while (1) {
+        pthread_mutex_unlock(&ni->atomic_locks[i]);
+        if (i == buf->atomic_lock_last)
+            break;
+        i = (i + 1) & ni->atomic_lock_mask;
+    }
+
+    buf->in_atomic = 0;
+}
+
 /**
  * @brief Handle atomic data in from a data segment to a list element and
  * save the starting address.
@@ -308,6 +379,7 @@ static int prepare_send_buf(buf_t *buf)
 #endif
 
         send_buf->length = sizeof(*ack_hdr);
+        send_buf->rlength = 0;
     } else {
 #if IS_PPE
         //REG: this is handled elsewhere, testcase for fix for Brian K.
@@ -418,6 +490,7 @@ static int tgt_start(buf_t *buf)
 
     /* initialize fields */
     INIT_LIST_HEAD(&buf->unexpected_list);
+    INIT_LIST_HEAD(&buf->unexpected_match_list);
 #if WITH_TRANSPORT_IB
     INIT_LIST_HEAD(&buf->transfer.rdma.rdma_list);
 #endif
@@ -440,8 +513,12 @@ static int tgt_start(buf_t *buf)
         conn_put(buf->conn);
         buf->conn = get_conn(ni, initiator);
     }
-    buf->conn->state = CONN_STATE_CONNECTED;
-    buf->conn->udp.dest_addr = buf->conn->sin;
+    /* A local initiator may be reached through shared memory, whose
+     * conn fields share the udp ones. */
+    if (buf->conn->transport.type == CONN_TYPE_UDP) {
+        buf->conn->state = CONN_STATE_CONNECTED;
+        buf->conn->udp.dest_addr = buf->conn->sin;
+    }
 #endif
 #if !WITH_TRANSPORT_UDP
     buf->conn = get_conn(ni, initiator);
@@ -615,6 +692,43 @@ int check_perm(buf_t *buf, const le_t *le)
     return ret;
 }
 
+/**
+ * @brief Find the first list element a message matches by walking
+ * the priority list and then the overflow list.
+ *
+ * @pre caller should hold the pt spinlock.
+ *
+ * @param[in] ni The NI the message was received on.
+ * @param[in] pt The portals table entry addressed by the message.
+ * @param[in] buf The message buf received by the target.
+ *
+ * @return The list element or NULL if nothing matches.
+ */
+static le_t *get_match_linear(ni_t *ni, pt_t *pt, buf_t *buf)
+{
+    le_t *le;
+
+    /* Check the priority list */
+    list_for_each_entry(le, &pt->priority_list, list) {
+        if (ni->options & PTL_NI_NO_MATCHING)
+            return le;
+
+        if (check_match(buf, (me_t *)le))
+            return le;
+    }
+
+    /* Check the overflow list */
+    list_for_each_entry(le, &pt->overflow_list, list) {
+        if (ni->options & PTL_NI_NO_MATCHING)
+            return le;
+
+        if (check_match(buf, (me_t *)le))
+            return le;
+    }
+
+    return NULL;
+}
+
 /**
  * @brief target get match state.
  *
@@ -631,37 +745,29 @@ static int tgt_get_match(buf_t *buf)
     ni_t *ni = obj_to_ni(buf);
     pt_t *pt = buf->pt;
     ptl_ni_fail_t ni_fail;
+    le_t *le;
 
     /* Synchronize with LE/ME append/search APIs */
     PTL_FASTLOCK_LOCK(&pt->lock);
 
-    /* Check the priority list.
-     * If we find a match take a reference to protect
-     * the list element pointer.
-     * Note buf->le and buf->me are in a union */
-    list_for_each_entry(buf->le, &pt->priority_list, list) {
-        if (ni->options & PTL_NI_NO_MATCHING) {
-            le_get(buf->le);
-            goto found_one;
-        }
+    if (pt->match_mode == PT_MATCH_LINEAR) {
+        le = get_match_linear(ni, pt, buf);
+    } else {
+        le = (le_t *)pt_match_index_find(pt, buf);
 
-        if (check_match(buf, buf->me)) {
-            me_get(buf->me);
-            goto found_one;
-        }
+        if (pt->match_mode == PT_MATCH_VERIFY &&
+            le != get_match_linear(ni, pt, buf))
+            ptl_fatal("match index disagrees with list on pt %u\n",
+                      pt->index);
     }
 
-    /* Check the overflow list */
-    list_for_each_entry(buf->le, &pt->overflow_list, list) {
-        if (ni->options & PTL_NI_NO_MATCHING) {
-            le_get(buf->le);
-            goto found_one;
-        }
-
-        if (check_match(buf, buf->me)) {
-            me_get(buf->me);
-            goto found_one;
-        }
+    /* If we find a match take a reference to protect
+     * the list element pointer.
+     * Note buf->le and buf->me are in a union */
+    if (le) {
+        buf->le = le;
+        le_get(le);
+        goto found_one;
     }
 
     /* Failed to match any elements */
@@ -734,6 +840,7 @@ static int tgt_get_match(buf_t *buf)
             buf->unexpected_busy = 1;
 
             list_add_tail(&buf->unexpected_list, &pt->unexpected_list);
+            pt_unexpected_add(pt, buf);
 
 #if WITH_TRANSPORT_SHMEM || IS_PPE
             /* If it is a shared memory buffer, then the data is actually
@@ -766,12 +873,13 @@ static int tgt_get_match(buf_t *buf)
     //indicate on which list this buf matched
     buf->matching_list = buf->le->ptl_list;
 
-    PTL_FASTLOCK_UNLOCK(&pt->lock);
-
     /* now that we have determined the list element
      * compute the remaining event mask bits */
     init_events(buf);
 
+    /* The pt lock is kept until tgt_get_length has reserved space
+     * in the list element, since other progress threads may be
+     * matching on this PT. */
     return STATE_TGT_GET_LENGTH;
 }
 
@@ -782,6 +890,7 @@ static int tgt_get_match(buf_t *buf)
  * list element that matches. It computes the actual length and offset
  * for the data transfer. These are based on whether the list element
  * is managed by the initiator or the target and the operation type.
+ * It is entered with the pt lock held by tgt_get_match.
  *
  * @param[in] buf The message buf received by the target.
  *
@@ -791,7 +900,9 @@ static int tgt_get_length(buf_t *buf)
 {
     int err;
     const ni_t *ni = obj_to_ni(buf);
+    pt_t *pt = buf->pt;
     me_t *me = buf->me;
+    int unlinked = 0;
     ptl_size_t offset;
     ptl_size_t length;
     const req_hdr_t *hdr = (req_hdr_t *) buf->data;
@@ -858,9 +969,9 @@ static int tgt_get_length(buf_t *buf)
 
     /*
      * If locally managed update to reserve space for the
-     * associated RDMA data. Note the early states in the
-     * state machine only run on the progress thread so no
-     * other request message can run this code until we return.
+     * associated RDMA data. Note the pt lock is still held
+     * so no other request message can run this code until
+     * we release it.
      */
     if (me->options & PTL_ME_MANAGE_LOCAL)
         me->offset += length;
@@ -872,26 +983,20 @@ static int tgt_get_length(buf_t *buf)
     if ((me->options & PTL_ME_USE_ONCE) ||
         ((me->options & PTL_ME_MANAGE_LOCAL) && me->min_free &&
          ((me->length - me->offset) < me->min_free))) {
-        le_unlink(buf->le, 0);
+        unlinked = le_unlink_locked(buf->le, 0);
         if (!(me->options & PTL_ME_EVENT_UNLINK_DISABLE))
             buf->auto_unlink_pending = 1;
     }
-#if WITH_TRANSPORT_UDP
-    if (buf->conn->transport.type == CONN_TYPE_UDP) {
-        if (atomic_read((atomic_t *)&ni->udp.self_recv) <= 0) {
-#endif
-            /* initialize buf->cur_loc_iov_index/off and buf->start */
-            err = init_local_offset(buf);
-            if (err)
-                return STATE_TGT_ERROR;
-#if WITH_TRANSPORT_UDP
-        }
-    } else {
-        err = init_local_offset(buf);
-        if (err)
-            return STATE_TGT_ERROR;
-    }
-#endif
+
+    PTL_FASTLOCK_UNLOCK(&pt->lock);
+
+    if (unlinked)
+        le_unlink_put(buf->le);
+    /* initialize buf->cur_loc_iov_index/off and buf->start */
+    err = init_local_offset(buf);
+    if (err)
+        return STATE_TGT_ERROR;
+
     /* if we are already connected to the initiator skip wait_conn */
     if (likely(buf->conn->state >= CONN_STATE_CONNECTED))
         return STATE_TGT_DATA;
@@ -980,18 +1085,14 @@ static int tgt_data(buf_t *buf)
         set_buf_dest(buf, buf->conn);
 
     /* This implementation guarantees atomicity between
-     * the three atomic type operations by only alowing a
-     * single operation at a time to be processed. */
+     * the three atomic type operations by serializing the
+     * operations whose target memory overlap. */
 
-    // TODO we could improve performance by having more locks
-    // here covering operations that do no overlap. Also
-    // we could think some more about how to protect between
+    // TODO we could think some more about how to protect between
     // atomic and regular get/put operations.
     if (buf->operation == OP_ATOMIC || buf->operation == OP_SWAP ||
-        buf->operation == OP_FETCH) {
-        pthread_mutex_lock(&ni->atomic_mutex);
-        buf->in_atomic = 1;
-    }
+        buf->operation == OP_FETCH)
+        atomic_lock(ni, buf);
 
     /* process data out, then data in */
     if (buf->get_resid)
@@ -1140,6 +1241,9 @@ static int tgt_start_copy(buf_t *buf)
     list_add_tail(&buf->list, &ni->shmem.noknem_list);
     PTL_FASTLOCK_UNLOCK(&ni->shmem.noknem_lock);
 
+    /* The first progress thread handles the list. */
+    progress_thread_wakeup(ni, 0);
+
     return STATE_TGT_RDMA;
 }
 #else
@@ -1169,6 +1273,14 @@ static int tgt_rdma(buf_t *buf)
     ptl_size_t *resid =
         buf->rdma_dir == DATA_DIR_IN ? &buf->put_resid : &buf->get_resid;
     int was_done;
+#if WITH_TRANSPORT_SHMEM && !USE_KNEM
+    const data_t *data =
+        buf->rdma_dir == DATA_DIR_IN ? buf->data_in : buf->data_out;
+    /* Single copy (CMA) transfers don't go through the noknem_list. */
+    const int noknem = buf->conn->transport.type == CONN_TYPE_SHMEM &&
+        data->data_fmt == DATA_FMT_NOKNEM;
+#endif
+
     was_done = 0;
 #if WITH_TRANSPORT_SHMEM && !USE_KNEM
     /* It is possible that post_tgt_dma() sets the target_done flag,
@@ -1177,7 +1289,7 @@ static int tgt_rdma(buf_t *buf)
      * receive state machine can remove the buffer from the
      * noknem_list; this function will be called again, and this time
      * was_done will be 1. May be this part needs a nicer design. */
-    if (buf->conn->transport.type == CONN_TYPE_SHMEM)
+    if (noknem)
         was_done =
             buf->transfer.noknem.noknem ? buf->transfer.noknem.
             noknem->init_done : 0;
@@ -1200,7 +1312,7 @@ static int tgt_rdma(buf_t *buf)
         return STATE_TGT_RDMA;
 #endif
 #if WITH_TRANSPORT_SHMEM && !USE_KNEM
-    if ((was_done == 0) && (buf->conn->transport.type == CONN_TYPE_SHMEM))
+    if ((was_done == 0) && noknem)
         return STATE_TGT_RDMA;
 #endif
 
@@ -1438,12 +1550,8 @@ static int tgt_data_in(buf_t *buf)
     }
 
     /* this can happen for a simple swap operation */
-    if (buf->in_atomic) {
-        ni_t *ni = obj_to_ni(buf);
-
-        pthread_mutex_unlock(&ni->atomic_mutex);
-        buf->in_atomic = 0;
-    }
+    if (buf->in_atomic)
+        atomic_unlock(obj_to_ni(buf), buf);
 
     return next;
 }
@@ -1484,8 +1592,7 @@ static int tgt_atomic_data_in(buf_t *buf)
     assert(buf->in_atomic);
 
     ni = obj_to_ni(buf);
-    pthread_mutex_unlock(&ni->atomic_mutex);
-    buf->in_atomic = 0;
+    atomic_unlock(ni, buf);
 
     return STATE_TGT_COMM_EVENT;
 }
@@ -1577,8 +1684,7 @@ static int tgt_swap_data_in(buf_t *buf)
     assert(buf->in_atomic);
 
     ni = obj_to_ni(buf);
-    pthread_mutex_unlock(&ni->atomic_mutex);
-    buf->in_atomic = 0;
+    atomic_unlock(ni, buf);
 
     return STATE_TGT_COMM_EVENT;
 }
@@ -1750,7 +1856,7 @@ static int tgt_send_ack(buf_t *buf)
             case CONN_TYPE_UDP:
                 ack_buf->dest.udp.dest_addr = buf->udp.src_addr;
                 ack_buf->conn = buf->conn;
-                ack_buf->rlength = sizeof(buf_t);
+                ack_buf->rlength = 0;
                 ptl_info("buffer handle for initiator: %i \n",
                          le32_to_cpu(ack_hdr->h1.handle));
 
@@ -1762,6 +1868,17 @@ static int tgt_send_ack(buf_t *buf)
                 break;
 #endif
 
+#if WITH_TRANSPORT_TCP
+            case CONN_TYPE_TCP:
+                /* Send the received buffer back as the ack. */
+                err = ack_buf->conn->transport.send_message(ack_buf, 0);
+                if (err) {
+                    WARN();
+                    return STATE_TGT_ERROR;
+                }
+                break;
+#endif
+
 #if WITH_TRANSPORT_IB
             case CONN_TYPE_RDMA:
                 /* That should not be possible. */
@@ -2149,11 +2266,8 @@ int process_tgt(buf_t *buf)
                 state = tgt_overflow_event(buf);
                 break;
             case STATE_TGT_ERROR:
-                if (buf->in_atomic) {
-                    ni_t *ni = obj_to_ni(buf);
-                    pthread_mutex_unlock(&ni->atomic_mutex);
-                    buf->in_atomic = 0;
-                }
+                if (buf->in_atomic)
+                    atomic_unlock(obj_to_ni(buf), buf);
                 err = PTL_FAIL;
                 state = STATE_TGT_CLEANUP;
                 break;
@@ -2164,12 +2278,7 @@ int process_tgt(buf_t *buf)
                 tgt_cleanup_2(buf);
                 buf->tgt_state = STATE_TGT_DONE;
                 pthread_mutex_unlock(&buf->mutex);
-#if WITH_TRANSPORT_UDP
-                ni_t *ni = obj_to_ni(buf);
-                if (atomic_read(&ni->udp.self_recv) == 0)
-#endif
-                    buf_put(buf);      /* match buf_alloc */
-
+                buf_put(buf);          /* match buf_alloc */
 
                 return err;
             case STATE_TGT_DONE:
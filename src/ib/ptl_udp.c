@@ -6,6 +6,228 @@
 
 #include "ptl_loc.h"
 #include "ptl_rudp.h"
+#include "ptl_udp_uring.h"
+
+/* Type of the datagram carrying a buf. */
+static inline uint8_t udp_msg_type(buf_t *buf)
+{
+    switch (buf->type) {
+        case BUF_UDP_CONN_REQ:
+            return UDP_MSG_CONN_REQ;
+        case BUF_UDP_CONN_REP:
+            return UDP_MSG_CONN_REP;
+        default:
+            return UDP_MSG_DATA;
+    }
+}
+
+/**
+ * @brief Check whether a destination is the NI itself.
+ *
+ * @param[in] ni the network interface
+ * @param[in] dest the destination
+ *
+ * @return 1 if the message is for the process itself, 0 otherwise
+ */
+static inline int udp_is_self(ni_t *ni, const struct sockaddr_in *dest)
+{
+    return dest->sin_port == pid_to_port(ni->id.phys.pid) &&
+        dest->sin_addr.s_addr == nid_to_addr(ni->id.phys.nid);
+}
+
+/**
+ * @brief Prepare the datagram for a buf without payload.
+ *
+ * Only the UDP header, the buf->length bytes of portals header and,
+ * for a connection message, the connection message are sent.
+ *
+ * @param[in] buf the buf to send
+ * @param[out] hdr the UDP header to fill
+ * @param[out] iov an array of 3 iovecs to fill
+ *
+ * @return the number of iovecs used
+ */
+static int udp_pack_hdr(buf_t *buf, struct udp_hdr *hdr, struct iovec *iov)
+{
+    assert(buf->length <= BUF_DATA_SIZE);
+
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->type = udp_msg_type(buf);
+    hdr->hdr_len = cpu_to_le16(buf->length);
+    hdr->seq_num = cpu_to_le32(buf->transfer.udp.seq_num);
+    hdr->rlength = cpu_to_le64(buf->rlength);
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(*hdr);
+    iov[1].iov_base = buf->data;
+    iov[1].iov_len = buf->length;
+
+    if (hdr->type == UDP_MSG_CONN_REQ || hdr->type == UDP_MSG_CONN_REP) {
+        iov[2].iov_base = &buf->transfer.udp.conn_msg;
+        iov[2].iov_len = sizeof(buf->transfer.udp.conn_msg);
+        return 3;
+    }
+
+    return 2;
+}
+
+/**
+ * @brief Send a buf without payload.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf
+ * @param[in] dest the destination socket info
+ *
+ * @return the number of bytes sent, or -1
+ */
+ssize_t udp_send_hdr(ni_t *ni, buf_t *buf, struct sockaddr_in *dest)
+{
+    struct udp_hdr hdr;
+    struct iovec iov[3];
+    struct msghdr msg;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = dest;
+    msg.msg_namelen = sizeof(*dest);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = udp_pack_hdr(buf, &hdr, iov);
+
+    return ptl_sendmsg(ni->iface->udp.connect_s, &msg, 0, ni);
+}
+
+/* Room for the portals header and the connection message of a
+ * queued datagram. */
+#define UDP_SEND_SLOT (BUF_DATA_SIZE + sizeof(struct udp_conn_msg))
+
+/**
+ * Datagrams without payload sent by the progress thread during a
+ * pass, see udp_send_start(). Their content is copied, so the bufs can
+ * be changed or released as soon as udp_send() returns. Only the
+ * owner thread queues datagrams.
+ */
+struct udp_send_batch {
+    unsigned int size;          /* datagrams per sendmmsg */
+    unsigned int count;         /* datagrams queued */
+    int active;                 /* set between start and flush */
+    pthread_t owner;
+    struct sockaddr_in *addrs;
+    struct udp_hdr *hdrs;
+    struct iovec (*iovs)[3];
+    struct mmsghdr *msgs;
+    unsigned char *data;        /* size * UDP_SEND_SLOT bytes */
+};
+
+/**
+ * @brief Send the queued datagrams.
+ *
+ * @param[in] ni the network interface
+ * @param[in] batch the send batch of the NI
+ */
+static void udp_send_batch_flush(ni_t *ni, struct udp_send_batch *batch)
+{
+    unsigned int sent;
+    int n;
+
+    for (sent = 0; sent < batch->count; sent += n) {
+        n = ptl_sendmmsg(ni->iface->udp.connect_s, &batch->msgs[sent],
+                         batch->count - sent, 0, ni);
+        if (n == -1) {
+            WARN();
+            ptl_error("error sending batch to socket: %i %s \n",
+                      ni->iface->udp.connect_s, strerror(errno));
+            abort();
+            return;
+        }
+    }
+
+    batch->count = 0;
+}
+
+/**
+ * @brief Queue a buf without payload, if the calling thread is in a
+ * pass of the progress thread.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf
+ * @param[in] dest the destination socket info
+ *
+ * @return 1 if the datagram was queued, 0 if the caller must send it
+ */
+static int udp_send_batch_add(ni_t *ni, buf_t *buf,
+                              const struct sockaddr_in *dest)
+{
+    struct udp_send_batch *batch = ni->udp.send_batch;
+    struct msghdr *msg;
+    struct iovec *iov;
+    unsigned char *p;
+    unsigned int n;
+    int i;
+
+    if (!batch || !batch->active ||
+        !pthread_equal(batch->owner, pthread_self()))
+        return 0;
+
+    n = batch->count++;
+    iov = batch->iovs[n];
+    msg = &batch->msgs[n].msg_hdr;
+
+    batch->addrs[n] = *dest;
+
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name = &batch->addrs[n];
+    msg->msg_namelen = sizeof(batch->addrs[n]);
+    msg->msg_iov = iov;
+    msg->msg_iovlen = udp_pack_hdr(buf, &batch->hdrs[n], iov);
+
+    /* Everything but the UDP header still points into the buf. */
+    p = &batch->data[(size_t)n * UDP_SEND_SLOT];
+    for (i = 1; i < msg->msg_iovlen; i++) {
+        memcpy(p, iov[i].iov_base, iov[i].iov_len);
+        iov[i].iov_base = p;
+        p += iov[i].iov_len;
+    }
+
+    if (batch->count == batch->size)
+        udp_send_batch_flush(ni, batch);
+
+    return 1;
+}
+
+/**
+ * @brief Start queuing the datagrams without payload sent by the
+ * calling thread.
+ *
+ * Called by the progress thread before it handles the datagrams it
+ * received, so that the acks and replies they trigger go out with a
+ * single sendmmsg in udp_send_flush().
+ *
+ * @param[in] ni the network interface
+ */
+void udp_send_start(ni_t *ni)
+{
+    struct udp_send_batch *batch = ni->udp.send_batch;
+
+    if (batch) {
+        batch->owner = pthread_self();
+        batch->active = 1;
+    }
+}
+
+/**
+ * @brief Send the datagrams queued since udp_send_start(), and stop
+ * queuing.
+ *
+ * @param[in] ni the network interface
+ */
+void udp_send_flush(ni_t *ni)
+{
+    struct udp_send_batch *batch = ni->udp.send_batch;
+
+    if (batch && batch->active) {
+        udp_send_batch_flush(ni, batch);
+        batch->active = 0;
+    }
+}
 
 /**
  * @brief Send a message using UDP.
@@ -30,6 +252,23 @@ static int send_message_udp(buf_t *buf, int from_init)
     ptl_info("&&&&&&&&&& Reliable UDP send &&&&&&&&&\n");
 #endif
 
+    if (from_init) {
+        ni_t *ni = buf->obj.obj_ni;
+        struct sockaddr_in *dest = &buf->dest.udp.dest_addr;
+
+        /* Only immediate messages to another process are bundled;
+         * flush the bundle before the others to keep the order. */
+        if (buf->rlength <= get_param(PTL_MAX_INLINE_DATA) &&
+            !udp_is_self(ni, dest)) {
+            if (ni_bundle_add(ni, buf) == PTL_OK) {
+                buf_put(buf);
+                return PTL_OK;
+            }
+        } else {
+            ni_bundle_flush(ni);
+        }
+    }
+
     udp_send(buf->obj.obj_ni, buf, &buf->dest.udp.dest_addr);
 
     buf_put(buf);
@@ -37,6 +276,41 @@ static int send_message_udp(buf_t *buf, int from_init)
     return PTL_OK;
 }
 
+/**
+ * @brief Send the messages of a bundle with a single sendmmsg.
+ *
+ * @param[in] bufs the immediate buffers queued by send_message_udp.
+ * @param[in] num_bufs the number of buffers.
+ */
+static void send_bundle_udp(buf_t **bufs, int num_bufs)
+{
+    ni_t *ni = bufs[0]->obj.obj_ni;
+    struct mmsghdr msgs[num_bufs];
+    struct udp_hdr hdrs[num_bufs];
+    struct iovec iov[num_bufs][3];
+    int sent;
+    int i;
+
+    for (i = 0; i < num_bufs; i++) {
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &bufs[i]->dest.udp.dest_addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        msgs[i].msg_hdr.msg_iov = iov[i];
+        msgs[i].msg_hdr.msg_iovlen = udp_pack_hdr(bufs[i], &hdrs[i], iov[i]);
+    }
+
+    for (sent = 0; sent < num_bufs; sent += i) {
+        i = ptl_sendmmsg(ni->iface->udp.connect_s, &msgs[sent],
+                         num_bufs - sent, 0, ni);
+        if (i == -1) {
+            WARN();
+            ptl_error("error sending bundle to socket: %s \n",
+                      strerror(errno));
+            break;
+        }
+    }
+}
+
 static void udp_set_send_flags(buf_t *buf, int can_signal)
 {
     /* The data is always in the buffer. */
@@ -97,6 +371,7 @@ static void append_init_data_udp_direct(data_t *data, mr_t *mr, void *addr,
 
     buf->transfer.udp.length_left = length;
 
+    buf->length += sizeof(*data);
 }
 
 /**
@@ -124,6 +399,17 @@ static int init_prepare_transfer_udp(md_t *md, data_dir_t dir,
     ptl_size_t iov_start = 0;
     ptl_size_t iov_offset = 0;
 
+    /* Nothing is appended for an empty transfer, and the datagram
+     * stops at the last descriptor, so the target must not look for
+     * one. */
+    if (!length) {
+        if (dir == DATA_DIR_IN)
+            hdr->h1.data_in = 0;
+        else
+            hdr->h1.data_out = 0;
+        return PTL_OK;
+    }
+
     if (length <= get_param(PTL_MAX_INLINE_DATA)) {
         mr_t **mr_list;
 
@@ -336,68 +622,196 @@ static int udp_tgt_data_out(buf_t *buf, data_t *data)
     return STATE_TGT_UDP;
 }
 
+/* Most datagrams in a UDP_SEGMENT send; the kernel limit. */
+#define UDP_GSO_MAX_SEGS	64
+
+/* Most datagrams handed to the kernel by a single call. */
+#define UDP_SEND_DGRAMS		128
+
 /**
- * @brief send a buf to a pid using UDP socket.
+ * @brief Wait for room in the send buffer of a socket.
+ *
+ * @param[in] fd the socket
+ */
+static void udp_wait_send(int fd)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = POLLOUT;
+    pfd.revents = 0;
+
+    poll(&pfd, 1, 1);
+}
+
+/**
+ * @brief Send a large message.
+ *
+ * The payload is cut in fragments, each sent in a datagram with the
+ * UDP header and the portals header. The datagrams are handed to the
+ * kernel by batches with sendmmsg. When the kernel supports it, each
+ * message of a batch carries up to UDP_GSO_MAX_SEGS datagrams, split
+ * by the kernel or the NIC (UDP_SEGMENT). If the offload fails, it is
+ * disabled and the datagrams are sent one by one.
  *
  * @param[in] ni the network interface
- * @param[in] buf the buf
- * @param[in] dest the destination socket info
+ * @param[in] buf the buf holding the portals header
+ * @param[in] dest the destination
+ * @param[in] data the buf->rlength bytes of payload
+ *
+ * @return 0 on success, -1 on error
  */
-void udp_send(ni_t *ni, buf_t *buf, struct sockaddr_in *dest)
+static int udp_send_large(ni_t *ni, buf_t *buf, struct sockaddr_in *dest,
+                          const unsigned char *data)
 {
-    int err;
+    const int fd = ni->iface->udp.connect_s;
+    const ptl_size_t rlength = buf->rlength;
+    const size_t hdr_size = sizeof(struct udp_hdr) + buf->length;
+    struct udp_hdr proto;
+    struct udp_hdr hdrs[UDP_SEND_DGRAMS];
+    struct iovec iov[UDP_SEND_DGRAMS][3];
+    struct mmsghdr msgs[UDP_SEND_DGRAMS];
+#ifdef UDP_SEGMENT
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+    } ctrl;
+#endif
+    size_t dgram_size = ni->iface->udp.max_msg;
+    size_t frag_size;
+    unsigned int segs = 1;
+    ptl_size_t offset = 0;
+    uint32_t frag_seq = 0;
+
+#ifdef UDP_SEGMENT
+    if (ni->iface->udp.gso_size > hdr_size) {
+        struct cmsghdr *cmsg = &ctrl.align;
+
+        dgram_size = ni->iface->udp.gso_size;
+        segs = UDP_MAX_DATAGRAM / dgram_size;
+        if (segs > UDP_GSO_MAX_SEGS)
+            segs = UDP_GSO_MAX_SEGS;
+
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *(uint16_t *)CMSG_DATA(cmsg) = dgram_size;
+    }
+#endif
 
-    const struct sockaddr_in target = *dest;
+    frag_size = dgram_size - hdr_size;
 
-    int MAX_UDP_MSG_SIZE = 1488;
-    uint32_t max_len_size;
-    max_len_size = sizeof(int);
-    getsockopt(ni->iface->udp.connect_s, SOL_SOCKET, SO_SNDBUF,
-               (int *)&MAX_UDP_MSG_SIZE, &max_len_size);
-    //65507 is the max IPv4 UDP message size (65536 - 8 byte UDP header - 20 byte IP header)
-    //Send buffers can sometimes exceed this size, so we need to cap the max packet size
-    if (MAX_UDP_MSG_SIZE > 65507)
-        MAX_UDP_MSG_SIZE = 65507;
-
-    ptl_info("max udp message size is: %i \n", MAX_UDP_MSG_SIZE);
-
-    //check for send to self, use local memory for transfer
-    if (((dest->sin_port == ni->id.phys.pid) &&
-         (dest->sin_addr.s_addr == nid_to_addr(ni->id.phys.nid)))) {
-        ptl_info("sending to self! \n");
-        if (buf->rlength <= sizeof(buf_t)) {
-            if (buf->transfer.udp.conn_msg.msg_type !=
-                le16_to_cpu(UDP_CONN_MSG_REP)) {
-                //the only multiple outstanding self sends that are valid are
-                //connection request replies and ACKS, otherwise, wait until the previous
-                //send has been received and processed
-                ack_hdr_t *hdr = (ack_hdr_t *) buf->data;
-                if (!
-                    (hdr->h1.operation == OP_ACK ||
-                     hdr->h1.operation == OP_CT_ACK ||
-                     hdr->h1.operation == OP_OC_ACK)) {
-                    while (atomic_read(&ni->udp.self_recv) > 0) {
-                        ptl_info("queuing for self send \n");
-                        sleep(1);
-                    }
-                }
+    memset(&proto, 0, sizeof(proto));
+    proto.type = udp_msg_type(buf);
+    proto.flags = UDP_HDR_LARGE;
+    proto.hdr_len = cpu_to_le16(buf->length);
+    proto.frag_size = cpu_to_le32(frag_size);
+    proto.rlength = cpu_to_le64(rlength);
+
+    ptl_info("# of segments: %i, %i per send\n",
+             (int)((rlength + frag_size - 1) / frag_size), segs);
+
+    while (offset < rlength) {
+        unsigned int n = 0;
+        unsigned int m = 0;
+        unsigned int sent;
+        int ret;
+
+        /* Fill a batch of messages of segs datagrams each. */
+        while (offset < rlength && n + segs <= UDP_SEND_DGRAMS) {
+            struct msghdr *msg = &msgs[m++].msg_hdr;
+            unsigned int first = n;
+
+            while (n - first < segs && offset < rlength) {
+                size_t len = rlength - offset;
+
+                if (len > frag_size)
+                    len = frag_size;
+
+                hdrs[n] = proto;
+                hdrs[n].frag_seq = cpu_to_le32(frag_seq);
+
+                iov[n][0].iov_base = &hdrs[n];
+                iov[n][0].iov_len = sizeof(hdrs[n]);
+                iov[n][1].iov_base = buf->data;
+                iov[n][1].iov_len = buf->length;
+                iov[n][2].iov_base = (void *)(data + offset);
+                iov[n][2].iov_len = len;
+
+                offset += len;
+                frag_seq++;
+                n++;
             }
-            buf->udp.src_addr = *dest;
-            ni->udp.self_recv_addr = buf;
-            ni->udp.self_recv_len = sizeof(buf_t);
-            ptl_info("self ref addr is: %p \n", ni->udp.self_recv_addr);
-            atomic_inc(&ni->udp.self_recv);
-            return;
-        } else {
-            ptl_warn("large message self sends not yet supported \n");
-            abort();
+
+            memset(msg, 0, sizeof(*msg));
+            msg->msg_name = dest;
+            msg->msg_namelen = sizeof(*dest);
+            msg->msg_iov = iov[first];
+            msg->msg_iovlen = 3 * (n - first);
+#ifdef UDP_SEGMENT
+            if (n - first > 1) {
+                msg->msg_control = &ctrl;
+                msg->msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            }
+#endif
         }
 
+        for (sent = 0; sent < m; sent += ret) {
+            ret = ptl_sendmmsg(fd, &msgs[sent], m - sent, 0, ni);
+            if (ret != -1)
+                continue;
+
+            ret = 0;
+
+            if (errno == EAGAIN || errno == EWOULDBLOCK ||
+                errno == ENOBUFS) {
+                udp_wait_send(fd);
+            } else if (segs > 1 && (errno == EIO || errno == EINVAL)) {
+                /* The device can't segment; resend the rest one
+                 * datagram at a time, with the same fragments. */
+                const struct udp_hdr *hdr =
+                    msgs[sent].msg_hdr.msg_iov[0].iov_base;
+
+                ptl_warn("UDP segmentation offload failed, disabled\n");
+                ni->iface->udp.gso_size = 0;
+                segs = 1;
+                frag_seq = le32_to_cpu(hdr->frag_seq);
+                offset = (ptl_size_t)frag_seq * frag_size;
+                break;
+            } else {
+                ptl_error("error while sending multi segment message: %s\n",
+                          strerror(errno));
+                return -1;
+            }
+        }
     }
 
+    return 0;
+}
+
+/**
+ * @brief Get the payload of a large message in a single piece.
+ *
+ * The datagrams are cut from contiguous memory; the payload of an
+ * iovec MD is gathered first.
+ *
+ * @param[in] buf the buf to send
+ * @param[out] copy the gathered payload when it had to be allocated,
+ *                  to be freed by the caller, or NULL
+ *
+ * @return the payload, or NULL if out of memory
+ */
+static unsigned char *udp_send_data(buf_t *buf, unsigned char **copy)
+{
     struct md *send_md = NULL;
+    const struct hdr_common *hdr = (struct hdr_common *)buf->data;
+
+    *copy = NULL;
 
-    if ((buf->put_md != NULL) || buf->get_md != NULL) {
+    /* Only a request buf is on the initiator side; acks and replies
+     * are target bufs, which have no put_md or get_md. */
+    if (hdr->operation <= OP_SWAP &&
+        ((buf->put_md != NULL) || buf->get_md != NULL)) {
         if (buf->put_md != NULL) {
             if (buf->put_md->options) {
                 if (!!(buf->put_md->options & PTL_IOVEC)) {
@@ -415,282 +829,216 @@ void udp_send(ni_t *ni, buf_t *buf, struct sockaddr_in *dest)
         }
 
     }
-    //the buf has data and is not a small message or an ack
-    //TODO: Adjust this to the actual data size available in the buf_t immediate data
-    if (buf->rlength > sizeof(buf_t)) {
-        //this means that we have a message that is too large for an immediate send
-        //we must send it as a iovec upto the maximum UDP message size (64KB)
 
-        ptl_info("starting large message send \n");
-        if (send_md == NULL) {
-            ptl_info("data ptr`: %p length: %i \n",
-                     buf->transfer.udp.my_iovec.iov_base,
-                     (int)buf->transfer.udp.my_iovec.iov_len);
-            buf->transfer.udp.is_iovec = 0;
-        } else {
-            if (buf->transfer.udp.is_iovec == 1) {
-                ptl_info
-                    ("Flagged IO vec, data prt: %p data: %llu number of vecs: %i \n",
-                     buf->transfer.udp.data,
-                     *(long long unsigned int *)buf->transfer.udp.data,
+    if (send_md == NULL) {
+        ptl_info("data ptr`: %p length: %i \n",
+                 buf->transfer.udp.my_iovec.iov_base,
+                 (int)buf->transfer.udp.my_iovec.iov_len);
+        buf->transfer.udp.is_iovec = 0;
+    } else {
+        if (buf->transfer.udp.is_iovec == 1) {
+            ptl_info
+                ("Flagged IO vec, data prt: %p data: %llu number of vecs: %i \n",
+                 buf->transfer.udp.data,
+                 *(long long unsigned int *)buf->transfer.udp.data,
+                 (int)buf->transfer.udp.num_iovecs);
+        } else if (!!(send_md->options & PTL_IOVEC)) {
+            ptl_info("IO vec, data prt: %p number of vecs: %i \n",
+                     buf->transfer.udp.iovecs,
                      (int)buf->transfer.udp.num_iovecs);
-            } else if (!!(send_md->options & PTL_IOVEC)) {
-                ptl_info("IO vec, data prt: %p number of vecs: %i \n",
-                         buf->transfer.udp.iovecs,
-                         (int)buf->transfer.udp.num_iovecs);
-                //Now we just copy the iovecs into a sinlge buffer for sending as one large message
-                int i;
-                int cur_pntr = 0;
-                for (i = 0; i < buf->transfer.udp.num_iovecs; i++) {
-                    memcpy(buf->transfer.udp.my_iovec.iov_base + cur_pntr,
-                           buf->transfer.udp.iovecs[i].iov_base,
-                           buf->transfer.udp.iovecs[i].iov_len);
-                    cur_pntr += buf->transfer.udp.iovecs[i].iov_len;
-                }
-                buf->transfer.udp.is_iovec = 0;
-            } else {
-                buf->transfer.udp.is_iovec = 0;
+            //Now we just copy the iovecs into a sinlge buffer for sending as one large message
+            int i;
+            int cur_pntr = 0;
+            for (i = 0; i < buf->transfer.udp.num_iovecs; i++) {
+                memcpy(buf->transfer.udp.my_iovec.iov_base + cur_pntr,
+                       buf->transfer.udp.iovecs[i].iov_base,
+                       buf->transfer.udp.iovecs[i].iov_len);
+                cur_pntr += buf->transfer.udp.iovecs[i].iov_len;
             }
+            buf->transfer.udp.is_iovec = 0;
+        } else {
+            buf->transfer.udp.is_iovec = 0;
         }
+    }
 
-        int segments = 0;
-        struct msghdr buf_msg_hdr;
-        int bytes_remain;
-        int cur_ptr;
-        struct sockaddr_in msg_dest;
-        int current_iovec = 0;
-        msg_dest = *dest;
-        req_hdr_t *hdr = (req_hdr_t *) buf->internal_data;
-
-        segments = (buf->rlength / (MAX_UDP_MSG_SIZE - sizeof(buf_t))) + 1;
-
-        hdr->fragment_seq = 0;
+    if (buf->transfer.udp.is_iovec == 1 &&
+        buf->transfer.udp.num_iovecs != buf->rlength) {
+        //gather the iovecs, the datagrams are cut from a single buffer
+        unsigned char *data = calloc(1, buf->rlength);
+        ptl_size_t cur_pntr = 0;
+        int i;
 
-        int iovec_elements;
+        if (!data) {
+            WARN();
+            return NULL;
+        }
 
-        if (buf->transfer.udp.is_iovec == 0) {
-            iovec_elements = 2;
-            buf->transfer.udp.num_iovecs = iovec_elements;
-            buf->transfer.udp.is_iovec = 0;
-        } else {
-            iovec_elements = buf->transfer.udp.num_iovecs;
-            if (iovec_elements == buf->rlength) {
-                iovec_elements = 2;
-                buf->transfer.udp.num_iovecs = 2;
-                buf->transfer.udp.is_iovec = 0;
-            } else {
-                iovec_elements = buf->transfer.udp.num_iovecs++;
-            }
-            current_iovec = 0;
+        for (i = 0; i < buf->transfer.udp.num_iovecs &&
+             cur_pntr < buf->rlength; i++) {
+            ptl_size_t len = buf->transfer.udp.iovecs[i].iov_len;
 
+            if (len > buf->rlength - cur_pntr)
+                len = buf->rlength - cur_pntr;
+            memcpy(data + cur_pntr, buf->transfer.udp.iovecs[i].iov_base,
+                   len);
+            cur_pntr += len;
         }
-        //for a non-iovec based send
-        //we only have two iovec elements, the buf_t and the data
-        //for an io-vec based send we have 1 + the number of
-        //elements in the sending io-vec
-        struct iovec iov[iovec_elements + 1];
 
-        ptl_info("# of segments: %i \n", segments);
-        assert(segments > 0);
+        *copy = data;
+        return data;
+    }
 
-        buf->udp.src_addr = target;
-        ptl_info("set buf target to: %s:%d \n", inet_ntoa(target.sin_addr),
-                 ntohs(target.sin_port));
+    buf->transfer.udp.is_iovec = 0;
 
+    return buf->transfer.udp.my_iovec.iov_base;
+}
 
-        iov[0].iov_base = buf;
-        iov[0].iov_len = sizeof(buf_t);
+/**
+ * @brief Deliver a message to the process itself.
+ *
+ * The message is unpacked at once in a buf of the destination NI, as
+ * udp_unpack() would on reception, and queued for its progress
+ * thread. Any thread can send, so the queue is a lock free MPSC one.
+ *
+ * The payload of a large message is used in place when it comes from
+ * the MD of an initiator waiting for a response: the MD stays
+ * untouched until the target has copied the payload into the ME and
+ * answered. Otherwise it is copied once, since the sender may reuse
+ * its memory as soon as this returns.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf to send
+ * @param[in] dest the destination, which is the NI itself
+ *
+ * @return 0 on success, -1 on error
+ */
+static int udp_send_self(ni_t *ni, buf_t *buf, struct sockaddr_in *dest)
+{
+    ni_t *dest_ni = udp_dest_ni(ni, buf->data);
+    buf_t *self_buf;
 
-        if (buf->transfer.udp.is_iovec == 0) {
-            buf->transfer.udp.is_iovec = 0;
-            iov[1].iov_base = (void *)buf->transfer.udp.my_iovec.iov_base;
-            ptl_info("sending iov: %p \n",
-                     buf->transfer.udp.my_iovec.iov_base);
-            if (buf->rlength > MAX_UDP_MSG_SIZE - sizeof(buf_t)) {
-                iov[1].iov_len = MAX_UDP_MSG_SIZE - sizeof(buf_t);
-                bytes_remain =
-                    buf->rlength - (MAX_UDP_MSG_SIZE - sizeof(buf_t));
-                cur_ptr = (MAX_UDP_MSG_SIZE - sizeof(buf_t));
-            } else {
-                iov[1].iov_len = buf->rlength;
-                bytes_remain = 0;
-            }
-            //this is always equal to 2 for non-iovec sends
-            current_iovec = iovec_elements;
-        } else {
-            int i = 1;
-            bytes_remain = buf->rlength;
-            int current_size = 0;
+    if (!dest_ni) {
+        ptl_info("packet not meant for any NI, dropping \n");
+        return 0;
+    }
 
-            int total_size = 0;
-            for (i = 0; i < buf->transfer.udp.num_iovecs; i++) {
-                total_size += buf->transfer.udp.iovecs[i].iov_len;
-            }
+    if (buf_alloc(dest_ni, &self_buf)) {
+        WARN();
+        return -1;
+    }
 
-            bytes_remain = total_size;
-            ptl_info("total size of iovec is: %i \n", total_size);
-            i = 1;
-
-            if (total_size < (MAX_UDP_MSG_SIZE - sizeof(buf_t))) {
-                //just send all of the iovecs in the message data iovec
-                for (i = 1; i <= iovec_elements; i++) {
-                    iov[i].iov_base =
-                        buf->transfer.udp.iovecs[i - 1].iov_base;
-                    iov[i].iov_len = buf->transfer.udp.iovecs[i - 1].iov_len;
-                    current_iovec++;
+    assert(buf->length <= BUF_DATA_SIZE);
+    memcpy(self_buf->internal_data, buf->data, buf->length);
+    self_buf->length = buf->length;
+    self_buf->rlength = buf->rlength;
+    self_buf->transfer.udp.seq_num = buf->transfer.udp.seq_num;
+    self_buf->udp.src_addr = *dest;
+    INIT_LIST_HEAD(&self_buf->list);
+
+    switch (udp_msg_type(buf)) {
+        case UDP_MSG_CONN_REQ:
+            self_buf->type = BUF_UDP_CONN_REQ;
+            self_buf->transfer.udp.conn_msg = buf->transfer.udp.conn_msg;
+            break;
+
+        case UDP_MSG_CONN_REP:
+            self_buf->type = BUF_UDP_CONN_REP;
+            self_buf->transfer.udp.conn_msg = buf->transfer.udp.conn_msg;
+            self_buf->conn = (conn_t *)(uintptr_t)
+                buf->transfer.udp.conn_msg.req_cookie;
+            break;
+
+        default:
+            self_buf->type = BUF_UDP_RECEIVE;
+
+            if (buf->rlength > get_param(PTL_MAX_INLINE_DATA)) {
+                unsigned char *copy;
+                unsigned char *data = udp_send_data(buf, &copy);
+
+                if (data && !copy &&
+                    !(buf->event_mask & XI_RECEIVE_EXPECTED)) {
+                    copy = malloc(buf->rlength);
+                    if (copy)
+                        memcpy(copy, data, buf->rlength);
+                    data = copy;
                 }
-                current_iovec++;
-            } else {
-                while (bytes_remain && current_iovec <= iovec_elements) {
-
-                    if ((current_size +
-                         buf->transfer.udp.iovecs[current_iovec].iov_len) <
-                        (MAX_UDP_MSG_SIZE - sizeof(buf_t))) {
-                        iov[i].iov_base =
-                            buf->transfer.udp.iovecs[current_iovec].iov_base;
-                        ptl_info
-                            ("native IOvec send, sending iovec #%i of %i \n",
-                             current_iovec + 1,
-                             (int)buf->transfer.udp.num_iovecs);
-                        iov[i].iov_len =
-                            buf->transfer.udp.iovecs[current_iovec].iov_len;
-                        bytes_remain = bytes_remain - iov[i].iov_len;
-                        current_size = current_size + iov[i].iov_len;
-                        current_iovec++;
-                        i++;
-                    } else {
-                        //if there's any space left, send part of the next iovec.
-                        if (current_size < (MAX_UDP_MSG_SIZE - sizeof(buf_t))) {
-                            int space_left =
-                                (MAX_UDP_MSG_SIZE - sizeof(buf_t)) -
-                                current_size;
-                            iov[i].iov_base =
-                                buf->transfer.udp.
-                                iovecs[current_iovec].iov_base;
-                            iov[i].iov_len = space_left;
-                            current_size += iov[i].iov_len;
-                            buf->transfer.udp.
-                                iovecs[current_iovec].iov_base += space_left;
-                            buf->transfer.udp.iovecs[current_iovec].iov_len -=
-                                space_left;
-                            i++;
-                        }
-                        ptl_info
-                            ("current message data payload full, send additional segments \n");
-                        //send iovec datagram and then loop back to prepare another
-                        buf_msg_hdr.msg_name = (void *)dest;
-                        buf_msg_hdr.msg_namelen = sizeof(*dest);
-                        buf_msg_hdr.msg_iov = (struct iovec *)&iov;
-                        buf_msg_hdr.msg_iovlen = i;
-                        buf->transfer.udp.msg_num_iovecs = i;
-                        ptl_info
-                            ("message header iov num set to %i , size: %i, length: %i\n",
-                             (int)buf_msg_hdr.msg_iovlen, (int)buf->rlength,
-                             (int)current_size);
-                        buf_msg_hdr.msg_flags = 0;
-
-                        ptl_info("sending large message to: %s:%i \n",
-                                 inet_ntoa(((struct sockaddr_in *)
-                                            buf_msg_hdr.msg_name)->sin_addr),
-                                 ntohs(((struct sockaddr_in *)
-                                        buf_msg_hdr.msg_name)->sin_port));
-
-                        buf_msg_hdr.msg_control = NULL;
-                        buf_msg_hdr.msg_controllen = 0;
-                        ptl_info("send IOvec, segment #%i of #%i \n",
-                                 hdr->fragment_seq + 1, segments);
-                        err =
-                            ptl_sendmsg(ni->iface->udp.connect_s,
-                                        (void *)&buf_msg_hdr, 0, ni);
-                        hdr->fragment_seq++;
-                        current_size = 0;
-                        i = 1;
-                    }
 
+                if (!data) {
+                    buf_put(self_buf);
+                    return -1;
                 }
-                //current_iovec is used in the next section as the length of the to be sent message, so set it to i.
-                bytes_remain = 0;
-                current_iovec = i;
 
+                self_buf->transfer.udp.recv_data = copy;
+                self_buf->transfer.udp.fragment_count = 1;
+                self_buf->transfer.udp.data = data;
+                self_buf->transfer.udp.my_iovec.iov_base = data;
+                self_buf->transfer.udp.my_iovec.iov_len = buf->rlength;
+            } else {
+                self_buf->transfer.udp.data = self_buf->internal_data;
+                self_buf->transfer.udp.my_iovec.iov_len = self_buf->length;
             }
-        }
+            break;
+    }
 
+    self_buf->obj.next = NULL;
+    enqueue(NULL, &dest_ni->udp.self_queue, (obj_t *)self_buf);
 
-        ptl_info("iov lengths: %u %u \n", (int)iov[0].iov_len,
-                 (int)iov[1].iov_len);
-
-        buf_msg_hdr.msg_name = (void *)dest;
-        buf_msg_hdr.msg_namelen = sizeof(*dest);
-        buf_msg_hdr.msg_iov = (struct iovec *)&iov;
-        buf_msg_hdr.msg_iovlen = current_iovec;
-        buf->transfer.udp.msg_num_iovecs = current_iovec;
-        ptl_info("message header iov num set to %i \n",
-                 (int)buf_msg_hdr.msg_iovlen);
-        buf_msg_hdr.msg_flags = 0;
-
-        ptl_info("sending large message to: %s:%i \n",
-                 inet_ntoa(((struct sockaddr_in *)buf_msg_hdr.
-                            msg_name)->sin_addr),
-                 ntohs(((struct sockaddr_in *)buf_msg_hdr.
-                        msg_name)->sin_port));
-
-        buf_msg_hdr.msg_control = NULL;
-        buf_msg_hdr.msg_controllen = 0;
-
-        ptl_info("is message iovec? %i \n", buf->transfer.udp.is_iovec);
-        ptl_info("sending UDP message of size: %i, maximum: %i \n",
-                 (int)(buf_msg_hdr.msg_iov[0].iov_len +
-                       buf_msg_hdr.msg_iov[1].iov_len),
-                 (int)MAX_UDP_MSG_SIZE);
-        ptl_info("send segment #%i of #%i \n", hdr->fragment_seq + 1,
-                 segments);
-        err =
-            ptl_sendmsg(ni->iface->udp.connect_s, (void *)&buf_msg_hdr, 0,
-                        ni);
-        if (err == -1) {
-            ptl_error
-                ("error while sending multi segment message: %s\n remaining data: %i \n",
-                 strerror(errno), bytes_remain);
-        }
-        //this continues sending other datagrams for the non-iovec case
-        while (bytes_remain) {
-
-            hdr->fragment_seq++;
-            //keep sending multiple UDP segments until all the data is sent
-            if (bytes_remain >= (MAX_UDP_MSG_SIZE - sizeof(buf_t))) {
-                //more UDP segments to this message will follow
-                cur_ptr = MAX_UDP_MSG_SIZE - sizeof(buf_t);
-                bytes_remain -= (MAX_UDP_MSG_SIZE - sizeof(buf_t));
-            } else {
-                //last UDP segment in sequence
-                cur_ptr = bytes_remain;
-                bytes_remain -= bytes_remain;
-            }
-            iov[1].iov_base += cur_ptr;
-            iov[1].iov_len = cur_ptr;
-            buf_msg_hdr.msg_iov = (struct iovec *)&iov;
-            ptl_info("send segment #%i of #%i \n", hdr->fragment_seq + 1,
-                     segments);
-#ifdef __APPLE__
-            //We can overrun the send buffer without a wait here
-            //due to Mac's having very small network buffers
-            usleep(50);
-#endif
-            err =
-                ptl_sendmsg(ni->iface->udp.connect_s, (void *)&buf_msg_hdr, 0,
-                            ni);
-            if (err == -1) {
-                ptl_error
-                    ("error while sending multi segment message: %s\n remaining data: %i \n",
-                     strerror(errno), bytes_remain);
-            }
+    progress_thread_wakeup(dest_ni, 0);
+
+    return 0;
+}
+
+/**
+ * @brief send a buf to a pid using UDP socket.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf
+ * @param[in] dest the destination socket info
+ */
+void udp_send(ni_t *ni, buf_t *buf, struct sockaddr_in *dest)
+{
+    int err;
+
+    const struct sockaddr_in target = *dest;
+
+    if (udp_is_self(ni, dest)) {
+        //send to self, the message is handed over in memory
+        ptl_info("sending to self! \n");
+        err = udp_send_self(ni, buf, dest);
+    } else if (buf->rlength > get_param(PTL_MAX_INLINE_DATA)) {
+        //the buf has data and is not a small message or an ack
+        //this means that we have a message that is too large for an immediate send
+        //we must send it as a iovec upto the maximum UDP message size (64KB)
+        unsigned char *copy;
+        unsigned char *data;
+
+        ptl_info("starting large message send \n");
+
+        /* Keep the datagrams queued by this thread in order. */
+        if (ni->udp.send_batch && ni->udp.send_batch->active &&
+            pthread_equal(ni->udp.send_batch->owner, pthread_self()))
+            udp_send_batch_flush(ni, ni->udp.send_batch);
+
+        buf->udp.src_addr = target;
+        ptl_info("set buf target to: %s:%d \n", inet_ntoa(target.sin_addr),
+                 ntohs(target.sin_port));
+
+        data = udp_send_data(buf, &copy);
+        if (!data) {
+            WARN();
+            abort();
+            return;
         }
 
+        err = udp_send_large(ni, buf, dest, data);
+        free(copy);
 
-    } else if (buf->rlength <= sizeof(buf_t)) { // for immediate data, just send the actual buffer
-        err =
-            ptl_sendto(ni->iface->udp.connect_s, buf, sizeof(*buf), 0,
-                       (struct sockaddr *)dest, sizeof(*dest), ni);
+    } else if (udp_send_batch_add(ni, buf, dest)) {
+        /* Queued by the progress thread. */
+        return;
+    } else {
+        /* Immediate data; send the headers only. */
+        err = udp_send_hdr(ni, buf, dest);
     }
 
     if (err == -1) {
@@ -703,394 +1051,792 @@ void udp_send(ni_t *ni, buf_t *buf, struct sockaddr_in *dest)
         return;
     }
     ptl_info
-        ("UDP send completed successfully to: %s:%d from: %d size:%lu %i %i\n",
+        ("UDP send completed successfully to: %s:%d from: %d size:%i %i\n",
          inet_ntoa(target.sin_addr), ntohs(target.sin_port),
-         ntohs(ni->iface->udp.sin.sin_port), sizeof(*buf), (int)buf->rlength,
-         err);
+         ntohs(ni->iface->udp.sin.sin_port), (int)buf->rlength, err);
 
 }
 
 /**
- * @brief receive a buf using a UDP socket.
+ * @brief Add a datagram to a large message.
  *
- * @param[in] ni the network interface.
+ * The payload is gathered in the buf of the first datagram received,
+ * which waits on ni->udp_list until the message is complete.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf holding the datagram header
+ * @param[in] whdr the UDP header of the datagram
+ * @param[in] len the length of the payload in the datagram
+ * @param[in] payload the payload
+ *
+ * @return the buf of the message if complete, or NULL
  */
-buf_t *udp_receive(ni_t *ni)
+static buf_t *udp_recv_large(ni_t *ni, buf_t *buf,
+                             const struct udp_hdr *whdr, size_t len,
+                             const void *payload)
 {
+    const ptl_size_t rlength = buf->rlength;
+    const ptl_size_t frag_size = le32_to_cpu(whdr->frag_size);
+    const ptl_size_t offset = le32_to_cpu(whdr->frag_seq) * frag_size;
+    ptl_size_t num_frags;
+    buf_t *big_buf = NULL;
+    struct list_head *l;
+
+    if (frag_size == 0 || len > frag_size || offset + len > rlength) {
+        ptl_warn("dropping invalid UDP segment\n");
+        buf_put(buf);
+        return NULL;
+    }
 
-    int err;
-    struct sockaddr_in temp_sin;
-    socklen_t lensin = sizeof(temp_sin);
+    num_frags = (rlength + frag_size - 1) / frag_size;
 
-    buf_t *thebuf = (buf_t *)calloc(1, sizeof(buf_t));
+    if (num_frags > 1) {
+        //We only need to check the source address
+        list_for_each(l, &ni->udp_list) {
+            buf_t *b = list_entry(l, buf_t, list);
 
-    if (atomic_read(&ni->udp.self_recv) >= 1) {
-        ptl_info("got a message from self %p \n", ni->udp.self_recv_addr);
-        free(thebuf);
-        thebuf = (buf_t *)ni->udp.self_recv_addr;
-        return thebuf;
+            if (b->udp.src_addr.sin_port == buf->udp.src_addr.sin_port &&
+                b->udp.src_addr.sin_addr.s_addr ==
+                buf->udp.src_addr.sin_addr.s_addr) {
+                big_buf = b;
+                break;
+            }
+        }
     }
 
-
-    int flags;
-    flags = MSG_PEEK;
-    //REG: we need to perform a quick message peek here to determine if it is a short or long message
-    // this can be tweaked performance wise to only peek on the beginning of the buf for the length
-    // this peak is also used to determine if it is a multi-segment message
-    err =
-        ptl_recvfrom(ni->iface->udp.connect_s, thebuf, sizeof(*thebuf), flags,
-                     (struct sockaddr *)&temp_sin, &lensin, ni);
-
-    if (err == -1) {
-        if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
-            // OK, nothing ready to fetch
-            free(thebuf);
-            return NULL;
-        } else {
-            // Error, recvfrom returned unexpected error
-            free(thebuf);
+    if (big_buf) {
+        ptl_info("found a matching in-progress transfer \n");
+        buf_put(buf);
+    } else {
+        big_buf = buf;
+        big_buf->transfer.udp.recv_data = malloc(rlength);
+        if (!big_buf->transfer.udp.recv_data) {
             WARN();
-            ptl_warn("error when peeking at message: %s \n", strerror(errno));
+            buf_put(buf);
             return NULL;
         }
+
+        big_buf->transfer.udp.fragment_count = 0;
+        big_buf->transfer.udp.my_iovec.iov_len = 0;
+
+        if (num_frags > 1)
+            list_add_tail(&big_buf->list, &ni->udp_list);
     }
 
-    req_hdr_t *hdr;
+    memcpy(big_buf->transfer.udp.recv_data + offset, payload, len);
+    big_buf->transfer.udp.my_iovec.iov_len += len;
+    big_buf->transfer.udp.fragment_count++;
 
-    //first check to see if this is meant for this ni
-    if (thebuf->internal_data != NULL) {
-        hdr = (req_hdr_t *) thebuf->internal_data;
-    } else {
-        hdr = (req_hdr_t *) & thebuf->data;
+    ptl_info("have #%i segments of #%i size: %i\n",
+             (int)big_buf->transfer.udp.fragment_count, (int)num_frags,
+             (int)rlength);
+
+    if (big_buf->transfer.udp.fragment_count < num_frags)
+        return NULL;
+
+    if (num_frags > 1)
+        list_del_init(&big_buf->list);
+
+    big_buf->transfer.udp.data = big_buf->transfer.udp.recv_data;
+    big_buf->transfer.udp.my_iovec.iov_base = big_buf->transfer.udp.recv_data;
+    big_buf->transfer.udp.my_iovec.iov_len = rlength;
+
+    return big_buf;
+}
+
+/**
+ * @brief Find the NI a received datagram is meant for.
+ *
+ * All the NIs of an interface share the same socket, so a progress
+ * thread can receive datagrams for another NI.
+ *
+ * @param[in] ni the network interface that received the datagram
+ * @param[in] hdr the portals header of the datagram
+ *
+ * @return the destination NI, or NULL if there is none
+ */
+ni_t *udp_dest_ni(ni_t *ni, const void *hdr)
+{
+    const struct hdr_common *h1 = hdr;
+
+    if (h1->ni_type == ni->ni_type)
+        return ni;
+
+    if (h1->ni_type < MAX_NI_TYPES)
+        return ni->iface->ni[h1->ni_type];
+
+    return NULL;
+}
+
+/**
+ * @brief Copy a received datagram.
+ *
+ * The copy is not processed again by the reliability layer.
+ *
+ * @param[in] whdr the UDP header
+ * @param[in] len the length of the datagram
+ * @param[in] body the bytes following the UDP header
+ * @param[in] src_addr the source of the datagram
+ *
+ * @return the copy, or NULL if out of memory
+ */
+struct udp_fwd *udp_copy_datagram(const struct udp_hdr *whdr, size_t len,
+                                  const void *body,
+                                  const struct sockaddr_in *src_addr)
+{
+    struct udp_fwd *fwd;
+    struct udp_hdr *fhdr;
+    size_t n = len - sizeof(*whdr);
+
+    fwd = malloc(sizeof(*fwd) + len);
+    if (!fwd) {
+        WARN();
+        return NULL;
+    }
+
+    fwd->src_addr = *src_addr;
+    fwd->len = len;
+    fhdr = (struct udp_hdr *)fwd->data;
+    *fhdr = *whdr;
+    fhdr->flags &= ~(UDP_HDR_SEQ | UDP_HDR_ACK);
+    memcpy(fwd->data + sizeof(*whdr), body, n);
+
+    return fwd;
+}
+
+/**
+ * @brief Queue a copy of a datagram on the NI it is meant for.
+ *
+ * @param[in] ni the destination network interface
+ * @param[in] fwd the copy of the datagram
+ */
+void udp_queue_datagram(ni_t *ni, struct udp_fwd *fwd)
+{
+    PTL_FASTLOCK_LOCK(&ni->udp_lock);
+    list_add_tail(&fwd->list, &ni->udp_recv_list);
+    PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
+
+    progress_thread_wakeup(ni, 0);
+}
+
+/**
+ * @brief Queue a datagram for the NI it is meant for.
+ *
+ * @param[in] ni the network interface that received the datagram
+ * @param[in] buf the buf holding the portals header, released here
+ * @param[in] whdr the UDP header
+ * @param[in] len the length of the datagram
+ * @param[in] body the bytes following the UDP header
+ * @param[in] src_addr the source of the datagram
+ */
+static void udp_forward(ni_t *ni, buf_t *buf, const struct udp_hdr *whdr,
+                        size_t len, const void *body,
+                        const struct sockaddr_in *src_addr)
+{
+    ni_t *dest_ni = udp_dest_ni(ni, buf->internal_data);
+    struct udp_fwd *fwd;
+
+    if (!dest_ni || dest_ni == ni) {
+        //this datagram is not meant for any NI
+        ptl_info("packet not meant for this NI, dropping \n");
+        buf_put(buf);
+        return;
+    }
+
+    fwd = udp_copy_datagram(whdr, len, body, src_addr);
+    buf_put(buf);
+
+    if (fwd)
+        udp_queue_datagram(dest_ni, fwd);
+}
+
+/**
+ * @brief Turn a received datagram into a message.
+ *
+ * @param[in] ni the network interface
+ * @param[in] buf the buf holding the first BUF_DATA_SIZE bytes
+ *                following the UDP header
+ * @param[in] whdr the UDP header
+ * @param[in] len the length of the datagram
+ * @param[in] body the bytes following the UDP header, contiguous
+ * @param[in] src_addr the source of the datagram
+ *
+ * @return the buf of a complete message, or NULL
+ */
+static buf_t *udp_unpack(ni_t *ni, buf_t *buf, const struct udp_hdr *whdr,
+                         size_t len, const void *body,
+                         const struct sockaddr_in *src_addr)
+{
+    const req_hdr_t *hdr = (req_hdr_t *) buf->internal_data;
+    const size_t hdr_len = le16_to_cpu(whdr->hdr_len);
+    const int is_conn = (whdr->type == UDP_MSG_CONN_REQ ||
+                         whdr->type == UDP_MSG_CONN_REP);
+    size_t min_len = hdr_len;
+
+#if WITH_RUDP
+    /* Acknowledgements only matter to the reliability layer. */
+    if (len >= sizeof(*whdr) && whdr->type == UDP_MSG_ACK) {
+        rudp_recv(ni, NULL, whdr, len, NULL, src_addr);
+        buf_put(buf);
+        return NULL;
     }
+#endif
+
+    if (is_conn)
+        min_len += sizeof(struct udp_conn_msg);
+
+    if (len < sizeof(*whdr) + min_len || min_len > BUF_DATA_SIZE ||
+        hdr_len < sizeof(struct hdr_common)) {
+        ptl_warn("dropping invalid UDP datagram of size %i\n", (int)len);
+        buf_put(buf);
+        return NULL;
+    }
+
+#if WITH_RUDP
+    if ((whdr->flags & (UDP_HDR_SEQ | UDP_HDR_ACK)) &&
+        rudp_recv(ni, buf, whdr, len, body, src_addr) != RUDP_DELIVER) {
+        buf_put(buf);
+        return NULL;
+    }
+#endif
 
     ptl_info("QQQQQQQQQQQQQQ: ni_type of incoming message: %x and ni_type of %x\n",hdr->h1.ni_type,ni->ni_type);
 
-    if (((hdr->h1.physical == 0) && (!!(ni->options & PTL_NI_PHYSICAL))) ||
-        ((hdr->h1.physical == 1) && (!!(ni->options & PTL_NI_LOGICAL))) ||
-        (hdr->h1.ni_type != ni->ni_type)) {
-            //this datagram is not meant for us
-            ptl_info("packet not meant for this NI, dropping \n");
-            free(thebuf);
-            //this time interval is just to back off, it is completely arbitrary
-            //although 20us is a reasonable approximation of the time to 
-            //fetch a recv through the kernel UDP networking stack
-            usleep(20);
-            return NULL;
-        
+    if (hdr->h1.ni_type != ni->ni_type) {
+        udp_forward(ni, buf, whdr, len, body, src_addr);
+        return NULL;
     }
-    //we are going to be handling multiple messages, implemented through a recvmsg call
-    if (thebuf->rlength > sizeof(buf_t)) {
-        ptl_info("peek indicates large message of size: %i\n",
-                 (int)thebuf->rlength);
-
-        //first I/O vector will be the traditional portals buf
-        //second will be the data for the buf, so we need to set the data pointer appropriately once
-        //the data has arrived
-        struct msghdr buf_msg_hdr;
-        char *buf_data;
-        int buf_data_len;
-        struct iovec iov[thebuf->transfer.udp.num_iovecs + 1];
-
-        //this is the size of the largest UDP message that can be sent
-        //without fragmenting into multiple datagrams
-        int MAX_UDP_MSG_SIZE;
-        uint32_t max_len_size;
-        max_len_size = sizeof(int);
-        int current_message_size;
-
-        getsockopt(ni->iface->udp.connect_s, SOL_SOCKET, SO_RCVBUF,
-                   (int *)&MAX_UDP_MSG_SIZE, &max_len_size);
-        //65507 is the max IPv4 UDP message size (65536 - 8 byte UDP header - 20 byte IP header)
-        if (MAX_UDP_MSG_SIZE > 65507)
-            MAX_UDP_MSG_SIZE = 65507;
-        buf_data = calloc(1, (size_t) MAX_UDP_MSG_SIZE);
-
-        iov[0].iov_base = thebuf;
-        iov[0].iov_len = sizeof(buf_t);
-        iov[1].iov_base = buf_data;
-        //just combine all data into one big iov
-        iov[1].iov_len = thebuf->rlength;
-
-        buf_msg_hdr.msg_name = &temp_sin;
-        buf_msg_hdr.msg_namelen = sizeof(temp_sin);
-        buf_msg_hdr.msg_iov = (struct iovec *)&iov;
-
-        //we only ever have two iovecs, the header and the data
-        buf_msg_hdr.msg_iovlen = 2;
-
-        err = recvmsg(ni->iface->udp.connect_s, &buf_msg_hdr, 0);
-        if (err == -1) {
-            free(thebuf);
-            free(buf_data);
-            WARN();
-            ptl_warn("error receiving main buffer from socket: %d %s\n",
-                     ni->iface->udp.connect_s, strerror(errno));
-            abort();
-            return NULL;
 
+    buf->length = hdr_len;
+    buf->rlength = le64_to_cpu(whdr->rlength);
+    buf->transfer.udp.seq_num = le32_to_cpu(whdr->seq_num);
+    buf->udp.src_addr = *src_addr;
+    INIT_LIST_HEAD(&buf->list);
+
+    switch (whdr->type) {
+        case UDP_MSG_CONN_REQ:
+            ptl_info("received a UDP connection request \n");
+            buf->type = BUF_UDP_CONN_REQ;
+            break;
+        case UDP_MSG_CONN_REP:
+            ptl_info("recieved a UDP connection reply \n");
+            buf->type = BUF_UDP_CONN_REP;
+            break;
+        default:
+            ptl_info("received a UDP data packet \n");
+            buf->type = BUF_UDP_RECEIVE;
+            break;
+    }
+
+    if (is_conn) {
+        memcpy(&buf->transfer.udp.conn_msg, buf->internal_data + hdr_len,
+               sizeof(buf->transfer.udp.conn_msg));
+
+        /* The reply carries the cookie of the request. */
+        if (buf->type == BUF_UDP_CONN_REP)
+            buf->conn =
+                (conn_t *)(uintptr_t) buf->transfer.udp.conn_msg.req_cookie;
+
+        return buf;
+    }
+
+    if (whdr->flags & UDP_HDR_LARGE) {
+        ptl_info("received large message segment of size: %i\n",
+                 (int)buf->rlength);
+        return udp_recv_large(ni, buf, whdr, len - sizeof(*whdr) - hdr_len,
+                              (const unsigned char *)body + hdr_len);
+    }
+
+    buf->transfer.udp.data = buf->internal_data;
+    buf->transfer.udp.my_iovec.iov_len = buf->length;
+
+    return buf;
+}
+
+/**
+ * @brief Turn a datagram held in memory into a message.
+ *
+ * @param[in] ni the network interface
+ * @param[in] data the datagram, starting with its UDP header
+ * @param[in] len the length of the datagram
+ * @param[in] src_addr the source of the datagram
+ *
+ * @return the buf of a complete message, or NULL
+ */
+buf_t *udp_recv_datagram(ni_t *ni, const void *data, size_t len,
+                         const struct sockaddr_in *src_addr)
+{
+    const unsigned char *body = (const unsigned char *)data +
+        sizeof(struct udp_hdr);
+    struct udp_hdr whdr;
+    buf_t *buf;
+    size_t n;
+
+    if (len < sizeof(whdr)) {
+        ptl_warn("dropping invalid UDP datagram of size %i\n", (int)len);
+        return NULL;
+    }
+
+    if (buf_alloc(ni, &buf)) {
+        WARN();
+        return NULL;
+    }
+
+    memcpy(&whdr, data, sizeof(whdr));
+    n = len - sizeof(whdr);
+    memcpy(buf->internal_data, body, n < BUF_DATA_SIZE ? n : BUF_DATA_SIZE);
+
+    return udp_unpack(ni, buf, &whdr, len, body, src_addr);
+}
+
+/* Staging memory of a receive slot: room to move the start of the
+ * body in front of the rest, then the rest of the datagram. */
+#define UDP_RECV_SLOT	(BUF_DATA_SIZE + UDP_MAX_DATAGRAM)
+
+/* Room for the UDP_GRO control message of a slot. */
+union udp_recv_ctrl {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+};
+
+/**
+ * Datagrams received by a single recvmmsg call. Each slot holds a buf
+ * from the NI pool; the slots whose buf was consumed are refilled
+ * before the next call, the others are reused as they are. With
+ * UDP_GRO, a slot can hold several datagrams coalesced by the kernel.
+ */
+struct udp_recv_batch {
+    unsigned int size;          /* slots per recvmmsg */
+    unsigned int count;         /* slots filled by the last call */
+    unsigned int next;          /* next slot to unpack */
+    size_t seg_off;             /* offset of the next datagram in it */
+    buf_t **bufs;
+    struct udp_hdr *hdrs;
+    struct sockaddr_in *addrs;
+    struct iovec (*iovs)[3];
+    struct mmsghdr *msgs;
+    union udp_recv_ctrl *ctrls;
+    unsigned char *payload;     /* size * UDP_RECV_SLOT bytes */
+};
+
+/**
+ * @brief Allocate the send batch of the progress thread.
+ *
+ * @param[in] ni the network interface
+ * @param[in] size the number of datagrams in the batch
+ *
+ * @return status
+ */
+static int udp_init_send_batch(ni_t *ni, unsigned int size)
+{
+    struct udp_send_batch *batch;
+
+    batch = calloc(1, sizeof(*batch));
+    if (!batch)
+        return PTL_NO_SPACE;
+
+    batch->size = size;
+    batch->addrs = calloc(size, sizeof(*batch->addrs));
+    batch->hdrs = calloc(size, sizeof(*batch->hdrs));
+    batch->iovs = calloc(size, sizeof(*batch->iovs));
+    batch->msgs = calloc(size, sizeof(*batch->msgs));
+    batch->data = malloc((size_t)size * UDP_SEND_SLOT);
+
+    ni->udp.send_batch = batch;
+
+    if (!batch->addrs || !batch->hdrs || !batch->iovs || !batch->msgs ||
+        !batch->data)
+        return PTL_NO_SPACE;
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Allocate the receive resources of an NI, and the batch of the
+ * datagrams sent by its progress thread.
+ *
+ * Start the io_uring engine if PTL_UDP_ENGINE selects it, or fall
+ * back to a recvmmsg batch.
+ *
+ * @param[in] ni the network interface, whose socket is open
+ *
+ * @return status
+ */
+int udp_init_recv(ni_t *ni)
+{
+    struct udp_recv_batch *batch;
+    unsigned int size = get_param(PTL_UDP_RECV_BATCH);
+
+    if (udp_init_send_batch(ni, size) != PTL_OK) {
+        udp_fini_recv(ni);
+        return PTL_NO_SPACE;
+    }
+
+    if (get_param(PTL_UDP_ENGINE) == UDP_ENGINE_URING) {
+        if (udp_uring_init(ni) == PTL_OK)
+            return PTL_OK;
+
+        ptl_warn("io_uring engine not available, using sockets\n");
+    }
+
+    batch = calloc(1, sizeof(*batch));
+    if (!batch)
+        return PTL_NO_SPACE;
+
+    ni->udp.recv_batch = batch;
+
+    batch->size = size;
+    batch->bufs = calloc(size, sizeof(*batch->bufs));
+    batch->hdrs = calloc(size, sizeof(*batch->hdrs));
+    batch->addrs = calloc(size, sizeof(*batch->addrs));
+    batch->iovs = calloc(size, sizeof(*batch->iovs));
+    batch->msgs = calloc(size, sizeof(*batch->msgs));
+    batch->ctrls = calloc(size, sizeof(*batch->ctrls));
+    batch->payload = malloc((size_t)size * UDP_RECV_SLOT);
+
+    if (!batch->bufs || !batch->hdrs || !batch->addrs || !batch->iovs ||
+        !batch->msgs || !batch->ctrls || !batch->payload) {
+        udp_fini_recv(ni);
+        return PTL_NO_SPACE;
+    }
+
+    return PTL_OK;
+}
+
+/**
+ * @brief Release the receive resources of an NI.
+ *
+ * @param[in] ni the network interface
+ */
+void udp_fini_recv(ni_t *ni)
+{
+    struct udp_recv_batch *batch = ni->udp.recv_batch;
+    struct udp_send_batch *send_batch = ni->udp.send_batch;
+    unsigned int i;
+    buf_t *buf;
+
+    udp_uring_fini(ni);
+
+    if (send_batch) {
+        free(send_batch->addrs);
+        free(send_batch->hdrs);
+        free(send_batch->iovs);
+        free(send_batch->msgs);
+        free(send_batch->data);
+        free(send_batch);
+
+        ni->udp.send_batch = NULL;
+    }
+
+    while ((buf = (buf_t *)dequeue(NULL, &ni->udp.self_queue)))
+        buf_put(buf);
+
+    while (!list_empty(&ni->udp_recv_list)) {
+        struct udp_fwd *fwd =
+            list_first_entry(&ni->udp_recv_list, struct udp_fwd, list);
+
+        list_del(&fwd->list);
+        free(fwd);
+    }
+
+    if (!batch)
+        return;
+
+    if (batch->bufs) {
+        for (i = 0; i < batch->size; i++) {
+            if (batch->bufs[i])
+                buf_put(batch->bufs[i]);
         }
+    }
 
-        current_message_size = err - sizeof(buf_t);
-        ptl_info("received message of size: %i %i %i\n", err,
-                 (int)iov[0].iov_len, (int)iov[1].iov_len);
+    free(batch->bufs);
+    free(batch->hdrs);
+    free(batch->addrs);
+    free(batch->iovs);
+    free(batch->msgs);
+    free(batch->ctrls);
+    free(batch->payload);
+    free(batch);
 
-        //process received IO vectors
-        thebuf = (buf_t *)buf_msg_hdr.msg_iov[0].iov_base;
-        thebuf->transfer.udp.num_iovecs = buf_msg_hdr.msg_iovlen;
+    ni->udp.recv_batch = NULL;
+}
 
-        struct md *recv_md = NULL;
+/**
+ * @brief Receive a batch of datagrams.
+ *
+ * Refill the empty slots with bufs from the pool and read as many
+ * datagrams as possible with a single system call.
+ *
+ * @param[in] ni the network interface
+ * @param[in] batch the receive batch of the NI
+ *
+ * @return the number of datagrams received, 0 if there was none
+ */
+static int udp_recv_batch(ni_t *ni, struct udp_recv_batch *batch)
+{
+    unsigned int n;
+    int ret;
 
-        //check if this is an iovec
-        //if it is, copy all of the iovecs over
-        if (thebuf->transfer.udp.num_iovecs > 2) {
-            int cur_iov_copy_loc = 0;
-            int i;
-            for (i = 1; i < thebuf->transfer.udp.num_iovecs; i++) { //msg_num_iovecs
-                ptl_info("copy iovec #%i of %i\n", i,
-                         (int)thebuf->transfer.udp.num_iovecs);
-                memcpy((buf_data + cur_iov_copy_loc),
-                       buf_msg_hdr.msg_iov[i].iov_base,
-                       buf_msg_hdr.msg_iov[i].iov_len);
-                cur_iov_copy_loc =
-                    cur_iov_copy_loc + buf_msg_hdr.msg_iov[i].iov_len;
-            }
-            thebuf->transfer.udp.my_iovec.iov_base = buf_data;
-            thebuf->transfer.udp.my_iovec.iov_len = thebuf->rlength;
-        } else {
-            //if not, copy just the data in the 2 element iovec
-            ptl_info("not an iovec \n");
-            memcpy(buf_data, buf_msg_hdr.msg_iov[1].iov_base,
-                   (size_t) buf_msg_hdr.msg_iovlen);
-            buf_data_len = buf_msg_hdr.msg_iovlen;
-            thebuf->transfer.udp.my_iovec.iov_base =
-                buf_msg_hdr.msg_iov[1].iov_base;
-            thebuf->transfer.udp.my_iovec.iov_len =
-                buf_msg_hdr.msg_iov[1].iov_len;
+    for (n = 0; n < batch->size; n++) {
+        struct iovec *iov = batch->iovs[n];
+        struct msghdr *msg = &batch->msgs[n].msg_hdr;
+
+        if (!batch->bufs[n] && buf_alloc(ni, &batch->bufs[n])) {
+            batch->bufs[n] = NULL;
+            break;
         }
 
-        thebuf->transfer.udp.data = (unsigned char *)buf_data;
-
-        temp_sin = *(struct sockaddr_in *)buf_msg_hdr.msg_name;
-        lensin = buf_msg_hdr.msg_namelen;
-
-        int MAX_UDP_RECV_SIZE = 1488;
-        uint32_t max_recv_size;
-        max_recv_size = sizeof(int);
-        getsockopt(ni->iface->udp.connect_s, SOL_SOCKET, SO_SNDBUF,
-                   (int *)&MAX_UDP_RECV_SIZE, &max_recv_size);
-        if (MAX_UDP_RECV_SIZE > 65507)
-            MAX_UDP_RECV_SIZE = 65507;
-
-        if ((thebuf->rlength + sizeof(buf_t)) > MAX_UDP_RECV_SIZE) {
-            //this message is large enough to span multiple UDP messages, so we need to fetch them all
-            //first message will be the portals buf, and data upto 64K
-            //subsequent messages need to be added to the received data buffer as extra data
-            //there is no finalization footer etc.
-            //THIS ASSUMES UDP IS RELIABLE AND IN-ORDER, which it is not unless a reliability layer is present.
-            //this also assumes that there is not data incoming from multiple sources on this socket/port           
-            ptl_warn
-                ("Message size exceeds that of a single datagram, this operational mode is not recommended \n");
-
-            ptl_info("ni->iface is %p \n", ni->iface);
-
-            buf_t *big_buf;
-
-            //create or fetch a large message buffer from a linked list
-            int found_one = 0;
-            struct list_head *l, *t;
-
-            list_for_each_safe(l, t, &ni->udp_list) {
-                big_buf = list_entry(l, buf_t, list);
-                ptl_info("list buf @%p \n", big_buf);
-                ptl_info
-                    ("compare in progress list item to present transfer %p %i %s:%i\n",
-                     ni->iface, ni->iface->id.phys.pid,
-                     inet_ntoa(big_buf->udp.src_addr.sin_addr),
-                     ntohs(big_buf->udp.src_addr.sin_port));
-                //We only need to check the pid
-                if (ntohs(thebuf->udp.src_addr.sin_port) ==
-                    ntohs(big_buf->udp.src_addr.sin_port)) {
-                    //ptl_info("found match for system, checking logical NI \n");
-                    //found a matching buf, check to see if addressing mode is correct
-                    if ((((!!(ni->options & PTL_NI_LOGICAL)) &&
-                         (hdr->h1.physical == 0)) ||
-                        ((!!(ni->options & PTL_NI_PHYSICAL)) &&
-                         (hdr->h1.physical == 1))) &&
-                        (hdr->h1.ni_type == ni->ni_type)) {
-                            //this is an exact match
-                            found_one = 1;
-                            ptl_info("found a matching in-progress transfer \n");
-                            break;
-                            
-                    }
-                }
+        iov[0].iov_base = &batch->hdrs[n];
+        iov[0].iov_len = sizeof(batch->hdrs[n]);
+        iov[1].iov_base = batch->bufs[n]->internal_data;
+        iov[1].iov_len = BUF_DATA_SIZE;
+        iov[2].iov_base = batch->payload + (size_t)n * UDP_RECV_SLOT +
+            BUF_DATA_SIZE;
+        iov[2].iov_len = UDP_MAX_DATAGRAM;
+
+        memset(msg, 0, sizeof(*msg));
+        msg->msg_name = &batch->addrs[n];
+        msg->msg_namelen = sizeof(batch->addrs[n]);
+        msg->msg_iov = iov;
+        msg->msg_iovlen = 3;
+#ifdef UDP_GRO
+        msg->msg_control = &batch->ctrls[n];
+        msg->msg_controllen = sizeof(batch->ctrls[n]);
+#endif
+    }
 
-            }
-            //if a buffer didn't already exist, this is a new incoming
-            //large message, so allocate one
-            if (found_one != 1) {
-                //size is 16MB because we have 8 bits available for number of 64K packets
-                //this is completely arbitrary, and could be adjusted up or down
-                ptl_info
-                    ("not an oustanding transfer, allocate a new buffer \n");
-                //copy the buf over to the first iovec
-                big_buf = calloc(1, sizeof(buf_t));
-                memcpy(big_buf, buf_msg_hdr.msg_iov[0].iov_base,
-                       sizeof(buf_t));
-                //set the 16MB buffer
-                big_buf->transfer.udp.data = calloc(1, 65536 << 8);
-                ptl_info
-                    ("memory region starting at %p allocated for transfer reception \n",
-                     big_buf->transfer.udp.data);
-                ptl_info("destination pid is: %s:%d \n",
-                         inet_ntoa(big_buf->udp.src_addr.sin_addr),
-                         ntohs(big_buf->udp.src_addr.sin_port));
-                big_buf->transfer.udp.my_iovec.iov_len = 0;
-                ptl_info("adding buffer @%p to the list \n", big_buf);
-                //add the buffer to the udp outstanding transfer list
-                INIT_LIST_HEAD(&big_buf->list);
-                list_add_tail(&big_buf->list, &ni->udp_list);
-                big_buf->transfer.udp.fragment_count = 0;
-                big_buf->transfer.udp.cur_iov_copy_loc = 0;
-            }
+    if (n == 0) {
+        WARN();
+        return 0;
+    }
 
-            ptl_info("copy data to big receive buffer for segment #%i\n",
-                     hdr->fragment_seq);
-            //Copy the incoming data to the big buffer's data region
-            //In the correct section for its sequence number
-            //so we don't have to worry about out of order segments, this is handled here
-            ptl_info("copying to location: %p \n",
-                     big_buf->transfer.udp.data +
-                     ((MAX_UDP_RECV_SIZE -
-                       sizeof(buf_t)) * hdr->fragment_seq));
-
-            if (big_buf->transfer.udp.is_iovec) {
-                if ((big_buf->put_md != NULL) || big_buf->get_md != NULL) {
-                    if (big_buf->put_md != NULL) {
-                        if (big_buf->put_md->options) {
-                            if (big_buf->put_md->options & PTL_IOVEC) {
-                                ptl_warn("IO vec put transfer %i \n",
-                                         (int)big_buf->rlength);
-                                recv_md = big_buf->put_md;
-                            }
-                        }
-                    }
-                } else {
-                    if (big_buf->get_md->options) {
-                        if (big_buf->get_md->options & PTL_IOVEC) {
-                            ptl_info("IO vec get transfer %i \n",
-                                     (int)big_buf->rlength);
-                            recv_md = big_buf->get_md;
-                        }
-                    }
-                }
-            } else {
-                ptl_info("Not a iovec recv \n");
-                recv_md = NULL;
-            }
+#ifdef HAVE_RECVMMSG
+    ret = recvmmsg(ni->iface->udp.connect_s, batch->msgs, n, MSG_DONTWAIT,
+                   NULL);
+#else
+    for (ret = 0; ret < n; ret++) {
+        ssize_t len = recvmsg(ni->iface->udp.connect_s,
+                              &batch->msgs[ret].msg_hdr, MSG_DONTWAIT);
 
-            memcpy((big_buf->transfer.udp.data +
-                    (((MAX_UDP_RECV_SIZE -
-                       sizeof(buf_t)) * hdr->fragment_seq))),
-                   buf_msg_hdr.msg_iov[1].iov_base, current_message_size);
-
-            ptl_info("segment size was data:%i max data size:%lu \n",
-                     current_message_size, MAX_UDP_RECV_SIZE - sizeof(buf_t));
-            big_buf->transfer.udp.my_iovec.iov_len += current_message_size;
-
-            //increment the fragment counter and check to see if it equals the total
-            big_buf->transfer.udp.fragment_count++;
-            ptl_info("have #%i segments of #%i size: %i\n",
-                     (int)big_buf->transfer.udp.fragment_count,
-                     (int)((thebuf->rlength /
-                            (MAX_UDP_RECV_SIZE - sizeof(buf_t))) + 1),
-                     (int)thebuf->rlength);
-            //check to see if the transfer is complete
-            if (big_buf->transfer.udp.fragment_count ==
-                ((thebuf->rlength / (MAX_UDP_RECV_SIZE - sizeof(buf_t))) +
-                 1)) {
-                //we're done the transfer
-                ptl_info
-                    ("transfer complete length: %i, removing buffer from active transfers list \n",
-                     (int)big_buf->transfer.udp.my_iovec.iov_len);
-
-                ptl_info("data at end (%p) is: %llu \n",
-                         (big_buf->transfer.udp.data + big_buf->rlength),
-                         *(long long unsigned int *)(big_buf->transfer.
-                                                     udp.data +
-                                                     (current_message_size)));
-
-                if (!(list_empty(&ni->udp_list))) {
-                    list_del(l);
-                }
-                big_buf->transfer.udp.my_iovec.iov_base =
-                    big_buf->transfer.udp.data;
-                big_buf->transfer.udp.my_iovec.iov_len = thebuf->rlength;
-                thebuf = big_buf;
-                thebuf->recv_buf = big_buf;
-            }
-            //if it does not, return nothing as we are still in progress
-            else {
-                ptl_info
-                    ("transfer not complete, wait for more incoming datagrams \n");
-                return NULL;
-            }
+        if (len == -1)
+            break;
+
+        batch->msgs[ret].msg_len = len;
+    }
+
+    if (ret == 0)
+        ret = -1;
+#endif
+
+    if (ret == -1) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            WARN();
+            ptl_warn("error receiving from socket: %d %s\n",
+                     ni->iface->udp.connect_s, strerror(errno));
         }
-    } else {
-        //this is a small transfer with immediate data, fetch it.
-        err =
-            ptl_recvfrom(ni->iface->udp.connect_s, thebuf, sizeof(*thebuf), 0,
-                         (struct sockaddr *)&temp_sin, &lensin, ni);
-        if (err == -1) {
-            if (errno != EAGAIN) {
-                free(thebuf);
-                WARN();
-                ptl_warn("error receiving main buffer from socket: %d %s\n",
-                         ni->iface->udp.connect_s, strerror(errno));
-                return NULL;
+        return 0;
+    }
 
-            } else {
-                //Nothing to fetch
-                free(thebuf);
-                return NULL;
-            }
+    return ret;
+}
+
+/**
+ * @brief Get the size of the datagrams coalesced in a slot.
+ *
+ * @param[in] msg the message header of the slot
+ *
+ * @return the size of each datagram but the last, or 0 if the kernel
+ *         did not coalesce datagrams
+ */
+static size_t udp_gro_size(struct msghdr *msg)
+{
+#ifdef UDP_GRO
+    struct cmsghdr *cmsg;
+    int size;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+            return size;
         }
-        thebuf->transfer.udp.data = (unsigned char*)&thebuf->internal_data;
-        thebuf->transfer.udp.my_iovec.iov_len = thebuf->length;
+    }
+#endif
+
+    return 0;
+}
+
+/**
+ * @brief Unpack the next datagram of a batch.
+ *
+ * The start of the body of a large datagram, received in the buf, is
+ * copied in front of the rest so that the body is contiguous. The
+ * datagrams coalesced in a slot are unpacked one at a time, the first
+ * one in the buf of the slot and the others in new bufs.
+ *
+ * @param[in] ni the network interface
+ * @param[in] batch the receive batch of the NI
+ *
+ * @return the buf of a complete message, or NULL
+ */
+static buf_t *udp_recv_next(ni_t *ni, struct udp_recv_batch *batch)
+{
+    const unsigned int i = batch->next;
+    const size_t total = batch->msgs[i].msg_len;
+    unsigned char *slot = batch->payload + (size_t)i * UDP_RECV_SLOT;
+    struct udp_hdr *whdr = &batch->hdrs[i];
+    size_t seg = udp_gro_size(&batch->msgs[i].msg_hdr);
+    size_t off = batch->seg_off;
+    size_t len;
+    void *body;
+    buf_t *buf;
+
+    if (seg == 0 || seg >= total)
+        seg = total;
+
+    /* Move on to the next slot once this datagram is unpacked. */
+    batch->seg_off = off + seg;
+    if (batch->seg_off >= total) {
+        batch->seg_off = 0;
+        batch->next++;
     }
 
-    if (&thebuf->transfer.udp.conn_msg != NULL) {
-        ptl_info("process received message type \n");
-        struct udp_conn_msg *msg = &thebuf->transfer.udp.conn_msg;
+    if (off == 0) {
+        buf = batch->bufs[i];
+        batch->bufs[i] = NULL;
+        len = seg;
+        body = buf->internal_data;
+
+        if (total > sizeof(*whdr) + BUF_DATA_SIZE ||
+            (seg < total && seg >= sizeof(*whdr))) {
+            len = total - sizeof(*whdr);
+            memcpy(slot, buf->internal_data,
+                   len < BUF_DATA_SIZE ? len : BUF_DATA_SIZE);
+            len = seg;
+            body = slot;
+        }
+    } else {
+        /* A datagram coalesced after the first one. */
+        len = total - off;
+        if (len > seg)
+            len = seg;
+
+        if (seg < sizeof(*whdr) || len < sizeof(*whdr)) {
+            ptl_warn("dropping invalid UDP datagram of size %i\n",
+                     (int)len);
+            return NULL;
+        }
 
-        if (msg->msg_type == le16_to_cpu(UDP_CONN_MSG_REQ)) {
-            ptl_info("received a UDP connection request \n");
-            thebuf->type = BUF_UDP_CONN_REQ;
-        } else if (msg->msg_type == le16_to_cpu(UDP_CONN_MSG_REP)) {
-            ptl_info("recieved a UDP connection reply \n");
-            thebuf->type = BUF_UDP_CONN_REP;
-        } else {
-            ptl_info("received a UDP data packet \n");
-            thebuf->type = BUF_UDP_RECEIVE;
+        if (buf_alloc(ni, &buf)) {
+            WARN();
+            return NULL;
         }
 
+        body = slot + off;
+        memcpy(whdr, slot + off - sizeof(*whdr), sizeof(*whdr));
+        memcpy(buf->internal_data, body,
+               len - sizeof(*whdr) < BUF_DATA_SIZE ?
+               len - sizeof(*whdr) : BUF_DATA_SIZE);
     }
 
-    if (thebuf->type == BUF_UDP_RECEIVE) {
-        thebuf->obj.obj_ni = ni;
-        thebuf->conn =
-            get_conn(ni, (ptl_process_t)le32_to_cpu(hdr->h1.src_rank));
-        //atomic_inc(&thebuf->conn->udp.recv_seq);
+    ptl_info("received data from %s:%i size: %i\n",
+             inet_ntoa(batch->addrs[i].sin_addr),
+             ntohs(batch->addrs[i].sin_port), (int)len);
+
+    return udp_unpack(ni, buf, whdr, len, body, &batch->addrs[i]);
+}
+
+/**
+ * @brief Tell whether datagrams already received are waiting to be
+ * handed out by udp_receive().
+ *
+ * @param[in] ni the network interface
+ *
+ * @return 1 if some are waiting, 0 otherwise
+ */
+int udp_recv_pending(ni_t *ni)
+{
+    struct udp_recv_batch *batch = ni->udp.recv_batch;
+
+    if (ni->udp.uring && udp_uring_pending(ni))
+        return 1;
+
+    return (batch && batch->next < batch->count) ||
+        !list_empty(&ni->udp_recv_list) ||
+        !queue_is_empty(&ni->udp.self_queue);
+}
+
+/**
+ * @brief Get the file descriptor a progress thread polls to wait for
+ * datagrams.
+ *
+ * @param[in] ni the network interface
+ *
+ * @return the file descriptor
+ */
+int udp_wait_fd(ni_t *ni)
+{
+    if (ni->udp.uring)
+        return udp_uring_fd(ni);
+
+    return ni->iface->udp.connect_s;
+}
+
+/**
+ * @brief receive a buf using a UDP socket.
+ *
+ * Datagrams are read in batches of PTL_UDP_RECV_BATCH, directly in
+ * bufs from the NI pool, or by the io_uring engine, and handed out one
+ * at a time.
+ *
+ * @param[in] ni the network interface.
+ *
+ * @return the buf of a complete message, or NULL
+ */
+buf_t *udp_receive(ni_t *ni)
+{
+    struct udp_recv_batch *batch = ni->udp.recv_batch;
+    buf_t *buf;
+
+    buf = (buf_t *)dequeue(NULL, &ni->udp.self_queue);
+    if (buf) {
+        ptl_info("got a message from self %p \n", buf);
+        return buf;
     }
 
-    ptl_info
-        ("received data from %s:%i type:%i data size: %lu message size:%u %i \n",
-         inet_ntoa(temp_sin.sin_addr), ntohs(temp_sin.sin_port), thebuf->type,
-         sizeof(*(thebuf->data)), (int)thebuf->rlength, err);
+    if (!list_empty(&ni->udp_recv_list)) {
+        struct udp_fwd *fwd = NULL;
 
-    thebuf->udp.src_addr = temp_sin;
-    return (buf_t *)thebuf;
+        PTL_FASTLOCK_LOCK(&ni->udp_lock);
+        if (!list_empty(&ni->udp_recv_list)) {
+            fwd = list_first_entry(&ni->udp_recv_list, struct udp_fwd, list);
+            list_del(&fwd->list);
+        }
+        PTL_FASTLOCK_UNLOCK(&ni->udp_lock);
+
+        if (fwd) {
+            buf = udp_recv_datagram(ni, fwd->data, fwd->len, &fwd->src_addr);
+            free(fwd);
+
+            return buf;
+        }
+    }
+
+    if (ni->udp.uring)
+        return udp_uring_receive(ni);
+
+    while (1) {
+        while (batch->next < batch->count) {
+            buf = udp_recv_next(ni, batch);
+            if (buf)
+                return buf;
+        }
+
+        batch->next = 0;
+        batch->seg_off = 0;
+        batch->count = udp_recv_batch(ni, batch);
+        if (batch->count == 0)
+            return NULL;
+    }
 }
 
 /* change the state of conn; we are now connected (UO & REB) */
@@ -1176,7 +1922,7 @@ static int init_connect_udp(ni_t *ni, conn_t *conn)
     hdr->h1.ni_type = ni->ni_type;
 
     conn_buf->transfer.udp.conn_msg = msg;
-    conn_buf->length = (sizeof(buf_t));
+    conn_buf->length = sizeof(req_hdr_t);
     conn_buf->conn = conn;
     conn_buf->udp.dest_addr = &conn->sin;
 
@@ -1189,31 +1935,25 @@ static int init_connect_udp(ni_t *ni, conn_t *conn)
     ptl_info("addr: %s : %i \n", inet_ntoa(conn->sin.sin_addr),
              ntohs(conn_buf->udp.dest_addr->sin_port));
 
-    if (conn_buf->udp.dest_addr->sin_port == ntohs(ni->id.phys.pid)) {
-        if (temp_sin.sin_addr.s_addr == conn->sin.sin_addr.s_addr) {
-            //we are sending to ourselves, so we don't need a connection
-            ptl_info("sending to self\n");
-            conn_buf->udp.src_addr = conn->sin;
-
-            ni->udp.self_recv_addr = conn_buf;
-            ni->udp.self_recv_len = conn_buf->length;
-            //since setmap does not have to be run, make sure its valid
-            ni->udp.dest_addr = conn_buf->udp.dest_addr;
-            ni->udp.map_done = 1;
-            //now let the progress thread know that we've sent something to ourselves
-            atomic_set(&ni->udp.self_recv, 1);
-            return PTL_OK;
+    if (udp_is_self(ni, &conn->sin)) {
+        //we are sending to ourselves, the request doesn't use the socket
+        ptl_info("sending to self\n");
+
+        //since setmap does not have to be run, make sure its valid
+        ni->udp.dest_addr = conn_buf->udp.dest_addr;
+        ni->udp.map_done = 1;
+
+        ret = udp_send_self(ni, conn_buf, &conn->sin);
+        free(conn_buf);
+        if (ret == -1) {
+            WARN();
+            return PTL_FAIL;
         }
+        return PTL_OK;
     }
 
-    ptl_info("to send msg size: %lu in UDP message size: %lu\n", sizeof(msg),
-             sizeof(buf_t));
-
     /* Send the request to the listening socket on the remote node. */
-    /* This does not send just the msg, but a buf to maintain compatibility with the progression thread */
-    ret =
-        ptl_sendto(ni->iface->udp.connect_s, conn_buf, conn_buf->length, 0,
-                   (struct sockaddr *)&conn->sin, sizeof(conn->sin), ni);
+    ret = udp_send_hdr(ni, conn_buf, &conn->sin);
     if (ret == -1) {
         WARN();
         return PTL_FAIL;
@@ -1234,6 +1974,7 @@ struct transport transport_udp = {
     .buf_alloc = buf_alloc,
     .init_connect = init_connect_udp,
     .send_message = send_message_udp,
+    .send_bundle = send_bundle_udp,
     .set_send_flags = udp_set_send_flags,
     .init_prepare_transfer = init_prepare_transfer_udp,
     .post_tgt_dma = do_udp_transfer,
@@ -0,0 +1,751 @@
+/**
+ * @file ptl_udp_uring.c
+ *
+ * @brief io_uring engine of the UDP transport.
+ *
+ * A multishot recvmsg keeps receiving datagrams in a ring of buffers
+ * provided to the kernel, and sends are queued and submitted by
+ * batches. All the completions are handled by the progress thread, in
+ * udp_uring_receive().
+ *
+ * The socket is shared with the rest of the transport and stays non
+ * blocking. The kernel normally waits for it to be ready; the
+ * requests it completes with -EAGAIN anyway are queued again, to be
+ * issued once the socket is ready.
+ */
+
+#include "ptl_loc.h"
+#include "ptl_rudp.h"
+#include "ptl_udp_uring.h"
+
+#include <liburing.h>
+
+/* Submission queue entries. */
+#define UDP_URING_ENTRIES	256
+
+/* Buffer group of the receive buffers. */
+#define UDP_URING_BGID		0
+
+/* user_data of the receive completions; the sends carry their
+ * struct udp_uring_send. */
+#define UDP_URING_RECV		NULL
+
+/* Room of the send buffers of the small class, which holds all the
+ * datagrams but the ones of large messages. The others have room for
+ * the largest datagram, or batch of them with UDP_SEGMENT. */
+#define UDP_URING_SMALL_SEND	(2048)
+
+/* Send buffers kept on the free lists, per class. */
+#define UDP_URING_SMALL_FREE	UDP_URING_ENTRIES
+#define UDP_URING_LARGE_FREE	(16)
+
+#ifndef IORING_RECVSEND_POLL_FIRST
+#define IORING_RECVSEND_POLL_FIRST	0
+#endif
+
+/* A datagram being sent. It is a copy, so the caller can reuse its
+ * memory as soon as the send is queued. */
+struct udp_uring_send {
+    struct udp_uring_send *next;        /* on a free list */
+    size_t size;                /* room in data */
+    struct msghdr msg;
+    struct iovec iov;
+    struct sockaddr_in dest;
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(uint16_t))];
+    } ctrl;
+    unsigned char data[0];
+};
+
+struct udp_uring {
+    struct io_uring ring;
+    int sockfd;
+
+    /* Serializes the submissions, which come from any thread. The
+     * completions are only handled by the progress thread. */
+    PTL_FASTLOCK_TYPE lock;
+
+    /* Sends not completed yet. */
+    atomic_t in_flight;
+
+    /* Send buffers no longer in use, small and large ones, so that
+     * the sends don't go through malloc. */
+    PTL_FASTLOCK_TYPE free_lock;
+    struct {
+        struct udp_uring_send *first;
+        unsigned int count;
+    } free[2];
+
+    /* Receive buffers. */
+    struct io_uring_buf_ring *br;
+    unsigned char *bufs;
+    unsigned int num_bufs;
+    unsigned int buf_size;
+
+    /* Template of the multishot recvmsg, and whether it is armed. */
+    struct msghdr msg;
+    int armed;
+
+    /* Buffer being unpacked; it can hold several datagrams coalesced
+     * by the kernel (UDP_GRO). */
+    unsigned char *cur;
+    unsigned short cur_bid;
+    size_t cur_len;
+    size_t cur_seg;
+    size_t cur_off;
+    struct sockaddr_in cur_src;
+};
+
+/**
+ * @brief Get a submission queue entry, flushing the queue if full.
+ *
+ * @param[in] u the engine, locked
+ *
+ * @return the entry
+ */
+static struct io_uring_sqe *udp_uring_get_sqe(struct udp_uring *u)
+{
+    struct io_uring_sqe *sqe;
+
+    while ((sqe = io_uring_get_sqe(&u->ring)) == NULL) {
+        io_uring_submit(&u->ring);
+        SPINLOCK_BODY();
+    }
+
+    return sqe;
+}
+
+/**
+ * @brief Arm the multishot recvmsg.
+ *
+ * @param[in] u the engine
+ */
+static void udp_uring_arm(struct udp_uring *u)
+{
+    struct io_uring_sqe *sqe;
+
+    PTL_FASTLOCK_LOCK(&u->lock);
+
+    sqe = udp_uring_get_sqe(u);
+    io_uring_prep_recvmsg_multishot(sqe, u->sockfd, &u->msg, 0);
+    sqe->ioprio |= IORING_RECVSEND_POLL_FIRST;
+    sqe->flags |= IOSQE_BUFFER_SELECT;
+    sqe->buf_group = UDP_URING_BGID;
+    io_uring_sqe_set_data(sqe, UDP_URING_RECV);
+    io_uring_submit(&u->ring);
+
+    PTL_FASTLOCK_UNLOCK(&u->lock);
+
+    u->armed = 1;
+}
+
+/**
+ * @brief Give a receive buffer back to the kernel.
+ *
+ * @param[in] u the engine
+ * @param[in] bid the buffer
+ */
+static void udp_uring_recycle(struct udp_uring *u, unsigned short bid)
+{
+    io_uring_buf_ring_add(u->br, u->bufs + (size_t)bid * u->buf_size,
+                          u->buf_size, bid,
+                          io_uring_buf_ring_mask(u->num_bufs), 0);
+    io_uring_buf_ring_advance(u->br, 1);
+}
+
+/**
+ * @brief Start the io_uring engine of an NI.
+ *
+ * @param[in] ni the network interface, whose socket is open
+ *
+ * @return status
+ */
+int udp_uring_init(ni_t *ni)
+{
+    struct udp_uring *u;
+    struct io_uring_params params;
+    const long sqpoll = get_param(PTL_UDP_URING_SQPOLL);
+    unsigned int i;
+    int ret;
+
+    u = calloc(1, sizeof(*u));
+    if (!u)
+        return PTL_NO_SPACE;
+
+    u->sockfd = ni->iface->udp.connect_s;
+    PTL_FASTLOCK_INIT(&u->lock);
+    PTL_FASTLOCK_INIT(&u->free_lock);
+    atomic_set(&u->in_flight, 0);
+
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = 4 * UDP_URING_ENTRIES;
+    if (sqpoll) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = sqpoll;
+    }
+
+    ret = io_uring_queue_init_params(UDP_URING_ENTRIES, &u->ring, &params);
+    if (ret < 0 && sqpoll) {
+        ptl_info("io_uring SQ polling not available: %s\n", strerror(-ret));
+        params.flags &= ~IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = 0;
+        ret = io_uring_queue_init_params(UDP_URING_ENTRIES, &u->ring,
+                                         &params);
+    }
+    if (ret < 0) {
+        ptl_warn("io_uring not available: %s\n", strerror(-ret));
+        goto err1;
+    }
+
+    /* Enough for the largest datagrams coalesced by the kernel. */
+    u->msg.msg_namelen = sizeof(struct sockaddr_in);
+#ifdef UDP_GRO
+    u->msg.msg_controllen = CMSG_SPACE(sizeof(int));
+#endif
+    u->buf_size = sizeof(struct io_uring_recvmsg_out) + u->msg.msg_namelen +
+        u->msg.msg_controllen + 65536;
+
+    /* The ring size must be a power of 2. */
+    u->num_bufs = 1;
+    while (u->num_bufs < get_param(PTL_UDP_RECV_BATCH))
+        u->num_bufs <<= 1;
+
+    u->bufs = malloc((size_t)u->num_bufs * u->buf_size);
+    if (!u->bufs)
+        goto err2;
+
+    u->br = io_uring_setup_buf_ring(&u->ring, u->num_bufs, UDP_URING_BGID, 0,
+                                    &ret);
+    if (!u->br) {
+        ptl_warn("io_uring buffer rings not available: %s\n",
+                 strerror(-ret));
+        goto err3;
+    }
+
+    for (i = 0; i < u->num_bufs; i++)
+        io_uring_buf_ring_add(u->br, u->bufs + (size_t)i * u->buf_size,
+                              u->buf_size, i,
+                              io_uring_buf_ring_mask(u->num_bufs), i);
+    io_uring_buf_ring_advance(u->br, u->num_bufs);
+
+    ni->udp.uring = u;
+
+    udp_uring_arm(u);
+
+    ptl_info("io_uring engine started, %u receive buffers%s\n",
+             u->num_bufs,
+             (params.flags & IORING_SETUP_SQPOLL) ? ", SQ polling" : "");
+
+    return PTL_OK;
+
+  err3:
+    free(u->bufs);
+  err2:
+    io_uring_queue_exit(&u->ring);
+  err1:
+    PTL_FASTLOCK_DESTROY(&u->free_lock);
+    PTL_FASTLOCK_DESTROY(&u->lock);
+    free(u);
+    return PTL_FAIL;
+}
+
+/**
+ * @brief Get a send buffer with room for a datagram.
+ *
+ * @param[in] u the engine
+ * @param[in] len the length of the datagram
+ *
+ * @return the buffer, or NULL
+ */
+static struct udp_uring_send *udp_uring_alloc(struct udp_uring *u,
+                                              size_t len)
+{
+    const int large = len > UDP_URING_SMALL_SEND;
+    struct udp_uring_send *s;
+    size_t size;
+
+    PTL_FASTLOCK_LOCK(&u->free_lock);
+    s = u->free[large].first;
+    if (s) {
+        u->free[large].first = s->next;
+        u->free[large].count--;
+    }
+    PTL_FASTLOCK_UNLOCK(&u->free_lock);
+
+    if (s)
+        return s;
+
+    size = large ? UDP_MAX_DATAGRAM : UDP_URING_SMALL_SEND;
+    s = malloc(sizeof(*s) + size);
+    if (s)
+        s->size = size;
+
+    return s;
+}
+
+/**
+ * @brief Give a send buffer back.
+ *
+ * It is kept for the next sends, unless the free list is full.
+ *
+ * @param[in] u the engine
+ * @param[in] s the buffer
+ */
+static void udp_uring_release(struct udp_uring *u, struct udp_uring_send *s)
+{
+    const int large = s->size > UDP_URING_SMALL_SEND;
+    const unsigned int max = large ? UDP_URING_LARGE_FREE :
+        UDP_URING_SMALL_FREE;
+
+    PTL_FASTLOCK_LOCK(&u->free_lock);
+    if (u->free[large].count < max) {
+        s->next = u->free[large].first;
+        u->free[large].first = s;
+        u->free[large].count++;
+        s = NULL;
+    }
+    PTL_FASTLOCK_UNLOCK(&u->free_lock);
+
+    free(s);
+}
+
+/**
+ * @brief Stop the io_uring engine of an NI.
+ *
+ * The sends still in flight get some time to complete.
+ *
+ * @param[in] ni the network interface
+ */
+void udp_uring_fini(ni_t *ni)
+{
+    struct udp_uring *u = ni->udp.uring;
+    struct io_uring_cqe *cqe;
+    struct __kernel_timespec ts = {.tv_sec = 0,.tv_nsec = 10000000 };
+    int tries = 100;
+    int i;
+
+    if (!u)
+        return;
+
+    ni->udp.uring = NULL;
+
+    while (atomic_read(&u->in_flight) > 0 && tries > 0) {
+        if (io_uring_wait_cqe_timeout(&u->ring, &cqe, &ts)) {
+            tries--;
+            continue;
+        }
+
+        if (io_uring_cqe_get_data(cqe) != UDP_URING_RECV) {
+            udp_uring_release(u, io_uring_cqe_get_data(cqe));
+            atomic_dec(&u->in_flight);
+        }
+        io_uring_cqe_seen(&u->ring, cqe);
+    }
+
+    io_uring_free_buf_ring(&u->ring, u->br, u->num_bufs, UDP_URING_BGID);
+    io_uring_queue_exit(&u->ring);
+    free(u->bufs);
+
+    for (i = 0; i < 2; i++) {
+        while (u->free[i].first) {
+            struct udp_uring_send *s = u->free[i].first;
+
+            u->free[i].first = s->next;
+            free(s);
+        }
+    }
+
+    PTL_FASTLOCK_DESTROY(&u->free_lock);
+    PTL_FASTLOCK_DESTROY(&u->lock);
+    free(u);
+}
+
+/**
+ * @brief Copy a datagram for sending.
+ *
+ * @param[in] u the engine
+ * @param[in] msg the datagram
+ *
+ * @return the copy, or NULL
+ */
+static struct udp_uring_send *udp_uring_copy(struct udp_uring *u,
+                                             const struct msghdr *msg)
+{
+    struct udp_uring_send *s;
+    size_t len = 0;
+    size_t i;
+
+    if (msg->msg_controllen > sizeof(s->ctrl) ||
+        msg->msg_namelen > sizeof(s->dest)) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    for (i = 0; i < msg->msg_iovlen; i++)
+        len += msg->msg_iov[i].iov_len;
+
+    if (len > UDP_MAX_DATAGRAM) {
+        errno = EMSGSIZE;
+        return NULL;
+    }
+
+    s = udp_uring_alloc(u, len);
+    if (!s) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    len = 0;
+    for (i = 0; i < msg->msg_iovlen; i++) {
+        memcpy(s->data + len, msg->msg_iov[i].iov_base,
+               msg->msg_iov[i].iov_len);
+        len += msg->msg_iov[i].iov_len;
+    }
+
+    memset(&s->msg, 0, sizeof(s->msg));
+    memset(&s->dest, 0, sizeof(s->dest));
+    memcpy(&s->dest, msg->msg_name, msg->msg_namelen);
+    s->msg.msg_name = &s->dest;
+    s->msg.msg_namelen = msg->msg_namelen;
+    s->iov.iov_base = s->data;
+    s->iov.iov_len = len;
+    s->msg.msg_iov = &s->iov;
+    s->msg.msg_iovlen = 1;
+    if (msg->msg_controllen) {
+        memcpy(&s->ctrl, msg->msg_control, msg->msg_controllen);
+        s->msg.msg_control = &s->ctrl;
+        s->msg.msg_controllen = msg->msg_controllen;
+    }
+
+    return s;
+}
+
+/**
+ * @brief Queue sends, and submit them.
+ *
+ * @param[in] u the engine
+ * @param[in] sends the datagrams
+ * @param[in] n the number of datagrams
+ * @param[in] poll_first whether the kernel must wait for the socket
+ *                       to be ready before trying
+ */
+static void udp_uring_submit(struct udp_uring *u,
+                             struct udp_uring_send **sends, unsigned int n,
+                             int poll_first)
+{
+    unsigned int i;
+
+    PTL_FASTLOCK_LOCK(&u->lock);
+
+    for (i = 0; i < n; i++) {
+        struct io_uring_sqe *sqe = udp_uring_get_sqe(u);
+
+        io_uring_prep_sendmsg(sqe, u->sockfd, &sends[i]->msg, 0);
+        if (poll_first)
+            sqe->ioprio |= IORING_RECVSEND_POLL_FIRST;
+        io_uring_sqe_set_data(sqe, sends[i]);
+    }
+
+    io_uring_submit(&u->ring);
+
+    PTL_FASTLOCK_UNLOCK(&u->lock);
+}
+
+/**
+ * @brief Queue the sends of a batch of datagrams, and submit them.
+ *
+ * @param[in] ni the network interface
+ * @param[in] msgvec the datagrams
+ * @param[in] vlen the number of datagrams
+ *
+ * @return the number of datagrams queued, or -1 if none could be
+ */
+int udp_uring_sendmmsg(ni_t *ni, struct mmsghdr *msgvec, unsigned int vlen)
+{
+    struct udp_uring *u = ni->udp.uring;
+    struct udp_uring_send *sends[vlen];
+    unsigned int n;
+
+    /* Copy outside of the submission lock. */
+    for (n = 0; n < vlen; n++) {
+        sends[n] = udp_uring_copy(u, &msgvec[n].msg_hdr);
+        if (!sends[n])
+            break;
+        msgvec[n].msg_len = sends[n]->iov.iov_len;
+    }
+
+    if (n == 0)
+        return -1;
+
+    atomic_add(&u->in_flight, n);
+
+    udp_uring_submit(u, sends, n, 0);
+
+    return n;
+}
+
+/**
+ * @brief Queue the send of a datagram, and submit it.
+ *
+ * @param[in] ni the network interface
+ * @param[in] msg the datagram
+ *
+ * @return the size of the datagram, or -1
+ */
+ssize_t udp_uring_sendmsg(ni_t *ni, const struct msghdr *msg)
+{
+    struct mmsghdr m;
+
+    m.msg_hdr = *msg;
+
+    if (udp_uring_sendmmsg(ni, &m, 1) != 1)
+        return -1;
+
+    return m.msg_len;
+}
+
+/**
+ * @brief Send again, one at a time, the datagrams of a send the
+ * kernel could not segment.
+ *
+ * @param[in] ni the network interface
+ * @param[in] s the send, whose datagrams all have the size given by
+ *              its UDP_SEGMENT control message, but the last one
+ */
+static void udp_uring_resend_segments(ni_t *ni, struct udp_uring_send *s)
+{
+    const size_t len = s->iov.iov_len;
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&s->msg);
+    uint16_t seg_size;
+    unsigned int n;
+    unsigned int i;
+    int ret;
+
+    memcpy(&seg_size, CMSG_DATA(cmsg), sizeof(seg_size));
+    if (seg_size == 0 || seg_size >= len)
+        seg_size = len;
+
+    n = (len + seg_size - 1) / seg_size;
+
+    {
+        struct iovec iov[n];
+        struct mmsghdr msgs[n];
+
+        for (i = 0; i < n; i++) {
+            iov[i].iov_base = s->data + (size_t)i * seg_size;
+            iov[i].iov_len = (i == n - 1) ?
+                len - (size_t)i * seg_size : seg_size;
+
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &s->dest;
+            msgs[i].msg_hdr.msg_namelen = s->msg.msg_namelen;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+
+        for (i = 0; i < n; i += ret) {
+            ret = udp_uring_sendmmsg(ni, &msgs[i], n - i);
+            if (ret == -1) {
+                ptl_warn("out of memory, %u datagrams to %s:%d lost\n",
+                         n - i, inet_ntoa(s->dest.sin_addr),
+                         ntohs(s->dest.sin_port));
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Handle the completion of a send.
+ *
+ * @param[in] ni the network interface
+ * @param[in] u the engine
+ * @param[in] cqe the completion
+ */
+static void udp_uring_sent(ni_t *ni, struct udp_uring *u,
+                           struct io_uring_cqe *cqe)
+{
+    struct udp_uring_send *s = io_uring_cqe_get_data(cqe);
+
+    if (cqe->res == -EAGAIN) {
+        /* The socket is non blocking. Try again once it is ready. */
+        udp_uring_submit(u, &s, 1, 1);
+        return;
+    }
+
+    if (cqe->res < 0) {
+        if (s->msg.msg_controllen &&
+            (cqe->res == -EIO || cqe->res == -EINVAL)) {
+            /* Same as in udp_send_large(). */
+            ptl_warn("UDP segmentation offload failed, disabled\n");
+            ni->iface->udp.gso_size = 0;
+            udp_uring_resend_segments(ni, s);
+        } else {
+            ptl_warn("error sending to %s:%d: %s\n",
+                     inet_ntoa(s->dest.sin_addr), ntohs(s->dest.sin_port),
+                     strerror(-cqe->res));
+        }
+    }
+
+    udp_uring_release(u, s);
+    atomic_dec(&u->in_flight);
+}
+
+/**
+ * @brief Take the buffer of a receive completion.
+ *
+ * @param[in] u the engine
+ * @param[in] cqe the completion
+ */
+static void udp_uring_received(struct udp_uring *u, struct io_uring_cqe *cqe)
+{
+    struct io_uring_recvmsg_out *out;
+    unsigned short bid;
+    unsigned char *buf;
+
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+        u->armed = 0;
+
+    if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+        /* Out of buffers, or the socket was not ready. The recvmsg
+         * is armed again once no buffer is being unpacked. */
+        if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -EAGAIN)
+            ptl_warn("error receiving from socket: %s\n",
+                     strerror(-cqe->res));
+        return;
+    }
+
+    bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+    buf = u->bufs + (size_t)bid * u->buf_size;
+
+    out = io_uring_recvmsg_validate(buf, cqe->res, &u->msg);
+    if (!out || (out->flags & MSG_TRUNC) ||
+        out->namelen < sizeof(struct sockaddr_in)) {
+        ptl_warn("dropping invalid UDP datagram\n");
+        udp_uring_recycle(u, bid);
+        return;
+    }
+
+    u->cur = io_uring_recvmsg_payload(out, &u->msg);
+    u->cur_bid = bid;
+    u->cur_len = io_uring_recvmsg_payload_length(out, cqe->res, &u->msg);
+    u->cur_seg = 0;
+    u->cur_off = 0;
+    memcpy(&u->cur_src, io_uring_recvmsg_name(out), sizeof(u->cur_src));
+
+#ifdef UDP_GRO
+    {
+        struct cmsghdr *cmsg;
+        int seg;
+
+        for (cmsg = io_uring_recvmsg_cmsg_firsthdr(out, &u->msg); cmsg;
+             cmsg = io_uring_recvmsg_cmsg_nexthdr(out, &u->msg, cmsg)) {
+            if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                memcpy(&seg, CMSG_DATA(cmsg), sizeof(seg));
+                u->cur_seg = seg;
+            }
+        }
+    }
+#endif
+
+    if (u->cur_seg == 0 || u->cur_seg > u->cur_len)
+        u->cur_seg = u->cur_len;
+}
+
+/**
+ * @brief Unpack the next datagram of the current buffer.
+ *
+ * @param[in] ni the network interface
+ * @param[in] u the engine
+ *
+ * @return the buf of a complete message, or NULL
+ */
+static buf_t *udp_uring_next(ni_t *ni, struct udp_uring *u)
+{
+    const unsigned char *data = u->cur + u->cur_off;
+    size_t len = u->cur_len - u->cur_off;
+    buf_t *buf;
+
+    if (len > u->cur_seg)
+        len = u->cur_seg;
+
+    buf = udp_recv_datagram(ni, data, len, &u->cur_src);
+
+    /* The datagram has been copied; give the buffer back after the
+     * last one. */
+    u->cur_off += u->cur_seg;
+    if (u->cur_off >= u->cur_len) {
+        udp_uring_recycle(u, u->cur_bid);
+        u->cur = NULL;
+    }
+
+    return buf;
+}
+
+/**
+ * @brief Handle the completions of an NI until a message is received.
+ *
+ * @param[in] ni the network interface
+ *
+ * @return the buf of a complete message, or NULL
+ */
+buf_t *udp_uring_receive(ni_t *ni)
+{
+    struct udp_uring *u = ni->udp.uring;
+    struct io_uring_cqe *cqe;
+    buf_t *buf;
+
+    while (1) {
+        while (u->cur) {
+            buf = udp_uring_next(ni, u);
+            if (buf)
+                return buf;
+        }
+
+        if (io_uring_peek_cqe(&u->ring, &cqe))
+            break;
+
+        if (io_uring_cqe_get_data(cqe) == UDP_URING_RECV)
+            udp_uring_received(u, cqe);
+        else
+            udp_uring_sent(ni, u, cqe);
+
+        io_uring_cqe_seen(&u->ring, cqe);
+
+        if (!u->armed && !u->cur)
+            udp_uring_arm(u);
+    }
+
+    if (!u->armed)
+        udp_uring_arm(u);
+
+    return NULL;
+}
+
+/**
+ * @brief Tell whether completions are waiting to be handled.
+ *
+ * @param[in] ni the network interface
+ *
+ * @return 1 if some are waiting, 0 otherwise
+ */
+int udp_uring_pending(ni_t *ni)
+{
+    struct udp_uring *u = ni->udp.uring;
+
+    return u->cur != NULL || io_uring_cq_ready(&u->ring) > 0;
+}
+
+/**
+ * @brief Get the file descriptor to poll for completions.
+ *
+ * @param[in] ni the network interface
+ *
+ * @return the file descriptor of the ring
+ */
+int udp_uring_fd(ni_t *ni)
+{
+    return ni->udp.uring->ring.ring_fd;
+}
@@ -0,0 +1,63 @@
+/*
+ * ptl_udp_uring.h - io_uring engine of the UDP transport
+ */
+
+#ifndef PTL_UDP_URING_H
+#define PTL_UDP_URING_H
+
+/* Values of PTL_UDP_ENGINE. */
+enum udp_engine {
+    UDP_ENGINE_SOCKET,          /* recvmmsg and sendmmsg */
+    UDP_ENGINE_URING,           /* io_uring */
+};
+
+#if WITH_TRANSPORT_UDP && USE_LIBURING
+
+int udp_uring_init(ni_t *ni);
+void udp_uring_fini(ni_t *ni);
+ssize_t udp_uring_sendmsg(ni_t *ni, const struct msghdr *msg);
+int udp_uring_sendmmsg(ni_t *ni, struct mmsghdr *msgvec, unsigned int vlen);
+buf_t *udp_uring_receive(ni_t *ni);
+int udp_uring_pending(ni_t *ni);
+int udp_uring_fd(ni_t *ni);
+
+#else
+
+static inline int udp_uring_init(ni_t *ni)
+{
+    return PTL_FAIL;
+}
+
+static inline void udp_uring_fini(ni_t *ni)
+{
+}
+
+static inline ssize_t udp_uring_sendmsg(ni_t *ni, const struct msghdr *msg)
+{
+    return -1;
+}
+
+static inline int udp_uring_sendmmsg(ni_t *ni, struct mmsghdr *msgvec,
+                                     unsigned int vlen)
+{
+    return -1;
+}
+
+static inline buf_t *udp_uring_receive(ni_t *ni)
+{
+    return NULL;
+}
+
+static inline int udp_uring_pending(ni_t *ni)
+{
+    return 0;
+}
+
+static inline int udp_uring_fd(ni_t *ni)
+{
+    return -1;
+}
+
+#endif
+
+#endif
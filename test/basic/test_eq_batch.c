@@ -0,0 +1,136 @@
+#include <portals4.h>
+#include <support.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <sched.h>
+
+#include "testing.h"
+
+#define NUM_PUTS 20
+#define BATCH    8
+
+/*
+ * Check that PtlEQGetBatch and PtlEQPollBatch return the events in
+ * order, and no more than asked for.
+ */
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_h;
+    ptl_process_t   myself;
+    ptl_pt_index_t  pt_index;
+    uint64_t        value, writeval;
+    ptl_le_t        value_le;
+    ptl_handle_le_t value_le_handle;
+    ptl_handle_eq_t eq_h[2];
+    ptl_md_t        write_md;
+    ptl_handle_md_t write_md_handle;
+    ptl_ct_event_t  ctc;
+    ptl_event_t     events[BATCH];
+    unsigned int    which[BATCH];
+    unsigned int    count;
+    unsigned int    got, sent, acked;
+    int             i;
+
+    CHECK_RETURNVAL(PtlInit());
+
+    CHECK_RETURNVAL(libtest_init());
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_NO_MATCHING | PTL_NI_PHYSICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_h));
+
+    CHECK_RETURNVAL(PtlGetId(ni_h, &myself));
+
+    /* eq_h[0] gets the target events, eq_h[1] the initiator ones */
+    CHECK_RETURNVAL(PtlEQAlloc(ni_h, 2 * NUM_PUTS, &eq_h[0]));
+    CHECK_RETURNVAL(PtlEQAlloc(ni_h, 2 * NUM_PUTS, &eq_h[1]));
+
+    CHECK_RETURNVAL(PtlPTAlloc(ni_h, 0, eq_h[0], PTL_PT_ANY, &pt_index));
+
+    value_le.start     = &value;
+    value_le.length    = sizeof(uint64_t);
+    value_le.uid       = PTL_UID_ANY;
+    value_le.options   = PTL_LE_OP_PUT | PTL_LE_EVENT_LINK_DISABLE;
+    value_le.ct_handle = PTL_CT_NONE;
+    CHECK_RETURNVAL(PtlLEAppend(ni_h, pt_index, &value_le,
+                                PTL_PRIORITY_LIST, NULL, &value_le_handle));
+
+    write_md.start     = &writeval;
+    write_md.length    = sizeof(uint64_t);
+    write_md.options   = PTL_MD_EVENT_CT_ACK;
+    write_md.eq_handle = eq_h[1];
+    CHECK_RETURNVAL(PtlCTAlloc(ni_h, &write_md.ct_handle));
+    CHECK_RETURNVAL(PtlMDBind(ni_h, &write_md, &write_md_handle));
+
+    /* Nothing to get yet. */
+    assert(PtlEQGetBatch(eq_h[0], events, BATCH, &count) == PTL_EQ_EMPTY);
+    assert(count == 0);
+    assert(PtlEQGetBatch(eq_h[0], events, 0, &count) == PTL_ARG_INVALID);
+
+    for (i = 0; i < NUM_PUTS; i++) {
+        writeval = i;
+        CHECK_RETURNVAL(PtlPut(write_md_handle, 0, sizeof(uint64_t),
+                               PTL_ACK_REQ, myself, pt_index, 0, 0,
+                               NULL, i));
+        CHECK_RETURNVAL(PtlCTWait(write_md.ct_handle, i + 1, &ctc));
+        assert(ctc.failure == 0);
+    }
+
+    /* The target events, in order, at most BATCH at a time. */
+    got = 0;
+    while (got < NUM_PUTS) {
+        CHECK_RETURNVAL(PtlEQGetBatch(eq_h[0], events, BATCH, &count));
+        assert(count > 0 && count <= BATCH);
+
+        for (i = 0; i < count; i++) {
+            assert(events[i].type == PTL_EVENT_PUT);
+            assert(events[i].hdr_data == got + i);
+        }
+        got += count;
+    }
+    assert(got == NUM_PUTS);
+    assert(PtlEQGetBatch(eq_h[0], events, BATCH, &count) == PTL_EQ_EMPTY);
+
+    /* The initiator events, through the poll on both queues. */
+    sent = acked = 0;
+    while (acked < NUM_PUTS) {
+        CHECK_RETURNVAL(PtlEQPollBatch(eq_h, 2, PTL_TIME_FOREVER, events,
+                                       BATCH, &count, which));
+        assert(count > 0 && count <= BATCH);
+
+        for (i = 0; i < count; i++) {
+            assert(which[i] == 1);
+            if (events[i].type == PTL_EVENT_SEND) {
+                sent++;
+            } else {
+                assert(events[i].type == PTL_EVENT_ACK);
+                acked++;
+            }
+        }
+    }
+    assert(sent == NUM_PUTS);
+
+    assert(PtlEQPollBatch(eq_h, 2, 0, events, BATCH, &count, NULL) ==
+           PTL_EQ_EMPTY);
+    assert(count == 0);
+
+    /* cleanup */
+    CHECK_RETURNVAL(PtlMDRelease(write_md_handle));
+    CHECK_RETURNVAL(PtlCTFree(write_md.ct_handle));
+    CHECK_RETURNVAL(PtlLEUnlink(value_le_handle));
+    CHECK_RETURNVAL(PtlPTFree(ni_h, pt_index));
+    CHECK_RETURNVAL(PtlEQFree(eq_h[0]));
+    CHECK_RETURNVAL(PtlEQFree(eq_h[1]));
+    CHECK_RETURNVAL(PtlNIFini(ni_h));
+    CHECK_RETURNVAL(libtest_fini());
+    PtlFini();
+
+    return 0;
+}
+
+/* vim:set expandtab: */
@@ -0,0 +1,189 @@
+#include <portals4.h>
+#include <support.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "testing.h"
+
+/* Number of non-matching MEs used to populate the match index. */
+#define NUM_FILLERS 64
+
+/* Number of puts, and of MEs they land in. */
+#define NUM_VALUES 4
+
+/* A page for each ME and for the source of each put. */
+#define NUM_PAGES (NUM_FILLERS + 2 * NUM_VALUES)
+
+/*
+ * Check that messages match the first ME in list order, whether
+ * exact or wildcard MEs come first.
+ */
+
+static void append(ptl_handle_ni_t  ni_h,
+                   uint64_t        *value,
+                   ptl_match_bits_t match_bits,
+                   ptl_match_bits_t ignore_bits,
+                   unsigned int     options,
+                   ptl_handle_ct_t  ct_h,
+                   ptl_handle_me_t *me_h)
+{
+    ptl_me_t value_e;
+
+    value_e.start          = value;
+    value_e.length         = sizeof(uint64_t);
+    value_e.uid            = PTL_UID_ANY;
+    value_e.match_id.rank  = PTL_RANK_ANY;
+    value_e.match_bits     = match_bits;
+    value_e.ignore_bits    = ignore_bits;
+    value_e.options        = PTL_ME_OP_PUT | PTL_ME_EVENT_CT_COMM | options;
+    value_e.ct_handle      = ct_h;
+    CHECK_RETURNVAL(PtlMEAppend(ni_h, 0, &value_e, PTL_PRIORITY_LIST, NULL,
+                                me_h));
+}
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_h;
+    ptl_pt_index_t  pt_index;
+    uint64_t       *value[NUM_VALUES], *filler[NUM_FILLERS];
+    uint64_t       *writeval[NUM_VALUES];
+    char           *pages;
+    long            pagesize;
+    ptl_handle_me_t value_e_handle[NUM_VALUES];
+    ptl_handle_me_t filler_handle[NUM_FILLERS];
+    ptl_handle_ct_t value_ct;
+    ptl_md_t        write_md;
+    ptl_handle_md_t write_md_handle[NUM_VALUES];
+    ptl_ct_event_t  ctc;
+    ptl_process_t  *procs;
+    int             num_procs;
+    int             rank;
+    int             i;
+
+    /* match bits of each put, and which ME it must land in */
+    static const ptl_match_bits_t put_bits[NUM_VALUES] = { 5, 5, 5, 3 };
+    static const int              expected[NUM_VALUES] = { 0, 1, 2, 3 };
+
+    CHECK_RETURNVAL(PtlInit());
+
+    CHECK_RETURNVAL(libtest_init());
+
+    rank = libtest_get_rank();
+    num_procs = libtest_get_size();
+
+    /* This test only succeeds if we have more than one rank */
+    if (num_procs < 2) return 77;
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_MATCHING | PTL_NI_LOGICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_h));
+
+    procs = libtest_get_mapping(ni_h);
+    CHECK_RETURNVAL(PtlSetMap(ni_h, num_procs, procs));
+
+    CHECK_RETURNVAL(PtlPTAlloc(ni_h, 0, PTL_EQ_NONE, PTL_PT_ANY,
+                               &pt_index));
+    assert(pt_index == 0);
+
+    /* Each ME and MD gets its own page, so that their memory
+     * registrations don't overlap. */
+    pagesize = sysconf(_SC_PAGESIZE);
+    if (posix_memalign((void **)&pages, pagesize, NUM_PAGES * pagesize))
+        abort();
+    memset(pages, 0, NUM_PAGES * pagesize);
+    for (i = 0; i < NUM_FILLERS; i++)
+        filler[i] = (uint64_t *)(pages + i * pagesize);
+    for (i = 0; i < NUM_VALUES; i++) {
+        value[i] = (uint64_t *)(pages + (NUM_FILLERS + i) * pagesize);
+        writeval[i] =
+            (uint64_t *)(pages + (NUM_FILLERS + NUM_VALUES + i) * pagesize);
+    }
+
+    if (1 == rank) {
+        CHECK_RETURNVAL(PtlCTAlloc(ni_h, &value_ct));
+
+        for (i = 0; i < NUM_FILLERS; i++) {
+            append(ni_h, filler[i], 100 + i, 0, 0, value_ct,
+                   &filler_handle[i]);
+        }
+
+        /* exact, wildcard, exact on the same bits, then other bits */
+        append(ni_h, value[0], 5, 0, PTL_ME_USE_ONCE, value_ct,
+               &value_e_handle[0]);
+        append(ni_h, value[1], 0, 0xf, PTL_ME_USE_ONCE, value_ct,
+               &value_e_handle[1]);
+        append(ni_h, value[2], 5, 0, PTL_ME_USE_ONCE, value_ct,
+               &value_e_handle[2]);
+        append(ni_h, value[3], 3, 0, PTL_ME_USE_ONCE, value_ct,
+               &value_e_handle[3]);
+    } else if (0 == rank) {
+        write_md.length    = sizeof(uint64_t);
+        write_md.options   = PTL_MD_EVENT_CT_SEND | PTL_MD_EVENT_CT_ACK;
+        write_md.eq_handle = PTL_EQ_NONE;
+        CHECK_RETURNVAL(PtlCTAlloc(ni_h, &write_md.ct_handle));
+
+        for (i = 0; i < NUM_VALUES; i++) {
+            *writeval[i] = i + 1;
+            write_md.start = writeval[i];
+            CHECK_RETURNVAL(PtlMDBind(ni_h, &write_md, &write_md_handle[i]));
+        }
+    }
+
+    libtest_barrier();
+
+    if (1 == rank) {
+        /* wait for all the puts to arrive */
+        CHECK_RETURNVAL(PtlCTWait(value_ct, NUM_VALUES, &ctc));
+        assert(ctc.failure == 0);
+
+        for (i = 0; i < NUM_VALUES; i++)
+            assert(*value[expected[i]] == i + 1);
+        for (i = 0; i < NUM_FILLERS; i++)
+            assert(*filler[i] == 0);
+    } else if (0 == rank) {
+        ptl_process_t peer;
+
+        peer.rank = 1;
+
+        /* One put at a time, so they are matched in order. */
+        for (i = 0; i < NUM_VALUES; i++) {
+            CHECK_RETURNVAL(PtlPut(write_md_handle[i], 0,
+                                   sizeof(uint64_t), PTL_CT_ACK_REQ, peer,
+                                   pt_index, put_bits[i], 0, NULL, 0));
+            CHECK_RETURNVAL(PtlCTWait(write_md.ct_handle, 2 * (i + 1),
+                                      &ctc));
+            assert(ctc.failure == 0);
+        }
+    }
+
+    libtest_barrier();
+
+    /* cleanup */
+    if (1 == rank) {
+        for (i = 0; i < NUM_FILLERS; i++)
+            CHECK_RETURNVAL(PtlMEUnlink(filler_handle[i]));
+        CHECK_RETURNVAL(PtlCTFree(value_ct));
+    } else if (0 == rank) {
+        for (i = 0; i < NUM_VALUES; i++)
+            CHECK_RETURNVAL(PtlMDRelease(write_md_handle[i]));
+        CHECK_RETURNVAL(PtlCTFree(write_md.ct_handle));
+    }
+
+    CHECK_RETURNVAL(PtlPTFree(ni_h, pt_index));
+    CHECK_RETURNVAL(PtlNIFini(ni_h));
+    CHECK_RETURNVAL(libtest_fini());
+    PtlFini();
+
+    free(pages);
+
+    return 0;
+}
+
+/* vim:set expandtab: */
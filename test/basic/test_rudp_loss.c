@@ -0,0 +1,150 @@
+#include <portals4.h>
+#include <support.h>
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "testing.h"
+
+#define NUM_BURSTS 128
+#define BURST      16
+
+/* Retransmission timeout and datagrams dropped per million. */
+#define RTO        "10"
+#define LOSS       "50000"
+
+/* Longest a burst may take, in ms. A datagram lost four times in a
+ * row is retransmitted after 10 + 20 + 40 + 80 ms. A missed timer
+ * waits for the timer wheel to come round, 256 ms later. */
+#define MAX_BURST_TIME 200
+
+/*
+ * Check that the datagrams dropped by reliable UDP are retransmitted
+ * when their timer expires. Rank 0 keeps a burst of puts in flight
+ * to rank 1 while the losses are recovered, so that datagrams are
+ * sent and received while the timers run.
+ */
+
+static double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int main(int   argc,
+         char *argv[])
+{
+    ptl_handle_ni_t ni_h;
+    ptl_pt_index_t  pt_index;
+    uint64_t        value[BURST];
+    ptl_le_t        value_le;
+    ptl_handle_le_t value_le_handle;
+    ptl_md_t        write_md;
+    ptl_handle_md_t write_md_handle;
+    ptl_ct_event_t  ctc;
+    ptl_process_t  *procs;
+    double          start, elapsed;
+    int             failed = 0;
+    int             num_procs;
+    int             rank;
+    int             i, j;
+
+    /* The parameters are read by PtlInit. */
+    setenv("PTL_RUDP_RTO", RTO, 1);
+    setenv("PTL_RUDP_LOSS", LOSS, 1);
+
+    CHECK_RETURNVAL(PtlInit());
+
+    CHECK_RETURNVAL(libtest_init());
+
+    rank = libtest_get_rank();
+    num_procs = libtest_get_size();
+
+    /* This test only succeeds if we have more than one rank */
+    if (num_procs < 2) return 77;
+
+    CHECK_RETURNVAL(PtlNIInit(PTL_IFACE_DEFAULT,
+                              PTL_NI_NO_MATCHING | PTL_NI_PHYSICAL,
+                              PTL_PID_ANY, NULL, NULL, &ni_h));
+
+    procs = libtest_get_mapping(ni_h);
+
+    CHECK_RETURNVAL(PtlPTAlloc(ni_h, 0, PTL_EQ_NONE, PTL_PT_ANY,
+                               &pt_index));
+
+    if (1 == rank) {
+        value_le.start   = value;
+        value_le.length  = sizeof(value);
+        value_le.uid     = PTL_UID_ANY;
+        value_le.options = PTL_LE_OP_PUT | PTL_LE_EVENT_CT_COMM;
+        CHECK_RETURNVAL(PtlCTAlloc(ni_h, &value_le.ct_handle));
+        CHECK_RETURNVAL(PtlLEAppend(ni_h, pt_index, &value_le,
+                                    PTL_PRIORITY_LIST, NULL,
+                                    &value_le_handle));
+    } else if (0 == rank) {
+        write_md.start     = value;
+        write_md.length    = sizeof(value);
+        write_md.options   = PTL_MD_EVENT_CT_ACK;
+        write_md.eq_handle = PTL_EQ_NONE;
+        CHECK_RETURNVAL(PtlCTAlloc(ni_h, &write_md.ct_handle));
+        CHECK_RETURNVAL(PtlMDBind(ni_h, &write_md, &write_md_handle));
+    }
+
+    libtest_barrier();
+
+    if (1 == rank) {
+        CHECK_RETURNVAL(PtlCTWait(value_le.ct_handle, NUM_BURSTS * BURST,
+                                  &ctc));
+        assert(ctc.failure == 0);
+
+        for (j = 0; j < BURST; j++)
+            assert(value[j] == (NUM_BURSTS - 1) * BURST + j);
+    } else if (0 == rank) {
+        for (i = 0; i < NUM_BURSTS; i++) {
+            start = now_ms();
+            for (j = 0; j < BURST; j++) {
+                value[j] = i * BURST + j;
+                CHECK_RETURNVAL(PtlPut(write_md_handle,
+                                       j * sizeof(uint64_t),
+                                       sizeof(uint64_t), PTL_CT_ACK_REQ,
+                                       procs[1], pt_index, 0,
+                                       j * sizeof(uint64_t), NULL, 0));
+            }
+            CHECK_RETURNVAL(PtlCTWait(write_md.ct_handle, (i + 1) * BURST,
+                                      &ctc));
+            assert(ctc.failure == 0);
+
+            elapsed = now_ms() - start;
+            if (elapsed > MAX_BURST_TIME) {
+                fprintf(stderr, "burst %d took %.0f ms\n", i, elapsed);
+                failed = 1;
+            }
+        }
+    }
+
+    libtest_barrier();
+
+    /* cleanup */
+    if (1 == rank) {
+        CHECK_RETURNVAL(PtlLEUnlink(value_le_handle));
+        CHECK_RETURNVAL(PtlCTFree(value_le.ct_handle));
+    } else if (0 == rank) {
+        CHECK_RETURNVAL(PtlMDRelease(write_md_handle));
+        CHECK_RETURNVAL(PtlCTFree(write_md.ct_handle));
+    }
+
+    CHECK_RETURNVAL(PtlPTFree(ni_h, pt_index));
+    CHECK_RETURNVAL(PtlNIFini(ni_h));
+    CHECK_RETURNVAL(libtest_fini());
+    PtlFini();
+
+    return failed;
+}
+
+/* vim:set expandtab: */
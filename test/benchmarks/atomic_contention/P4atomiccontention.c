@@ -0,0 +1,325 @@
+/*
+** Multi-initiator atomic contention benchmark.
+**
+** Rank 0 exposes a buffer, and every other rank issues PTL_SUM atomics
+** on 64 bit integers to it. In the disjoint test each initiator targets
+** its own slot; in the shared test they all target the same address.
+** The aggregate rate shows how much the target serializes atomics that
+** do not overlap. The final values are checked on the target.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <portals4.h>
+#include <support.h>
+
+#ifdef __APPLE__
+# include <sys/time.h>
+#endif
+
+
+#define AtomicContentionIndex	(1)
+
+/* slots are cache line aligned, so that disjoint atomics never share one */
+#define SLOT_ALIGN		(64)
+
+
+static int rank;
+static int world_size;
+static int machine_output;
+
+
+static inline double
+timer(void)
+{
+#ifdef __APPLE__
+    struct timeval tm;
+    gettimeofday(&tm, NULL);
+    return tm.tv_sec + tm.tv_usec * 1e-6;
+#else
+    struct timespec tm;
+
+    clock_gettime(CLOCK_REALTIME, &tm);
+    return tm.tv_sec + tm.tv_nsec / 1000000000.0;
+#endif
+}  /* end of timer() */
+
+
+static void
+display_result(const char *test, const double result)
+{
+    if (0 == rank)   {
+        if (machine_output)   {
+            printf("%.2f ", result);
+        } else   {
+            printf("%20s: %.2f\n", test, result);
+        }
+    }
+
+}  /* end of display_result() */
+
+
+/*
+** Run one test and return the number of errors found on the target.
+*/
+static int
+test_contention(const char *test, ptl_handle_ni_t ni, int shared,
+	int64_t *src_buf, int64_t *tgt_buf, int slot_size, int nbytes,
+	int niters, int window)
+{
+    double tmp, rate= 0;
+    int rc;
+    int errors= 0;
+
+    if (rank == 0)   {
+	memset(tgt_buf, 0, slot_size * world_size);
+    }
+    libtest_Barrier();
+
+    if (rank != 0)   {
+	int i;
+	ptl_handle_md_t md_handle;
+	ptl_handle_ct_t ct_handle;
+	ptl_md_t md;
+	ptl_ct_event_t cnt_value;
+	ptl_process_t dest;
+	ptl_size_t offset= shared ? 0 : slot_size * rank;
+
+	rc= PtlCTAlloc(ni, &ct_handle);
+	LIBTEST_CHECK(rc, "PtlCTAlloc");
+
+	md.start     = src_buf;
+	md.length    = nbytes;
+	md.options   = PTL_MD_EVENT_CT_ACK;
+	md.eq_handle = PTL_EQ_NONE;
+	md.ct_handle = ct_handle;
+	rc= PtlMDBind(ni, &md, &md_handle);
+	LIBTEST_CHECK(rc, "PtlMDBind");
+
+	dest.rank= 0;
+
+	tmp= timer();
+	for (i= 0; i < niters; i++)   {
+	    if (i >= window)   {
+		rc= PtlCTWait(ct_handle, i - window + 1, &cnt_value);
+		LIBTEST_CHECK(rc, "PtlCTWait");
+	    }
+	    rc= PtlAtomic(md_handle, 0, nbytes, PTL_CT_ACK_REQ, dest,
+		AtomicContentionIndex, 0, offset, NULL, 0, PTL_SUM,
+		PTL_INT64_T);
+	    LIBTEST_CHECK(rc, "PtlAtomic");
+	}
+	rc= PtlCTWait(ct_handle, niters, &cnt_value);
+	LIBTEST_CHECK(rc, "PtlCTWait");
+	rate= niters / (timer() - tmp);
+
+	if (cnt_value.failure != 0)   {
+	    fprintf(stderr, "Rank %d: %d failed atomics\n", rank,
+		(int)cnt_value.failure);
+	}
+
+	rc= PtlMDRelease(md_handle);
+	LIBTEST_CHECK(rc, "PtlMDRelease");
+	rc= PtlCTFree(ct_handle);
+	LIBTEST_CHECK(rc, "PtlCTFree");
+    }
+
+    tmp= libtest_AllreduceDouble(rate, PTL_SUM);
+    display_result(test, tmp);
+
+    libtest_Barrier();
+
+    if (rank == 0)   {
+	int r, k;
+	int nelems= nbytes / sizeof(int64_t);
+
+	for (r= shared ? 0 : 1; r < (shared ? 1 : world_size); r++)   {
+	    int64_t *slot= (int64_t *)((char *)tgt_buf + slot_size * r);
+	    int64_t expected= (int64_t)niters * (shared ? world_size - 1 : 1);
+
+	    for (k= 0; k < nelems; k++)   {
+		if (slot[k] != expected)   {
+		    errors++;
+		}
+	    }
+	}
+
+	if (errors)   {
+	    fprintf(stderr, "%s: %d wrong values on the target\n", test,
+		errors);
+	}
+    }
+
+    return errors;
+
+}  /* end of test_contention() */
+
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: P4atomiccontention [OPTION]...\n\n");
+    fprintf(stderr, "  -h           Display this help message and exit\n");
+    fprintf(stderr, "  -i <num>     Number of atomics per initiator\n");
+    fprintf(stderr, "  -s <size>    Number of bytes per atomic, a multiple of 8\n");
+    fprintf(stderr, "  -w <num>     Number of outstanding atomics per initiator\n");
+    fprintf(stderr, "  -m           Print machine readable output\n");
+}  /* end of usage() */
+
+
+int
+main(int argc, char *argv[])
+{
+    int ch, i;
+    int rc;
+    int niters= 100000;
+    int nbytes= 8;
+    int window= 64;
+    int slot_size;
+    int errors= 0;
+    int64_t *src_buf;
+    int64_t *tgt_buf;
+    ptl_handle_ni_t ni;
+    ptl_ni_limits_t actual;
+    ptl_pt_index_t index;
+    ptl_handle_le_t le_handle;
+    ptl_le_t le;
+
+    rc= PtlInit();
+    LIBTEST_CHECK(rc, "PtlInit");
+
+    rc= libtest_init();
+    LIBTEST_CHECK(rc, "libtest_init");
+    rank= libtest_get_rank();
+    world_size= libtest_get_size();
+
+    while ((ch= getopt(argc, argv, "i:s:w:mh")) != -1)   {
+	switch (ch)   {
+	    case 'i':
+		niters= strtol(optarg, (char **)NULL, 0);
+		break;
+	    case 's':
+		nbytes= strtol(optarg, (char **)NULL, 0);
+		break;
+	    case 'w':
+		window= strtol(optarg, (char **)NULL, 0);
+		break;
+	    case 'm':
+		machine_output= 1;
+		break;
+	    case 'h':
+	    case '?':
+	    default:
+		if (rank == 0)   {
+		    usage();
+		}
+		libtest_fini();
+		PtlFini();
+		exit(1);
+	}
+    }
+
+    if (niters <= 0 || window <= 0 || nbytes <= 0 ||
+	    nbytes % sizeof(int64_t) != 0)   {
+	if (rank == 0)   {
+	    usage();
+	}
+	libtest_fini();
+	PtlFini();
+	exit(1);
+    }
+
+    if (world_size < 2)   {
+	if (rank == 0)   {
+	    fprintf(stderr, "Need at least 2 processes\n");
+	}
+	libtest_fini();
+	PtlFini();
+	exit(1);
+    }
+
+    rc= PtlNIInit(PTL_IFACE_DEFAULT, PTL_NI_NO_MATCHING | PTL_NI_LOGICAL,
+	    PTL_PID_ANY, NULL, &actual, &ni);
+    LIBTEST_CHECK(rc, "PtlNIInit");
+
+    rc= PtlSetMap(ni, world_size, libtest_get_mapping(ni));
+    LIBTEST_CHECK(rc, "PtlSetMap");
+
+    if (nbytes > actual.max_atomic_size)   {
+	if (rank == 0)   {
+	    fprintf(stderr, "Atomics are limited to %d bytes.\n",
+		(int)actual.max_atomic_size);
+	}
+	exit(1);
+    }
+
+    slot_size= (nbytes + SLOT_ALIGN - 1) / SLOT_ALIGN * SLOT_ALIGN;
+
+    src_buf= malloc(nbytes);
+    tgt_buf= malloc(slot_size * world_size);
+    if (src_buf == NULL || tgt_buf == NULL)   {
+	perror("malloc");
+	exit(1);
+    }
+
+    for (i= 0; i < nbytes / (int)sizeof(int64_t); i++)   {
+	src_buf[i]= 1;
+    }
+
+    if (rank == 0)   {
+	index= libtest_PTAlloc(ni, AtomicContentionIndex, PTL_EQ_NONE);
+
+	le.start     = tgt_buf;
+	le.length    = slot_size * world_size;
+	le.uid       = PTL_UID_ANY;
+	le.options   = PTL_LE_OP_PUT | PTL_LE_EVENT_COMM_DISABLE |
+		       PTL_LE_EVENT_LINK_DISABLE;
+	le.ct_handle = PTL_CT_NONE;
+	rc= PtlLEAppend(ni, index, &le, PTL_PRIORITY_LIST, NULL, &le_handle);
+	LIBTEST_CHECK(rc, "PtlLEAppend");
+
+	if (!machine_output)   {
+	    printf("job size:   %d\n", world_size);
+	    printf("niters:     %d\n", niters);
+	    printf("nbytes:     %d\n", nbytes);
+	    printf("window:     %d\n", window);
+	    printf("(aggregate atomics per second)\n");
+	} else   {
+	    printf("%d %d %d %d ", world_size, niters, nbytes, window);
+	}
+    }
+
+    libtest_BarrierInit(ni, rank, world_size);
+    libtest_AllreduceDouble_init(ni);
+    libtest_barrier();
+
+    errors += test_contention("disjoint", ni, 0, src_buf, tgt_buf,
+	    slot_size, nbytes, niters, window);
+    errors += test_contention("shared", ni, 1, src_buf, tgt_buf,
+	    slot_size, nbytes, niters, window);
+
+    if ((rank == 0) && machine_output)   {
+	printf("\n");
+    }
+
+    if (rank == 0)   {
+	rc= PtlLEUnlink(le_handle);
+	LIBTEST_CHECK(rc, "PtlLEUnlink");
+	rc= PtlPTFree(ni, index);
+	LIBTEST_CHECK(rc, "PtlPTFree");
+    }
+
+    free(src_buf);
+    free(tgt_buf);
+
+    PtlNIFini(ni);
+    libtest_fini();
+    PtlFini();
+
+    return errors ? 1 : 0;
+
+}  /* end of main() */
@@ -0,0 +1,250 @@
+/*
+** Microbenchmark for the atomic operation kernels.
+**
+** For each (operation, datatype) pair with a vectorized kernel, measure
+** the throughput of the plain C kernel of the atom_op table and of
+** every vectorized version the CPU supports, in GB/s of target data.
+** The vectorized kernels are first checked against the atom_op ones.
+**
+** The benchmark links the library internals, and never calls PtlInit(),
+** so atom_op still holds the plain C kernels.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+#include <complex.h>
+#include <portals4.h>
+
+#ifdef __APPLE__
+# include <sys/time.h>
+#endif
+
+#include "ptl_atomic.h"
+#include "ptl_atomic_simd.h"
+
+
+static const char *op_name[PTL_OP_LAST]= {
+    [PTL_MIN]= "min",
+    [PTL_MAX]= "max",
+    [PTL_SUM]= "sum",
+    [PTL_PROD]= "prod",
+    [PTL_BOR]= "bor",
+    [PTL_BAND]= "band",
+    [PTL_BXOR]= "bxor",
+};
+
+static const char *type_name[PTL_DATATYPE_LAST]= {
+    [PTL_INT8_T]= "int8",
+    [PTL_UINT8_T]= "uint8",
+    [PTL_INT16_T]= "int16",
+    [PTL_UINT16_T]= "uint16",
+    [PTL_INT32_T]= "int32",
+    [PTL_UINT32_T]= "uint32",
+    [PTL_INT64_T]= "int64",
+    [PTL_UINT64_T]= "uint64",
+    [PTL_FLOAT]= "float",
+    [PTL_DOUBLE]= "double",
+    [PTL_FLOAT_COMPLEX]= "float complex",
+    [PTL_DOUBLE_COMPLEX]= "double complex",
+};
+
+
+static inline double
+timer(void)
+{
+#ifdef __APPLE__
+    struct timeval tm;
+    gettimeofday(&tm, NULL);
+    return tm.tv_sec + tm.tv_usec * 1e-6;
+#else
+    struct timespec tm;
+
+    clock_gettime(CLOCK_REALTIME, &tm);
+    return tm.tv_sec + tm.tv_nsec / 1000000000.0;
+#endif
+}  /* end of timer() */
+
+
+/*
+** Check a kernel against the atom_op one, for all the lengths up to
+** nbytes, so that the tails are covered too. Return the first length
+** that differs, or -1.
+*/
+static int
+check(atom_simd_op_t kernel, atom_op_t ref, int size, char *dst, char *src,
+	int nbytes)
+{
+    char *expect;
+    char *got;
+    int len;
+    int i;
+
+    expect= malloc(nbytes);
+    got= malloc(nbytes);
+    if (expect == NULL || got == NULL)   {
+	perror("malloc");
+	exit(1);
+    }
+
+    /* values a few bits wide, so that the products neither overflow
+     * nor all come out the same */
+    for (i= 0; i < nbytes; i++)   {
+	src[i]= (i * 7 + 3) & 0x1f;
+	dst[i]= (i * 13 + 5) & 0x1f;
+    }
+
+    for (len= 0; len <= nbytes; len+= size)   {
+	memcpy(expect, dst, nbytes);
+	memcpy(got, dst, nbytes);
+	ref(expect, src, len);
+	kernel(got, src, len);
+	if (memcmp(expect, got, nbytes) != 0)   {
+	    break;
+	}
+    }
+
+    free(expect);
+    free(got);
+
+    return len <= nbytes ? len : -1;
+}  /* end of check() */
+
+
+/* Return the throughput of kernel in GB/s. */
+static double
+measure(atom_simd_op_t kernel, char *dst, char *src, int nbytes, int niters)
+{
+    double start;
+    int i;
+
+    /* warm up */
+    for (i= 0; i < niters / 10 + 1; i++)   {
+	kernel(dst, src, nbytes);
+    }
+
+    start= timer();
+    for (i= 0; i < niters; i++)   {
+	kernel(dst, src, nbytes);
+    }
+
+    return ((double)nbytes * niters) / (timer() - start) / 1e9;
+}  /* end of measure() */
+
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: P4atomickernels [OPTION]...\n\n");
+    fprintf(stderr, "  -h           Display this help message and exit\n");
+    fprintf(stderr, "  -i <num>     Number of iterations per kernel\n");
+    fprintf(stderr, "  -s <size>    Number of bytes per operation\n");
+    fprintf(stderr, "  -u           Misalign the buffers\n");
+}  /* end of usage() */
+
+
+int
+main(int argc, char *argv[])
+{
+    int ch;
+    int niters= 1000000;
+    int nbytes= 512;
+    int misalign= 0;
+    enum atom_simd_level level, best;
+    int op, type;
+    int failed= 0;
+    char *src, *dst;
+
+    while ((ch= getopt(argc, argv, "i:s:uh")) != -1)   {
+	switch (ch)   {
+	    case 'i':
+		niters= strtol(optarg, (char **)NULL, 0);
+		break;
+	    case 's':
+		nbytes= strtol(optarg, (char **)NULL, 0);
+		break;
+	    case 'u':
+		misalign= 1;
+		break;
+	    case 'h':
+	    case '?':
+	    default:
+		usage();
+		return 1;
+	}
+    }
+
+    if (niters <= 0 || nbytes <= 0)   {
+	usage();
+	return 1;
+    }
+
+    src= malloc(nbytes + 64);
+    dst= malloc(nbytes + 64);
+    if (src == NULL || dst == NULL)   {
+	perror("malloc");
+	return 1;
+    }
+
+    best= atom_simd_detect();
+
+    printf("nbytes:     %d\n", nbytes);
+    printf("niters:     %d\n", niters);
+    printf("misaligned: %s\n", misalign ? "yes" : "no");
+    printf("best level: %s\n\n", atom_simd_level_name[best]);
+
+    printf("%-6s %-15s", "op", "type");
+    for (level= ATOM_SIMD_NONE; level <= best; level++)   {
+	printf(" %12s", atom_simd_level_name[level]);
+    }
+    printf("  (GB/s)\n");
+
+    for (op= 0; op < PTL_OP_LAST; op++)   {
+	for (type= 0; type < PTL_DATATYPE_LAST; type++)   {
+	    double scalar;
+
+	    if (best == ATOM_SIMD_NONE ||
+		atom_simd_op(best, op, type) == NULL)   {
+		continue;
+	    }
+
+	    for (level= ATOM_SIMD_NONE + 1; level <= best; level++)   {
+		int len= check(atom_simd_op(level, op, type), atom_op[op][type],
+			       atom_type_size[type], dst + misalign,
+			       src + 3 * misalign, nbytes);
+
+		if (len >= 0)   {
+		    fprintf(stderr, "%s %s %s: differs from atom_op at %d "
+			    "bytes\n", atom_simd_level_name[level], op_name[op],
+			    type_name[type], len);
+		    failed= 1;
+		}
+	    }
+
+	    /* small values, so that products don't overflow to inf/nan */
+	    memset(src, 1, nbytes + 64);
+	    memset(dst, 1, nbytes + 64);
+
+	    scalar= measure(atom_op[op][type], dst + misalign,
+			    src + 3 * misalign, nbytes, niters);
+
+	    printf("%-6s %-15s %12.2f", op_name[op], type_name[type], scalar);
+	    for (level= ATOM_SIMD_NONE + 1; level <= best; level++)   {
+		double rate= measure(atom_simd_op(level, op, type),
+				     dst + misalign, src + 3 * misalign,
+				     nbytes, niters);
+
+		printf(" %6.2f %4.1fx", rate, rate / scalar);
+	    }
+	    printf("\n");
+	}
+    }
+
+    free(src);
+    free(dst);
+
+    return failed;
+}
@@ -53,6 +53,7 @@
 /* configuration parameters - setable by command line arguments */
 int ppn;
 int machine_output;
+int bundle;
 
 
 
@@ -182,6 +183,10 @@ void
 test_prepostLE(int cache_size, int *cache_buf, ptl_handle_ni_t ni, int npeers,
                 int nmsgs, int nbytes, int niters );
 
+void
+test_unexpectedME(int cache_size, int *cache_buf, ptl_handle_ni_t ni, int npeers,
+                int nmsgs, int nbytes, int niters );
+
 void
 test_one_wayME(int cache_size, int *cache_buf, ptl_handle_ni_t ni, int npeers,
                 int nmsgs, int nbytes, int niters );
@@ -253,6 +258,7 @@ usage(void)
     fprintf(stderr, "  -n <ppn>     Number of procs per node\n");
     fprintf(stderr, "  -t <test>    0 for LE and CT, 1 for ME and full events\n");
     fprintf(stderr, "  -o           Format output to be machine readable\n");
+    fprintf(stderr, "  -b           Bundle the puts of the single direction test\n");
     fprintf(stderr, "  -v           Increase verbosity. Using -v -v or more may impact test results!\n");
     fprintf(stderr, "\nReport bugs to <bwbarre@sandia.gov>\n");
 }
@@ -277,6 +283,7 @@ ptl_handle_ni_t ni_collectives;
 int cache_size;
 int *cache_buf;
 int test_type;
+int run_unexpected;
 
 
     /* Set some defaults */
@@ -290,6 +297,7 @@ int test_type;
     nbytes= 8;
     ppn= -1;
     machine_output= 0;
+    bundle= 0;
     test_type= LEwithCT;
 
 
@@ -305,7 +313,7 @@ int test_type;
 
     /* Handle command line arguments */
     while (start_err != 1 && 
-	   (ch= getopt(argc, argv, "p:i:m:s:c:n:ohvt:")) != -1)   {
+	   (ch= getopt(argc, argv, "p:i:m:s:c:n:obhvt:")) != -1)   {
 	switch (ch)   {
 	    case 'p':
 		npeers= strtol(optarg, (char **)NULL, 0);
@@ -341,6 +349,9 @@ int test_type;
 	    case 'o':
 		machine_output= 1;
 		break;
+	    case 'b':
+		bundle= 1;
+		break;
 	    case 'v':
 		verbose++;
 		break;
@@ -443,6 +454,7 @@ int test_type;
             printf("nbytes:     %d\n", nbytes);
             printf("cache size: %d\n", cache_size * (int)sizeof(int));
             printf("ppn:        %d\n", ppn);
+            printf("bundle:     %s\n", bundle ? "yes" : "no");
 	    if (test_type == LEwithCT)   {
 		printf("test:       LE with counting events\n");
 	    } else if (test_type == MEwithEQ)   {
@@ -465,6 +477,17 @@ int test_type;
 	exit(-1);
     }
 
+    /* The unexpected test leaves nmsgs headers on the overflow list. */
+    run_unexpected= (test_type == MEwithEQ);
+    if (run_unexpected && nmsgs > actual.max_unexpected_headers)   {
+	if (rank == 0)   {
+	    fprintf(stderr, "Not enough unexpected headers. Need %d, have %d. "
+		"Skipping the unexpected test.\n", nmsgs,
+		actual.max_unexpected_headers);
+	}
+	run_unexpected= 0;
+    }
+
     /* allocate buffers */
     send_peers= malloc(sizeof(int) * npeers);
     if (NULL == send_peers)   {
@@ -562,6 +585,15 @@ int test_type;
 	test_prepostME(cache_size, cache_buf, ni_logical, npeers, nmsgs, 
 		nbytes, niters );
 
+    if ( run_unexpected )   {
+	if (verbose > 0)   {
+	    printf("Rank %3d: Starting test_unexpected(nmsgs %d, nbytes %d, niters %d)\n", rank,
+		nmsgs, nbytes, niters);
+	}
+	test_unexpectedME(cache_size, cache_buf, ni_logical, npeers, nmsgs,
+		nbytes, niters );
+    }
+
     if (verbose > 0)   {
 	printf("Rank %3d: Starting test_allstart(nmsgs %d, nbytes %d, niters %d)\n", rank,
 	    nmsgs, nbytes, niters);
@@ -28,6 +28,8 @@ void test_one_wayLE(int             cache_size,
 
             libtest_Barrier();
             tmp = timer();
+            if (bundle)
+                ptl_assert(PtlStartBundle(ni), PTL_OK);
             for (k = 0; k < nmsgs; k++) {
                 ptl_size_t    offset = nbytes * k;
                 ptl_process_t dest;
@@ -35,6 +37,8 @@ void test_one_wayLE(int             cache_size,
                 ptl_assert(libtest_Put_offset(md_handle, offset, nbytes, dest,
                                            TestOneWayIndex, magic_tag, offset), PTL_OK);
             }
+            if (bundle)
+                ptl_assert(PtlEndBundle(ni), PTL_OK);
 
             ptl_assert(PtlCTWait(ct_handle, (i + 1) * nmsgs, &cnt_value),
                        PTL_OK);
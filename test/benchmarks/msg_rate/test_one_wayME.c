@@ -29,6 +29,8 @@ void test_one_wayME(int cache_size, int *cache_buf, ptl_handle_ni_t ni,
 
             libtest_Barrier();
 	    tmp = timer();
+	    if (bundle)
+		ptl_assert( PtlStartBundle(ni), PTL_OK );
 	    for (k= 0; k < nmsgs; k++)   {
                 ptl_size_t offset = nbytes * k;
                 ptl_process_t dest;
@@ -36,6 +38,8 @@ void test_one_wayME(int cache_size, int *cache_buf, ptl_handle_ni_t ni,
                 ptl_assert( libtest_Put_offset(md_handle, offset, nbytes, dest,
 			TestOneWayIndex, k, offset), PTL_OK );
             }
+	    if (bundle)
+		ptl_assert( PtlEndBundle(ni), PTL_OK );
 
 	    for (k= 0; k < nmsgs; k++)   {
 		ptl_event_t event;
@@ -0,0 +1,150 @@
+#include "test_unexpected.h"
+
+/*
+ * The senders push nmsgs messages with distinct tags before the
+ * receivers have posted anything, so they all land on the overflow
+ * list. The receivers then post one ME per message, in reverse
+ * order, and time how long it takes to match all of them against
+ * the unexpected list.
+ */
+void test_unexpectedME(int cache_size, int *cache_buf, ptl_handle_ni_t ni,
+	int npeers, int nmsgs, int nbytes, int niters )
+{
+    double tmp, total = 0;
+
+    Debug("\n");
+
+    libtest_Barrier();
+    if (rank < (world_size / 2))   {
+	int i;
+	ptl_handle_md_t md_handle;
+	ptl_md_t        md;
+
+	ptl_assert( PtlEQAlloc( ni, nmsgs + 1, &md.eq_handle ), PTL_OK );
+
+        md.start     = send_buf;
+        md.length    = SEND_BUF_SIZE;
+        md.options   = PTL_MD_UNORDERED;
+        md.ct_handle = PTL_CT_NONE;
+
+        ptl_assert( PtlMDBind(ni, &md, &md_handle), PTL_OK );
+
+        for (i= 0; i < niters; ++i)   {
+	    int k;
+
+            /* wait for the overflow list to be ready */
+            libtest_Barrier();
+
+	    for (k= 0; k < nmsgs; k++)   {
+                ptl_size_t offset = nbytes * k;
+                ptl_process_t dest;
+		dest.rank= rank + (world_size / 2);
+                ptl_assert( libtest_Put_offset(md_handle, offset, nbytes, dest,
+			TestUnexpectedIndex, k, offset), PTL_OK );
+            }
+
+	    for (k= 0; k < nmsgs; k++)   {
+		ptl_event_t event;
+                ptl_assert( PtlEQWait(md.eq_handle, &event), PTL_OK );
+		ptl_assert( event.type, PTL_EVENT_SEND );
+            }
+
+            /* let the receivers time their appends */
+            libtest_Barrier();
+        }
+
+        ptl_assert( PtlEQFree( md.eq_handle ), PTL_OK );
+        ptl_assert( PtlMDRelease(md_handle) , PTL_OK );
+
+    } else {
+	int i;
+	ptl_pt_index_t  index;
+	ptl_handle_me_t overflow_handle;
+	ptl_handle_me_t me_handle;
+	ptl_handle_eq_t eq_handle;
+	ptl_process_t   src;
+	ptl_me_t        me;
+	char           *overflow_buf;
+
+	overflow_buf = malloc(RECV_BUF_SIZE);
+	if (NULL == overflow_buf)   {
+	    perror("malloc overflow_buf");
+	    exit(1);
+	}
+
+	src.rank = rank - (world_size / 2);
+
+	ptl_assert( PtlEQAlloc(ni, 2 * nmsgs + 1, &eq_handle), PTL_OK );
+
+	ptl_assert( PtlPTAlloc( ni, 0, eq_handle, TestUnexpectedIndex,
+							&index ), PTL_OK );
+	ptl_assert( index, TestUnexpectedIndex );
+
+        for (i= 0; i < niters; ++i)   {
+            int k;
+
+            cache_invalidate(cache_size, cache_buf);
+
+            /* catch everything on the overflow list */
+            me.start       = overflow_buf;
+            me.length      = RECV_BUF_SIZE;
+            me.ct_handle   = PTL_CT_NONE;
+            me.min_free    = 0;
+            me.uid         = PTL_UID_ANY;
+            me.options     = PTL_ME_OP_PUT | PTL_ME_MANAGE_LOCAL |
+                             PTL_ME_EVENT_LINK_DISABLE |
+                             PTL_ME_EVENT_UNLINK_DISABLE;
+            me.match_id.rank = PTL_RANK_ANY;
+            me.match_bits  = 0;
+            me.ignore_bits = ~(ptl_match_bits_t)0;
+            ptl_assert( PtlMEAppend(ni, index, &me, PTL_OVERFLOW_LIST, NULL,
+                                    &overflow_handle), PTL_OK );
+
+            libtest_Barrier();
+
+	    for (k= 0; k < nmsgs; k++)   {
+		ptl_event_t event;
+                ptl_assert( PtlEQWait(eq_handle, &event), PTL_OK );
+		ptl_assert( event.type, PTL_EVENT_PUT );
+            }
+
+            libtest_Barrier();
+	    tmp = timer();
+
+            for (k= nmsgs - 1; k >= 0; k--)   {
+                me.start       = recv_buf + nbytes * k;
+                me.length      = nbytes;
+                me.min_free    = 0;
+                me.options     = PTL_ME_OP_PUT | PTL_ME_USE_ONCE |
+                                 PTL_ME_EVENT_LINK_DISABLE |
+                                 PTL_ME_EVENT_UNLINK_DISABLE;
+                me.match_id    = src;
+                me.match_bits  = k;
+                me.ignore_bits = 0;
+                ptl_assert( PtlMEAppend(ni, index, &me, PTL_PRIORITY_LIST,
+                                        NULL, &me_handle), PTL_OK );
+            }
+
+	    for (k= 0; k < nmsgs; k++)   {
+		ptl_event_t event;
+                ptl_assert( PtlEQWait(eq_handle, &event), PTL_OK );
+		ptl_assert( event.type, PTL_EVENT_PUT_OVERFLOW );
+            }
+
+	    total += (timer() - tmp);
+
+            ptl_assert( PtlMEUnlink(overflow_handle), PTL_OK );
+	}
+
+	ptl_assert( PtlEQFree( eq_handle ), PTL_OK );
+        ptl_assert( PtlPTFree( ni, index ), PTL_OK );
+        free(overflow_buf);
+    }
+
+    tmp= libtest_AllreduceDouble(total, PTL_SUM);
+
+    display_result("unexpected",
+				(niters * nmsgs) / (tmp / (world_size / 2)));
+
+    libtest_Barrier();
+}